@@ -53,6 +53,7 @@ TESTS_COMMON= \
 	sbin/fscanf_test \
 	sbin/hellotest \
 	sbin/idctest \
+	sbin/memobj_pager_test \
 	sbin/memtest \
 	sbin/schedtest \
 	sbin/testerror \
@@ -160,6 +161,8 @@ BENCH_x86_64= \
 	sbin/placement_bench \
 	sbin/rcce_pingpong \
 	sbin/shared_mem_clock_bench \
+	sbin/slab_bench \
+	sbin/slab_bench_old \
 	sbin/tsc_bench
 
 BENCH_k1om=\
@@ -570,6 +573,11 @@ $(TESTS): %.txt: %.cfg tools/bin/simulator
 schedsim-check: $(wildcard $(SRCDIR)/tools/schedsim/*.cfg)
 	for f in $^; do tools/bin/simulator $$f $(RUNTIME) | diff -q - `dirname $$f`/`basename $$f .cfg`.txt || exit 1; done
 
+# Scheduler benchmark with synthetic workloads, options in SCHEDBENCH_ARGS
+schedsim-bench: tools/bin/schedbench
+	tools/bin/schedbench $(SCHEDBENCH_ARGS)
+.PHONY: schedsim-bench
+
 ######################################################################
 #
 # Intel Xeon Phi Builds
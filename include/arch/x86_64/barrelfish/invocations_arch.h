@@ -225,6 +225,48 @@ static inline errval_t invoke_vnode_unmap(struct capref cap, capaddr_t mapping_a
     return cap_invoke5(cap, VNodeCmd_Unmap, mapping_addr, bits, entry, num_pages).error;
 }
 
+/**
+ * \brief Perform a batch of map operations with a single invocation
+ *
+ * \param vroot    Root page table of the address space
+ * \param ops      Operations to perform, at most VNODE_BATCH_MAX
+ * \param count    Number of operations
+ * \param done     Returns the number of operations that succeeded
+ */
+static inline errval_t invoke_vnode_map_batch(struct capref vroot,
+                                              struct vnode_map_op *ops,
+                                              size_t count, size_t *done)
+{
+    struct sysret sysret = cap_invoke3(vroot, VNodeCmd_MapBatch,
+                                       (uintptr_t)ops, count);
+    if (done) {
+        *done = sysret.value;
+    }
+    return sysret.error;
+}
+
+/**
+ * \brief Perform a batch of unmap operations with a single invocation
+ *
+ * The kernel flushes the TLB once for the whole batch.
+ *
+ * \param vroot    Root page table of the address space
+ * \param ops      Operations to perform, at most VNODE_BATCH_MAX
+ * \param count    Number of operations
+ * \param done     Returns the number of operations that succeeded
+ */
+static inline errval_t invoke_vnode_unmap_batch(struct capref vroot,
+                                                struct vnode_unmap_op *ops,
+                                                size_t count, size_t *done)
+{
+    struct sysret sysret = cap_invoke3(vroot, VNodeCmd_UnmapBatch,
+                                       (uintptr_t)ops, count);
+    if (done) {
+        *done = sysret.value;
+    }
+    return sysret.error;
+}
+
 /**
  * \brief Return the physical address and size of a frame capability
  *
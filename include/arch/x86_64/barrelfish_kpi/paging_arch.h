@@ -58,4 +58,34 @@
 
 #define PTABLE_ENTRY_SIZE       X86_64_PTABLE_ENTRY_SIZE
 
+/**
+ * Batched page table invocations. The root page table is invoked with a
+ * pointer to an array of operations, which the kernel carries out in order.
+ * Page tables, frames and mappings are given as capability addresses in the
+ * CSpace of the caller.
+ */
+#define VNODE_BATCH_MAX         64      ///< Maximum operations per invocation
+
+/// One mapping of VNodeCmd_MapBatch
+struct vnode_map_op {
+    uint32_t ptable;        ///< Address of the page table to map into
+    uint32_t frame;         ///< Address of the frame to map
+    uint8_t  ptable_bits;   ///< Valid bits of the page table address
+    uint8_t  frame_bits;    ///< Valid bits of the frame address
+    uint16_t slot;          ///< First entry in the page table
+    uint32_t pte_count;     ///< Number of entries to map
+    uint64_t flags;         ///< Mapping flags
+    uint64_t offset;        ///< Offset into the frame
+};
+
+/// One mapping of VNodeCmd_UnmapBatch
+struct vnode_unmap_op {
+    uint32_t ptable;        ///< Address of the page table to unmap from
+    uint32_t mapping;       ///< Address of the mapped frame copy
+    uint8_t  ptable_bits;   ///< Valid bits of the page table address
+    uint8_t  mapping_bits;  ///< Valid bits of the mapping address
+    uint16_t slot;          ///< First entry in the page table
+    uint32_t pte_count;     ///< Number of entries to unmap
+};
+
 #endif // ARCH_X86_64_BARRELFISH_KPI_PAGING_H
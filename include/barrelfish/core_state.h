@@ -55,10 +55,27 @@ struct v2pmap {
     size_t      size;
 };
 
+/// Number of size classes of the size-class malloc
+#define MALLOC_SC_CLASSES       36
+
+struct malloc_sc_span;
+struct malloc_sc_run;
+struct malloc_sc_block;
+
+/// Per-dispatcher arena of the size-class malloc (scmalloc.c)
+struct malloc_sc_arena {
+    struct malloc_sc_span *partial[MALLOC_SC_CLASSES]; ///< Spans with free blocks
+    struct malloc_sc_run *runs;             ///< Free spans, sorted by address
+    struct malloc_sc_block *volatile remote; ///< Blocks freed on other dispatchers
+    lvaddr_t mc_end;                        ///< End of the memory from morecore
+    lvaddr_t mc_used;                       ///< End of the span aligned part
+};
+
 struct morecore_state {
     struct thread_mutex mutex;
     Header header_base;
     Header *header_freep;
+    struct malloc_sc_arena sc_arena;
     struct vspace_mmu_aware mmu_state;
     struct v2pmap v2p_mappings[MAX_V2P_MAPPINGS];
     int v2p_entries;
@@ -67,6 +84,21 @@ struct morecore_state {
 #endif // 0 DELETEME
 };
 
+/*
+ * Small RAM caps without affinity are handed out from a per-core cache.
+ * Each size class is refilled with one RAM cap from mem_serv that is
+ * 2^RAM_CACHE_REFILL_BITS times bigger and split locally.
+ */
+#define RAM_CACHE_MIN_BITS      BASE_PAGE_BITS
+#define RAM_CACHE_CLASSES       3
+#define RAM_CACHE_REFILL_BITS   4
+#define RAM_CACHE_BATCH         (1U << RAM_CACHE_REFILL_BITS)
+
+struct ram_cache {
+    cslot_t next;               ///< Next cached cap in the class slots
+    cslot_t count;              ///< Number of caps in the class slots
+};
+
 struct ram_alloc_state {
     bool mem_connect_done;
     errval_t mem_connect_err;
@@ -75,6 +107,11 @@ struct ram_alloc_state {
     uint64_t default_minbase;
     uint64_t default_maxlimit;
     int base_capnum;
+    struct thread_mutex ram_cache_lock;
+    struct thread *ram_cache_owner;     ///< Thread refilling the cache
+    struct capref ram_cache_cnode_cap;  ///< CNode holding the cached caps
+    struct cnoderef ram_cache_cnode;
+    struct ram_cache ram_cache[RAM_CACHE_CLASSES];
 };
 
 struct skb_state {
@@ -35,6 +35,9 @@ enum memobj_type {
 typedef uint32_t memobj_flags_t;
 typedef uint32_t vs_prot_flags_t;
 
+/// Anonymous memobj: map aligned frames with large pages, allow promotion
+#define MEMOBJ_ANON_LARGE_PAGES     0x01
+
 struct memobj;
 struct vregion;
 struct memobj_funcs {
@@ -66,7 +69,7 @@ struct vregion_list {
 /// Public interface for memobj
 struct memobj {
     size_t size;              ///< Size of the object
-    memobj_flags_t flags;     ///< Flags for the object. NYI.
+    memobj_flags_t flags;     ///< Flags for the object
     enum memobj_type type;    ///< Type of the memory object
     struct memobj_funcs f;    ///< Function pointers
 };
@@ -103,15 +106,36 @@ struct memobj_frame_list {
     size_t size;                    ///< Size of the frame
     genpaddr_t pa;                  ///< XXX: physical address of frame
     genpaddr_t foffset;             ///< Offset into frame
+    uint32_t pins;                  ///< Number of pins, pinned frames stay resident
+    bool referenced;                ///< Faulted in since the last eviction scan
+    bool paged_out;                 ///< Contents are in the backing store
     struct memobj_frame_list *next;
 };
 
+/**
+ * Backing store for frames that an anonymous memobj releases in pager_free.
+ * Contents are identified by their offset into the memobj.
+ */
+struct memobj_anon_pager {
+    /// Save `size` bytes at `buf`, the contents at `offset`
+    errval_t (*page_out)(struct memobj_anon_pager *pager, genvaddr_t offset,
+                         void *buf, size_t size);
+    /// Restore the contents at `offset` into `buf`
+    errval_t (*page_in)(struct memobj_anon_pager *pager, genvaddr_t offset,
+                        void *buf, size_t size);
+    /// Drop the saved contents at `offset`, may be NULL
+    void (*discard)(struct memobj_anon_pager *pager, genvaddr_t offset,
+                    size_t size);
+};
+
 struct memobj_anon {
     struct memobj m;
     struct vregion_list *vregion_list;    ///< List of vregions mapped into the obj
     struct slab_allocator vregion_slab;       ///< Slab to back the vregion list
     struct memobj_frame_list *frame_list; ///< List of frames tracked by the obj
     struct slab_allocator frame_slab;         ///< Slab to back the frame list
+    struct memobj_anon_pager *pager;      ///< Backing store for evicted frames
+    genvaddr_t clock_hand;                ///< Offset to resume eviction at
 };
 
 /**
@@ -146,6 +170,10 @@ errval_t memobj_create_pinned(struct memobj_pinned *memobj, size_t size,
 errval_t memobj_create_anon(struct memobj_anon *memobj, size_t size,
                             memobj_flags_t flags);
 errval_t memobj_destroy_anon(struct memobj *memobj);
+errval_t memobj_anon_promote(struct memobj *memobj, struct vregion *vregion,
+                             size_t *ret_count);
+void memobj_anon_set_pager(struct memobj_anon *memobj,
+                           struct memobj_anon_pager *pager);
 
 errval_t memobj_create_one_frame(struct memobj_one_frame *memobj, size_t size,
                                  memobj_flags_t flags);
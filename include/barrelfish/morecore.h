@@ -21,6 +21,8 @@
 __BEGIN_DECLS
 
 errval_t morecore_init(size_t alignment);
+errval_t morecore_init_promote(void);
+errval_t morecore_promote(size_t *ret_count);
 void morecore_use_optimal(void);
 errval_t morecore_reinit(void);
 
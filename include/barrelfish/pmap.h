@@ -17,6 +17,22 @@
 
 struct pmap_dump_info;
 struct pmap;
+
+/// A mapping to create with pmap_funcs.map_batch
+struct pmap_map_op {
+    genvaddr_t vaddr;
+    struct capref frame;
+    size_t offset;
+    size_t size;
+    vregion_flags_t flags;
+};
+
+/// A region to remove with pmap_funcs.unmap_batch
+struct pmap_unmap_op {
+    genvaddr_t vaddr;
+    size_t size;
+};
+
 struct pmap_funcs {
     errval_t (*determine_addr)(struct pmap *pmap, struct memobj *memobj,
                                size_t alignment, genvaddr_t *vaddr);
@@ -27,6 +43,12 @@ struct pmap_funcs {
                     size_t *retoffset, size_t *retsize);
     errval_t (*unmap)(struct pmap* pmap, genvaddr_t vaddr, size_t size,
                       size_t *retsize);
+    /// Optional: create many mappings with as few invocations as possible
+    errval_t (*map_batch)(struct pmap *pmap, struct pmap_map_op *ops,
+                          size_t count);
+    /// Optional: remove many mappings with a single TLB flush
+    errval_t (*unmap_batch)(struct pmap *pmap, struct pmap_unmap_op *ops,
+                            size_t count);
     errval_t (*modify_flags)(struct pmap* pmap, genvaddr_t vaddr, size_t size,
                              vregion_flags_t flags, size_t *retsize);
     errval_t (*lookup)(struct pmap *pmap, genvaddr_t vaddr,
@@ -22,6 +22,10 @@ __BEGIN_DECLS
 errval_t rsrc_manifest(const char *manifest, rsrcid_t *id);
 errval_t rsrc_join(rsrcid_t id);
 errval_t rsrc_phase(rsrcid_t id, uint32_t phase);
+errval_t rsrc_balance_policy(uint32_t period_ms, uint32_t threshold,
+                             uint32_t hold);
+errval_t rsrc_balance_join(void);
+bool rsrc_balance_point(void);
 
 __END_DECLS
 
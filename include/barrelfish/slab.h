@@ -22,11 +22,13 @@ __BEGIN_DECLS
 // forward declarations
 struct slab_allocator;
 struct block_head;
+struct thread_mutex;
 
 typedef errval_t (*slab_refill_func_t)(struct slab_allocator *slabs);
 
 struct slab_head {
-    struct slab_head *next; ///< Next slab in the allocator
+    struct slab_head *next, *prev;  ///< Neighbours in the full/partial/empty list
+    struct slab_head *left, *right; ///< Children in the tree of slabs by address
     uint32_t total, free;   ///< Count of total and free blocks in this slab
     struct block_head *blocks; ///< Pointer to free block list
 };
@@ -34,11 +36,31 @@ struct slab_head {
 struct slot_allocator;
 
 struct slab_allocator {
-    struct slab_head *slabs;    ///< Pointer to list of slabs
+    struct slab_head *partial;  ///< Slabs with free and allocated blocks
+    struct slab_head *empty;    ///< Slabs with only free blocks
+    struct slab_head *full;     ///< Slabs without free blocks
+    struct slab_head *root;     ///< Root of the (splay) tree of all slabs
+    size_t nfree;               ///< Count of free blocks in all slabs
     size_t blocksize;           ///< Size of blocks managed by this allocator
     slab_refill_func_t refill_func;  ///< Refill function
 };
 
+/// Number of blocks a magazine can hold
+#define SLAB_MAGAZINE_ROUNDS 16
+
+/**
+ * \brief Cache of blocks in front of a slab allocator
+ *
+ * A magazine is owned by a single thread, so allocations and frees that hit
+ * the magazine do not need to take the lock of the (shared) allocator.
+ */
+struct slab_magazine {
+    struct slab_allocator *slabs;   ///< Backing slab allocator
+    struct thread_mutex *lock;      ///< Lock of the allocator, or NULL
+    uint32_t rounds;                ///< Number of blocks in the magazine
+    void *round[SLAB_MAGAZINE_ROUNDS]; ///< Cached blocks
+};
+
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func);
 void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen);
@@ -47,6 +69,12 @@ void slab_free(struct slab_allocator *slabs, void *block);
 size_t slab_freecount(struct slab_allocator *slabs);
 errval_t slab_default_refill(struct slab_allocator *slabs);
 
+void slab_magazine_init(struct slab_magazine *mag, struct slab_allocator *slabs,
+                        struct thread_mutex *lock);
+void *slab_magazine_alloc(struct slab_magazine *mag);
+void slab_magazine_free(struct slab_magazine *mag, void *block);
+void slab_magazine_flush(struct slab_magazine *mag);
+
 // size of block header
 #define SLAB_BLOCK_HDRSIZE (sizeof(void *))
 // should be able to fit the header into the block
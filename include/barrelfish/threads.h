@@ -71,6 +71,11 @@ void *thread_get_tls(void);
 void thread_set_tls_key(int, void *);
 void *thread_get_tls_key(int);
 
+typedef void (*thread_malloc_cache_release_fn)(void *cache);
+void thread_set_malloc_cache(void *cache,
+                             thread_malloc_cache_release_fn release);
+void *thread_get_malloc_cache(void);
+
 uintptr_t thread_id(void);
 uintptr_t thread_get_id(struct thread *t);
 void thread_set_id(uintptr_t id);
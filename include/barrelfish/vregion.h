@@ -44,6 +44,15 @@ __BEGIN_DECLS
 struct vspace;
 struct memobj;
 
+/// Free range of virtual address space, node in the gap tree of a vspace
+struct vspace_gap {
+    genvaddr_t start;        ///< First free address
+    genvaddr_t size;         ///< Size of the free range
+    struct vspace_gap *left, *right; ///< Children in the tree in vspace
+    genvaddr_t max_limit;    ///< Highest end of a gap in the subtree
+    int height;              ///< Height of the subtree
+};
+
 struct vregion {
     struct vspace *vspace;   ///< A vregion is always associated with one vspace
     struct memobj *memobj;   ///< A vregion is always associated with one memobj
@@ -52,6 +61,9 @@ struct vregion {
     genvaddr_t base;         ///< Base address of the vregion
     vregion_flags_t flags;   ///< Flags
     struct vregion *next;    ///< Pointer for the list in vspace
+    struct vregion *left, *right; ///< Children in the tree in vspace
+    int height;              ///< Height of the subtree
+    struct vspace_gap gap;   ///< Free space up to the next vregion
 };
 
 /**
@@ -23,6 +23,9 @@ struct vspace {
     struct pmap *pmap;           ///< Pmap associated with the vspace
     struct vspace_layout layout; ///< The layout of the address space
     struct vregion *head;        ///< List of vregions in the vspace
+    struct vregion *root;        ///< AVL tree of vregions by base address
+    struct vspace_gap head_gap;  ///< Free space before the first vregion
+    struct vspace_gap *gaps;     ///< AVL tree of free space by size
 };
 
 /**
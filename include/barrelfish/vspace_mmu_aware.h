@@ -45,6 +45,11 @@ errval_t vspace_mmu_aware_init_aligned(struct vspace_mmu_aware *state,
                                        struct slot_allocator *slot_alloc,
                                        size_t size, size_t alignment,
                                        vregion_flags_t flags);
+errval_t vspace_mmu_aware_init_promote(struct vspace_mmu_aware *state,
+                                       struct slot_allocator *slot_alloc,
+                                       size_t size, vregion_flags_t flags);
+errval_t vspace_mmu_aware_promote(struct vspace_mmu_aware *state,
+                                  size_t *ret_count);
 errval_t vspace_mmu_aware_reset(struct vspace_mmu_aware *state,
                                 struct capref frame, size_t size);
 errval_t vspace_mmu_aware_map(struct vspace_mmu_aware *state, size_t req_size,
@@ -167,7 +167,9 @@ enum vnode_cmd {
     VNodeCmd_Map,
     VNodeCmd_Unmap,
     VNodeCmd_Inherit,
-    VNodeCmd_Switch
+    VNodeCmd_Switch,
+    VNodeCmd_MapBatch,      ///< Create a vector of page mappings
+    VNodeCmd_UnmapBatch,    ///< Remove a vector of page mappings
 };
 
 /**
@@ -210,6 +212,7 @@ enum kernel_cmd {
     KernelCmd_Remove_kcb,         ///< remove kcb from scheduling ring
     KernelCmd_Suspend_kcb_sched,  ///< suspend/resume kcb scheduler
     KernelCmd_Toggle_TLB_Tag,
+    KernelCmd_Get_sched_load,     ///< Returns the scheduler load of the core
     KernelCmd_Count
 };
 
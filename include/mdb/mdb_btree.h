@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef LIBMDB_MDB_BTREE_H
+#define LIBMDB_MDB_BTREE_H
+
+#include <sys/cdefs.h>
+
+#include <errors/errno.h>
+#include <barrelfish/types.h>
+#include <mdb/types.h>
+
+__BEGIN_DECLS
+
+struct capability;
+struct cte;
+
+/*
+ * Alternative MDB index: a B+-tree over (type root, base, end, cte) keys.
+ *
+ * Unlike the AA-tree in mdb_tree.c, which links the CTEs themselves, the
+ * B+-tree keeps the fields that searches need in arrays inside its nodes,
+ * next to the greatest end of every child's subtree. Searches and range
+ * queries thus only touch a CTE to break ties between caps that share type
+ * root, base and end. Leaves are linked, so iterating in order does not
+ * have to go back to the root.
+ *
+ * The tree does not allocate memory itself but gets nodes from the
+ * functions passed to mdb_btree_init(), so it can be used in the kernel.
+ * The ordering is the same as in the AA-tree (see compare_caps()), and
+ * the operations mirror the ones of mdb_tree.h.
+ */
+
+/// Maximum number of entries or children of a node
+#define MDB_BTREE_FANOUT    16
+/// Minimum number of entries or children of a node other than the root
+#define MDB_BTREE_MIN_FILL  (MDB_BTREE_FANOUT / 2)
+
+struct mdb_btree_node {
+    uint8_t count;                  ///< Number of entries or children
+    uint8_t height;                 ///< Distance to the leaves, 0 for leaves
+    /// Leaves: the entries. Inner nodes: the first entry of every child.
+    mdb_root_t root[MDB_BTREE_FANOUT];
+    genpaddr_t base[MDB_BTREE_FANOUT];
+    genpaddr_t end[MDB_BTREE_FANOUT];
+    struct cte *cte[MDB_BTREE_FANOUT];
+    /// Inner nodes only: greatest (root, end) in every child's subtree
+    mdb_root_t max_root[MDB_BTREE_FANOUT];
+    genpaddr_t max_end[MDB_BTREE_FANOUT];
+    struct mdb_btree_node *child[MDB_BTREE_FANOUT];
+    /// Leaves only: neighbouring leaves in the ordering
+    struct mdb_btree_node *prev, *next;
+};
+
+/// Returns a new node, or NULL if no memory is available
+typedef struct mdb_btree_node *(*mdb_btree_alloc_fn)(void *st);
+typedef void (*mdb_btree_free_fn)(void *st, struct mdb_btree_node *node);
+
+struct mdb_btree {
+    struct mdb_btree_node *root;
+    /// Nodes reserved so that an insert can't fail halfway through splitting
+    struct mdb_btree_node *spare;
+    size_t spare_count;
+    mdb_btree_alloc_fn alloc;
+    mdb_btree_free_fn free;
+    void *alloc_st;
+};
+
+enum mdb_btree_invariant {
+    MDB_BTREE_INVARIANT_OK,
+    /// Every node other than the root must be at least half full
+    MDB_BTREE_INVARIANT_FILL,
+    /// All leaves must be at the same depth
+    MDB_BTREE_INVARIANT_HEIGHT,
+    /// The keys of an entry must match its cap
+    MDB_BTREE_INVARIANT_KEY,
+    /// Entries must be in ascending order
+    MDB_BTREE_INVARIANT_ORDER,
+    /// The key of a child must be the first entry of its subtree
+    MDB_BTREE_INVARIANT_CHILD_KEY,
+    /// The end of a child must be the greatest end in its subtree
+    MDB_BTREE_INVARIANT_END_IS_MAX,
+    /// The leaves must be linked in order
+    MDB_BTREE_INVARIANT_LEAF_LINKS,
+};
+
+void mdb_btree_init(struct mdb_btree *tree, mdb_btree_alloc_fn alloc,
+                    mdb_btree_free_fn free, void *alloc_st);
+// Free all nodes. The caps in the tree are not touched.
+void mdb_btree_destroy(struct mdb_btree *tree);
+// Check that the invariants hold. The return value indicates the first issue
+// that was encountered.
+enum mdb_btree_invariant mdb_btree_check_invariants(struct mdb_btree *tree);
+
+// Insert a cap into the tree. An error (MDB_DUPLICATE_ENTRY) is returned if
+// the cap is already present in the tree, MDB_NODE_ALLOC if a node could not
+// be allocated. The tree is unchanged on error.
+errval_t mdb_btree_insert(struct mdb_btree *tree, struct cte *cte);
+// Remove a cap from the tree. An error (MDB_ENTRY_NOTFOUND) is returned iff
+// the cap is not present in the tree.
+errval_t mdb_btree_remove(struct mdb_btree *tree, struct cte *cte);
+
+struct cte *mdb_btree_predecessor(struct mdb_btree *tree, struct cte *current);
+struct cte *mdb_btree_successor(struct mdb_btree *tree, struct cte *current);
+// Store up to max caps that follow current in the ordering in ret, in
+// ascending order. Returns the number of caps stored.
+size_t mdb_btree_successors(struct mdb_btree *tree, struct cte *current,
+                            struct cte **ret, size_t max);
+
+// Same as the mdb_find_* functions of the same name. Where several copies of
+// the cap compare equal, the first (find_greater, find_equal) or last
+// (find_less) one in the ordering is returned.
+struct cte *mdb_btree_find_equal(struct mdb_btree *tree,
+                                 struct capability *cap);
+struct cte *mdb_btree_find_less(struct mdb_btree *tree,
+                                struct capability *cap, bool equal_ok);
+struct cte *mdb_btree_find_greater(struct mdb_btree *tree,
+                                   struct capability *cap, bool equal_ok);
+
+// Find a cap in the given range, see mdb_find_range(). If a result greater
+// than max_result is found, the first such result in the ordering is
+// returned.
+errval_t mdb_btree_find_range(struct mdb_btree *tree, mdb_root_t root,
+                              genpaddr_t address, gensize_t size,
+                              int max_result, struct cte **ret_node,
+                              int *result);
+errval_t mdb_btree_find_cap_for_address(struct mdb_btree *tree,
+                                        genpaddr_t address,
+                                        struct cte **ret_node);
+
+__END_DECLS
+
+#endif // LIBMDB_MDB_BTREE_H
@@ -100,6 +100,10 @@ errval_t mdb_remove(struct cte *node);
 
 struct cte *mdb_predecessor(struct cte *current);
 struct cte *mdb_successor(struct cte *current);
+// Store up to max caps that follow current in the ordering in ret, in
+// ascending order. Returns the number of caps stored. Same as calling
+// mdb_successor() repeatedly, but only searches the tree once.
+size_t mdb_successors(struct cte *current, struct cte **ret, size_t max);
 
 // Find a cap in the tree that compares equal to the given cap. Returns NULL if
 // no such cap is found.
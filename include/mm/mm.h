@@ -34,10 +34,16 @@ enum nodetype {
 struct mmnode {
     enum nodetype type;     ///< Type of this node
     uint8_t childbits;      ///< Number of children (in bits / power of two)
+    uint8_t sizebits;       ///< Size of this region (valid for Free nodes)
     struct capref cap;    ///< Cap to this region (invalid for Dummy regions)
+    genpaddr_t base;        ///< Base address of region (valid for Free nodes)
+    struct mmnode *free_next, *free_prev; ///< Free list of same sized nodes
     struct mmnode *children[0];///< Child node pointers
 };
 
+/// Number of free lists, one for every possible size in bits
+#define MM_NUM_FREE_LISTS   64
+
 /// Macro to statically determine size of a node, given the maxchildbits
 #define MM_NODE_SIZE(maxchildbits) \
     (sizeof(struct mmnode) + sizeof(struct mmnode *) * (1UL << (maxchildbits)))
@@ -58,6 +64,8 @@ struct mm {
     uint8_t sizebits;       ///< Size of root node (in bits)
     uint8_t maxchildbits;   ///< Maximum number of children of every node (in bits)
     bool delete_chunked;    ///< Delete chunked capabilities if true
+    struct mmnode *free_lists[MM_NUM_FREE_LISTS]; ///< Free nodes by sizebits
+    uint64_t free_mask;     ///< Bit n set if free_lists[n] is not empty
 };
 
 void mm_debug_print(struct mmnode *mmnode, int space);
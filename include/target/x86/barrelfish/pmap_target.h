@@ -16,16 +16,20 @@
 #define TARGET_X86_BARRELFISH_PMAP_H
 
 #include <barrelfish/pmap.h>
+#include <barrelfish_kpi/paging_arch.h>
 
 /// Node in the meta-data, corresponds to an actual VNode object
 struct vnode { // NB: misnomer :)
     uint16_t      entry;       ///< Page table entry of this VNode
     bool          is_vnode;    ///< Is this a vnode, or a (leaf) page mapping
     struct vnode  *next;       ///< Next entry in list of siblings
+    struct vnode  *prev;       ///< Previous entry in list of siblings
     union {
         struct {
             struct capref cap;         ///< VNode cap
             struct vnode  *children;   ///< Children of this VNode
+            struct vnode  **index;     ///< Children by entry, NULL if sparse
+            uint16_t      nchildren;   ///< Number of children in the list
         } vnode; // for non-leaf node (maps another vnode)
         struct {
             struct capref cap;         ///< Frame cap
@@ -36,6 +40,26 @@ struct vnode { // NB: misnomer :)
     } u;
 };
 
+#ifdef VNODE_BATCH_MAX
+/**
+ * \brief Leaf mappings collected for a single kernel invocation
+ *
+ * The page table metadata is updated when an operation is queued. For maps
+ * the metadata of operations the kernel did not carry out is removed again
+ * on flush; for unmaps it is reinserted.
+ */
+struct pmap_batch {
+    size_t count;
+    union {
+        struct vnode_map_op map[VNODE_BATCH_MAX];
+        struct vnode_unmap_op unmap[VNODE_BATCH_MAX];
+    } ops;
+    struct vnode *pt[VNODE_BATCH_MAX];      ///< leaf page table of each op
+    struct vnode *page[VNODE_BATCH_MAX];    ///< page metadata of each op
+    bool delete_cap[VNODE_BATCH_MAX];       ///< destroy mapped cap on unmap
+};
+#endif
+
 struct pmap_x86 {
     struct pmap p;
     struct vregion vregion;     ///< Vregion used to reserve virtual address for metadata
@@ -46,9 +70,17 @@ struct pmap_x86 {
     struct vnode root;          ///< Root of the vnode tree
     errval_t (*refill_slabs)(struct pmap_x86 *); ///< Function to refill slabs
     struct slab_allocator slab;     ///< Slab allocator for the vnode lists
+    struct slab_allocator index_slab; ///< Slab allocator for the child indices
+    bool index_wanted;          ///< A page table is waiting for a child index
     genvaddr_t min_mappable_va; ///< Minimum mappable virtual address
     genvaddr_t max_mappable_va; ///< Maximum mappable virtual address
     uint8_t slab_buffer[512];   ///< Initial buffer to back the allocator
+#ifdef VNODE_BATCH_MAX
+    /// Operations of the running map or unmap call. Kept here rather than
+    /// on the stack, which may be small in page fault handlers.
+    struct pmap_batch batch;
+    bool batch_busy;            ///< A call is using the batch
+#endif
 
 };
 
@@ -88,6 +88,7 @@ errval_t vas_attach(vas_handle_t vas, vas_flags_t flags);
 errval_t vas_detach(vas_handle_t vas);
 errval_t vas_switch(vas_handle_t vas);
 errval_t vas_switchm(vas_handle_t vas, vas_handle_t *prev_id);
+errval_t vas_replicate(vas_handle_t vas, coreid_t core);
 
 vas_state_t vas_get_state(vas_handle_t vas);
 vas_id_t vas_get_id(vas_handle_t vas);
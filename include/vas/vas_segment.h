@@ -69,13 +69,29 @@ errval_t vas_seg_create(const char *name, vas_seg_type_t type, size_t length,
                        vas_seg_id_t *ret_seg);
 errval_t vas_seg_free   (vas_seg_handle_t seg);
 errval_t vas_seg_lookup(const char *name, vas_seg_handle_t *ret_seg);
+errval_t vas_seg_lookup_addr(vas_handle_t vh, lvaddr_t vaddr,
+                             vas_seg_handle_t *ret_seg);
+
+errval_t vas_seg_get_life(vas_seg_handle_t sh, vas_life_t *life);
+errval_t vas_seg_set_life(vas_seg_handle_t sh, vas_life_t lifetime);
 
 errval_t vas_seg_attach(vas_handle_t vh, vas_seg_handle_t sh, vas_flags_t flags);
 errval_t vas_seg_detach(vas_handle_t vh, vas_seg_handle_t sh);
+errval_t vas_seg_attach_batch(vas_handle_t vh, vas_seg_handle_t *sh,
+                              size_t count, vas_flags_t flags);
+errval_t vas_seg_detach_batch(vas_handle_t vh, vas_seg_handle_t *sh,
+                              size_t count);
 
 lvaddr_t vas_seg_get_vaddr(vas_seg_handle_t);
 vas_seg_id_t vas_seg_get_id(vas_seg_handle_t);
 size_t vas_seg_get_size(vas_seg_handle_t sh);
 
+/*
+ * shared heap inside a segment
+ */
+errval_t vas_seg_heap_init(vas_seg_handle_t sh);
+void *vas_seg_malloc(vas_seg_handle_t sh, size_t bytes);
+void vas_seg_mfree(vas_seg_handle_t sh, void *ptr);
+
 
 #endif /* __LIBVAS_SEG_H */
@@ -596,9 +596,9 @@ void kernel_startup(void)
             // set queue pointers
             scheduler_restore_state();
             // restore wakeup queue state
-            printk(LOG_DEBUG, "%s:%s:%d: kcb_current->wakeup_queue_head = %p\n",
-                   __FILE__, __FUNCTION__, __LINE__, kcb_current->wakeup_queue_head);
-            wakeup_set_queue_head(kcb_current->wakeup_queue_head);
+            printk(LOG_DEBUG, "%s:%s:%d: kcb_current->wakeup_queue = %p\n",
+                   __FILE__, __FUNCTION__, __LINE__, kcb_current->wakeup_queue);
+            wakeup_restore();
 
             printk(LOG_DEBUG, "%s:%s:%d: dcb_current = %p\n",
                    __FILE__, __FUNCTION__, __LINE__, dcb_current);
@@ -841,6 +841,12 @@ static struct sysret kernel_suspend_kcb_sched(struct capability *kern_cap,
     return sys_kernel_suspend_kcb_sched((bool)args[0]);
 }
 
+static struct sysret kernel_get_sched_load(struct capability *kern_cap,
+                                           int cmd, uintptr_t *args)
+{
+    return sys_kernel_get_sched_load();
+}
+
 static struct sysret handle_kcb_identify(struct capability *to,
                                          int cmd, uintptr_t *args)
 {
@@ -933,7 +939,8 @@ static invocation_handler_t invocations[ObjType_Num][CAP_MAX_CMD] = {
         [KernelCmd_GetGlobalPhys] = kernel_get_global_phys,
         [KernelCmd_Add_kcb]      = kernel_add_kcb,
         [KernelCmd_Remove_kcb]   = kernel_remove_kcb,
-        [KernelCmd_Suspend_kcb_sched]   = kernel_suspend_kcb_sched
+        [KernelCmd_Suspend_kcb_sched]   = kernel_suspend_kcb_sched,
+        [KernelCmd_Get_sched_load] = kernel_get_sched_load
     },
     [ObjType_IPI] = {
         [IPICmd_Send_Start] = kernel_send_start_ipi,
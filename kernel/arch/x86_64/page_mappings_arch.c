@@ -360,7 +360,7 @@ static inline void read_pt_entry(struct capability *pgtable, size_t slot,
 __attribute__((unused))
 static inline lvaddr_t get_leaf_ptable_for_vaddr(genvaddr_t vaddr)
 {
-    lvaddr_t root_pt = local_phys_to_mem(dcb_current->vspace);
+    lvaddr_t root_pt = local_phys_to_mem(X86_64_VSPACE_ADDR(dcb_current->vspace));
 
     // get pdpt
     union x86_64_pdir_entry *pdpt = (union x86_64_pdir_entry *)root_pt + X86_64_PML4_BASE(vaddr);
@@ -393,8 +393,28 @@ size_t do_unmap(lvaddr_t pt, cslot_t slot, size_t num_pages)
     return unmapped_pages;
 }
 
-errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping,
-                             size_t slot, size_t num_pages)
+/// Page size mapped by an entry of a page table of type `type`
+static inline size_t leaf_page_size(enum objtype type)
+{
+    switch (type) {
+    case ObjType_VNode_x86_64_pdpt:
+        return X86_64_HUGE_PAGE_SIZE;
+    case ObjType_VNode_x86_64_pdir:
+        return X86_64_LARGE_PAGE_SIZE;
+    default:
+        return X86_64_BASE_PAGE_SIZE;
+    }
+}
+
+/**
+ * \brief Remove a mapping and record the TLB invalidation it needs in `batch`
+ *
+ * The TLB is not touched until tlb_flush_batch_commit() is called.
+ */
+errval_t page_mappings_unmap_batched(struct capability *pgtable,
+                                     struct cte *mapping, size_t slot,
+                                     size_t num_pages,
+                                     struct tlb_flush_batch *batch)
 {
     assert(type_is_vnode(pgtable->type));
     errval_t err;
@@ -431,15 +451,17 @@ errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping,
 
     do_unmap(pt, slot, num_pages);
 
-    // flush TLB for unmapped pages if we got a valid virtual address
-    // TODO: heuristic that decides if selective or full flush is more
-    //       efficient?
+    // remember the unmapped pages if we got a valid virtual address
     if (tlb_flush_necessary) {
-        if (num_pages > 1 || err_is_fail(err)) {
-            do_full_tlb_flush();
+        if (err_is_fail(err) || batch->nranges == TLB_FLUSH_BATCH_RANGES) {
+            batch->full = true;
         } else {
-            do_one_tlb_flush(vaddr);
+            batch->range[batch->nranges].vaddr = vaddr;
+            batch->range[batch->nranges].pages = num_pages;
+            batch->range[batch->nranges].page_size = leaf_page_size(pgtable->type);
+            batch->nranges++;
         }
+        batch->pages += num_pages;
     }
 
     // update mapping info
@@ -448,6 +470,42 @@ errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping,
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Carry out the TLB invalidation collected in `batch`
+ *
+ * Invalidates the unmapped pages one by one if there are few of them, and
+ * flushes the whole TLB otherwise.
+ */
+void tlb_flush_batch_commit(struct tlb_flush_batch *batch)
+{
+    if (batch->full || batch->pages > TLB_FLUSH_SELECTIVE_MAX) {
+        do_full_tlb_flush();
+    } else {
+        for (size_t r = 0; r < batch->nranges; r++) {
+            genvaddr_t vaddr = batch->range[r].vaddr;
+            for (size_t i = 0; i < batch->range[r].pages; i++) {
+                // invlpg should work for large/huge pages
+                do_one_tlb_flush(vaddr + i * batch->range[r].page_size);
+            }
+        }
+    }
+    tlb_flush_batch_init(batch);
+}
+
+errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping,
+                             size_t slot, size_t num_pages)
+{
+    struct tlb_flush_batch batch;
+    tlb_flush_batch_init(&batch);
+
+    errval_t err = page_mappings_unmap_batched(pgtable, mapping, slot,
+                                               num_pages, &batch);
+    if (err_is_ok(err)) {
+        tlb_flush_batch_commit(&batch);
+    }
+    return err;
+}
+
 /**
  * \brief modify flags of mapping for `frame`.
  *
@@ -537,7 +595,7 @@ errval_t page_mappings_modify_flags(struct capability *frame, size_t offset,
 
 void paging_dump_tables(struct dcb *dispatcher)
 {
-    lvaddr_t root_pt = local_phys_to_mem(dispatcher->vspace);
+    lvaddr_t root_pt = local_phys_to_mem(X86_64_VSPACE_ADDR(dispatcher->vspace));
 
     // loop over pdpts
     union x86_64_ptable_entry *pt;
@@ -0,0 +1,249 @@
+/**
+ * \file
+ * \brief Per-core process-context identifier (PCID) management
+ *
+ * Every tagged root page table which is loaded on this core gets a PCID
+ * assigned. The PCIDs are recycled in LRU order once all of them are in use.
+ *
+ * TLB entries of a PCID are invalidated lazily: Whenever a mapping is changed,
+ * the flush generation is increased and only the entries of the current PCID
+ * are flushed. All other PCIDs are flushed when they are loaded the next time.
+ * A switch to a PCID which is up to date does not touch the TLB at all.
+ *
+ * A root page table may be deleted on another core than the ones it was loaded
+ * on. Releases are therefore counted in the shared global structure, and an
+ * entry whose root has been released since it was assigned is flushed before
+ * its next use, in case the page became the root of another vspace.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+#include <kernel.h>
+#include <paging_kernel_arch.h>
+#include <pcid.h>
+#include <arch/x86/global.h>
+
+#define PCID_NONE       0
+#define PCID_HASH_SIZE  1024
+#define PCID_HASH(vr)   (((vr) >> BASE_PAGE_BITS) & (PCID_HASH_SIZE - 1))
+#define PCID_RELEASED(vr) \
+    (global->pcid_released[((vr) >> BASE_PAGE_BITS) & (PCID_RELEASE_SLOTS - 1)])
+
+struct pcid_entry {
+    lpaddr_t vroot;             ///< root page table using the PCID, 0 if free
+    uint64_t gen;               ///< flush generation the TLB entries belong to
+    uint32_t released;          ///< release count of the root when assigned
+    uint16_t lru_prev;          ///< LRU list, entry PCID_NONE is the list head
+    uint16_t lru_next;
+    uint16_t hash_next;         ///< next entry in the hash bucket
+};
+
+/// PCIDs are enabled on this core
+bool pcid_enabled = false;
+
+static struct pcid_entry pcids[X86_64_PCID_NUM];
+static uint16_t pcid_hash[PCID_HASH_SIZE];
+
+/// current flush generation, entries with an older generation may be stale
+static uint64_t pcid_gen = 1;
+
+/// PCID currently loaded in CR3
+static uint16_t pcid_current = PCID_NONE;
+
+static inline void lru_remove(uint16_t id)
+{
+    pcids[pcids[id].lru_prev].lru_next = pcids[id].lru_next;
+    pcids[pcids[id].lru_next].lru_prev = pcids[id].lru_prev;
+}
+
+/// inserts the entry as most recently used
+static inline void lru_insert_head(uint16_t id)
+{
+    pcids[id].lru_prev = PCID_NONE;
+    pcids[id].lru_next = pcids[PCID_NONE].lru_next;
+    pcids[pcids[PCID_NONE].lru_next].lru_prev = id;
+    pcids[PCID_NONE].lru_next = id;
+}
+
+/// inserts the entry as least recently used, i.e. next to be recycled
+static inline void lru_insert_tail(uint16_t id)
+{
+    pcids[id].lru_next = PCID_NONE;
+    pcids[id].lru_prev = pcids[PCID_NONE].lru_prev;
+    pcids[pcids[PCID_NONE].lru_prev].lru_next = id;
+    pcids[PCID_NONE].lru_prev = id;
+}
+
+static uint16_t hash_lookup(lpaddr_t vroot)
+{
+    uint16_t id = pcid_hash[PCID_HASH(vroot)];
+    while (id != PCID_NONE && pcids[id].vroot != vroot) {
+        id = pcids[id].hash_next;
+    }
+    return id;
+}
+
+static void hash_remove(uint16_t id)
+{
+    uint16_t *walk = &pcid_hash[PCID_HASH(pcids[id].vroot)];
+    while (*walk != id) {
+        assert(*walk != PCID_NONE);
+        walk = &pcids[*walk].hash_next;
+    }
+    *walk = pcids[id].hash_next;
+    pcids[id].hash_next = PCID_NONE;
+}
+
+static void hash_insert(uint16_t id)
+{
+    uint16_t *bucket = &pcid_hash[PCID_HASH(pcids[id].vroot)];
+    pcids[id].hash_next = *bucket;
+    *bucket = id;
+}
+
+/**
+ * \brief Assigns the least recently used PCID to the root page table
+ */
+static uint16_t pcid_alloc(lpaddr_t vroot)
+{
+    uint16_t id = pcids[PCID_NONE].lru_prev;
+    assert(id != PCID_NONE);
+
+    if (pcids[id].vroot != 0) {
+        hash_remove(id);
+    }
+
+    pcids[id].vroot = vroot;
+    pcids[id].released = PCID_RELEASED(vroot);
+    /* the PCID may still have entries of its previous owner */
+    pcids[id].gen = 0;
+    hash_insert(id);
+
+    return id;
+}
+
+static void pcid_reset(void)
+{
+    memset(pcid_hash, 0, sizeof(pcid_hash));
+
+    pcids[PCID_NONE].lru_next = pcids[PCID_NONE].lru_prev = PCID_NONE;
+    for (uint16_t id = 1; id < X86_64_PCID_NUM; id++) {
+        pcids[id].vroot = 0;
+        pcids[id].gen = 0;
+        pcids[id].hash_next = PCID_NONE;
+        lru_insert_tail(id);
+    }
+
+    pcid_current = PCID_NONE;
+}
+
+/**
+ * \brief Enables the PCID allocator. CR4.PCIDE must be set by the caller.
+ */
+void pcid_enable(void)
+{
+    pcid_reset();
+    pcid_enabled = true;
+}
+
+/**
+ * \brief Disables the PCID allocator. Clearing CR4.PCIDE flushes the TLB.
+ */
+void pcid_disable(void)
+{
+    pcid_enabled = false;
+    pcid_current = PCID_NONE;
+}
+
+/**
+ * \brief Calculates the CR3 value for a switch to the vspace
+ *
+ * \param vspace    root page table, optionally marked with X86_64_VSPACE_TAGGED
+ *
+ * \returns value to be loaded into CR3
+ */
+lpaddr_t pcid_context_cr3(lpaddr_t vspace)
+{
+    lpaddr_t vroot = X86_64_VSPACE_ADDR(vspace);
+
+    if (!pcid_enabled || !(vspace & X86_64_VSPACE_TAGGED)) {
+        /* loading PCID 0 without the no-flush bit invalidates its entries */
+        pcid_current = PCID_NONE;
+        return vroot;
+    }
+
+    uint16_t id = hash_lookup(vroot);
+    if (id == PCID_NONE) {
+        id = pcid_alloc(vroot);
+    } else if (pcids[id].released != PCID_RELEASED(vroot)) {
+        /* the root was deleted on some core, the page may now be a new root */
+        pcids[id].released = PCID_RELEASED(vroot);
+        pcids[id].gen = 0;
+    }
+
+    lru_remove(id);
+    lru_insert_head(id);
+
+    pcid_current = id;
+
+    if (pcids[id].gen == pcid_gen) {
+        return vroot | id | X86_64_CR3_NOFLUSH;
+    }
+
+    pcids[id].gen = pcid_gen;
+
+    return vroot | id;
+}
+
+/**
+ * \brief Marks the TLB entries of all but the current PCID as stale.
+ *
+ * Called whenever a mapping is removed or changed. The caller is responsible
+ * for invalidating the entries of the currently loaded PCID.
+ */
+void pcid_invalidate(void)
+{
+    if (!pcid_enabled) {
+        return;
+    }
+
+    pcid_gen++;
+    if (pcid_current != PCID_NONE) {
+        pcids[pcid_current].gen = pcid_gen;
+    }
+}
+
+/**
+ * \brief Releases the PCID of a root page table which is being deleted
+ *
+ * The entries of other cores are invalidated on their next lookup.
+ */
+void pcid_release(lpaddr_t vroot)
+{
+    /* other cores may still have an entry for the root */
+    __sync_fetch_and_add(&PCID_RELEASED(vroot), 1);
+
+    if (!pcid_enabled) {
+        return;
+    }
+
+    uint16_t id = hash_lookup(vroot);
+    if (id == PCID_NONE) {
+        return;
+    }
+
+    hash_remove(id);
+    pcids[id].vroot = 0;
+    pcids[id].gen = 0;
+
+    lru_remove(id);
+    lru_insert_tail(id);
+}
@@ -36,6 +36,7 @@
 #include <barrelfish_kpi/lmp.h>
 #include <barrelfish_kpi/dispatcher_shared_target.h>
 #include <trace/trace.h>
+#include <useraccess.h>
 #ifndef __k1om__
 #include <vmkit.h>
 #include <dev/amd_vmcb_dev.h>
@@ -45,8 +46,6 @@
 
 extern uint64_t user_stack_save;
 
-static int tlb_tags_enabled = 0;
-
 /* FIXME: lots of missing argument checks in this function */
 static struct sysret handle_dispatcher_setup(struct capability *to,
                                              int cmd, uintptr_t *args)
@@ -227,6 +226,124 @@ static struct sysret handle_unmap(struct capability *pgtable,
     return SYSRET(err);
 }
 
+/**
+ * \brief Looks up the page table of a batched VNode operation
+ */
+static errval_t batch_lookup_ptable(capaddr_t cptr, int bits,
+                                    struct capability **ret)
+{
+    struct cte *ptable;
+    errval_t err = caps_lookup_slot(&dcb_current->cspace.cap, cptr, bits,
+                                    &ptable, CAPRIGHTS_READ_WRITE);
+    if (err_is_fail(err)) {
+        return err_push(err, SYS_ERR_CAP_NOT_FOUND);
+    }
+    if (!type_is_vnode(ptable->cap.type)) {
+        return SYS_ERR_VNODE_TYPE;
+    }
+    *ret = &ptable->cap;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Performs a batch of map operations with a single invocation
+ *
+ * Operations are carried out in order. On failure the value of the returned
+ * sysret holds the number of operations that completed successfully.
+ */
+static struct sysret handle_map_batch(struct capability *vroot,
+                                      int cmd, uintptr_t *args)
+{
+    lvaddr_t ops  = args[0];
+    size_t count  = args[1];
+
+    if (count > VNODE_BATCH_MAX) {
+        return SYSRET(SYS_ERR_VM_BATCH_SIZE);
+    }
+    if (!access_ok(ACCESS_READ, ops, count * sizeof(struct vnode_map_op))) {
+        return SYSRET(SYS_ERR_INVALID_USER_BUFFER);
+    }
+
+    TRACE(KERNEL, SC_MAP, 0);
+    struct sysret sr = SYSRET(SYS_ERR_OK);
+    size_t done;
+    for (done = 0; done < count; done++) {
+        struct vnode_map_op op = ((struct vnode_map_op *)ops)[done];
+
+        struct capability *ptable;
+        sr.error = batch_lookup_ptable(op.ptable, op.ptable_bits, &ptable);
+        if (err_is_fail(sr.error)) {
+            break;
+        }
+        sr = sys_map(ptable, op.slot, op.frame, op.frame_bits, op.flags,
+                     op.offset, op.pte_count);
+        if (err_is_fail(sr.error)) {
+            break;
+        }
+    }
+    TRACE(KERNEL, SC_MAP, 1);
+
+    sr.value = done;
+    return sr;
+}
+
+/**
+ * \brief Performs a batch of unmap operations with a single invocation
+ *
+ * The TLB invalidations of all operations are collected and carried out
+ * once at the end, as a full flush if there are too many pages to
+ * invalidate individually. On failure the value of the returned sysret
+ * holds the number of operations that completed successfully.
+ */
+static struct sysret handle_unmap_batch(struct capability *vroot,
+                                        int cmd, uintptr_t *args)
+{
+    lvaddr_t ops  = args[0];
+    size_t count  = args[1];
+
+    if (count > VNODE_BATCH_MAX) {
+        return SYSRET(SYS_ERR_VM_BATCH_SIZE);
+    }
+    if (!access_ok(ACCESS_READ, ops, count * sizeof(struct vnode_unmap_op))) {
+        return SYSRET(SYS_ERR_INVALID_USER_BUFFER);
+    }
+
+    struct tlb_flush_batch batch;
+    tlb_flush_batch_init(&batch);
+
+    TRACE(KERNEL, SC_UNMAP, 0);
+    errval_t err = SYS_ERR_OK;
+    size_t done;
+    for (done = 0; done < count; done++) {
+        struct vnode_unmap_op op = ((struct vnode_unmap_op *)ops)[done];
+
+        struct capability *ptable;
+        err = batch_lookup_ptable(op.ptable, op.ptable_bits, &ptable);
+        if (err_is_fail(err)) {
+            break;
+        }
+
+        struct cte *mapping;
+        err = caps_lookup_slot(&dcb_current->cspace.cap, op.mapping,
+                               op.mapping_bits, &mapping, CAPRIGHTS_READ_WRITE);
+        if (err_is_fail(err)) {
+            err = err_push(err, SYS_ERR_CAP_NOT_FOUND);
+            break;
+        }
+
+        err = page_mappings_unmap_batched(ptable, mapping, op.slot,
+                                          op.pte_count, &batch);
+        if (err_is_fail(err)) {
+            break;
+        }
+    }
+    // the entries of completed operations are gone, flush them in any case
+    tlb_flush_batch_commit(&batch);
+    TRACE(KERNEL, SC_UNMAP, 1);
+
+    return (struct sysret) { .error = err, .value = done };
+}
+
 /*
  *  MVAS Extension
  */
@@ -300,12 +417,14 @@ static struct sysret handle_inherit(struct capability *dest,
 static struct sysret handle_vroot_switch(struct capability *dest,
                                     int cmd, uintptr_t *args)
 {
+    lpaddr_t vspace;
+
     switch(dest->type) {
         case ObjType_Null :
-            dcb_current->vspace = dcb_current->vspace0;
+            vspace = X86_64_VSPACE_ADDR(dcb_current->vspace0);
             break;
         case ObjType_VNode_x86_64_pml4 :
-            dcb_current->vspace = dest->u.vnode_x86_64_pml4.base;
+            vspace = dest->u.vnode_x86_64_pml4.base;
             break;
         default:
             return SYSRET(SYS_ERR_CNODE_TYPE);
@@ -325,13 +444,17 @@ static struct sysret handle_vroot_switch(struct capability *dest,
     - If CR4.PCIDE = 1 and bit 63 of the instruction's source operand is 1, the
     instruction is not required to invalidate any TLB entries or entries in pagingstructure
     caches.
+
+    The PCID of the root page table is assigned by the per-core allocator in
+    pcid.c. The argument only requests tagging. The same holds for regular
+    dispatcher switches as the marker is kept in dcb->vspace.
   */
-    if (tlb_tags_enabled) {
-        if (args[0]) {
-            dcb_current->vspace |= ((args[0] & 0xfffUL) | (1UL << 63));
-        }
+    if (args[0]) {
+        vspace |= X86_64_VSPACE_TAGGED;
     }
 
+    dcb_current->vspace = vspace;
+
     paging_context_switch(dcb_current->vspace);
 
     return SYSRET(SYS_ERR_OK);
@@ -1021,6 +1144,12 @@ static struct sysret kernel_suspend_kcb_sched(struct capability *kern_cap,
     return sys_kernel_suspend_kcb_sched((bool)args[0]);
 }
 
+static struct sysret kernel_get_sched_load(struct capability *kern_cap,
+                                           int cmd, uintptr_t *args)
+{
+    return sys_kernel_get_sched_load();
+}
+
 static lpaddr_t inline kernel_read_cr4(void)
 {
     uint64_t cr4;
@@ -1060,12 +1189,12 @@ static struct sysret kernel_tlb_tag(struct capability *kern_cap,
     if (enable && !(cr4 & (1UL << 17))) {
         cr4 |= (1UL << 17);
         kernel_write_cr4(cr4);
-        tlb_tags_enabled = 1;
+        pcid_enable();
     } else {
         if (cr4 & (1UL << 17)) {
+            pcid_disable();
             cr4 &= ~(1UL << 17);
             kernel_write_cr4(cr4);
-            tlb_tags_enabled = 0;
         }
     }
 
@@ -1117,6 +1246,8 @@ static invocation_handler_t invocations[ObjType_Num][CAP_MAX_CMD] = {
         [VNodeCmd_Unmap] = handle_unmap,
         [VNodeCmd_Inherit] = handle_inherit,
         [VNodeCmd_Switch] = handle_vroot_switch,
+        [VNodeCmd_MapBatch] = handle_map_batch,
+        [VNodeCmd_UnmapBatch] = handle_unmap_batch,
     },
     [ObjType_VNode_x86_64_pdpt] = {
         [VNodeCmd_Map]   = handle_map,
@@ -1162,7 +1293,8 @@ static invocation_handler_t invocations[ObjType_Num][CAP_MAX_CMD] = {
         [KernelCmd_Add_kcb]      = kernel_add_kcb,
         [KernelCmd_Remove_kcb]   = kernel_remove_kcb,
         [KernelCmd_Suspend_kcb_sched]   = kernel_suspend_kcb_sched,
-        [KernelCmd_Toggle_TLB_Tag] = kernel_tlb_tag
+        [KernelCmd_Toggle_TLB_Tag] = kernel_tlb_tag,
+        [KernelCmd_Get_sched_load] = kernel_get_sched_load
     },
     [ObjType_IPI] = {
         [IPICmd_Send_Start] = kernel_send_start_ipi,
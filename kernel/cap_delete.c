@@ -32,12 +32,17 @@
 struct cte *clear_head, *clear_tail;
 struct cte *delete_head, *delete_tail;
 
+/// Number of successors fetched at once while marking caps for revoke
+#define MARK_BATCH 64
+
 static errval_t caps_try_delete(struct cte *cte);
 static errval_t cleanup_copy(struct cte *cte);
 static errval_t cleanup_last(struct cte *cte, struct cte *ret_ram_cap);
 static void caps_mark_revoke_copy(struct cte *cte);
 static void caps_mark_revoke_generic(struct cte *cte);
 static void clear_list_prepend(struct cte *cte);
+static errval_t caps_delete_one(struct cte *ret_next);
+static errval_t caps_clear_one(struct cte *ret_ram_cap);
 static errval_t caps_copyout_last(struct cte *target, struct cte *ret_cte);
 
 /**
@@ -253,6 +258,13 @@ cleanup_last(struct cte *cte, struct cte *ret_ram_cap)
         }
     }
 
+#if defined(__x86_64__) || defined(__k1om__)
+    // the TLB tag of a root page table must not be reused for its successor
+    if (cap->type == ObjType_VNode_x86_64_pml4) {
+        pcid_release(gen_phys_to_local_phys(get_address(cap)));
+    }
+#endif
+
     err = cleanup_copy(cte);
     if (err_is_fail(err)) {
         return err;
@@ -445,31 +457,42 @@ errval_t caps_mark_revoke(struct capability *base, struct cte *revoked)
         return SYS_ERR_CAP_NOT_FOUND;
     }
 
-    for (next = mdb_successor(prev);
-         next && is_copy(base, &next->cap);
-         next = mdb_successor(prev))
-    {
-        // note: if next is a copy of base, prev will also be a copy
-        if (next == revoked) {
-            // do not delete the revoked capability, use it as the new prev
-            // instead, and delete the old prev.
-            next = prev;
-            prev = revoked;
-        }
-        assert(revoked || next->mdbnode.owner != my_core_id);
-        caps_mark_revoke_copy(next);
-    }
-
-    for (next = mdb_successor(prev);
-         next && is_ancestor(&next->cap, base);
-         next = mdb_successor(prev))
-    {
-        caps_mark_revoke_generic(next);
-        if (next->cap.type) {
-            // the cap has not been deleted, so we must use it as the new prev
-            prev = next;
+    // Copies of base come first in the ordering, followed by its
+    // descendants. Fetching the successors in batches saves a tree search
+    // per cap. Marking a cap removes at most that cap from the tree, so the
+    // remaining entries of a batch stay valid.
+    struct cte *batch[MARK_BATCH];
+    bool copies = true;
+    size_t i, count;
+    do {
+        count = mdb_successors(prev, batch, MARK_BATCH);
+        for (i = 0; i < count; i++) {
+            next = batch[i];
+            if (copies && is_copy(base, &next->cap)) {
+                // note: if next is a copy of base, prev will also be a copy
+                if (next == revoked) {
+                    // do not delete the revoked capability, use it as the new
+                    // prev instead, and delete the old prev.
+                    next = prev;
+                    prev = revoked;
+                }
+                assert(revoked || next->mdbnode.owner != my_core_id);
+                caps_mark_revoke_copy(next);
+            }
+            else if (is_ancestor(&next->cap, base)) {
+                copies = false;
+                caps_mark_revoke_generic(next);
+                if (next->cap.type) {
+                    // the cap has not been deleted, so we must use it as the
+                    // new prev
+                    prev = next;
+                }
+            }
+            else {
+                break;
+            }
         }
-    }
+    } while (i == count && count == MARK_BATCH);
 
     if (prev != revoked && !prev->mdbnode.in_delete) {
         if (is_copy(base, &prev->cap)) {
@@ -509,7 +532,7 @@ static void clear_list_prepend(struct cte *cte)
     TRACE_CAP_MSG("inserted into clear list", cte);
 }
 
-errval_t caps_delete_step(struct cte *ret_next)
+static errval_t caps_delete_one(struct cte *ret_next)
 {
     errval_t err = SYS_ERR_OK;
 
@@ -563,7 +586,7 @@ errval_t caps_delete_step(struct cte *ret_next)
     return err;
 }
 
-errval_t caps_clear_step(struct cte *ret_ram_cap)
+static errval_t caps_clear_one(struct cte *ret_ram_cap)
 {
     errval_t err;
     assert(!delete_head);
@@ -620,6 +643,52 @@ errval_t caps_clear_step(struct cte *ret_ram_cap)
     return err;
 }
 
+/**
+ * \brief Delete caps from the head of the delete list.
+ *
+ * Stops when the list is empty, after CAPS_STEP_BUDGET worth of caps, or at
+ * the first cap that needs the attention of the monitor, whose result is
+ * returned.
+ */
+errval_t caps_delete_step(struct cte *ret_next)
+{
+    errval_t err;
+    size_t work = 0;
+
+    do {
+        struct cte *cte = delete_head;
+        if (cte && cte->cap.type == ObjType_CNode) {
+            // all slots get marked when the last copy is deleted
+            work += 1UL << cte->cap.u.cnode.bits;
+        }
+        else {
+            work++;
+        }
+        err = caps_delete_one(ret_next);
+    } while (err == SYS_ERR_OK && delete_head && work < CAPS_STEP_BUDGET);
+
+    return err;
+}
+
+/**
+ * \brief Clear caps from the head of the clear list.
+ *
+ * Stops when the list is empty, after CAPS_STEP_BUDGET caps, or at the first
+ * cap that does not complete with SYS_ERR_OK, e.g. because it returned a RAM
+ * cap in ret_ram_cap.
+ */
+errval_t caps_clear_step(struct cte *ret_ram_cap)
+{
+    errval_t err;
+    size_t work = 0;
+
+    do {
+        err = caps_clear_one(ret_ram_cap);
+    } while (err == SYS_ERR_OK && clear_head && ++work < CAPS_STEP_BUDGET);
+
+    return err;
+}
+
 static errval_t caps_copyout_last(struct cte *target, struct cte *ret_cte)
 {
     errval_t err;
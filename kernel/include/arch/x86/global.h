@@ -18,6 +18,9 @@
 
 #include <barrelfish_kpi/spinlocks_arch.h>
 
+/// Number of release counters for PCID-tagged root page tables (see pcid.c)
+#define PCID_RELEASE_SLOTS  256
+
 /**
  * \brief Struct passed to app_cores during boot.
  * Contains information that the bsp_kernel wants to pass to the app_kernels.
@@ -36,6 +39,9 @@ struct global {
     bool started_once;
 
     genpaddr_t notify[MAX_COREID];
+
+    /// Releases of root page tables, counted by hash of their address
+    volatile uint32_t pcid_released[PCID_RELEASE_SLOTS];
 };
 
 extern struct global *global;
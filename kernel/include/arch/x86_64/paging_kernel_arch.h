@@ -17,6 +17,7 @@
 
 #include <target/x86_64/paging_kernel_target.h>
 #include <paging_kernel_helper.h>
+#include <pcid.h>
 
 /** Physical memory page size is 2 MBytes */
 #define X86_64_MEM_PAGE_SIZE            X86_64_LARGE_PAGE_SIZE
@@ -49,11 +50,12 @@
  * effectively switching context to new address space. Be
  * cautious that you only switch to "good" page tables.
  *
- * \param addr  Physical base address of page table.
+ * \param addr  Physical base address of page table, optionally marked
+ *              with X86_64_VSPACE_TAGGED
  */
 static void inline paging_context_switch(lpaddr_t addr)
 {
-    paging_x86_64_context_switch(addr);
+    paging_x86_64_context_switch(pcid_context_cr3(addr));
 }
 
 static lvaddr_t inline paging_map_device(lpaddr_t base, size_t size)
@@ -71,22 +73,65 @@ static inline size_t get_pte_size(void) {
 
 static inline void do_one_tlb_flush(genvaddr_t vaddr)
 {
+    // invlpg only affects the current PCID
+    pcid_invalidate();
     __asm__ __volatile__("invlpg %0" : : "m" (*(char *)vaddr));
 }
 
 static inline void do_selective_tlb_flush(genvaddr_t vaddr, genvaddr_t vend)
 {
+    pcid_invalidate();
     for (genvaddr_t addr = vaddr; addr < vend; addr += X86_64_BASE_PAGE_SIZE) {
         __asm__ __volatile__("invlpg %0" : : "m" (*(char *)addr));
     }
 }
 
+/// Most pages a deferred TLB flush invalidates one by one
+#define TLB_FLUSH_SELECTIVE_MAX 32
+
+/// Most ranges a deferred TLB flush keeps before it flushes the whole TLB
+#define TLB_FLUSH_BATCH_RANGES  8
+
+/**
+ * \brief TLB invalidation deferred across several unmaps
+ *
+ * Collects the unmapped ranges of a batch, so that a single decision between
+ * invlpg of every page and a full flush can be taken at the end.
+ */
+struct tlb_flush_batch {
+    bool   full;            ///< The whole TLB needs to be flushed
+    size_t pages;           ///< Number of pages in the ranges
+    size_t nranges;         ///< Number of valid ranges
+    struct {
+        genvaddr_t vaddr;
+        size_t     pages;
+        size_t     page_size;
+    } range[TLB_FLUSH_BATCH_RANGES];
+};
+
+static inline void tlb_flush_batch_init(struct tlb_flush_batch *batch)
+{
+    batch->full = false;
+    batch->pages = 0;
+    batch->nranges = 0;
+}
+
+struct capability;
+struct cte;
+errval_t page_mappings_unmap_batched(struct capability *pgtable,
+                                     struct cte *mapping, size_t slot,
+                                     size_t num_pages,
+                                     struct tlb_flush_batch *batch);
+void tlb_flush_batch_commit(struct tlb_flush_batch *batch);
+
 static inline void do_full_tlb_flush(void) {
     // XXX: FIXME: Going to reload cr3 to flush the entire TLB.
     // This is inefficient.
     // The current implementation is also not multicore safe.
     // We should only invalidate the affected entry using invlpg
     // and figure out which remote tlbs to flush.
+    // Reloading cr3 clears the no-flush bit and flushes the current PCID.
+    pcid_invalidate();
     uint64_t cr3;
     __asm__ __volatile__("mov %%cr3,%0" : "=a" (cr3) : );
     __asm__ __volatile__("mov %0,%%cr3" :  : "a" (cr3));
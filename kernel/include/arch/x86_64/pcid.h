@@ -0,0 +1,41 @@
+/**
+ * \file
+ * \brief Per-core process-context identifier (PCID) management
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef KERNEL_ARCH_X86_64_PCID_H
+#define KERNEL_ARCH_X86_64_PCID_H
+
+/// Number of PCIDs supported by the hardware, PCID 0 is used for untagged roots
+#define X86_64_PCID_NUM         4096
+
+/// CR3 bit 63: don't invalidate the TLB entries of the loaded PCID
+#define X86_64_CR3_NOFLUSH      (1UL << 63)
+
+/**
+ * Marks a vspace root (dcb->vspace) whose TLB entries should be tagged with a
+ * PCID. Page tables are 4k aligned, hence the low bits of the root are free.
+ */
+#define X86_64_VSPACE_TAGGED    (1UL << 0)
+
+/// Extracts the address of the root page table from dcb->vspace
+#define X86_64_VSPACE_ADDR(vs)  ((vs) & ~(lpaddr_t)0xfff)
+
+extern bool pcid_enabled;
+
+void pcid_enable(void);
+void pcid_disable(void);
+lpaddr_t pcid_context_cr3(lpaddr_t vspace);
+void pcid_invalidate(void);
+void pcid_release(lpaddr_t vroot);
+
+#endif // KERNEL_ARCH_X86_64_PCID_H
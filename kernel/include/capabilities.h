@@ -111,6 +111,10 @@ errval_t caps_lookup_slot(struct capability *cnode_cap, capaddr_t cptr,
  * Delete and revoke
  */
 
+/// Work a single delete or clear step may do, in caps. Every slot of a
+/// CNode that is marked for deletion counts as one cap.
+#define CAPS_STEP_BUDGET 256
+
 errval_t caps_delete_last(struct cte *cte, struct cte *ret_ram_cap);
 errval_t caps_delete_foreigns(struct cte *cte);
 errval_t caps_mark_revoke(struct capability *base, struct cte *revoked);
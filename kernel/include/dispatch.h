@@ -19,6 +19,7 @@
 #include <barrelfish_kpi/dispatcher_shared_arch.h>
 #include <capabilities.h>
 #include <misc.h>
+#include <pheap.h>
 
 extern uint64_t context_switch_counter;
 
@@ -50,16 +51,19 @@ struct dcb {
     struct guest        guest_desc;     ///< Descriptor of the VM Guest
     uint64_t            domain_id;      ///< ID of dispatcher's domain
     systime_t           wakeup_time;    ///< Time to wakeup this dispatcher
-    struct dcb          *wakeup_prev, *wakeup_next; ///< Next/prev in timeout queue
+    struct pheap_node   wakeup_node;    ///< Node in timeout queue
 
     struct dcb          *next;          ///< Next DCB in schedule
     struct dcb          *prev;          ///< Previous DCB in schedule
-                                        /// (only valid iff CONFIG_SCHEDULER_RR)
 #if defined(CONFIG_SCHEDULER_RBED)
     unsigned long       release_time, etime, last_dispatch;
     unsigned long       wcet, period, deadline;
     unsigned short      weight;
     enum task_type      type;
+    struct pheap_node   sched_node;     ///< Node in ready or pending queue
+    unsigned long       sched_deadline; ///< Deadline when queued
+    uint64_t            sched_seq;      ///< Order of queueing, breaks ties
+    bool                sched_released; ///< In ready (not pending) queue?
 #endif
 };
 
@@ -19,6 +19,7 @@
 #include <capabilities.h>
 #include <irq.h>
 #include <mdb/mdb_tree.h>
+#include <pheap.h>
 
 struct cte;
 struct dcb;
@@ -56,11 +57,14 @@ struct kcb {
     struct dcb *ring_current;
     /// RBED scheduler state
     struct dcb *queue_head, *queue_tail;
+    struct pheap_node *queue_ready, *queue_pending;
+    unsigned long queue_ready_max; ///< Largest deadline in ready queue
+    uint64_t queue_seq;
     unsigned int u_hrt, u_srt, w_be, n_be;
     /// current time since kernel start in timeslices. This is necessary to
     /// make the scheduler work correctly
-    /// wakeup queue head
-    struct dcb *wakeup_queue_head;
+    /// wakeup queue, ordered by wakeup time
+    struct pheap_node *wakeup_queue;
     /// last value of kernel_now before shutdown/migration
     //needs to be signed because it's possible to migrate a kcb onto a cpu
     //driver whose kernel_now > this kcb's kernel_off.
@@ -83,7 +87,7 @@ static inline void print_kcb(void)
     printk(LOG_DEBUG, "  mdb_root = 0x%"PRIxLVADDR"\n", kcb_current->mdb_root);
     printk(LOG_DEBUG, "  queue_head = %p\n", kcb_current->queue_head);
     printk(LOG_DEBUG, "  queue_tail = %p\n", kcb_current->queue_tail);
-    printk(LOG_DEBUG, "  wakeup_queue_head = %p\n", kcb_current->wakeup_queue_head);
+    printk(LOG_DEBUG, "  wakeup_queue = %p\n", kcb_current->wakeup_queue);
     printk(LOG_DEBUG, "  u_hrt = %u, u_srt = %u, w_be = %u, n_be = %u\n",
             kcb_current->u_hrt, kcb_current->u_srt, kcb_current->w_be,
             kcb_current->n_be);
@@ -0,0 +1,154 @@
+/**
+ * \file
+ * \brief Intrusive pairing heap
+ *
+ * The heap nodes are embedded in the objects they order, so the heap needs
+ * no memory of its own. Insertion is O(1), removal of the minimum or of an
+ * arbitrary node is O(log n) amortized. Nodes must compare as a strict
+ * total order; ties have to be broken by the comparison function.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef KERNEL_PHEAP_H
+#define KERNEL_PHEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pheap_node {
+    struct pheap_node *child;   ///< First child
+    struct pheap_node *sibling; ///< Next sibling
+    struct pheap_node *prev;    ///< Previous sibling, or parent of first child
+};
+
+/// Returns true if a must come before b
+typedef bool (*pheap_less_fn)(struct pheap_node *a, struct pheap_node *b);
+
+static inline void pheap_node_init(struct pheap_node *n)
+{
+    n->child = n->sibling = n->prev = NULL;
+}
+
+/// Returns true if the node is in the heap with the given root
+static inline bool pheap_contains(struct pheap_node *root, struct pheap_node *n)
+{
+    return n->prev != NULL || root == n;
+}
+
+/// Meld two heaps, given by their roots
+static inline struct pheap_node *pheap_meld(struct pheap_node *a,
+                                            struct pheap_node *b,
+                                            pheap_less_fn less)
+{
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (less(b, a)) {
+        struct pheap_node *t = a;
+        a = b;
+        b = t;
+    }
+
+    // b becomes the first child of a
+    b->prev = a;
+    b->sibling = a->child;
+    if (a->child != NULL) {
+        a->child->prev = b;
+    }
+    a->child = b;
+    a->sibling = a->prev = NULL;
+    return a;
+}
+
+/// Meld a list of siblings into one heap, pairing them up first
+static inline struct pheap_node *pheap_merge_pairs(struct pheap_node *first,
+                                                   pheap_less_fn less)
+{
+    struct pheap_node *pairs = NULL;
+
+    // left to right: meld pairs, collect the results in reverse order
+    while (first != NULL) {
+        struct pheap_node *a = first, *b = a->sibling;
+        first = b ? b->sibling : NULL;
+
+        a->sibling = a->prev = NULL;
+        if (b != NULL) {
+            b->sibling = b->prev = NULL;
+        }
+        a = pheap_meld(a, b, less);
+        a->sibling = pairs;
+        pairs = a;
+    }
+
+    // right to left: meld the pairs into one heap
+    struct pheap_node *root = NULL;
+    while (pairs != NULL) {
+        struct pheap_node *next = pairs->sibling;
+        pairs->sibling = NULL;
+        root = pheap_meld(pairs, root, less);
+        pairs = next;
+    }
+    return root;
+}
+
+static inline void pheap_insert(struct pheap_node **root, struct pheap_node *n,
+                                pheap_less_fn less)
+{
+    pheap_node_init(n);
+    *root = pheap_meld(*root, n, less);
+}
+
+/// Remove a node, which must be in the heap
+static inline void pheap_remove(struct pheap_node **root, struct pheap_node *n,
+                                pheap_less_fn less)
+{
+    if (n == *root) {
+        *root = pheap_merge_pairs(n->child, less);
+    } else {
+        // cut the subtree of n out of its sibling list
+        if (n->prev->child == n) {
+            n->prev->child = n->sibling;
+        } else {
+            n->prev->sibling = n->sibling;
+        }
+        if (n->sibling != NULL) {
+            n->sibling->prev = n->prev;
+        }
+        *root = pheap_meld(*root, pheap_merge_pairs(n->child, less), less);
+    }
+    pheap_node_init(n);
+}
+
+/**
+ * \brief Returns the node after n in a walk over all nodes of the heap
+ *
+ * The walk starts at the root and visits the nodes in no particular order.
+ * The heap must not be modified during the walk.
+ */
+static inline struct pheap_node *pheap_walk_next(struct pheap_node *n)
+{
+    if (n->child != NULL) {
+        return n->child;
+    }
+    while (n != NULL && n->sibling == NULL) {
+        // go up to the parent of the sibling list
+        while (n->prev != NULL && n->prev->child != n) {
+            n = n->prev;
+        }
+        n = n->prev;
+    }
+    return n ? n->sibling : NULL;
+}
+
+#endif // KERNEL_PHEAP_H
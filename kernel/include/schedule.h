@@ -19,6 +19,7 @@ struct dcb *schedule(void);
 void make_runnable(struct dcb *dcb);
 void scheduler_remove(struct dcb *dcb);
 void scheduler_yield(struct dcb *dcb);
+unsigned int scheduler_get_load(void);
 void scheduler_reset_time(void);
 void scheduler_convert(void);
 void scheduler_restore_state(void);
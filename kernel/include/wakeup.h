@@ -10,11 +10,14 @@
 #ifndef KERNEL_WAKEUP_H
 #define KERNEL_WAKEUP_H
 
+struct kcb;
+
 /// only use for restoring state
-void wakeup_set_queue_head(struct dcb *h);
+void wakeup_restore(void);
 void wakeup_remove(struct dcb *dcb);
 void wakeup_set(struct dcb *dcb, systime_t waketime);
 void wakeup_check(systime_t now);
 bool wakeup_is_pending(void);
+struct dcb *wakeup_walk(struct kcb *kcb, struct dcb *prev);
 
 #endif
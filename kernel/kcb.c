@@ -15,6 +15,7 @@
 #include <kernel.h>
 #include <kcb.h>
 #include <dispatch.h>
+#include <wakeup.h>
 
 // this is used to pin a kcb for critical sections
 bool kcb_sched_suspended = false;
@@ -96,7 +97,7 @@ void kcb_update_core_id(struct kcb *kcb)
 #error must define scheduler policy in Config.hs
 #endif
     // do it for dcbs in wakeup queue
-    for (struct dcb *d = kcb->wakeup_queue_head; d; d=d->wakeup_next) {
+    for (struct dcb *d = wakeup_walk(kcb, NULL); d; d = wakeup_walk(kcb, d)) {
         printk(LOG_NOTE, "[wakeup] updating current core id to %d for %s\n",
                 my_core_id, get_disp_name(d));
         struct dispatcher_shared_generic *disp =
@@ -50,6 +50,17 @@
  *  for best-effort tasks the scheduler is responsible to assigns proper values
  *  the RT parameters. Also, To prioritize between BE tasks, the scheduler uses
  *  ->weight.
+ *
+ * run queue:
+ *  the tasks in the queue are kept in two pairing heaps. Tasks released in
+ *  the future are ordered by release time in ->queue_pending. They move to
+ *  ->queue_ready, which is ordered by deadline, once they are released. The
+ *  deadline is taken when a task is inserted and ties are broken by the
+ *  order of insertion, so that trains of tasks with equal deadlines get
+ *  scheduled round-robin. The lazily allocated deadlines of best-effort
+ *  tasks are re-sorted when they change at the head of the queue.
+ *  ->queue_head and ->queue_tail link all tasks in the queue in no
+ *  particular order, for code that has to visit them all.
  */
 
 #include <limits.h>
@@ -110,51 +121,92 @@ static inline unsigned long deadline(struct dcb *dcb)
     return dcb->release_time + dcb->deadline;
 }
 
+static inline struct dcb *queue_dcb(struct pheap_node *n)
+{
+    return n ? (struct dcb *)((char *)n - offsetof(struct dcb, sched_node)) : NULL;
+}
+
+/// Order of released tasks (this is doing EDF)
+static bool ready_less(struct pheap_node *a, struct pheap_node *b)
+{
+    struct dcb *x = queue_dcb(a), *y = queue_dcb(b);
+    if(x->sched_deadline != y->sched_deadline) {
+        return x->sched_deadline < y->sched_deadline;
+    }
+    return x->sched_seq < y->sched_seq;
+}
+
+/// Order of tasks released in the future
+static bool pending_less(struct pheap_node *a, struct pheap_node *b)
+{
+    struct dcb *x = queue_dcb(a), *y = queue_dcb(b);
+    if(x->release_time != y->release_time) {
+        return x->release_time < y->release_time;
+    }
+    return x->sched_seq < y->sched_seq;
+}
+
 static void queue_insert(struct dcb *dcb)
 {
-    // Empty queue case
-    if(kcb_current->queue_head == NULL) {
-        assert(kcb_current->queue_tail == NULL);
-        kcb_current->queue_head = kcb_current->queue_tail = queue_tail = dcb;
-        return;
+    struct kcb *k = kcb_current;
+
+    // Append to the list of all tasks in the queue
+    dcb->next = NULL;
+    dcb->prev = k->queue_tail;
+    if(k->queue_tail == NULL) {
+        assert(k->queue_head == NULL);
+        k->queue_head = dcb;
+    } else {
+        k->queue_tail->next = dcb;
     }
+    k->queue_tail = queue_tail = dcb;
 
     /* Insert into priority queue (this is doing EDF). We insert at
      * the tail of a train of tasks with equal deadlines, as well as
-     * equal release times for best-effort tasks, so that trains of
-     * best-effort tasks with equal deadlines (and those released at
-     * the same time) get scheduled in a round-robin fashion. The
-     * release time equality check is important, as best-effort tasks
-     * have lazily allocated deadlines. In some circumstances (like
-     * when another task blocks), this might otherwise cause a wrong
-     * yielding behavior when old deadlines are encountered.
+     * behind all released tasks for best-effort tasks, so that trains
+     * of best-effort tasks with equal deadlines (and those released at
+     * the same time) get scheduled in a round-robin fashion. Queueing
+     * best-effort tasks behind the released ones is important, as
+     * best-effort tasks have lazily allocated deadlines. In some
+     * circumstances (like when another task blocks), this might
+     * otherwise cause a wrong yielding behavior when old deadlines are
+     * encountered.
      */
-    struct dcb *prev = NULL;
-    for(struct dcb *i = kcb_current->queue_head; i != NULL; prev = i, i = i->next) {
-        // Skip over equal, smaller release times if best-effort
-        if(dcb->type == TASK_TYPE_BEST_EFFORT &&
-           dcb->release_time >= i->release_time) {
-            continue;
+    dcb->sched_deadline = deadline(dcb);
+    dcb->sched_seq = k->queue_seq++;
+    dcb->sched_released = dcb->release_time <= kernel_now;
+    if(dcb->sched_released) {
+        if(k->queue_ready == NULL) {
+            k->queue_ready_max = 0;
         }
-
-        // Skip over equal deadlines
-        if(deadline(dcb) >= deadline(i)) {
-            continue;
+        if(dcb->type == TASK_TYPE_BEST_EFFORT) {
+            dcb->sched_deadline = MAX(dcb->sched_deadline, k->queue_ready_max);
         }
+        k->queue_ready_max = MAX(dcb->sched_deadline, k->queue_ready_max);
+        pheap_insert(&k->queue_ready, &dcb->sched_node, ready_less);
+    } else {
+        pheap_insert(&k->queue_pending, &dcb->sched_node, pending_less);
+    }
+}
 
-        dcb->next = i;
-        if(prev == NULL) {      // Insert before head
-            kcb_current->queue_head = dcb;
-        } else {                // Insert inside queue
-            prev->next = dcb;
+/**
+ * \brief Move all tasks released by now to the ready queue.
+ */
+static void queue_release(void)
+{
+    struct kcb *k = kcb_current;
+    struct dcb *dcb;
+
+    while((dcb = queue_dcb(k->queue_pending)) != NULL
+          && dcb->release_time <= kernel_now) {
+        pheap_remove(&k->queue_pending, &dcb->sched_node, pending_less);
+        dcb->sched_released = true;
+        if(k->queue_ready == NULL) {
+            k->queue_ready_max = 0;
         }
-
-        return;
+        k->queue_ready_max = MAX(dcb->sched_deadline, k->queue_ready_max);
+        pheap_insert(&k->queue_ready, &dcb->sched_node, ready_less);
     }
-
-    // Insert after queue tail
-    kcb_current->queue_tail->next = dcb;
-    kcb_current->queue_tail = queue_tail = dcb;
 }
 
 /**
@@ -173,27 +225,27 @@ static void queue_remove(struct dcb *dcb)
         return;
     }
 
-    if(dcb == kcb_current->queue_head) {
-        kcb_current->queue_head = dcb->next;
-        if(kcb_current->queue_head == NULL) {
-            kcb_current->queue_tail = queue_tail =  NULL;
-        }
+    struct kcb *k = kcb_current;
 
-        goto out;
+    if(dcb->prev == NULL) {
+        assert(k->queue_head == dcb);
+        k->queue_head = dcb->next;
+    } else {
+        dcb->prev->next = dcb->next;
     }
-
-    for(struct dcb *i = kcb_current->queue_head; i != NULL; i = i->next) {
-        if(i->next == dcb) {
-            i->next = i->next->next;
-            if(kcb_current->queue_tail == dcb) {
-                kcb_current->queue_tail = queue_tail = i;
-            }
-            break;
-        }
+    if(dcb->next == NULL) {
+        assert(k->queue_tail == dcb);
+        k->queue_tail = queue_tail = dcb->prev;
+    } else {
+        dcb->next->prev = dcb->prev;
     }
+    dcb->next = dcb->prev = NULL;
 
- out:
-    dcb->next = NULL;
+    if(dcb->sched_released) {
+        pheap_remove(&k->queue_ready, &dcb->sched_node, ready_less);
+    } else {
+        pheap_remove(&k->queue_pending, &dcb->sched_node, pending_less);
+    }
 }
 
 #if 0
@@ -314,31 +366,10 @@ struct dcb *schedule(void)
     }
 
  start_over:
-    todisp = kcb_current->queue_head;
-
-#ifndef SCHEDULER_SIMULATOR
-#define PRINT_NAME(d) \
-    do { \
-        if (!(d) || !(d)->disp) { \
-            debug(SUBSYS_DISPATCH, "todisp == NULL\n"); \
-            break; \
-        } \
-        struct dispatcher_shared_generic *dst = \
-            get_dispatcher_shared_generic(d->disp); \
-        debug(SUBSYS_DISPATCH, "looking at '%s', release_time=%lu, kernel_now=%zu\n", \
-                dst->name, d->release_time, kernel_now); \
-    }while(0)
-#else
-#define PRINT_NAME(d) do{}while(0)
-#endif
-
-    // Skip over all tasks released in the future, they're technically not
-    // in the schedule yet. We just have them to reduce book-keeping.
-    while(todisp != NULL && todisp->release_time > kernel_now) {
-        PRINT_NAME(todisp);
-        todisp = todisp->next;
-    }
-#undef PRINT_NAME
+    // Tasks released in the future are technically not in the schedule
+    // yet. We just have them to reduce book-keeping.
+    queue_release();
+    todisp = queue_dcb(kcb_current->queue_ready);
 
     // nothing to dispatch
     if(todisp == NULL) {
@@ -351,14 +382,39 @@ struct dcb *schedule(void)
 
     // Lazy resource allocation for best-effort processes
     if(todisp->type == TASK_TYPE_BEST_EFFORT) {
+        unsigned long old_deadline = deadline(todisp);
         set_best_effort_wcet(todisp);
 
+        // Re-sort if the number of best-effort tasks changed our deadline
+        if(deadline(todisp) != old_deadline) {
+            pheap_remove(&kcb_current->queue_ready, &todisp->sched_node, ready_less);
+            todisp->sched_deadline = deadline(todisp);
+            pheap_insert(&kcb_current->queue_ready, &todisp->sched_node, ready_less);
+            if(queue_dcb(kcb_current->queue_ready) != todisp) {
+                goto start_over;
+            }
+        }
+
         /* We might've shortened the deadline into the past (eg. when
          * another BE task was removed while we already ran well into
          * our timeslice). In that case we need to re-release.
          */
         if(deadline(todisp) < kernel_now) {
             todisp->release_time = kernel_now;
+
+            /* We stay at the head of the queue, but tasks released from
+             * now on have to see our new deadline.
+             */
+            pheap_remove(&kcb_current->queue_ready, &todisp->sched_node, ready_less);
+            struct dcb *next = queue_dcb(kcb_current->queue_ready);
+            todisp->sched_deadline = deadline(todisp);
+            if(next != NULL && next->sched_deadline < todisp->sched_deadline) {
+                todisp->sched_deadline = next->sched_deadline;
+            }
+            pheap_insert(&kcb_current->queue_ready, &todisp->sched_node, ready_less);
+            if(queue_dcb(kcb_current->queue_ready) != todisp) {
+                goto start_over;
+            }
         }
     }
 
@@ -560,6 +616,17 @@ void scheduler_yield(struct dcb *dcb)
     queue_insert(dcb);
 }
 
+/**
+ * \brief Returns the best-effort load of this core.
+ *
+ * The load is the number of runnable best-effort dispatchers. Real-time
+ * dispatchers have their reservation and are not counted.
+ */
+unsigned int scheduler_get_load(void)
+{
+    return kcb_current->n_be;
+}
+
 #ifndef SCHEDULER_SIMULATOR
 void scheduler_reset_time(void)
 {
@@ -570,10 +637,15 @@ void scheduler_reset_time(void)
     struct kcb *k = kcb_current;
     do {
         printk(LOG_NOTE, "clearing kcb %p\n", k);
+        k->queue_ready = k->queue_pending = NULL;
         for(struct dcb *i = k->queue_head; i != NULL; i = i->next) {
             i->release_time = 0;
             i->etime = 0;
             i->last_dispatch = 0;
+            // re-sort by the new deadlines, in the old order for ties
+            i->sched_deadline = deadline(i);
+            i->sched_released = true;
+            pheap_insert(&k->queue_ready, &i->sched_node, ready_less);
         }
         k = k->next;
     }while(k && k!=kcb_current);
@@ -594,6 +666,8 @@ void scheduler_convert(void)
             // initialize RBED fields
             // make all tasks best effort
             struct dcb *tmp = NULL;
+            kcb_current->queue_head = kcb_current->queue_tail = queue_tail = NULL;
+            kcb_current->queue_ready = kcb_current->queue_pending = NULL;
             printf("kcb_current: %p\n", kcb_current);
             printf("kcb_current->ring_current: %p\n", kcb_current->ring_current);
             printf("kcb_current->ring_current->prev: %p\n", kcb_current->ring_current->prev);
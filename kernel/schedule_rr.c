@@ -117,6 +117,22 @@ void scheduler_yield(struct dcb *dcb)
     // No-op for the round-robin scheduler
 }
 
+/**
+ * \brief Returns the load of this core, the number of dispatchers in the ring.
+ */
+unsigned int scheduler_get_load(void)
+{
+    unsigned int load = 0;
+    struct dcb *i = kcb_current->ring_current;
+    if (i != NULL) {
+        do {
+            load++;
+            i = i->next;
+        } while (i != kcb_current->ring_current);
+    }
+    return load;
+}
+
 void scheduler_reset_time(void)
 {
     // No-Op in RR scheduler
@@ -628,6 +628,14 @@ struct sysret sys_kernel_suspend_kcb_sched(bool suspend)
     return SYSRET(SYS_ERR_OK);
 }
 
+struct sysret sys_kernel_get_sched_load(void)
+{
+    return (struct sysret) {
+        .error = SYS_ERR_OK,
+        .value = scheduler_get_load(),
+    };
+}
+
 struct sysret sys_handle_kcb_identify(struct capability* to)
 {
     // Return with physical base address of frame
@@ -1,6 +1,11 @@
 /**
  * \file
  * \brief DCB wakeup queue management
+ *
+ * The dcbs waiting for a wakeup are kept in a pairing heap ordered by
+ * wakeup time, so that the next wakeup is found in constant time and
+ * setting or cancelling a wakeup is logarithmic in the number of waiting
+ * dcbs.
  */
 
 /*
@@ -14,44 +19,50 @@
 
 #include <kernel.h>
 #include <dispatch.h>
-#include <kcb.h> // kcb_current->wakeup_queue_head
+#include <kcb.h> // kcb_current->wakeup_queue
 #include <timer.h> // update_wakeup_timer()
 #include <wakeup.h>
 
-/* wrapper to change the head, and update the next wakeup tick */
-void wakeup_set_queue_head(struct dcb *h)
+static inline struct dcb *wakeup_dcb(struct pheap_node *n)
+{
+    return n ? (struct dcb *)((char *)n - offsetof(struct dcb, wakeup_node)) : NULL;
+}
+
+static bool wakeup_less(struct pheap_node *a, struct pheap_node *b)
+{
+    struct dcb *x = wakeup_dcb(a), *y = wakeup_dcb(b);
+    if (x->wakeup_time != y->wakeup_time) {
+        return x->wakeup_time < y->wakeup_time;
+    }
+    // wake up dispatchers with equal times in a fixed order
+    return x < y;
+}
+
+/// Set the timer for the first dcb in the wakeup queue
+void wakeup_restore(void)
 {
-    kcb_current->wakeup_queue_head = h;
     #ifdef CONFIG_ONESHOT_TIMER
-    // we changed the first dcb in the wakeup queue, which means
+    // the first dcb in the wakeup queue may have changed, which means
     // that we need to update the next tick value
+    struct dcb *h = wakeup_dcb(kcb_current->wakeup_queue);
     systime_t next_wakeup = h ? h->wakeup_time : TIMER_INF;
     update_wakeup_timer(next_wakeup);
     #endif
 }
-static inline void set_queue_head(struct dcb *h)
-{
-    wakeup_set_queue_head(h);
-}
 
 void wakeup_remove(struct dcb *dcb)
 {
+    // No-Op if not in queue...
     if (dcb->wakeup_time != 0) {
-        if (dcb->wakeup_prev == NULL) {
-            assert(kcb_current->wakeup_queue_head == dcb);
-            set_queue_head(dcb->wakeup_next);
-        } else {
-            assert(dcb->wakeup_prev->wakeup_next == dcb);
-            dcb->wakeup_prev->wakeup_next = dcb->wakeup_next;
-        }
-        if (dcb->wakeup_next != NULL) {
-            assert(dcb->wakeup_next->wakeup_prev == dcb);
-            dcb->wakeup_next->wakeup_prev = dcb->wakeup_prev;
+        struct pheap_node *head = kcb_current->wakeup_queue;
+
+        assert(pheap_contains(head, &dcb->wakeup_node));
+        pheap_remove(&kcb_current->wakeup_queue, &dcb->wakeup_node, wakeup_less);
+        dcb->wakeup_time = 0;
+        if (head == &dcb->wakeup_node) {
+            wakeup_restore();
         }
-        dcb->wakeup_prev = dcb->wakeup_next = NULL;
     }
-
-    // No-Op if not in queue...
 }
 
 /// Set the wakeup time for the given DCB
@@ -64,47 +75,44 @@ void wakeup_set(struct dcb *dcb, systime_t waketime)
     wakeup_remove(dcb);
 
     dcb->wakeup_time = waketime;
-
-    for (struct dcb *d = kcb_current->wakeup_queue_head, *p = NULL; ; p = d, d = d->wakeup_next) {
-        if (d == NULL || d->wakeup_time > waketime) {
-            if (p == NULL) { // insert at head
-                assert(d == kcb_current->wakeup_queue_head);
-                dcb->wakeup_prev = NULL;
-                dcb->wakeup_next = d;
-                if (d != NULL) {
-                    d->wakeup_prev = dcb;
-                }
-                set_queue_head(dcb);
-            } else {
-                dcb->wakeup_next = d;
-                dcb->wakeup_prev = p;
-                p->wakeup_next = dcb;
-                if (d != NULL) {
-                    d->wakeup_prev = dcb;
-                }
-            }
-            break;
-        }
+    pheap_insert(&kcb_current->wakeup_queue, &dcb->wakeup_node, wakeup_less);
+    if (kcb_current->wakeup_queue == &dcb->wakeup_node) {
+        wakeup_restore();
     }
 }
 
 /// Check for wakeups, given the current time
 void wakeup_check(systime_t now)
 {
-    struct dcb *d = kcb_current->wakeup_queue_head, *next = NULL;
-    for (; d != NULL && d->wakeup_time <= now; d = next) {
-        next = d->wakeup_next;
+    struct dcb *d;
+    bool woken = false;
+
+    while ((d = wakeup_dcb(kcb_current->wakeup_queue)) != NULL
+           && d->wakeup_time <= now) {
+        pheap_remove(&kcb_current->wakeup_queue, &d->wakeup_node, wakeup_less);
         d->wakeup_time = 0;
-        d->wakeup_prev = d->wakeup_next = NULL;
         make_runnable(d);
+        woken = true;
+    }
+    if (woken) {
+        wakeup_restore();
     }
-    if (d != NULL) {
-        d->wakeup_prev = NULL;
+}
+
+/**
+ * \brief Walk all dcbs in the wakeup queue, in no particular order
+ *
+ * Returns the first dcb for prev == NULL, NULL after the last dcb.
+ */
+struct dcb *wakeup_walk(struct kcb *kcb, struct dcb *prev)
+{
+    if (prev == NULL) {
+        return wakeup_dcb(kcb->wakeup_queue);
     }
-    set_queue_head(d);
+    return wakeup_dcb(pheap_walk_next(&prev->wakeup_node));
 }
 
 bool wakeup_is_pending(void)
 {
-    return kcb_current->wakeup_queue_head != NULL;
+    return kcb_current->wakeup_queue != NULL;
 }
@@ -58,6 +58,7 @@
 #include <barrelfish/caddr.h>
 #include <barrelfish/invocations_arch.h>
 #include <stdio.h>
+#include "vspace/vspace_internal.h"
 
 // Location of VSpace managed by this system.
 #ifdef __ARM_ARCH_7M__
@@ -1362,7 +1363,10 @@ errval_t pmap_current_init(bool init_domain)
 
     struct vspace *vspace = pmap_arm->p.vspace;
     assert(!vspace->head);
-    vspace->head = vregion;
+    errval_t err = vspace_add_vregion(vspace, vregion);
+    if (err_is_fail(err)) {
+        return err;
+    }
 
     pmap_arm->vregion_offset = pmap_arm->vregion.base;
 
@@ -850,16 +850,16 @@ static errval_t domain_wakeup_on_coreid_disabled(coreid_t core_id,
 {
     struct domain_state *ds = get_domain_state();
 
-    // XXX: Ugly hack to allow waking up on a core id we don't have a
-    // dispatcher handler for
-    thread->coreid = core_id;
-
     // Catch this early
     assert_disabled(ds != NULL);
     if (ds->b[core_id] == NULL) {
         return LIB_ERR_NO_SPANNED_DISP;
     }
 
+    // XXX: Ugly hack to allow waking up on a core id we don't have a
+    // dispatcher handler for
+    thread->coreid = core_id;
+
     thread_enqueue(thread, &ds->remote_wakeup_queue);
 
     // Signal the inter-disp waitset of this event
@@ -916,17 +916,28 @@ errval_t domain_thread_move_to(struct thread *thread, coreid_t core_id)
         return err;
     }
 
-    // run the next thread, if any
+#ifdef FPU_LAZY_CONTEXT_SWITCH
+    // The FPU state stays behind. We are called like any other function,
+    // so the ABI doesn't preserve the FPU registers anyway.
+    if(disp_gen->fpu_thread == thread) {
+        disp_gen->fpu_thread = NULL;
+        fpu_trap_on();
+    }
+#endif
+
+    // Save our state and run the next thread, if any. The wakeup on the
+    // other core is only sent by the inter-disp thread, after we are gone.
     if (next != thread) {
         disp_gen->current = next;
-        disp_resume(mydisp, &next->regs);
+        disp_switch(mydisp, &thread->regs, &next->regs);
     } else {
         disp_gen->current = NULL;
         disp->haswork = havework_disabled(mydisp);
-        disp_yield_disabled(mydisp);
+        disp_save(mydisp, &thread->regs, true, CPTR_NULL);
     }
 
-    USER_PANIC("should never be reached");
+    // Continuing on the new core
+    return SYS_ERR_OK;
 }
 
 errval_t domain_thread_create_on_varstack(coreid_t core_id,
@@ -22,6 +22,16 @@
                         + (1<<(VNODE_CACHE_REFILL_BITS+1)) \
                         + (1<<(VNODE_CACHE_REFILL_BITS+2)))
 
+/// Number of children at which a page table gets a dense child index
+#define VNODE_INDEX_THRESHOLD   16
+
+/// Size of a dense child index
+#define VNODE_INDEX_SIZE        (PTABLE_SIZE * sizeof(struct vnode *))
+
+/// Base pages added to the index slab allocator by one refill. The slab
+/// header takes space too, so a refill yields one index less than pages.
+#define VNODE_INDEX_REFILL_PAGES 4
+
 struct pmap;
 
 errval_t pmap_x86_serialise(struct pmap *pmap, void *buf, size_t buflen);
@@ -48,6 +58,15 @@ struct vnode *find_vnode(struct vnode *root, uint16_t entry);
  */
 bool inside_region(struct vnode *root, uint32_t entry, uint32_t npages);
 
+/**
+ * \brief insert vnode `item` into the children of `root`. Creates the child
+ * index of `root` once it has VNODE_INDEX_THRESHOLD children, if `pmap`'s
+ * index slab allocator has a free block. Otherwise sets `pmap->index_wanted`
+ * so that the next map() refills the allocator.
+ */
+void insert_vnode(struct pmap_x86 *pmap, struct vnode *root,
+                  struct vnode *item);
+
 /**
  * \brief remove vnode `item` from list of children of `root`.
  */
@@ -55,6 +55,8 @@ struct thread {
     exception_handler_fn exception_handler; ///< Exception handler, or NULL
     void                *userptr;           ///< User's thread local pointer
     void                *userptrs[MAX_TLS]; ///< User's thread local pointers
+    void                *malloc_cache;      ///< Thread cache of malloc, or NULL
+    thread_malloc_cache_release_fn malloc_cache_release; ///< Frees malloc_cache
     uintptr_t           yield_epoch;        ///< Yield epoch
     void                *wakeup_reason;     ///< Value returned from block()
     coreid_t            coreid;             ///< XXX: Core ID affinity
@@ -149,7 +149,8 @@ errval_t trace_my_setup(void)
 
 static bool request_done = false;
 
-static bool parse_argv(struct spawn_domain_params *params, size_t *morecore_alignment)
+static bool parse_argv(struct spawn_domain_params *params, size_t *morecore_alignment,
+                       bool *morecore_promote)
 {
     assert(params);
     // grab pagesize config from argv if available
@@ -158,7 +159,14 @@ static bool parse_argv(struct spawn_domain_params *params, size_t *morecore_alig
     bool found = false;
     for (; i < params->argc; i++) {
         if (!found) {
-            if (!strncmp(params->argv[i], "morecore=", 9)) {
+            if (!strcmp(params->argv[i], "morecore=promote")) {
+                // base pages, transparently replaced by large pages
+                if (morecore_promote) {
+                    *morecore_promote = true;
+                }
+                morecore_pagesize = BASE_PAGE_SIZE;
+                found = true;
+            } else if (!strncmp(params->argv[i], "morecore=", 9)) {
                 morecore_pagesize = strtol(params->argv[i]+9, NULL, 0);
                 // check for valid page size
                 switch (morecore_pagesize) {
@@ -246,6 +254,7 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
     } else {
         /* if there is a pagesize supplied, use this one */
         size_t morecore_pagesize = 0;
+        bool morecore_promote = false;
         if (params != NULL && params->pagesize) {
             morecore_pagesize =  params->pagesize;
 
@@ -256,12 +265,17 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
                    || morecore_pagesize == LARGE_PAGE_SIZE );
 
         } else {
-            parse_argv(params, &morecore_pagesize);
+            parse_argv(params, &morecore_pagesize, &morecore_promote);
 #if defined(__i386__) && !defined(CONFIG_PSE)
             morecore_pagesize = BASE_PAGE_SIZE;
+            morecore_promote = false;
 #endif
         }
-        err = morecore_init(morecore_pagesize);
+        if (morecore_promote) {
+            err = morecore_init_promote();
+        } else {
+            err = morecore_init(morecore_pagesize);
+        }
     }
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_MORECORE_INIT);
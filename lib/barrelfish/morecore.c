@@ -126,6 +126,52 @@ errval_t morecore_init(size_t alignment)
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Initialise morecore with transparent large pages
+ *
+ * The heap is faulted in with large pages where possible. Base pages that
+ * had to be used instead can be promoted later with morecore_promote().
+ */
+errval_t morecore_init_promote(void)
+{
+    errval_t err;
+    struct morecore_state *state = get_morecore_state();
+
+    thread_mutex_init(&state->mutex);
+
+    err = vspace_mmu_aware_init_promote(&state->mmu_state, NULL, HEAP_REGION,
+                                        VREGION_FLAGS_READ_WRITE);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_MMU_AWARE_INIT);
+    }
+
+    sys_morecore_alloc = morecore_alloc;
+    sys_morecore_free = morecore_free;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Promote base pages of the heap to large pages
+ *
+ * Only has an effect if morecore was set up with morecore_init_promote().
+ * The heap must not be written by other threads during the call, so this
+ * is meant to be called from a quiescent point of the program, e.g.
+ * periodically from its event loop.
+ *
+ * \param ret_count  If non-NULL, returns the number of promoted large pages
+ */
+errval_t morecore_promote(size_t *ret_count)
+{
+    struct morecore_state *state = get_morecore_state();
+
+    thread_mutex_lock(&state->mutex);
+    errval_t err = vspace_mmu_aware_promote(&state->mmu_state, ret_count);
+    thread_mutex_unlock(&state->mutex);
+
+    return err;
+}
+
 errval_t morecore_reinit(void)
 {
     errval_t err;
@@ -18,9 +18,9 @@
 #include <if/monitor_defs.h>
 #include <if/mem_rpcclient_defs.h>
 
-/* remote (indirect through a channel) version of ram_alloc, for most domains */
-static errval_t ram_alloc_remote(struct capref *ret, uint8_t size_bits,
-                                 uint64_t minbase, uint64_t maxlimit)
+/* allocate a single RAM cap from mem_serv */
+static errval_t ram_alloc_rpc(struct capref *ret, uint8_t size_bits,
+                              uint64_t minbase, uint64_t maxlimit)
 {
     struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
     errval_t err, result;
@@ -73,6 +73,142 @@ static errval_t ram_alloc_remote(struct capref *ret, uint8_t size_bits,
     return result;
 }
 
+/// Number of slots in the CNode of the RAM cache
+#define RAM_CACHE_CNODE_BITS    log2ceil(RAM_CACHE_CLASSES * RAM_CACHE_BATCH)
+
+/**
+ * \brief Refill a size class of the RAM cache
+ *
+ * Gets one RAM cap of RAM_CACHE_BATCH times the size of the class from
+ * mem_serv and retypes it into the slots of the class. Must be called with
+ * the cache lock held and the class empty.
+ */
+static errval_t ram_cache_refill(struct ram_alloc_state *state, int class)
+{
+    errval_t err;
+    struct capref ram;
+    uint8_t size_bits = RAM_CACHE_MIN_BITS + class;
+
+    assert(state->ram_cache[class].next == state->ram_cache[class].count);
+
+    // the cached caps are kept in a CNode of their own
+    if (capref_is_null(state->ram_cache_cnode_cap)) {
+        struct capref cnode_cap;
+        err = slot_alloc(&cnode_cap);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_SLOT_ALLOC);
+        }
+        err = ram_alloc_rpc(&ram, RAM_CACHE_CNODE_BITS + OBJBITS_CTE, 0, 0);
+        if (err_is_fail(err)) {
+            slot_free(cnode_cap);
+            return err_push(err, LIB_ERR_RAM_ALLOC);
+        }
+        err = cnode_create_from_mem(cnode_cap, ram, &state->ram_cache_cnode,
+                                    RAM_CACHE_CNODE_BITS);
+        if (err_is_fail(err)) {
+            cap_destroy(ram);
+            slot_free(cnode_cap);
+            return err_push(err, LIB_ERR_CNODE_CREATE_FROM_MEM);
+        }
+        err = cap_destroy(ram);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_CAP_DESTROY);
+        }
+        state->ram_cache_cnode_cap = cnode_cap;
+    }
+
+    err = ram_alloc_rpc(&ram, size_bits + RAM_CACHE_REFILL_BITS, 0, 0);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct capref dest = {
+        .cnode = state->ram_cache_cnode,
+        .slot  = class * RAM_CACHE_BATCH,
+    };
+    err = cap_retype(dest, ram, ObjType_RAM, size_bits);
+    if (err_is_fail(err)) {
+        cap_destroy(ram);
+        return err_push(err, LIB_ERR_CAP_RETYPE);
+    }
+    err = cap_destroy(ram);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_CAP_DESTROY);
+    }
+
+    state->ram_cache[class].next = 0;
+    state->ram_cache[class].count = RAM_CACHE_BATCH;
+    return SYS_ERR_OK;
+}
+
+/* allocate a RAM cap from the cache of this core */
+static errval_t ram_alloc_cached(struct capref *ret, uint8_t size_bits)
+{
+    struct ram_alloc_state *state = get_ram_alloc_state();
+    int class = size_bits - RAM_CACHE_MIN_BITS;
+    struct ram_cache *cache = &state->ram_cache[class];
+    errval_t err;
+
+    // allocating the slot may need RAM itself, do it before locking
+    err = slot_alloc(ret);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+
+    thread_mutex_lock(&state->ram_cache_lock);
+    // allocations while refilling bypass the cache
+    state->ram_cache_owner = thread_self();
+
+    if (cache->next == cache->count) {
+        err = ram_cache_refill(state, class);
+        if (err_is_fail(err)) {
+            state->ram_cache_owner = NULL;
+            thread_mutex_unlock(&state->ram_cache_lock);
+            // mem_serv may still have a single cap of the size
+            slot_free(*ret);
+            return ram_alloc_rpc(ret, size_bits, 0, 0);
+        }
+    }
+
+    // move the cap out of the cache CNode, so that its slot can be freed
+    struct capref src = {
+        .cnode = state->ram_cache_cnode,
+        .slot  = class * RAM_CACHE_BATCH + cache->next,
+    };
+    err = cap_copy(*ret, src);
+    if (err_is_ok(err)) {
+        cache->next++;
+        err = cap_delete(src);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_CAP_DELETE);
+        }
+    } else {
+        err = err_push(err, LIB_ERR_CAP_COPY);
+    }
+
+    state->ram_cache_owner = NULL;
+    thread_mutex_unlock(&state->ram_cache_lock);
+
+    if (err_is_fail(err)) {
+        slot_free(*ret);
+    }
+    return err;
+}
+
+/* remote (indirect through a channel) version of ram_alloc, for most domains */
+static errval_t ram_alloc_remote(struct capref *ret, uint8_t size_bits,
+                                 uint64_t minbase, uint64_t maxlimit)
+{
+    struct ram_alloc_state *state = get_ram_alloc_state();
+
+    if (minbase == 0 && maxlimit == 0 && size_bits >= RAM_CACHE_MIN_BITS
+        && size_bits < RAM_CACHE_MIN_BITS + RAM_CACHE_CLASSES
+        && state->ram_cache_owner != thread_self()) {
+        return ram_alloc_cached(ret, size_bits);
+    }
+    return ram_alloc_rpc(ret, size_bits, minbase, maxlimit);
+}
+
 
 void ram_set_affinity(uint64_t minbase, uint64_t maxlimit)
 {
@@ -199,6 +335,13 @@ void ram_alloc_init(void)
     ram_alloc_state->default_minbase  = 0;
     ram_alloc_state->default_maxlimit = 0;
     ram_alloc_state->base_capnum      = 0;
+    thread_mutex_init(&ram_alloc_state->ram_cache_lock);
+    ram_alloc_state->ram_cache_owner  = NULL;
+    ram_alloc_state->ram_cache_cnode_cap = NULL_CAP;
+    for (int i = 0; i < RAM_CACHE_CLASSES; i++) {
+        ram_alloc_state->ram_cache[i].next  = 0;
+        ram_alloc_state->ram_cache[i].count = 0;
+    }
 }
 
 /**
@@ -16,8 +16,21 @@
 #include <barrelfish/resource_ctrl.h>
 #include <barrelfish/curdispatcher_arch.h>
 #include <barrelfish/dispatcher_arch.h>
+#include <if/monitor_defs.h>
 #include <if/monitor_blocking_rpcclient_defs.h>
 
+/// Pending load balancing hint of every dispatcher of this domain
+static struct {
+    bool pending;
+    coreid_t dest;
+} balance_hint[MAX_COREID + 1];
+
+// private state for queuing on monitor send
+struct balance_join_send_state {
+    struct event_queue_node qnode;
+    struct monitor_binding *mb;
+};
+
 errval_t rsrc_manifest(const char *manifest, rsrcid_t *id)
 {
     struct monitor_blocking_rpc_client *b = get_monitor_blocking_rpc_client();
@@ -47,3 +60,102 @@ errval_t rsrc_phase(rsrcid_t id, uint32_t phase)
     struct monitor_blocking_rpc_client *b = get_monitor_blocking_rpc_client();
     return b->vtbl.rsrc_phase(b, id, phase);
 }
+
+/**
+ * \brief Sets the load balancing policy of all cores
+ *
+ * \param period_ms Balancing period in ms, 0 disables balancing
+ * \param threshold Load difference between two cores that counts as imbalance
+ * \param hold      Number of consecutive imbalanced periods before a core
+ *                  hands off a thread
+ */
+errval_t rsrc_balance_policy(uint32_t period_ms, uint32_t threshold,
+                             uint32_t hold)
+{
+    struct monitor_blocking_rpc_client *b = get_monitor_blocking_rpc_client();
+    errval_t err, msgerr;
+
+    err = b->vtbl.rsrc_balance(b, period_ms, threshold, hold, &msgerr);
+    assert(err_is_ok(err));
+
+    return msgerr;
+}
+
+static void rsrc_balance_hint_handler(struct monitor_binding *b, coreid_t dest)
+{
+    dispatcher_handle_t handle = disp_disable();
+    coreid_t core_id = disp_handle_get_core_id(handle);
+    balance_hint[core_id].pending = true;
+    balance_hint[core_id].dest = dest;
+    disp_enable(handle);
+}
+
+static void rsrc_balance_join_sender(void *arg)
+{
+    struct balance_join_send_state *st = arg;
+    struct monitor_binding *mb = st->mb;
+
+    errval_t err = mb->tx_vtbl.rsrc_balance_join(mb, NOP_CONT);
+    if (err_is_ok(err)) {
+        free(st);
+        event_mutex_unlock(&mb->mutex);
+    } else if (err_no(err) == FLOUNDER_ERR_TX_BUSY) {
+        err = mb->register_send(mb, mb->waitset,
+                                MKCONT(rsrc_balance_join_sender, st));
+        assert(err_is_ok(err)); // shouldn't fail, as we have the mutex
+    } else { // permanent error
+        free(st);
+        event_mutex_unlock(&mb->mutex);
+        DEBUG_ERR(err, "rsrc_balance_join");
+    }
+}
+
+/**
+ * \brief Offers the threads of this dispatcher for load balancing
+ *
+ * The local monitor may then hint the dispatcher to move a thread to a less
+ * loaded core. Threads follow the hint in rsrc_balance_point(). Every
+ * dispatcher of a spanned domain that wants to take part calls this.
+ */
+errval_t rsrc_balance_join(void)
+{
+    struct monitor_binding *mb = get_monitor_binding();
+    mb->rx_vtbl.rsrc_balance_hint = rsrc_balance_hint_handler;
+
+    struct balance_join_send_state *st =
+        malloc(sizeof(struct balance_join_send_state));
+    if (st == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    st->mb = mb;
+
+    // wait for the ability to use the monitor binding
+    event_mutex_enqueue_lock(&mb->mutex, &st->qnode,
+                             MKCLOSURE(rsrc_balance_join_sender, st));
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Follows a pending load balancing hint for the current core
+ *
+ * Moves the calling thread to the core the monitor suggested, if the domain
+ * is spanned to it. Threads call this at points where they may continue on
+ * another core. A hint is taken by at most one thread.
+ *
+ * \return true if the thread moved
+ */
+bool rsrc_balance_point(void)
+{
+    dispatcher_handle_t handle = disp_disable();
+    coreid_t core_id = disp_handle_get_core_id(handle);
+    bool pending = balance_hint[core_id].pending;
+    coreid_t dest = balance_hint[core_id].dest;
+    balance_hint[core_id].pending = false;
+    disp_enable(handle);
+
+    if (!pending || dest == core_id) {
+        return false;
+    }
+
+    return err_is_ok(domain_thread_move_to(thread_self(), dest));
+}
@@ -25,6 +25,135 @@ struct block_head {
 
 STATIC_ASSERT_SIZEOF(struct block_head, SLAB_BLOCK_HDRSIZE);
 
+/*
+ * Slabs are kept on one of three lists depending on their number of free
+ * blocks, so allocation takes the first partial (or empty) slab in constant
+ * time. To find the slab of a freed block, all slabs are also kept in a
+ * splay tree ordered by address. Frees tend to hit the same few slabs, which
+ * the splay tree keeps close to the root.
+ */
+
+static inline struct slab_head **slab_list(struct slab_allocator *slabs,
+                                           struct slab_head *sh)
+{
+    if (sh->free == 0) {
+        return &slabs->full;
+    } else if (sh->free == sh->total) {
+        return &slabs->empty;
+    } else {
+        return &slabs->partial;
+    }
+}
+
+static void slab_list_insert(struct slab_head **list, struct slab_head *sh)
+{
+    sh->prev = NULL;
+    sh->next = *list;
+    if (sh->next != NULL) {
+        sh->next->prev = sh;
+    }
+    *list = sh;
+}
+
+static void slab_list_remove(struct slab_head **list, struct slab_head *sh)
+{
+    if (sh->prev != NULL) {
+        sh->prev->next = sh->next;
+    } else {
+        assert(*list == sh);
+        *list = sh->next;
+    }
+    if (sh->next != NULL) {
+        sh->next->prev = sh->prev;
+    }
+}
+
+/// Compares an address with the memory range covered by a slab
+static inline int slab_cmp(struct slab_allocator *slabs, uintptr_t addr,
+                           struct slab_head *sh)
+{
+    uintptr_t base = (uintptr_t)sh;
+    uintptr_t limit = base + sizeof(struct slab_head)
+                      + slabs->blocksize * sh->total;
+    if (addr < base) {
+        return -1;
+    } else if (addr >= limit) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ * \brief Top-down splay of the slab tree
+ *
+ * Returns the new root, which is the slab containing addr if there is one,
+ * or else a slab neighbouring addr.
+ */
+static struct slab_head *slab_splay(struct slab_allocator *slabs,
+                                    struct slab_head *t, uintptr_t addr)
+{
+    struct slab_head n, *l, *r, *y;
+
+    if (t == NULL) {
+        return NULL;
+    }
+
+    n.left = n.right = NULL;
+    l = r = &n;
+
+    for (;;) {
+        int c = slab_cmp(slabs, addr, t);
+        if (c < 0) {
+            if (t->left == NULL) {
+                break;
+            }
+            if (slab_cmp(slabs, addr, t->left) < 0) {
+                /* rotate right */
+                y = t->left;
+                t->left = y->right;
+                y->right = t;
+                t = y;
+                if (t->left == NULL) {
+                    break;
+                }
+            }
+            /* link right */
+            r->left = t;
+            r = t;
+            t = t->left;
+        } else if (c > 0) {
+            if (t->right == NULL) {
+                break;
+            }
+            if (slab_cmp(slabs, addr, t->right) > 0) {
+                /* rotate left */
+                y = t->right;
+                t->right = y->left;
+                y->left = t;
+                t = y;
+                if (t->right == NULL) {
+                    break;
+                }
+            }
+            /* link left */
+            l->right = t;
+            l = t;
+            t = t->right;
+        } else {
+            break;
+        }
+    }
+
+    /* assemble */
+    l->right = t->left;
+    r->left = t->right;
+    t->left = n.right;
+    t->right = n.left;
+
+    return t;
+}
+
 /**
  * \brief Initialise a new slab allocator
  *
@@ -35,7 +164,9 @@ STATIC_ASSERT_SIZEOF(struct block_head, SLAB_BLOCK_HDRSIZE);
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func)
 {
-    slabs->slabs = NULL;
+    slabs->partial = slabs->empty = slabs->full = NULL;
+    slabs->root = NULL;
+    slabs->nfree = 0;
     slabs->blocksize = SLAB_REAL_BLOCKSIZE(blocksize);
     slabs->refill_func = refill_func;
 }
@@ -71,9 +202,24 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
     }
     bh->next = NULL;
 
-    /* enqueue slab in list of slabs */
-    head->next = slabs->slabs;
-    slabs->slabs = head;
+    /* enqueue slab in list of empty slabs */
+    slab_list_insert(&slabs->empty, head);
+    slabs->nfree += head->total;
+
+    /* insert slab into tree, the new root is a neighbour of the new slab */
+    struct slab_head *root = slab_splay(slabs, slabs->root, (uintptr_t)head);
+    if (root == NULL) {
+        head->left = head->right = NULL;
+    } else if ((uintptr_t)head < (uintptr_t)root) {
+        head->left = root->left;
+        head->right = root;
+        root->left = NULL;
+    } else {
+        head->right = root->right;
+        head->left = root;
+        root->right = NULL;
+    }
+    slabs->root = head;
 }
 
 /**
@@ -86,9 +232,8 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
 void *slab_alloc(struct slab_allocator *slabs)
 {
     errval_t err;
-    /* find a slab with free blocks */
-    struct slab_head *sh;
-    for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+    /* prefer partial slabs, to keep empty slabs empty */
+    struct slab_head *sh = slabs->partial ? slabs->partial : slabs->empty;
 
     if (sh == NULL) {
         /* out of memory. try refill function if we have one */
@@ -100,18 +245,26 @@ void *slab_alloc(struct slab_allocator *slabs)
                 DEBUG_ERR(err, "slab refill_func failed");
                 return NULL;
             }
-            for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+            sh = slabs->partial ? slabs->partial : slabs->empty;
             if (sh == NULL) {
                 return NULL;
             }
         }
     }
 
+    struct slab_head **list = slab_list(slabs, sh);
+
     /* dequeue top block from freelist */
     struct block_head *bh = sh->blocks;
     assert(bh != NULL);
     sh->blocks = bh->next;
     sh->free--;
+    slabs->nfree--;
+
+    if (slab_list(slabs, sh) != list) {
+        slab_list_remove(list, sh);
+        slab_list_insert(slab_list(slabs, sh), sh);
+    }
 
     return bh;
 }
@@ -131,41 +284,134 @@ void slab_free(struct slab_allocator *slabs, void *block)
     struct block_head *bh = (struct block_head *)block;
 
     /* find matching slab */
-    struct slab_head *sh;
-    size_t blocksize = slabs->blocksize;
-    for (sh = slabs->slabs; sh != NULL; sh = sh->next) {
-        /* check if block falls inside this slab */
-        uintptr_t slab_limit = (uintptr_t)sh + sizeof(struct slab_head)
-                               + blocksize * sh->total;
-        if ((uintptr_t)bh > (uintptr_t)sh && (uintptr_t)bh < slab_limit) {
-            break;
-        }
-    }
-    assert(sh != NULL);
+    struct slab_head *sh = slab_splay(slabs, slabs->root, (uintptr_t)bh);
+    slabs->root = sh;
+    assert(sh != NULL && slab_cmp(slabs, (uintptr_t)bh, sh) == 0);
+    assert((uintptr_t)bh >= (uintptr_t)sh + sizeof(struct slab_head));
+
+    struct slab_head **list = slab_list(slabs, sh);
 
     /* re-enqueue in slab's free list */
     bh->next = sh->blocks;
     sh->blocks = bh;
     sh->free++;
+    slabs->nfree++;
     assert(sh->free <= sh->total);
+
+    if (slab_list(slabs, sh) != list) {
+        slab_list_remove(list, sh);
+        slab_list_insert(slab_list(slabs, sh), sh);
+    }
 }
 
 /**
  * \brief Returns the count of free blocks in the allocator
  *
+ * Blocks cached in magazines are not included.
+ *
  * \param slabs Pointer to slab allocator instance
  *
  * \returns Free block count
  */
 size_t slab_freecount(struct slab_allocator *slabs)
 {
-    size_t ret = 0;
+    return slabs->nfree;
+}
+
+/**
+ * \brief Initialise a magazine in front of a slab allocator
+ *
+ * \param mag Pointer to magazine, to be filled-in
+ * \param slabs Pointer to slab allocator instance
+ * \param lock Lock protecting the slab allocator, or NULL if the caller
+ *             serialises all accesses to it
+ */
+void slab_magazine_init(struct slab_magazine *mag, struct slab_allocator *slabs,
+                        struct thread_mutex *lock)
+{
+    mag->slabs = slabs;
+    mag->lock = lock;
+    mag->rounds = 0;
+}
+
+/**
+ * \brief Allocate a block through a magazine
+ *
+ * An empty magazine is loaded with half its capacity from the allocator.
+ *
+ * \returns Pointer to block on success, NULL on error (out of memory)
+ */
+void *slab_magazine_alloc(struct slab_magazine *mag)
+{
+    if (mag->rounds == 0) {
+        if (mag->lock != NULL) {
+            thread_mutex_lock(mag->lock);
+        }
+        while (mag->rounds < SLAB_MAGAZINE_ROUNDS / 2) {
+            void *block = slab_alloc(mag->slabs);
+            if (block == NULL) {
+                break;
+            }
+            mag->round[mag->rounds++] = block;
+        }
+        if (mag->lock != NULL) {
+            thread_mutex_unlock(mag->lock);
+        }
+        if (mag->rounds == 0) {
+            return NULL;
+        }
+    }
+
+    return mag->round[--mag->rounds];
+}
+
+/**
+ * \brief Free a block through a magazine
+ *
+ * A full magazine returns half its blocks to the allocator.
+ *
+ * \param block Pointer to block previously returned by #slab_magazine_alloc
+ *              or #slab_alloc on the same allocator
+ */
+void slab_magazine_free(struct slab_magazine *mag, void *block)
+{
+    if (block == NULL) {
+        return;
+    }
 
-    for (struct slab_head *sh = slabs->slabs; sh != NULL; sh = sh->next) {
-        ret += sh->free;
+    if (mag->rounds == SLAB_MAGAZINE_ROUNDS) {
+        if (mag->lock != NULL) {
+            thread_mutex_lock(mag->lock);
+        }
+        while (mag->rounds > SLAB_MAGAZINE_ROUNDS / 2) {
+            slab_free(mag->slabs, mag->round[--mag->rounds]);
+        }
+        if (mag->lock != NULL) {
+            thread_mutex_unlock(mag->lock);
+        }
+    }
+
+    mag->round[mag->rounds++] = block;
+}
+
+/**
+ * \brief Return all blocks of a magazine to the allocator
+ */
+void slab_magazine_flush(struct slab_magazine *mag)
+{
+    if (mag->rounds == 0) {
+        return;
     }
 
-    return ret;
+    if (mag->lock != NULL) {
+        thread_mutex_lock(mag->lock);
+    }
+    while (mag->rounds > 0) {
+        slab_free(mag->slabs, mag->round[--mag->rounds]);
+    }
+    if (mag->lock != NULL) {
+        thread_mutex_unlock(mag->lock);
+    }
 }
 
 /**
@@ -13,9 +13,11 @@
  * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
  */
 
+#include <string.h>
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/pmap.h>
 #include "target/x86/pmap_x86.h"
+#include "vspace/vspace_internal.h"
 
 /**
  * \brief fallback allocation for vnodes
@@ -152,6 +154,10 @@ static errval_t vnode_alloc_cached(struct pmap_x86 *pmap, enum objtype type,
 
 static errval_t vnode_free_cached(struct pmap_x86 *pmap, struct vnode *vnode)
 {
+    if (vnode->u.vnode.index) {
+        slab_free(&pmap->index_slab, vnode->u.vnode.index);
+        vnode->u.vnode.index = NULL;
+    }
     debug_printf("##################3 NYI: leaking memory!\n");
     return SYS_ERR_OK;
 }
@@ -168,13 +174,34 @@ bool has_vnode(struct vnode *root, uint32_t entry, size_t len,
 
     // region we check [entry .. end_entry)
 
+    // scan whichever is shorter, the indexed region or the list of children
+    if (root->u.vnode.index && len < root->u.vnode.nchildren) {
+        for (uint32_t i = entry; i < end_entry && i < PTABLE_SIZE; i++) {
+            n = root->u.vnode.index[i];
+            if (n == NULL) {
+                continue;
+            }
+            if (n->is_vnode && only_pages) {
+                if (has_vnode(n, 0, PTABLE_SIZE, true)) {
+                    return true;
+                }
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
     for (n = root->u.vnode.children; n; n = n->next) {
         // n is page table, we need to check if it's anywhere inside the
         // region to check [entry .. end_entry)
         // this amounts to n->entry == entry for len = 1
         if (n->is_vnode && n->entry >= entry && n->entry < end_entry) {
             if (only_pages) {
-                return has_vnode(n, 0, PTABLE_SIZE, true);
+                if (has_vnode(n, 0, PTABLE_SIZE, true)) {
+                    return true;
+                }
+                continue;
             }
 #ifdef LIBBARRELFISH_DEBUG_PMAP
             debug_printf("1: found page table inside our region\n");
@@ -231,6 +258,10 @@ struct vnode *find_vnode(struct vnode *root, uint16_t entry)
     assert(root->is_vnode);
     struct vnode *n;
 
+    if (root->u.vnode.index) {
+        return entry < PTABLE_SIZE ? root->u.vnode.index[entry] : NULL;
+    }
+
     for(n = root->u.vnode.children; n != NULL; n = n->next) {
         if (!n->is_vnode) {
             // check whether entry is inside a large region
@@ -257,6 +288,12 @@ bool inside_region(struct vnode *root, uint32_t entry, uint32_t npages)
 
     struct vnode *n;
 
+    if (root->u.vnode.index) {
+        n = entry < PTABLE_SIZE ? root->u.vnode.index[entry] : NULL;
+        return n && !n->is_vnode &&
+               entry + npages <= n->entry + n->u.frame.pte_count;
+    }
+
     for (n = root->u.vnode.children; n; n = n->next) {
         if (!n->is_vnode) {
             uint16_t end = n->entry + n->u.frame.pte_count;
@@ -269,25 +306,80 @@ bool inside_region(struct vnode *root, uint32_t entry, uint32_t npages)
     return false;
 }
 
+/// Number of entries `n` occupies in the page table of its parent
+static inline uint32_t vnode_span(struct vnode *n)
+{
+    return n->is_vnode ? 1 : n->u.frame.pte_count;
+}
+
+/// Points the entries covered by `n` in the child index of `root` to `val`
+static void index_set(struct vnode *root, struct vnode *n, struct vnode *val)
+{
+    uint32_t end = n->entry + vnode_span(n);
+    assert(end <= PTABLE_SIZE);
+    for (uint32_t i = n->entry; i < end; i++) {
+        root->u.vnode.index[i] = val;
+    }
+}
+
+/// Builds the child index of `root` from its list of children
+static void index_build(struct pmap_x86 *pmap, struct vnode *root)
+{
+    struct vnode **index = slab_alloc(&pmap->index_slab);
+    if (index == NULL) {
+        // stay with the list, we try again on the next insert
+        pmap->index_wanted = true;
+        return;
+    }
+    memset(index, 0, VNODE_INDEX_SIZE);
+    root->u.vnode.index = index;
+
+    for (struct vnode *n = root->u.vnode.children; n != NULL; n = n->next) {
+        index_set(root, n, n);
+    }
+}
+
+void insert_vnode(struct pmap_x86 *pmap, struct vnode *root,
+                  struct vnode *item)
+{
+    assert(root->is_vnode);
+
+    item->prev = NULL;
+    item->next = root->u.vnode.children;
+    if (item->next) {
+        item->next->prev = item;
+    }
+    root->u.vnode.children = item;
+    root->u.vnode.nchildren++;
+
+    if (root->u.vnode.index) {
+        index_set(root, item, item);
+    } else if (root->u.vnode.nchildren >= VNODE_INDEX_THRESHOLD) {
+        index_build(pmap, root);
+    }
+}
+
 void remove_vnode(struct vnode *root, struct vnode *item)
 {
     assert(root->is_vnode);
-    struct vnode *walk = root->u.vnode.children;
-    struct vnode *prev = NULL;
-    while (walk) {
-        if (walk == item) {
-            if (prev) {
-                prev->next = walk->next;
-                return;
-            } else {
-                root->u.vnode.children = walk->next;
-                return;
-            }
-        }
-        prev = walk;
-        walk = walk->next;
+    assert(root->u.vnode.nchildren > 0);
+
+    // item->next stays valid, callers may be iterating over the children
+    if (item->prev) {
+        assert(item->prev->next == item);
+        item->prev->next = item->next;
+    } else {
+        assert(root->u.vnode.children == item);
+        root->u.vnode.children = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    }
+    root->u.vnode.nchildren--;
+
+    if (root->u.vnode.index) {
+        index_set(root, item, NULL);
     }
-    USER_PANIC("Should not get here");
 }
 
 /**
@@ -317,9 +409,10 @@ errval_t alloc_vnode(struct pmap_x86 *pmap, struct vnode *root,
     // The VNode meta data
     newvnode->is_vnode  = true;
     newvnode->entry     = entry;
-    newvnode->next      = root->u.vnode.children;
-    root->u.vnode.children = newvnode;
-    newvnode->u.vnode.children = NULL;
+    newvnode->u.vnode.children  = NULL;
+    newvnode->u.vnode.index     = NULL;
+    newvnode->u.vnode.nchildren = 0;
+    insert_vnode(pmap, root, newvnode);
 
     *retvnode = newvnode;
     return SYS_ERR_OK;
@@ -460,8 +553,9 @@ static errval_t deserialise_tree(struct pmap *pmap, struct serial_entry **in,
         n->u.vnode.cap.cnode = cnode_page;
         n->u.vnode.cap.slot  = (*in)->slot;
         n->u.vnode.children  = NULL;
-        n->next      = parent->u.vnode.children;
-        parent->u.vnode.children = n;
+        n->u.vnode.index     = NULL;
+        n->u.vnode.nchildren = 0;
+        insert_vnode(pmapx, parent, n);
 
         (*in)++;
         (*inlen)--;
@@ -525,16 +619,14 @@ errval_t pmap_x86_deserialise(struct pmap *pmap, void *buf, size_t buflen)
  * \param alignment Minimum alignment
  * \param retvaddr Pointer to return the determined address
  *
- * Relies on vspace.c code maintaining an ordered list of vregions
+ * Uses the vregion tree of the vspace to find the lowest suitable gap.
  */
 errval_t pmap_x86_determine_addr(struct pmap *pmap, struct memobj *memobj,
                                  size_t alignment, genvaddr_t *retvaddr)
 {
     struct pmap_x86 *pmapx = (struct pmap_x86 *)pmap;
-    genvaddr_t vaddr;
 
-    struct vregion *walk = pmap->vspace->head;
-    assert(walk != NULL); // assume there's always at least one existing entry
+    assert(pmap->vspace->root != NULL); // assume there's always at least one existing entry
 
     if (alignment == 0) {
         alignment = BASE_PAGE_SIZE;
@@ -543,44 +635,7 @@ errval_t pmap_x86_determine_addr(struct pmap *pmap, struct memobj *memobj,
     }
     size_t size = ROUND_UP(memobj->size, alignment);
 
-    // if there's space before the first object, map it there
-    genvaddr_t minva = ROUND_UP(pmapx->min_mappable_va, alignment);
-    if (minva + size <= vregion_get_base_addr(walk)) {
-        vaddr = minva;
-        goto out;
-    }
-
-    while (walk->next) { // Try to insert between existing mappings
-        genvaddr_t walk_base = vregion_get_base_addr(walk);
-        genvaddr_t walk_size = ROUND_UP(vregion_get_size(walk), BASE_PAGE_SIZE);
-        genvaddr_t walk_end = ROUND_UP(walk_base + walk_size, alignment);
-        genvaddr_t next_base = vregion_get_base_addr(walk->next);
-
-        // sanity-check for page alignment
-        assert(walk_base % BASE_PAGE_SIZE == 0);
-        assert(next_base % BASE_PAGE_SIZE == 0);
-
-        if (next_base > walk_end + size) {
-            vaddr = walk_end;
-            goto out;
-        }
-
-        walk = walk->next;
-    }
-
-    // Place beyond last mapping, with alignment
-    vaddr = ROUND_UP((vregion_get_base_addr(walk)
-                      + ROUND_UP(vregion_get_size(walk), BASE_PAGE_SIZE)),
-                     alignment);
-
- out:
-    // Ensure that we haven't run out of address space
-    if (vaddr + memobj->size > pmapx->max_mappable_va) {
-        return LIB_ERR_OUT_OF_VIRTUAL_ADDR;
-    }
-
     assert(retvaddr != NULL);
-    *retvaddr = vaddr;
-
-    return SYS_ERR_OK;
+    return vspace_find_free(pmap->vspace, pmapx->min_mappable_va,
+                            pmapx->max_mappable_va, size, alignment, retvaddr);
 }
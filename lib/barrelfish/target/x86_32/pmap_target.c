@@ -29,6 +29,7 @@
 #include <barrelfish/dispatch.h>
 #include <stdio.h>
 #include "target/x86/pmap_x86.h"
+#include "vspace/vspace_internal.h"
 
 
 // Location and size of virtual address space reserved for mapping
@@ -197,12 +198,11 @@ static errval_t do_single_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
     assert(page);
     page->is_vnode = false;
     page->entry = base;
-    page->next  = ptable->u.vnode.children;
-    ptable->u.vnode.children = page;
     page->u.frame.cap = frame;
     page->u.frame.offset = offset;
     page->u.frame.flags = flags;
     page->u.frame.pte_count = pte_count;
+    insert_vnode(pmap, ptable, page);
 
     // do map
     err = vnode_map(ptable->u.vnode.cap, frame, base,
@@ -937,11 +937,16 @@ errval_t pmap_x86_32_init(struct pmap *pmap, struct vspace *vspace,
     slab_grow(&x86->slab, x86->slab_buffer,
               sizeof(x86->slab_buffer));
     x86->refill_slabs = min_refill_slabs;
+    slab_init(&x86->index_slab, VNODE_INDEX_SIZE, NULL);
+    x86->index_wanted = false;
 
     x86->root.u.vnode.cap       = vnode;
     x86->root.u.vnode.children  = NULL;
+    x86->root.u.vnode.index     = NULL;
+    x86->root.u.vnode.nchildren = 0;
     x86->root.is_vnode  = true;
     x86->root.next      = NULL;
+    x86->root.prev      = NULL;
 
     // choose a minimum mappable VA for most domains; enough to catch NULL
     // pointer derefs with suitably large offsets
@@ -976,7 +981,10 @@ errval_t pmap_x86_32_current_init(bool init_domain)
 
     struct vspace *vspace = x86->p.vspace;
     assert(!vspace->head);
-    vspace->head = vregion;
+    errval_t err = vspace_add_vregion(vspace, vregion);
+    if (err_is_fail(err)) {
+        return err;
+    }
 
     x86->vregion_offset = x86->vregion.base;
 
@@ -28,6 +28,7 @@
 #include <barrelfish/barrelfish.h>
 #include <barrelfish/dispatch.h>
 #include "target/x86/pmap_x86.h"
+#include "vspace/vspace_internal.h"
 #include <stdio.h>
 
 // Size of virtual region mapped by a single PML4 entry
@@ -38,6 +39,11 @@
 #define META_DATA_RESERVED_BASE (PML4_MAPPING_SIZE * (disp_get_core_id() + 1))
 #define META_DATA_RESERVED_SIZE (X86_64_BASE_PAGE_SIZE * 80000)
 
+// Addresses for mappings without a vregion are taken from this range, which
+// ends with the lower half of the address space
+#define RAW_MAPPING_BASE  (PML4_MAPPING_SIZE * 16)
+#define RAW_MAPPING_LIMIT (PML4_MAPPING_SIZE * 256)
+
 /**
  * \brief Translate generic vregion flags to architecture specific pmap flags
  */
@@ -206,10 +212,114 @@ static inline struct vnode *find_ptable(struct pmap_x86 *pmap, genvaddr_t base)
     }
 }
 
+/**
+ * \brief Claim the batch of `pmap` for a map or unmap call
+ *
+ * A call can recurse into the same pmap, e.g. when allocating slots for new
+ * page tables faults in more memory. The batch then still holds the ops of
+ * the outer call, so the nested call gets NULL and maps and unmaps directly.
+ */
+static inline struct pmap_batch *batch_begin(struct pmap_x86 *pmap)
+{
+    if (pmap->batch_busy) {
+        return NULL;
+    }
+    pmap->batch_busy = true;
+    pmap->batch.count = 0;
+    return &pmap->batch;
+}
+
+/// Release the batch claimed by batch_begin(), which must have been flushed
+static inline void batch_end(struct pmap_x86 *pmap, struct pmap_batch *batch)
+{
+    if (batch != NULL) {
+        assert(batch->count == 0);
+        pmap->batch_busy = false;
+    }
+}
+
+/// Fill in the CSpace address of `cap` the way the kernel expects it
+static inline void batch_cap_addr(struct capref cap, uint32_t *addr,
+                                  uint8_t *bits)
+{
+    *bits = get_cap_valid_bits(cap);
+    *addr = get_cap_addr(cap) >> (CPTR_BITS - *bits);
+}
+
+/**
+ * \brief Map all queued leaf mappings with one invocation
+ */
+static errval_t batch_flush_map(struct pmap_x86 *pmap, struct pmap_batch *batch)
+{
+    if (batch == NULL || batch->count == 0) {
+        return SYS_ERR_OK;
+    }
+
+    size_t done = 0;
+    errval_t err = invoke_vnode_map_batch(pmap->root.u.vnode.cap,
+                                          batch->ops.map, batch->count, &done);
+    if (err_is_fail(err)) {
+        // forget about the mappings that have not been established
+        for (size_t i = done; i < batch->count; i++) {
+            remove_vnode(batch->pt[i], batch->page[i]);
+            slab_free(&pmap->slab, batch->page[i]);
+        }
+        err = err_push(err, LIB_ERR_VNODE_MAP_BATCH);
+    }
+    batch->count = 0;
+    return err;
+}
+
+/**
+ * \brief Unmap all queued leaf mappings with one invocation
+ *
+ * The kernel does a single TLB flush for the whole batch.
+ */
+static errval_t batch_flush_unmap(struct pmap_x86 *pmap,
+                                  struct pmap_batch *batch)
+{
+    if (batch == NULL || batch->count == 0) {
+        return SYS_ERR_OK;
+    }
+
+    size_t done = 0;
+    errval_t err = invoke_vnode_unmap_batch(pmap->root.u.vnode.cap,
+                                            batch->ops.unmap, batch->count,
+                                            &done);
+    if (err_is_fail(err)) {
+        printf("vnode_unmap_batch returned error: %s (%d)\n",
+                err_getstring(err), err_no(err));
+        err = err_push(err, LIB_ERR_VNODE_UNMAP_BATCH);
+        // these are still mapped
+        for (size_t i = done; i < batch->count; i++) {
+            insert_vnode(pmap, batch->pt[i], batch->page[i]);
+        }
+    }
+
+    // Free up the resources
+    for (size_t i = 0; i < done; i++) {
+        if (batch->delete_cap[i]) {
+            errval_t err2 = cap_destroy(batch->page[i]->u.frame.cap);
+            if (err_is_fail(err2) && err_is_ok(err)) {
+                err = err_push(err2, LIB_ERR_PMAP_DO_SINGLE_UNMAP);
+            }
+        }
+        slab_free(&pmap->slab, batch->page[i]);
+    }
+    batch->count = 0;
+    return err;
+}
+
+/**
+ * \brief Map `pte_count` pages of `frame` into a single leaf page table
+ *
+ * If `batch` is non-NULL, the mapping is queued and only established when
+ * the batch is flushed. Otherwise it is established immediately.
+ */
 static errval_t do_single_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
                               genvaddr_t vend, struct capref frame,
                               size_t offset, size_t pte_count,
-                              vregion_flags_t flags)
+                              vregion_flags_t flags, struct pmap_batch *batch)
 {
     if (pte_count == 0) {
         debug_printf("do_single_map: pte_count == 0, called from %p\n",
@@ -263,12 +373,34 @@ static errval_t do_single_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
     assert(page);
     page->is_vnode = false;
     page->entry = table_base;
-    page->next  = ptable->u.vnode.children;
-    ptable->u.vnode.children = page;
     page->u.frame.cap = frame;
     page->u.frame.offset = offset;
     page->u.frame.flags = flags;
     page->u.frame.pte_count = pte_count;
+    insert_vnode(pmap, ptable, page);
+
+    if (batch) {
+        if (batch->count == VNODE_BATCH_MAX) {
+            err = batch_flush_map(pmap, batch);
+            if (err_is_fail(err)) {
+                // the current mapping was not queued yet
+                remove_vnode(ptable, page);
+                slab_free(&pmap->slab, page);
+                return err;
+            }
+        }
+        struct vnode_map_op *op = &batch->ops.map[batch->count];
+        batch_cap_addr(ptable->u.vnode.cap, &op->ptable, &op->ptable_bits);
+        batch_cap_addr(frame, &op->frame, &op->frame_bits);
+        op->slot = table_base;
+        op->pte_count = pte_count;
+        op->flags = pmap_flags;
+        op->offset = offset;
+        batch->pt[batch->count] = ptable;
+        batch->page[batch->count] = page;
+        batch->count++;
+        return SYS_ERR_OK;
+    }
 
     // do map
     err = vnode_map(ptable->u.vnode.cap, frame, table_base,
@@ -282,10 +414,13 @@ static errval_t do_single_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
 
 /**
  * \brief Called when enough slabs exist for the given mapping
+ *
+ * The leaf mappings are queued in `batch` if it is non-NULL.
  */
 static errval_t do_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
                        struct capref frame, size_t offset, size_t size,
-                       vregion_flags_t flags, size_t *retoff, size_t *retsize)
+                       vregion_flags_t flags, size_t *retoff, size_t *retsize,
+                       struct pmap_batch *batch)
 {
     errval_t err;
 
@@ -359,7 +494,8 @@ static errval_t do_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
         if (debug_out) {
             debug_printf("  do_map: fast path: %zd\n", pte_count);
         }
-        err = do_single_map(pmap, vaddr, vend, frame, offset, pte_count, flags);
+        err = do_single_map(pmap, vaddr, vend, frame, offset, pte_count, flags,
+                            batch);
         if (err_is_fail(err)) {
             return err_push(err, LIB_ERR_PMAP_DO_MAP);
         }
@@ -371,7 +507,8 @@ static errval_t do_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
             debug_printf("  do_map: slow path: first leaf %"PRIu32"\n", c);
         }
         genvaddr_t temp_end = vaddr + c * page_size;
-        err = do_single_map(pmap, vaddr, temp_end, frame, offset, c, flags);
+        err = do_single_map(pmap, vaddr, temp_end, frame, offset, c, flags,
+                            batch);
         if (err_is_fail(err)) {
             return err_push(err, LIB_ERR_PMAP_DO_MAP);
         }
@@ -402,7 +539,7 @@ static errval_t do_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
                 debug_printf("  do_map: slow path: full leaf\n");
             }
             err = do_single_map(pmap, vaddr, temp_end, frame, offset,
-                    X86_64_PTABLE_SIZE, flags);
+                    X86_64_PTABLE_SIZE, flags, batch);
             if (err_is_fail(err)) {
                 return err_push(err, LIB_ERR_PMAP_DO_MAP);
             }
@@ -432,7 +569,8 @@ static errval_t do_map(struct pmap_x86 *pmap, genvaddr_t vaddr,
             if (debug_out) {
                 debug_printf("do_map: slow path: last leaf %"PRIu32"\n", c);
             }
-            err = do_single_map(pmap, temp_end, vend, next, offset, c, flags);
+            err = do_single_map(pmap, temp_end, vend, next, offset, c, flags,
+                                batch);
             if (err_is_fail(err)) {
                 return err_push(err, LIB_ERR_PMAP_DO_MAP);
             }
@@ -523,7 +661,7 @@ static errval_t refill_slabs(struct pmap_x86 *pmap, size_t request)
                vregion_get_size(&pmap->vregion));
 
         err = do_map(pmap, genvaddr, cap, 0, bytes,
-                     VREGION_FLAGS_READ_WRITE, NULL, NULL);
+                     VREGION_FLAGS_READ_WRITE, NULL, NULL, NULL);
         if (err_is_fail(err)) {
             return err_push(err, LIB_ERR_PMAP_DO_MAP);
         }
@@ -536,6 +674,59 @@ static errval_t refill_slabs(struct pmap_x86 *pmap, size_t request)
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Refill the slab allocator for dense child indices
+ *
+ * Like refill_slabs(), this maps frames into the reserved metadata region and
+ * can only be called for the current pmap. The frames are single base pages,
+ * so that this also works while RAM is only handed out in pages (e.g. during
+ * the initialization of a domain).
+ */
+static errval_t refill_index_slabs(struct pmap_x86 *pmap)
+{
+    errval_t err;
+    size_t bytes = VNODE_INDEX_REFILL_PAGES * BASE_PAGE_SIZE;
+
+    err = refill_slabs(pmap, max_slabs_for_mapping(bytes) +
+                             (1 << (VNODE_CACHE_REFILL_BITS + 2)));
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLAB_REFILL);
+    }
+
+    // the buffer must be contiguous, so map the pages next to each other
+    genvaddr_t genvaddr = pmap->vregion_offset;
+    size_t mapped;
+    for (mapped = 0; mapped < bytes; mapped += BASE_PAGE_SIZE) {
+        struct capref cap;
+        err = frame_alloc(&cap, BASE_PAGE_SIZE, NULL);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_FRAME_ALLOC);
+            break;
+        }
+
+        err = do_map(pmap, genvaddr + mapped, cap, 0, BASE_PAGE_SIZE,
+                     VREGION_FLAGS_READ_WRITE, NULL, NULL, NULL);
+        if (err_is_fail(err)) {
+            cap_destroy(cap);
+            err = err_push(err, LIB_ERR_PMAP_DO_MAP);
+            break;
+        }
+    }
+
+    pmap->vregion_offset += (genvaddr_t)mapped;
+    assert(pmap->vregion_offset < vregion_get_base_addr(&pmap->vregion) +
+           vregion_get_size(&pmap->vregion));
+
+    // use what we got, even if we ran out of memory halfway
+    if (mapped >= SLAB_STATIC_SIZE(1, VNODE_INDEX_SIZE)) {
+        lvaddr_t buf = vspace_genvaddr_to_lvaddr(genvaddr);
+        slab_grow(&pmap->index_slab, (void*)buf, mapped);
+        return SYS_ERR_OK;
+    }
+
+    return err;
+}
+
 /// Minimally refill the slab allocator
 static errval_t min_refill_slabs(struct pmap_x86 *pmap)
 {
@@ -543,22 +734,17 @@ static errval_t min_refill_slabs(struct pmap_x86 *pmap)
 }
 
 /**
- * \brief Create page mappings
+ * \brief Align a mapping to page boundaries and make sure enough slabs exist
  *
- * \param pmap     The pmap object
- * \param vaddr    The virtual address to create the mapping for
- * \param frame    The frame cap to map in
- * \param offset   Offset into the frame cap
- * \param size     Size of the mapping
- * \param flags    Flags for the mapping
- * \param retoff   If non-NULL, filled in with adjusted offset of mapped region
- * \param retsize  If non-NULL, filled in with adjusted size of mapped region
+ * Adjusts `offset` and `size` to the page size used for the mapping.
  */
-static errval_t map(struct pmap *pmap, genvaddr_t vaddr, struct capref frame,
-                    size_t offset, size_t size, vregion_flags_t flags,
-                    size_t *retoff, size_t *retsize)
+static errval_t map_prepare(struct pmap *pmap, genvaddr_t vaddr,
+                            struct capref frame, size_t *retoffset,
+                            size_t *retsize, vregion_flags_t flags)
 {
     errval_t err;
+    size_t offset = *retoffset;
+    size_t size = *retsize;
     struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
 
     struct frame_identity fi;
@@ -603,8 +789,29 @@ static errval_t map(struct pmap *pmap, genvaddr_t vaddr, struct capref frame,
 
     // minimum amount required to map a pages
     max_slabs += (1<< (VNODE_CACHE_REFILL_BITS + 2));
+    struct pmap *mypmap = get_current_pmap();
+
+    // Refill the index slab allocator once a page table needs an index.
+    // Child indices only speed up lookups, so without memory for them the
+    // page tables keep using their lists of children and we try again later.
+    if (x86->index_wanted && slab_freecount(&x86->index_slab) == 0) {
+        if (pmap == mypmap) {
+            err = refill_index_slabs(x86);
+            if (err_is_ok(err)) {
+                x86->index_wanted = false;
+            }
+        } else {
+            size_t bytes = VNODE_INDEX_REFILL_PAGES * BASE_PAGE_SIZE;
+            void *buf = malloc(bytes);
+            if (buf) {
+                slab_grow(&x86->index_slab, buf, bytes);
+                x86->index_wanted = false;
+            }
+        }
+        slabs_free = slab_freecount(&x86->slab);
+    }
+
     if (slabs_free < max_slabs) {
-        struct pmap *mypmap = get_current_pmap();
         if (pmap == mypmap) {
             err = refill_slabs(x86, max_slabs);
             if (err_is_fail(err)) {
@@ -621,7 +828,83 @@ static errval_t map(struct pmap *pmap, genvaddr_t vaddr, struct capref frame,
         }
     }
 
-    err = do_map(x86, vaddr, frame, offset, size, flags, retoff, retsize);
+    *retoffset = offset;
+    *retsize = size;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Create page mappings
+ *
+ * \param pmap     The pmap object
+ * \param vaddr    The virtual address to create the mapping for
+ * \param frame    The frame cap to map in
+ * \param offset   Offset into the frame cap
+ * \param size     Size of the mapping
+ * \param flags    Flags for the mapping
+ * \param retoff   If non-NULL, filled in with adjusted offset of mapped region
+ * \param retsize  If non-NULL, filled in with adjusted size of mapped region
+ */
+static errval_t map(struct pmap *pmap, genvaddr_t vaddr, struct capref frame,
+                    size_t offset, size_t size, vregion_flags_t flags,
+                    size_t *retoff, size_t *retsize)
+{
+    errval_t err;
+    struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
+
+    err = map_prepare(pmap, vaddr, frame, &offset, &size, flags);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // mappings spanning several leaf page tables need a single invocation
+    struct pmap_batch *batch = batch_begin(x86);
+
+    err = do_map(x86, vaddr, frame, offset, size, flags, retoff, retsize,
+                 batch);
+    errval_t err2 = batch_flush_map(x86, batch);
+    batch_end(x86, batch);
+    if (err_is_ok(err)) {
+        err = err2;
+    }
+    return err;
+}
+
+/**
+ * \brief Create a list of page mappings
+ *
+ * Establishes the leaf mappings of all operations with as few kernel
+ * invocations as possible. Operations are carried out in order.
+ *
+ * \param pmap     The pmap object
+ * \param ops      The mappings to create
+ * \param count    Number of entries in `ops`
+ */
+static errval_t map_batch(struct pmap *pmap, struct pmap_map_op *ops,
+                          size_t count)
+{
+    errval_t err = SYS_ERR_OK;
+    struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
+
+    struct pmap_batch *batch = batch_begin(x86);
+
+    for (size_t i = 0; i < count && err_is_ok(err); i++) {
+        size_t offset = ops[i].offset;
+        size_t size = ops[i].size;
+
+        err = map_prepare(pmap, ops[i].vaddr, ops[i].frame, &offset, &size,
+                          ops[i].flags);
+        if (err_is_ok(err)) {
+            err = do_map(x86, ops[i].vaddr, ops[i].frame, offset, size,
+                         ops[i].flags, NULL, NULL, batch);
+        }
+    }
+
+    errval_t err2 = batch_flush_map(x86, batch);
+    batch_end(x86, batch);
+    if (err_is_ok(err)) {
+        err = err2;
+    }
     return err;
 }
 
@@ -667,8 +950,15 @@ static bool find_mapping(struct pmap_x86 *pmap, genvaddr_t vaddr,
     }
 }
 
+/**
+ * \brief Queue the removal of the leaf mapping at `vaddr` in `batch`
+ *
+ * The metadata is removed right away and the mapping itself when the batch
+ * is flushed. If `batch` is NULL, the mapping is removed immediately.
+ */
 static errval_t do_single_unmap(struct pmap_x86 *pmap, genvaddr_t vaddr,
-                                size_t pte_count, bool delete_cap)
+                                size_t pte_count, bool delete_cap,
+                                struct pmap_batch *batch)
 {
     errval_t err;
     struct vnode *pt = NULL, *page = NULL;
@@ -678,7 +968,7 @@ static errval_t do_single_unmap(struct pmap_x86 *pmap, genvaddr_t vaddr,
     }
     assert(pt && pt->is_vnode && page && !page->is_vnode);
 
-    if (page->u.frame.pte_count == pte_count) {
+    if (page->u.frame.pte_count == pte_count && batch == NULL) {
         err = vnode_unmap(pt->u.vnode.cap, page->u.frame.cap, page->entry,
                 page->u.frame.pte_count);
         if (err_is_fail(err)) {
@@ -691,12 +981,30 @@ static errval_t do_single_unmap(struct pmap_x86 *pmap, genvaddr_t vaddr,
         if (delete_cap) {
             err = cap_destroy(page->u.frame.cap);
             if (err_is_fail(err)) {
-                printf("delete_cap\n");
                 return err_push(err, LIB_ERR_PMAP_DO_SINGLE_UNMAP);
             }
         }
         remove_vnode(pt, page);
         slab_free(&pmap->slab, page);
+    } else if (page->u.frame.pte_count == pte_count) {
+        if (batch->count == VNODE_BATCH_MAX) {
+            err = batch_flush_unmap(pmap, batch);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+
+        struct vnode_unmap_op *op = &batch->ops.unmap[batch->count];
+        batch_cap_addr(pt->u.vnode.cap, &op->ptable, &op->ptable_bits);
+        batch_cap_addr(page->u.frame.cap, &op->mapping, &op->mapping_bits);
+        op->slot = page->entry;
+        op->pte_count = page->u.frame.pte_count;
+        batch->pt[batch->count] = pt;
+        batch->page[batch->count] = page;
+        batch->delete_cap[batch->count] = delete_cap;
+        batch->count++;
+
+        remove_vnode(pt, page);
     }
 
     return SYS_ERR_OK;
@@ -712,19 +1020,13 @@ static inline bool is_huge_page(struct vnode *p)
 }
 
 /**
- * \brief Remove page mappings
- *
- * \param pmap     The pmap object
- * \param vaddr    The start of the virtual region to remove
- * \param size     The size of virtual region to remove
- * \param retsize  If non-NULL, filled in with the actual size removed
+ * \brief Queue the removal of the page mappings of a region in `batch`
  */
-static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
-                      size_t *retsize)
+static errval_t do_unmap(struct pmap_x86 *x86, genvaddr_t vaddr, size_t size,
+                         size_t *retsize, struct pmap_batch *batch)
 {
     //printf("[unmap] 0x%"PRIxGENVADDR", %zu\n", vaddr, size);
     errval_t err, ret = SYS_ERR_OK;
-    struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
 
     //determine if we unmap a larger page
     struct vnode* page = NULL;
@@ -765,7 +1067,7 @@ static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
         (is_same_pml4(vaddr, vend) && is_huge_page(page)))
     {
         // fast path
-        err = do_single_unmap(x86, vaddr, size / page_size, false);
+        err = do_single_unmap(x86, vaddr, size / page_size, false, batch);
         if (err_is_fail(err) && err_no(err) != LIB_ERR_PMAP_FIND_VNODE) {
             printf("error fast path\n");
             return err_push(err, LIB_ERR_PMAP_UNMAP);
@@ -775,7 +1077,7 @@ static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
         // unmap first leaf
         uint32_t c = X86_64_PTABLE_SIZE - table_base;
 
-        err = do_single_unmap(x86, vaddr, c, false);
+        err = do_single_unmap(x86, vaddr, c, false, batch);
         if (err_is_fail(err) && err_no(err) != LIB_ERR_PMAP_FIND_VNODE) {
             printf("error first leaf\n");
             return err_push(err, LIB_ERR_PMAP_UNMAP);
@@ -785,7 +1087,8 @@ static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
         vaddr += c * page_size;
         while (get_addr_prefix(vaddr, map_bits) < get_addr_prefix(vend, map_bits)) {
             c = X86_64_PTABLE_SIZE;
-            err = do_single_unmap(x86, vaddr, X86_64_PTABLE_SIZE, true);
+            err = do_single_unmap(x86, vaddr, X86_64_PTABLE_SIZE, true,
+                                  batch);
             if (err_is_fail(err) && err_no(err) != LIB_ERR_PMAP_FIND_VNODE) {
                 printf("error while loop\n");
                 return err_push(err, LIB_ERR_PMAP_UNMAP);
@@ -800,7 +1103,7 @@ static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
             get_addr_prefix(vaddr, map_bits-X86_64_PTABLE_BITS);
         assert(c < X86_64_PTABLE_SIZE);
         if (c) {
-            err = do_single_unmap(x86, vaddr, c, true);
+            err = do_single_unmap(x86, vaddr, c, true, batch);
             if (err_is_fail(err) && err_no(err) != LIB_ERR_PMAP_FIND_VNODE) {
                 printf("error remaining part\n");
                 return err_push(err, LIB_ERR_PMAP_UNMAP);
@@ -816,6 +1119,60 @@ static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
     return ret;
 }
 
+/**
+ * \brief Remove page mappings
+ *
+ * \param pmap     The pmap object
+ * \param vaddr    The start of the virtual region to remove
+ * \param size     The size of virtual region to remove
+ * \param retsize  If non-NULL, filled in with the actual size removed
+ */
+static errval_t unmap(struct pmap *pmap, genvaddr_t vaddr, size_t size,
+                      size_t *retsize)
+{
+    struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
+
+    struct pmap_batch *batch = batch_begin(x86);
+
+    errval_t err = do_unmap(x86, vaddr, size, retsize, batch);
+    errval_t err2 = batch_flush_unmap(x86, batch);
+    batch_end(x86, batch);
+    if (err_is_ok(err)) {
+        err = err2;
+    }
+    return err;
+}
+
+/**
+ * \brief Remove a list of page mappings
+ *
+ * Removes the leaf mappings of all regions with as few kernel invocations
+ * and TLB flushes as possible.
+ *
+ * \param pmap     The pmap object
+ * \param ops      The regions to remove
+ * \param count    Number of entries in `ops`
+ */
+static errval_t unmap_batch(struct pmap *pmap, struct pmap_unmap_op *ops,
+                            size_t count)
+{
+    errval_t err = SYS_ERR_OK;
+    struct pmap_x86 *x86 = (struct pmap_x86*)pmap;
+
+    struct pmap_batch *batch = batch_begin(x86);
+
+    for (size_t i = 0; i < count && err_is_ok(err); i++) {
+        err = do_unmap(x86, ops[i].vaddr, ops[i].size, NULL, batch);
+    }
+
+    errval_t err2 = batch_flush_unmap(x86, batch);
+    batch_end(x86, batch);
+    if (err_is_ok(err)) {
+        err = err2;
+    }
+    return err;
+}
+
 static errval_t do_single_modify_flags(struct pmap_x86 *pmap, genvaddr_t vaddr,
                                        size_t pages, vregion_flags_t flags)
 {
@@ -981,30 +1338,32 @@ static errval_t lookup(struct pmap *pmap, genvaddr_t vaddr,
 {
     struct pmap_x86 *x86 = (struct pmap_x86 *)pmap;
 
-    uint32_t base = X86_64_PTABLE_BASE(vaddr);
-    // Find the page table
-    struct vnode *ptable = find_ptable(x86, vaddr);
-    if (ptable == NULL) {
-        //mapped in pdir?
-        ptable = find_pdir(x86, vaddr);
-        if (ptable == NULL) {
-            return LIB_ERR_PMAP_FIND_VNODE;
-        }
-        base = X86_64_PDIR_BASE(vaddr);
+    struct vnode *pdpt = find_pdpt(x86, vaddr);
+    if (pdpt == NULL) {
+        return LIB_ERR_PMAP_FIND_VNODE;
     }
 
-    // Find the page
-    struct vnode *vn = find_vnode(ptable, base);
-    if (vn == NULL) {
+    // Walk down until we find the page, which may be a huge or large page
+    size_t pagesize = HUGE_PAGE_SIZE;
+    struct vnode *vn = find_vnode(pdpt, X86_64_PDPT_BASE(vaddr));
+    if (vn != NULL && vn->is_vnode) {
+        pagesize = LARGE_PAGE_SIZE;
+        vn = find_vnode(vn, X86_64_PDIR_BASE(vaddr));
+    }
+    if (vn != NULL && vn->is_vnode) {
+        pagesize = BASE_PAGE_SIZE;
+        vn = find_vnode(vn, X86_64_PTABLE_BASE(vaddr));
+    }
+    if (vn == NULL || vn->is_vnode) {
         return LIB_ERR_PMAP_FIND_VNODE;
     }
 
     if (retvaddr) {
-        *retvaddr = vaddr & ~(genvaddr_t)BASE_PAGE_MASK;
+        *retvaddr = vaddr & ~(genvaddr_t)(pagesize - 1);
     }
 
     if (retsize) {
-        *retsize = BASE_PAGE_SIZE;
+        *retsize = pagesize;
     }
 
     if (retcap) {
@@ -1065,14 +1424,60 @@ static errval_t dump(struct pmap *pmap, struct pmap_dump_info *buf, size_t bufle
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Returns the end of the first leaf mapping in [vaddr, vend), or 0
+ *
+ * \param root   The page table to search
+ * \param base   The virtual address mapped by the first entry of `root`
+ * \param shift  log2 of the size mapped by an entry of `root`
+ *
+ * Only visits page tables that exist, so sparse ranges are cheap.
+ */
+static genvaddr_t find_mapped(struct vnode *root, genvaddr_t base, int shift,
+                              genvaddr_t vaddr, genvaddr_t vend)
+{
+    uint32_t first = (vaddr - base) >> shift;
+    uint32_t last = (vend - 1 - base) >> shift;
+    assert(last < X86_64_PTABLE_SIZE);
+
+    for (uint32_t entry = first; entry <= last; entry++) {
+        struct vnode *n = find_vnode(root, entry);
+        if (n == NULL) {
+            continue;
+        }
+        if (!n->is_vnode) {
+            return base + ((genvaddr_t)(n->entry + n->u.frame.pte_count) << shift);
+        }
+        if (shift > X86_64_BASE_PAGE_BITS) {
+            genvaddr_t ebase = base + ((genvaddr_t)entry << shift);
+            genvaddr_t eend = ebase + ((genvaddr_t)1 << shift);
+            genvaddr_t end = find_mapped(n, ebase, shift - X86_64_PTABLE_BITS,
+                                         vaddr > ebase ? vaddr : ebase,
+                                         vend < eend ? vend : eend);
+            if (end != 0) {
+                return end;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Determine a suitable address for a mapping that has no vregion
+ *
+ * Raw mappings are not known to the vspace, so the address is taken from the
+ * free space between RAW_MAPPING_BASE and RAW_MAPPING_LIMIT, away from the
+ * vregions placed by pmap_x86_determine_addr, and checked against the page
+ * tables. If it
+ * overlaps an existing mapping, the search continues after that mapping.
+ */
 static errval_t determine_addr_raw(struct pmap *pmap, size_t size,
                                    size_t alignment, genvaddr_t *retvaddr)
 {
+    errval_t err;
     struct pmap_x86 *x86 = (struct pmap_x86 *)pmap;
 
-    struct vnode *walk_pml4 = x86->root.u.vnode.children;
-    assert(walk_pml4 != NULL); // assume there's always at least one existing entry
-
     if (alignment == 0) {
         alignment = BASE_PAGE_SIZE;
     } else {
@@ -1081,33 +1486,28 @@ static errval_t determine_addr_raw(struct pmap *pmap, size_t size,
     size = ROUND_UP(size, alignment);
     assert(size < 512ul * 1024 * 1024 * 1024); // pml4 size
 
-    // try to find free pml4 entry
-    bool f[512];
-    for (int i = 0; i < 512; i++) {
-        f[i] = true;
-    }
-    //debug_printf("entry: %d\n", walk_pml4->entry);
-    f[walk_pml4->entry] = false;
-    while (walk_pml4) {
-        //debug_printf("looping over pml4 entries\n");
-        assert(walk_pml4->is_vnode);
-        f[walk_pml4->entry] = false;
-        walk_pml4 = walk_pml4->next;
-    }
-    genvaddr_t first_free = 16;
-    for (; first_free < 512; first_free++) {
-        //debug_printf("f[%"PRIuGENVADDR"] = %d\n", first_free, f[first_free]);
-        if (f[first_free]) {
-            break;
-        }
+    genvaddr_t maxva = RAW_MAPPING_LIMIT;
+    if (maxva > x86->max_mappable_va) {
+        maxva = x86->max_mappable_va;
     }
-    //debug_printf("first_free: %"PRIuGENVADDR"\n", first_free);
-    if (first_free < 512) {
-        //debug_printf("first_free: %"PRIuGENVADDR"\n", first_free);
-        *retvaddr = first_free << 39;
-        return SYS_ERR_OK;
-    } else {
-        return LIB_ERR_OUT_OF_VIRTUAL_ADDR;
+
+    genvaddr_t minva = RAW_MAPPING_BASE;
+    for (;;) {
+        genvaddr_t vaddr;
+        err = vspace_find_free(pmap->vspace, minva, maxva, size, alignment,
+                               &vaddr);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        genvaddr_t mapped = find_mapped(&x86->root, 0,
+                                        X86_64_HUGE_PAGE_BITS + X86_64_PTABLE_BITS,
+                                        vaddr, vaddr + size);
+        if (mapped == 0) {
+            *retvaddr = vaddr;
+            return SYS_ERR_OK;
+        }
+        minva = mapped;
     }
 }
 
@@ -1116,6 +1516,8 @@ static struct pmap_funcs pmap_funcs = {
     .determine_addr_raw = determine_addr_raw,
     .map = map,
     .unmap = unmap,
+    .map_batch = map_batch,
+    .unmap_batch = unmap_batch,
     .lookup = lookup,
     .modify_flags = modify_flags,
     .serialise = pmap_x86_serialise,
@@ -1153,11 +1555,17 @@ errval_t pmap_x86_64_init(struct pmap *pmap, struct vspace *vspace,
     slab_grow(&x86->slab, x86->slab_buffer,
               sizeof(x86->slab_buffer));
     x86->refill_slabs = min_refill_slabs;
+    slab_init(&x86->index_slab, VNODE_INDEX_SIZE, NULL);
+    x86->index_wanted = false;
+    x86->batch_busy = false;
 
     x86->root.is_vnode          = true;
     x86->root.u.vnode.cap       = vnode;
     x86->root.u.vnode.children  = NULL;
+    x86->root.u.vnode.index     = NULL;
+    x86->root.u.vnode.nchildren = 0;
     x86->root.next              = NULL;
+    x86->root.prev              = NULL;
 
     // choose a minimum mappable VA for most domains; enough to catch NULL
     // pointer derefs with suitably large offsets
@@ -1193,7 +1601,10 @@ errval_t pmap_x86_64_region_init(struct pmap_x86 *pmap,
 
     struct vspace *vspace = pmap->p.vspace;
     assert(!vspace->head);
-    vspace->head = vregion;
+    errval_t err = vspace_add_vregion(vspace, vregion);
+    if (err_is_fail(err)) {
+        return err;
+    }
 
     pmap->vregion_offset = pmap->vregion.base;
 
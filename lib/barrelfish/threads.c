@@ -239,6 +239,8 @@ static void thread_init(dispatcher_handle_t disp, struct thread *newthread)
     newthread->coreid = get_dispatcher_generic(disp)->core_id;
     newthread->userptr = NULL;
     memset(newthread->userptrs, 0, sizeof(newthread->userptrs));
+    newthread->malloc_cache = NULL;
+    newthread->malloc_cache_release = NULL;
     newthread->yield_epoch = 0;
     newthread->wakeup_reason = NULL;
     newthread->return_value = 0;
@@ -356,6 +358,10 @@ static void free_thread(struct thread *thread)
     if (thread->tls_dtv != NULL) {
         free(thread->tls_dtv);
     }
+    if (thread->malloc_cache != NULL) {
+        assert(thread->malloc_cache_release != NULL);
+        thread->malloc_cache_release(thread->malloc_cache);
+    }
 
     thread_mutex_lock(&thread_slabs_mutex);
     acquire_spinlock(&thread_slabs_spinlock);
@@ -1284,6 +1290,32 @@ void *thread_get_tls_key(int key)
     return me->userptrs[key];
 }
 
+/**
+ * \brief Set the malloc thread cache of the current thread.
+ *
+ * The release function is called with the cache when the thread is freed.
+ * This may happen on another thread and on another dispatcher.
+ *
+ * \param cache    The cache
+ * \param release  Function that returns the cache and its contents to malloc
+ */
+void thread_set_malloc_cache(void *cache,
+                             thread_malloc_cache_release_fn release)
+{
+    struct thread *me = thread_self();
+    me->malloc_cache = cache;
+    me->malloc_cache_release = release;
+}
+
+/**
+ * \brief Return the malloc thread cache of the current thread, or NULL.
+ */
+void *thread_get_malloc_cache(void)
+{
+    struct thread *me = thread_self();
+    return me->malloc_cache;
+}
+
 /**
  * \brief Set the exception handler function for the current thread.
  *        Optionally also change its stack, and return the old values.
@@ -10,6 +10,15 @@
  *
  * morecore uses this memory object so it cannot use malloc for its lists.
  * Therefore, this uses slabs and grows them using the pinned memory.
+ *
+ * With MEMOBJ_ANON_LARGE_PAGES, frames that cover whole aligned large pages
+ * are mapped with large pages, and memobj_anon_promote() replaces runs of
+ * smaller frames that fill a large page by a single large frame.
+ *
+ * If a backing store is set with memobj_anon_set_pager(), pager_free writes
+ * unpinned frames to it and releases them. They are chosen with a clock
+ * sweep over the frames, skipping frames that were faulted in since the
+ * last sweep. The page fault handler reads released frames back in.
  */
 
 /*
@@ -23,8 +32,199 @@
  */
 
 #include <barrelfish/barrelfish.h>
+#include <string.h>
 #include "vspace_internal.h"
 
+/**
+ * \brief Flags to map a frame of the memobj with into a vregion
+ *
+ * \param anon     The memory object
+ * \param vregion  The vregion to map into
+ * \param vaddr    The virtual address the frame is mapped at
+ * \param frame    The frame
+ */
+static vregion_flags_t frame_map_flags(struct memobj_anon *anon,
+                                       struct vregion *vregion,
+                                       genvaddr_t vaddr,
+                                       struct memobj_frame_list *frame)
+{
+    vregion_flags_t flags = vregion_get_flags(vregion);
+
+    if ((anon->m.flags & MEMOBJ_ANON_LARGE_PAGES)
+        && vregion_get_size(vregion) >= LARGE_PAGE_SIZE
+        && (vaddr & LARGE_PAGE_MASK) == 0
+        && ((frame->pa + frame->foffset) & LARGE_PAGE_MASK) == 0
+        && (frame->size & LARGE_PAGE_MASK) == 0) {
+        flags |= VREGION_FLAGS_LARGE;
+    }
+
+    return flags;
+}
+
+/**
+ * \brief Map a frame at a temporary location to access its contents
+ *
+ * \param frame    The frame
+ * \param size     Number of bytes of the frame to map
+ * \param retbuf   Returns the address of the mapping
+ * \param retcopy  Returns the cap copy used for the mapping
+ */
+static errval_t frame_map_tmp(struct capref frame, size_t size, void **retbuf,
+                              struct capref *retcopy)
+{
+    errval_t err;
+
+    // the frame may be mapped already, which needs a copy of the cap
+    err = slot_alloc(retcopy);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = cap_copy(*retcopy, frame);
+    if (err_is_fail(err)) {
+        slot_free(*retcopy);
+        return err_push(err, LIB_ERR_CAP_COPY);
+    }
+    err = vspace_map_one_frame(retbuf, size, *retcopy, NULL, NULL);
+    if (err_is_fail(err)) {
+        cap_destroy(*retcopy);
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+    return SYS_ERR_OK;
+}
+
+static void frame_unmap_tmp(void *buf, struct capref copy)
+{
+    errval_t err = vspace_unmap(buf);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "vspace_unmap failed");
+    }
+    err = cap_destroy(copy);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "cap_destroy failed");
+    }
+}
+
+/**
+ * \brief Remove the mappings of a frame from all vregions of the memobj
+ */
+static errval_t frame_unmap_all(struct memobj_anon *anon,
+                                struct memobj_frame_list *frame)
+{
+    errval_t err;
+
+    for (struct vregion_list *vwalk = anon->vregion_list; vwalk != NULL;
+         vwalk = vwalk->next) {
+        struct pmap *pmap = vspace_get_pmap(vregion_get_vspace(vwalk->region));
+        genvaddr_t vaddr = vregion_get_base_addr(vwalk->region)
+                           + vregion_get_offset(vwalk->region) + frame->offset;
+
+        // the frame may never have been faulted in here
+        err = pmap->f.lookup(pmap, vaddr, NULL, NULL, NULL, NULL, NULL);
+        if (err_is_fail(err)) {
+            continue;
+        }
+        err = pmap->f.unmap(pmap, vaddr, frame->size, NULL);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_PMAP_UNMAP);
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Write a frame to the backing store and release it
+ *
+ * \param anon      The memory object
+ * \param frame     The frame to evict
+ * \param retframe  Returns the frame cap, which is no longer used by the obj
+ */
+static errval_t page_out(struct memobj_anon *anon,
+                         struct memobj_frame_list *frame,
+                         struct capref *retframe)
+{
+    errval_t err;
+
+    // unmap first, so that no writes are lost
+    err = frame_unmap_all(anon, frame);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    void *buf;
+    struct capref copy;
+    err = frame_map_tmp(frame->frame, frame->foffset + frame->size, &buf, &copy);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = anon->pager->page_out(anon->pager, frame->offset,
+                                (uint8_t *)buf + frame->foffset, frame->size);
+    frame_unmap_tmp(buf, copy);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_MEMOBJ_PAGE_OUT);
+    }
+
+    *retframe = frame->frame;
+    frame->frame = NULL_CAP;
+    frame->foffset = 0;
+    frame->pa = 0;
+    frame->paged_out = true;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Allocate a new frame for an evicted frame and restore its contents
+ */
+static errval_t page_in(struct memobj_anon *anon,
+                        struct memobj_frame_list *frame)
+{
+    errval_t err;
+
+    assert(frame->paged_out);
+    if (anon->pager == NULL) {
+        return LIB_ERR_MEMOBJ_NO_PAGER;
+    }
+
+    struct capref newframe;
+    size_t retsize;
+    err = frame_alloc(&newframe, frame->size, &retsize);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+
+    void *buf;
+    struct capref copy;
+    err = frame_map_tmp(newframe, frame->size, &buf, &copy);
+    if (err_is_fail(err)) {
+        cap_destroy(newframe);
+        return err;
+    }
+    err = anon->pager->page_in(anon->pager, frame->offset, buf, frame->size);
+    frame_unmap_tmp(buf, copy);
+    if (err_is_fail(err)) {
+        cap_destroy(newframe);
+        return err_push(err, LIB_ERR_MEMOBJ_PAGE_IN);
+    }
+
+    struct frame_identity id;
+    err = invoke_frame_identify(newframe, &id);
+    assert(err_is_ok(err));
+
+    frame->frame = newframe;
+    frame->pa = id.base;
+    frame->paged_out = false;
+    return SYS_ERR_OK;
+}
+
+/// Drop the contents of an evicted frame from the backing store
+static void page_discard(struct memobj_anon *anon,
+                         struct memobj_frame_list *frame)
+{
+    assert(frame->paged_out);
+    if (anon->pager->discard) {
+        anon->pager->discard(anon->pager, frame->offset, frame->size);
+    }
+}
+
 /**
  * \brief Map the memory object into a region
  *
@@ -97,9 +297,11 @@ static errval_t unmap_region(struct memobj *memobj, struct vregion *vregion)
             continue;
         }
         else if (fwalk->offset < vregion_end) {
-            err = pmap->f.unmap(pmap, vregion_base + vregion_off, fwalk->size, NULL);
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_PMAP_UNMAP);
+            if (!fwalk->paged_out) {
+                err = pmap->f.unmap(pmap, vregion_base + vregion_off, fwalk->size, NULL);
+                if (err_is_fail(err)) {
+                    return err_push(err, LIB_ERR_PMAP_UNMAP);
+                }
             }
 
             /* Remove the vregion from the list */
@@ -179,10 +381,13 @@ static errval_t protect(struct memobj *memobj, struct vregion *vregion,
             size_t range_in_frame = fwalk->offset + fwalk->size - offset;
             size_t size = range_in_frame < range ? range_in_frame : range;
 
-            size_t retsize;
-            err = pmap->f.modify_flags(pmap, vregion_base + offset, size, flags, &retsize);
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_PMAP_MODIFY_FLAGS);
+            size_t retsize = size;
+            if (!fwalk->paged_out) {
+                err = pmap->f.modify_flags(pmap, vregion_base + offset, size,
+                                           flags, &retsize);
+                if (err_is_fail(err)) {
+                    return err_push(err, LIB_ERR_PMAP_MODIFY_FLAGS);
+                }
             }
             range -= retsize;
             offset += retsize;
@@ -207,7 +412,30 @@ static errval_t protect(struct memobj *memobj, struct vregion *vregion,
 static errval_t pin(struct memobj *memobj, struct vregion *vregion,
                     genvaddr_t offset, size_t range)
 {
-    USER_PANIC("NYI");
+    errval_t err;
+    struct memobj_anon *anon = (struct memobj_anon*)memobj;
+    bool found = false;
+
+    // pinned frames must be resident
+    for (struct memobj_frame_list *walk = anon->frame_list; walk != NULL;
+         walk = walk->next) {
+        if (walk->offset >= offset + range) {
+            break;
+        }
+        if (walk->offset + walk->size <= offset) {
+            continue;
+        }
+        if (walk->paged_out) {
+            err = page_in(anon, walk);
+            if (err_is_fail(err)) {
+                return err_push(err, LIB_ERR_MEMOBJ_PIN_REGION);
+            }
+        }
+        walk->pins++;
+        found = true;
+    }
+
+    return found ? SYS_ERR_OK : LIB_ERR_MEMOBJ_WRONG_OFFSET;
 }
 
 /**
@@ -221,7 +449,34 @@ static errval_t pin(struct memobj *memobj, struct vregion *vregion,
 static errval_t unpin(struct memobj *memobj, struct vregion *vregion,
                       genvaddr_t offset, size_t range)
 {
-    USER_PANIC("NYI");
+    struct memobj_anon *anon = (struct memobj_anon*)memobj;
+    struct memobj_frame_list *first = NULL;
+
+    // check that the whole range is pinned before changing anything
+    for (struct memobj_frame_list *walk = anon->frame_list; walk != NULL;
+         walk = walk->next) {
+        if (walk->offset >= offset + range) {
+            break;
+        }
+        if (walk->offset + walk->size <= offset) {
+            continue;
+        }
+        if (walk->pins == 0) {
+            return LIB_ERR_MEMOBJ_NOT_PINNED;
+        }
+        if (first == NULL) {
+            first = walk;
+        }
+    }
+    if (first == NULL) {
+        return LIB_ERR_MEMOBJ_WRONG_OFFSET;
+    }
+
+    for (struct memobj_frame_list *walk = first;
+         walk != NULL && walk->offset < offset + range; walk = walk->next) {
+        walk->pins--;
+    }
+    return SYS_ERR_OK;
 }
 
 /**
@@ -267,6 +522,9 @@ static errval_t fill_foff(struct memobj *memobj, genvaddr_t offset, struct capre
     new->frame   = frame;
     new->size    = size;
     new->foffset = foffset;
+    new->pins    = 0;
+    new->referenced = true;
+    new->paged_out  = false;
 
     {
         struct frame_identity id;
@@ -327,6 +585,8 @@ static errval_t fill(struct memobj *memobj, genvaddr_t offset, struct capref fra
  * This will try to remove one frame at an offset greater than the one
  * specified. Call this function again and again till it returns the
  * LIB_ERR_MEMOBJ_UNFILL_TOO_HIGH_OFFSET error to get all frames.
+ *
+ * Returns NULL_CAP as frame for frames that are in the backing store.
  */
 static errval_t unfill(struct memobj *memobj, genvaddr_t offset,
                        struct capref *ret_frame, genvaddr_t *ret_offset)
@@ -351,7 +611,10 @@ static errval_t unfill(struct memobj *memobj, genvaddr_t offset,
 
  cont:
 
-    { // Unmap the frame from all vregions
+    if (fwalk->paged_out) {
+        // nothing mapped, the contents are in the backing store
+        page_discard(anon, fwalk);
+    } else { // Unmap the frame from all vregions
         struct vregion_list *vwalk = anon->vregion_list;
         while (vwalk) {
             struct vspace *vspace = vregion_get_vspace(vwalk->region);
@@ -408,14 +671,22 @@ static errval_t pagefault(struct memobj *memobj, struct vregion *vregion,
     struct memobj_frame_list *walk = anon->frame_list;
     while (walk) {
         if (offset >= walk->offset && offset < walk->offset + walk->size) {
+            if (walk->paged_out) {
+                err = page_in(anon, walk);
+                if (err_is_fail(err)) {
+                    return err;
+                }
+            }
+            walk->referenced = true;
+
             struct vspace *vspace = vregion_get_vspace(vregion);
             struct pmap *pmap     = vspace_get_pmap(vspace);
             genvaddr_t base          = vregion_get_base_addr(vregion);
             genvaddr_t vregion_off   = vregion_get_offset(vregion);
-            vregion_flags_t flags = vregion_get_flags(vregion);
-            err = pmap->f.map(pmap, base + vregion_off + walk->offset,
-                              walk->frame, walk->foffset, walk->size, flags,
-                              NULL, NULL);
+            genvaddr_t vaddr = base + vregion_off + walk->offset;
+            vregion_flags_t flags = frame_map_flags(anon, vregion, vaddr, walk);
+            err = pmap->f.map(pmap, vaddr, walk->frame, walk->foffset,
+                              walk->size, flags, NULL, NULL);
             if (err_is_fail(err)) {
                 return err_push(err, LIB_ERR_PMAP_MAP);
             }
@@ -436,11 +707,265 @@ static errval_t pagefault(struct memobj *memobj, struct vregion *vregion,
  * \param num_frames  The number of frames returned
  *
  * This will affect all the vregions that are associated with the object
+ *
+ * Unused entries of `frames` are set to NULL_CAP. If `frames` is NULL, the
+ * freed frames are deleted. Fewer than `size` bytes are freed if there are
+ * not enough unpinned resident frames, or not enough room in `frames`.
  */
 static errval_t pager_free(struct memobj *memobj, size_t size,
                            struct capref *frames, size_t num_frames)
 {
-    USER_PANIC("NYI");
+    errval_t err;
+    struct memobj_anon *anon = (struct memobj_anon*)memobj;
+
+    if (anon->pager == NULL) {
+        return LIB_ERR_MEMOBJ_NO_PAGER;
+    }
+
+    if (frames) {
+        for (size_t i = 0; i < num_frames; i++) {
+            frames[i] = NULL_CAP;
+        }
+    }
+
+    // resume the clock sweep where the last one stopped
+    size_t nframes = 0;
+    struct memobj_frame_list *walk = NULL;
+    for (struct memobj_frame_list *f = anon->frame_list; f != NULL; f = f->next) {
+        if (walk == NULL && f->offset >= anon->clock_hand) {
+            walk = f;
+        }
+        nframes++;
+    }
+
+    size_t freed = 0, nfreed = 0;
+    // every frame gets at most a second chance
+    for (size_t steps = 0; steps < 2 * nframes && freed < size; steps++) {
+        if (frames && nfreed == num_frames) {
+            break;
+        }
+        if (walk == NULL) {
+            walk = anon->frame_list;
+        }
+
+        if (!walk->paged_out && walk->pins == 0) {
+            if (walk->referenced) {
+                walk->referenced = false;
+            } else {
+                struct capref frame;
+                err = page_out(anon, walk, &frame);
+                if (err_is_fail(err)) {
+                    return err_push(err, LIB_ERR_MEMOBJ_PAGER_FREE);
+                }
+                if (frames) {
+                    frames[nfreed] = frame;
+                } else {
+                    err = cap_destroy(frame);
+                    if (err_is_fail(err)) {
+                        DEBUG_ERR(err, "cap_destroy failed");
+                    }
+                }
+                nfreed++;
+                freed += walk->size;
+            }
+        }
+        walk = walk->next;
+    }
+    anon->clock_hand = walk ? walk->offset : 0;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Set the backing store for frames released by pager_free
+ *
+ * \param anon   The memory object
+ * \param pager  The backing store, must outlive the memory object
+ */
+void memobj_anon_set_pager(struct memobj_anon *anon,
+                           struct memobj_anon_pager *pager)
+{
+    anon->pager = pager;
+}
+
+/**
+ * \brief Replace the frames backing a large page by a single large frame
+ *
+ * \param anon     The memory object
+ * \param vregion  A vregion the frames are mapped into, used for the copy
+ * \param prev     The frame before `first` in the list, or NULL
+ * \param first    The first frame of the range
+ * \param count    The number of frames covering the range
+ *
+ * Returns LIB_ERR_MEMOBJ_NO_PROMOTE without changing anything if the
+ * allocated frame is not aligned to a large page.
+ */
+static errval_t promote_range(struct memobj_anon *anon, struct vregion *vregion,
+                              struct memobj_frame_list *prev,
+                              struct memobj_frame_list *first, size_t count)
+{
+    errval_t err;
+
+    // get a large page and copy the contents of the range into it
+    struct capref large, copy;
+    size_t retsize;
+    err = frame_alloc(&large, LARGE_PAGE_SIZE, &retsize);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+
+    struct frame_identity id;
+    err = invoke_frame_identify(large, &id);
+    assert(err_is_ok(err));
+    if ((id.base & LARGE_PAGE_MASK) != 0) {
+        cap_destroy(large);
+        return LIB_ERR_MEMOBJ_NO_PROMOTE;
+    }
+
+    void *buf;
+    err = frame_map_tmp(large, LARGE_PAGE_SIZE, &buf, &copy);
+    if (err_is_fail(err)) {
+        cap_destroy(large);
+        return err;
+    }
+
+    genvaddr_t src = vregion_get_base_addr(vregion) + vregion_get_offset(vregion)
+                     + first->offset;
+    memcpy(buf, (void *)vspace_genvaddr_to_lvaddr(src), LARGE_PAGE_SIZE);
+
+    frame_unmap_tmp(buf, copy);
+
+    // replace the mappings of the old frames in all vregions
+    struct memobj_frame_list *end = first;
+    for (size_t i = 0; i < count; i++) {
+        end = end->next;
+    }
+
+    for (struct memobj_frame_list *f = first; f != end; f = f->next) {
+        err = frame_unmap_all(anon, f);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    // replace the old frames in the list, freeing their slots as well
+    struct memobj_frame_list *walk = first->next;
+    while (walk != end) {
+        struct memobj_frame_list *next = walk->next;
+        err = cap_destroy(walk->frame);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "cap_destroy failed");
+        }
+        slab_free(&anon->frame_slab, walk);
+        walk = next;
+    }
+    err = cap_destroy(first->frame);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "cap_destroy failed");
+    }
+    first->frame   = large;
+    first->size    = LARGE_PAGE_SIZE;
+    first->foffset = 0;
+    first->pa      = id.base;
+    first->next    = end;
+    assert(prev == NULL || prev->next == first);
+
+    for (struct vregion_list *vwalk = anon->vregion_list; vwalk != NULL;
+         vwalk = vwalk->next) {
+        struct pmap *pmap = vspace_get_pmap(vregion_get_vspace(vwalk->region));
+        genvaddr_t vaddr = vregion_get_base_addr(vwalk->region)
+                           + vregion_get_offset(vwalk->region) + first->offset;
+        vregion_flags_t flags = frame_map_flags(anon, vwalk->region, vaddr, first);
+
+        err = pmap->f.map(pmap, vaddr, first->frame, 0, LARGE_PAGE_SIZE, flags,
+                          NULL, NULL);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_PMAP_MAP);
+        }
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Promote fully populated ranges of the memobj to large pages
+ *
+ * \param memobj     The memory object, created with MEMOBJ_ANON_LARGE_PAGES
+ * \param vregion    A vregion the memobj is mapped into
+ * \param ret_count  If non-NULL, returns the number of promoted large pages
+ *
+ * Looks for large page aligned ranges that are completely backed by several
+ * frames. The contents of each such range are copied into a new large page,
+ * which replaces the frames and is mapped with a single large page mapping.
+ * The old frames are deleted.
+ *
+ * Ranges that contain pinned or paged out frames are skipped.
+ *
+ * The memory is not protected while it is copied. The caller has to make
+ * sure that it is not written concurrently.
+ */
+errval_t memobj_anon_promote(struct memobj *memobj, struct vregion *vregion,
+                             size_t *ret_count)
+{
+    errval_t err;
+    struct memobj_anon *anon = (struct memobj_anon*)memobj;
+    size_t promoted = 0;
+
+    if (memobj->type != ANONYMOUS || !(memobj->flags & MEMOBJ_ANON_LARGE_PAGES)) {
+        return LIB_ERR_MEMOBJ_NO_PROMOTE;
+    }
+
+    genvaddr_t base = vregion_get_base_addr(vregion) + vregion_get_offset(vregion);
+    genvaddr_t end  = vregion_get_offset(vregion) + vregion_get_size(vregion);
+
+    struct memobj_frame_list *prev = NULL;
+    struct memobj_frame_list *walk = anon->frame_list;
+    while (walk) {
+        // find frames that start a large page and together fill it
+        if (((base + walk->offset) & LARGE_PAGE_MASK) != 0
+            || walk->size >= LARGE_PAGE_SIZE
+            || walk->offset + LARGE_PAGE_SIZE > end) {
+            prev = walk;
+            walk = walk->next;
+            continue;
+        }
+
+        size_t count = 1;
+        size_t covered = walk->size;
+        bool movable = !walk->paged_out && walk->pins == 0;
+        struct memobj_frame_list *last = walk;
+        while (covered < LARGE_PAGE_SIZE && last->next != NULL
+               && last->next->offset == last->offset + last->size) {
+            last = last->next;
+            covered += last->size;
+            movable = movable && !last->paged_out && last->pins == 0;
+            count++;
+        }
+
+        // pinned frames must stay where they are
+        if (covered != LARGE_PAGE_SIZE || !movable) {
+            prev = last;
+            walk = last->next;
+            continue;
+        }
+
+        err = promote_range(anon, vregion, prev, walk, count);
+        if (err_no(err) == LIB_ERR_MEMOBJ_NO_PROMOTE) {
+            // could not get an aligned large page, try again later
+            break;
+        } else if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_MEMOBJ_PROMOTE);
+        }
+        promoted++;
+
+        prev = walk;
+        walk = walk->next;
+    }
+
+    if (ret_count) {
+        *ret_count = promoted;
+    }
+    return SYS_ERR_OK;
 }
 
 /**
@@ -481,6 +1006,8 @@ errval_t memobj_create_anon(struct memobj_anon *anon, size_t size,
 
     anon->vregion_list = NULL;
     anon->frame_list = NULL;
+    anon->pager = NULL;
+    anon->clock_hand = 0;
     return SYS_ERR_OK;
 }
 
@@ -507,9 +1034,13 @@ errval_t memobj_destroy_anon(struct memobj *memobj)
 
     struct memobj_frame_list *fwalk = m->frame_list;
     while (fwalk) {
-        err = cap_delete(fwalk->frame);
-        if (err_is_fail(err)) {
-            return err;
+        if (fwalk->paged_out) {
+            page_discard(m, fwalk);
+        } else {
+            err = cap_delete(fwalk->frame);
+            if (err_is_fail(err)) {
+                return err;
+            }
         }
         struct memobj_frame_list *old = fwalk;
         fwalk = fwalk->next;
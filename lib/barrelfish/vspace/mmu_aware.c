@@ -49,10 +49,11 @@ errval_t vspace_mmu_aware_init(struct vspace_mmu_aware *state, size_t size)
             VREGION_FLAGS_READ_WRITE);
 }
 
-errval_t vspace_mmu_aware_init_aligned(struct vspace_mmu_aware *state,
-                                       struct slot_allocator *slot_allocator,
-                                       size_t size, size_t alignment,
-                                       vregion_flags_t flags)
+static errval_t mmu_aware_init(struct vspace_mmu_aware *state,
+                               struct slot_allocator *slot_allocator,
+                               size_t size, size_t alignment,
+                               vregion_flags_t flags,
+                               memobj_flags_t memobj_flags)
 {
     state->size = size;
     state->consumed = 0;
@@ -67,7 +68,7 @@ errval_t vspace_mmu_aware_init_aligned(struct vspace_mmu_aware *state,
     errval_t err;
 
     size = ROUND_UP(size, BASE_PAGE_SIZE);
-    err = memobj_create_anon(&state->memobj, size, 0);
+    err = memobj_create_anon(&state->memobj, size, memobj_flags);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_MEMOBJ_CREATE_ANON);
     }
@@ -83,6 +84,96 @@ errval_t vspace_mmu_aware_init_aligned(struct vspace_mmu_aware *state,
     return SYS_ERR_OK;
 }
 
+errval_t vspace_mmu_aware_init_aligned(struct vspace_mmu_aware *state,
+                                       struct slot_allocator *slot_allocator,
+                                       size_t size, size_t alignment,
+                                       vregion_flags_t flags)
+{
+    return mmu_aware_init(state, slot_allocator, size, alignment, flags, 0);
+}
+
+/**
+ * \brief Initialize vspace_mmu_aware struct with transparent large pages
+ *
+ * The region is backed by large pages wherever they can be allocated, and
+ * filled with base pages otherwise. Base pages that fill a large page can
+ * later be promoted with vspace_mmu_aware_promote().
+ */
+errval_t vspace_mmu_aware_init_promote(struct vspace_mmu_aware *state,
+                                       struct slot_allocator *slot_allocator,
+                                       size_t size, vregion_flags_t flags)
+{
+    return mmu_aware_init(state, slot_allocator, size, LARGE_PAGE_SIZE,
+                          flags & ~(VREGION_FLAGS_LARGE | VREGION_FLAGS_HUGE),
+                          MEMOBJ_ANON_LARGE_PAGES);
+}
+
+/**
+ * \brief Back the memobj at `offset` with a new frame and map it
+ *
+ * \param state     The object metadata
+ * \param offset    Offset into the memobj
+ * \param bytes     Size of the frame to create
+ * \param min_bytes Amount needed by the caller. If the memory server only
+ *                  hands out base pages and this fits into one, a base page
+ *                  is used instead.
+ * \param retbytes  Returns the size of the frame
+ */
+static errval_t mmu_aware_fill(struct vspace_mmu_aware *state,
+                               genvaddr_t offset, size_t bytes,
+                               size_t min_bytes, size_t *retbytes)
+{
+    errval_t err;
+    struct capref frame;
+    size_t ret_size;
+
+    err = state->slot_alloc->alloc(state->slot_alloc, &frame);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC_NO_SPACE);
+    }
+
+retry:
+    err = frame_create(frame, bytes, &ret_size);
+    if (err_is_fail(err)) {
+        if (err_no(err) == LIB_ERR_RAM_ALLOC_MS_CONSTRAINTS) {
+            // we can only get 4k frames for now; retry with 4k
+            if (bytes > BASE_PAGE_SIZE && min_bytes <= BASE_PAGE_SIZE) {
+                bytes = BASE_PAGE_SIZE;
+                goto retry;
+            }
+            state->slot_alloc->free(state->slot_alloc, frame);
+            return err_push(err, LIB_ERR_FRAME_CREATE_MS_CONSTRAINTS);
+        }
+        state->slot_alloc->free(state->slot_alloc, frame);
+        return err_push(err, LIB_ERR_FRAME_CREATE);
+    }
+    assert(ret_size >= min_bytes);
+
+    if (state->consumed + (offset - state->mapoffset) + ret_size > state->size) {
+        err = cap_delete(frame);
+        if (err_is_fail(err)) {
+            debug_err(__FILE__, __func__, __LINE__, err,
+                      "cap_delete failed");
+        }
+        state->slot_alloc->free(state->slot_alloc, frame);
+        return LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE;
+    }
+
+    // Map it in
+    err = state->memobj.m.f.fill(&state->memobj.m, offset, frame, ret_size);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_MEMOBJ_FILL);
+    }
+    err = state->memobj.m.f.pagefault(&state->memobj.m, &state->vregion,
+                                      offset, 0);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_MEMOBJ_PAGEFAULT_HANDLER);
+    }
+
+    *retbytes = ret_size;
+    return SYS_ERR_OK;
+}
+
 /**
  * \brief Create mappings
  *
@@ -102,8 +193,6 @@ errval_t vspace_mmu_aware_map(struct vspace_mmu_aware *state, size_t req_size,
 {
     errval_t err;
 
-    struct capref frame;
-
     // Calculate how much still to map in
     size_t origsize = req_size;
     assert(state->mapoffset >= state->offset);
@@ -114,6 +203,7 @@ errval_t vspace_mmu_aware_map(struct vspace_mmu_aware *state, size_t req_size,
     }
     size_t alloc_size = ROUND_UP(req_size, BASE_PAGE_SIZE);
     size_t ret_size = 0;
+    size_t mapped = 0;
 
     if (req_size > 0) {
 #if __x86_64__
@@ -140,51 +230,40 @@ errval_t vspace_mmu_aware_map(struct vspace_mmu_aware *state, size_t req_size,
             // if state->vregion.flags has VREGION_FLAGS_LARGE set and
             // mapoffset is aligned to at least LARGE_PAGE_SIZE.
             alloc_size = ROUND_UP(req_size, LARGE_PAGE_SIZE);
-        }
-        // Create frame of appropriate size
-allocate:
-        err = state->slot_alloc->alloc(state->slot_alloc, &frame);
-        if (err_is_fail(err)) {
-            return err_push(err, LIB_ERR_SLOT_ALLOC_NO_SPACE);
-        }
-
-        err = frame_create(frame, alloc_size, &ret_size);
-        if (err_is_fail(err)) {
-            if (err_no(err) == LIB_ERR_RAM_ALLOC_MS_CONSTRAINTS) {
-                // we can only get 4k frames for now; retry with 4k
-                if (alloc_size > BASE_PAGE_SIZE && req_size <= BASE_PAGE_SIZE) {
-                    alloc_size = BASE_PAGE_SIZE;
-                    goto allocate;
+        } else if ((state->memobj.m.flags & MEMOBJ_ANON_LARGE_PAGES) &&
+                   state->consumed + ROUND_UP(req_size, LARGE_PAGE_SIZE)
+                   <= state->size)
+        {
+            // transparent large pages: a frame that straddles a large page
+            // boundary can neither be mapped nor promoted as a large page.
+            // Up to the next boundary, use frames as large as the alignment
+            // of their offset; these double in size until they reach it.
+            genvaddr_t offset = state->mapoffset;
+            while (mapped < req_size && (offset & LARGE_PAGE_MASK) != 0) {
+                err = mmu_aware_fill(state, offset, offset & -offset,
+                                     BASE_PAGE_SIZE, &ret_size);
+                if (err_is_fail(err)) {
+                    goto out_partial;
                 }
-                return err_push(err, LIB_ERR_FRAME_CREATE_MS_CONSTRAINTS);
+                mapped += ret_size;
+                offset += ret_size;
+            }
+            if (mapped < req_size) {
+                alloc_size = ROUND_UP(req_size - mapped, LARGE_PAGE_SIZE);
             }
-            return err_push(err, LIB_ERR_FRAME_CREATE);
         }
-        assert(ret_size >= req_size);
-        origsize += ret_size - req_size;
-        req_size = ret_size;
-
-        if (state->consumed + req_size > state->size) {
-            err = cap_delete(frame);
+        // Create frame of appropriate size
+allocate:
+        if (mapped < req_size) {
+            err = mmu_aware_fill(state, state->mapoffset + mapped, alloc_size,
+                                 req_size - mapped, &ret_size);
             if (err_is_fail(err)) {
-                debug_err(__FILE__, __func__, __LINE__, err,
-                          "cap_delete failed");
+                goto out_partial;
             }
-            state->slot_alloc->free(state->slot_alloc, frame);
-            return LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE;
-        }
-
-        // Map it in
-        err = state->memobj.m.f.fill(&state->memobj.m, state->mapoffset, frame,
-                                     req_size);
-        if (err_is_fail(err)) {
-            return err_push(err, LIB_ERR_MEMOBJ_FILL);
-        }
-        err = state->memobj.m.f.pagefault(&state->memobj.m, &state->vregion,
-                                          state->mapoffset, 0);
-        if (err_is_fail(err)) {
-            return err_push(err, LIB_ERR_MEMOBJ_PAGEFAULT_HANDLER);
+            mapped += ret_size;
         }
+        origsize += mapped - req_size;
+        req_size = mapped;
     }
 
     // Return buffer
@@ -196,6 +275,11 @@ allocate:
     state->consumed += origsize;
 
     return SYS_ERR_OK;
+
+out_partial:
+    // keep what we mapped so far for the next request
+    state->mapoffset += mapped;
+    return err;
 }
 
 errval_t vspace_mmu_aware_reset(struct vspace_mmu_aware *state,
@@ -267,6 +351,21 @@ errval_t vspace_mmu_aware_reset(struct vspace_mmu_aware *state,
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Promote base pages of the region to large pages
+ *
+ * \param state      The object metadata, set up with
+ *                   vspace_mmu_aware_init_promote()
+ * \param ret_count  If non-NULL, returns the number of promoted large pages
+ *
+ * See memobj_anon_promote() for the restrictions.
+ */
+errval_t vspace_mmu_aware_promote(struct vspace_mmu_aware *state,
+                                  size_t *ret_count)
+{
+    return memobj_anon_promote(&state->memobj.m, &state->vregion, ret_count);
+}
+
 errval_t vspace_mmu_aware_unmap(struct vspace_mmu_aware *state,
                                 lvaddr_t base, size_t bytes)
 {
@@ -25,6 +25,8 @@
 #include "vspace_internal.h"
 #include <stdio.h>
 
+static void vspace_gaps_init(struct vspace *vspace);
+
 /**
  * \brief Initialize the current vspace structure
  *
@@ -38,6 +40,8 @@ errval_t vspace_current_init(bool init_domain)
 
     vspace->pmap = pmap;
     vspace->head = NULL;
+    vspace->root = NULL;
+    vspace_gaps_init(vspace);
 
     // Setup the layout
     err = vspace_layout_init(&vspace->layout);
@@ -68,6 +72,315 @@ errval_t vspace_current_init(bool init_domain)
     return SYS_ERR_OK;
 }
 
+/*
+ * The vregions of a vspace are kept both in a list sorted by base address,
+ * which the pmaps and other users walk, and in an AVL tree, which makes
+ * insert, remove and lookup logarithmic. The free space between the
+ * vregions is kept in a second AVL tree ordered by size, which gives
+ * best-fit placement in logarithmic time. Every vregion owns the gap up to
+ * the next vregion, and the vspace owns the gap in front of the first one,
+ * so the gap tree needs no memory of its own. Gap tree nodes cache the
+ * highest address covered by their subtree to skip gaps below a minimum
+ * address.
+ */
+
+#define GAP_MAX(a, b)   ((a) > (b) ? (a) : (b))
+
+/// End of the gap after the last vregion
+#define GAP_LIMIT       (~(genvaddr_t)BASE_PAGE_MASK)
+
+static inline int vregion_height(struct vregion *n)
+{
+    return n == NULL ? 0 : n->height;
+}
+
+static inline genvaddr_t vregion_end(struct vregion *n)
+{
+    return n->base + n->size;
+}
+
+/// Recomputes the height of a node from its children
+static void vregion_update(struct vregion *n)
+{
+    n->height = 1 + GAP_MAX(vregion_height(n->left), vregion_height(n->right));
+}
+
+static struct vregion *vregion_rotate_right(struct vregion *n)
+{
+    struct vregion *l = n->left;
+    n->left = l->right;
+    l->right = n;
+    vregion_update(n);
+    vregion_update(l);
+    return l;
+}
+
+static struct vregion *vregion_rotate_left(struct vregion *n)
+{
+    struct vregion *r = n->right;
+    n->right = r->left;
+    r->left = n;
+    vregion_update(n);
+    vregion_update(r);
+    return r;
+}
+
+static struct vregion *vregion_balance(struct vregion *n)
+{
+    vregion_update(n);
+
+    int balance = vregion_height(n->left) - vregion_height(n->right);
+    if (balance > 1) {
+        if (vregion_height(n->left->left) < vregion_height(n->left->right)) {
+            n->left = vregion_rotate_left(n->left);
+        }
+        return vregion_rotate_right(n);
+    } else if (balance < -1) {
+        if (vregion_height(n->right->right) < vregion_height(n->right->left)) {
+            n->right = vregion_rotate_right(n->right);
+        }
+        return vregion_rotate_left(n);
+    }
+
+    return n;
+}
+
+static struct vregion *vregion_tree_insert(struct vregion *t,
+                                           struct vregion *region)
+{
+    if (t == NULL) {
+        region->left = region->right = NULL;
+        vregion_update(region);
+        return region;
+    }
+
+    if (region->base < t->base) {
+        t->left = vregion_tree_insert(t->left, region);
+    } else {
+        t->right = vregion_tree_insert(t->right, region);
+    }
+    return vregion_balance(t);
+}
+
+static struct vregion *vregion_tree_remove_min(struct vregion *t)
+{
+    if (t->left == NULL) {
+        return t->right;
+    }
+    t->left = vregion_tree_remove_min(t->left);
+    return vregion_balance(t);
+}
+
+static struct vregion *vregion_tree_remove(struct vregion *t,
+                                           struct vregion *region)
+{
+    assert(t != NULL);
+
+    if (region->base < t->base) {
+        t->left = vregion_tree_remove(t->left, region);
+    } else if (region->base > t->base) {
+        t->right = vregion_tree_remove(t->right, region);
+    } else {
+        assert(t == region);
+        if (t->left == NULL) {
+            return t->right;
+        } else if (t->right == NULL) {
+            return t->left;
+        }
+        struct vregion *min = t->right;
+        while (min->left != NULL) {
+            min = min->left;
+        }
+        min->right = vregion_tree_remove_min(t->right);
+        min->left = t->left;
+        t = min;
+    }
+    return vregion_balance(t);
+}
+
+/// Returns the vregion with the highest base address <= addr, or NULL
+static struct vregion *vregion_tree_floor(struct vregion *t, genvaddr_t addr)
+{
+    struct vregion *floor = NULL;
+    while (t != NULL) {
+        if (t->base <= addr) {
+            floor = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return floor;
+}
+
+/// Returns the vregion with the lowest base address > addr, or NULL
+static struct vregion *vregion_tree_higher(struct vregion *t, genvaddr_t addr)
+{
+    struct vregion *higher = NULL;
+    while (t != NULL) {
+        if (t->base > addr) {
+            higher = t;
+            t = t->left;
+        } else {
+            t = t->right;
+        }
+    }
+    return higher;
+}
+
+static inline int gap_height(struct vspace_gap *g)
+{
+    return g == NULL ? 0 : g->height;
+}
+
+/// Orders gaps by size, then by address
+static inline bool gap_less(struct vspace_gap *a, struct vspace_gap *b)
+{
+    if (a->size != b->size) {
+        return a->size < b->size;
+    }
+    if (a->start != b->start) {
+        return a->start < b->start;
+    }
+    return a < b;
+}
+
+static inline genvaddr_t gap_limit(struct vspace_gap *g)
+{
+    return g->start + g->size;
+}
+
+/// Recomputes the cached subtree information of a node from its children
+static void gap_update(struct vspace_gap *g)
+{
+    g->height = 1 + GAP_MAX(gap_height(g->left), gap_height(g->right));
+    g->max_limit = gap_limit(g);
+    if (g->left != NULL) {
+        g->max_limit = GAP_MAX(g->max_limit, g->left->max_limit);
+    }
+    if (g->right != NULL) {
+        g->max_limit = GAP_MAX(g->max_limit, g->right->max_limit);
+    }
+}
+
+static struct vspace_gap *gap_rotate_right(struct vspace_gap *g)
+{
+    struct vspace_gap *l = g->left;
+    g->left = l->right;
+    l->right = g;
+    gap_update(g);
+    gap_update(l);
+    return l;
+}
+
+static struct vspace_gap *gap_rotate_left(struct vspace_gap *g)
+{
+    struct vspace_gap *r = g->right;
+    g->right = r->left;
+    r->left = g;
+    gap_update(g);
+    gap_update(r);
+    return r;
+}
+
+static struct vspace_gap *gap_balance(struct vspace_gap *g)
+{
+    gap_update(g);
+
+    int balance = gap_height(g->left) - gap_height(g->right);
+    if (balance > 1) {
+        if (gap_height(g->left->left) < gap_height(g->left->right)) {
+            g->left = gap_rotate_left(g->left);
+        }
+        return gap_rotate_right(g);
+    } else if (balance < -1) {
+        if (gap_height(g->right->right) < gap_height(g->right->left)) {
+            g->right = gap_rotate_right(g->right);
+        }
+        return gap_rotate_left(g);
+    }
+
+    return g;
+}
+
+static struct vspace_gap *gap_tree_insert(struct vspace_gap *t,
+                                          struct vspace_gap *gap)
+{
+    if (t == NULL) {
+        gap->left = gap->right = NULL;
+        gap_update(gap);
+        return gap;
+    }
+
+    if (gap_less(gap, t)) {
+        t->left = gap_tree_insert(t->left, gap);
+    } else {
+        t->right = gap_tree_insert(t->right, gap);
+    }
+    return gap_balance(t);
+}
+
+static struct vspace_gap *gap_tree_remove_min(struct vspace_gap *t)
+{
+    if (t->left == NULL) {
+        return t->right;
+    }
+    t->left = gap_tree_remove_min(t->left);
+    return gap_balance(t);
+}
+
+static struct vspace_gap *gap_tree_remove(struct vspace_gap *t,
+                                          struct vspace_gap *gap)
+{
+    assert(t != NULL);
+
+    if (gap_less(gap, t)) {
+        t->left = gap_tree_remove(t->left, gap);
+    } else if (gap_less(t, gap)) {
+        t->right = gap_tree_remove(t->right, gap);
+    } else {
+        assert(t == gap);
+        if (t->left == NULL) {
+            return t->right;
+        } else if (t->right == NULL) {
+            return t->left;
+        }
+        struct vspace_gap *min = t->right;
+        while (min->left != NULL) {
+            min = min->left;
+        }
+        min->right = gap_tree_remove_min(t->right);
+        min->left = t->left;
+        t = min;
+    }
+    return gap_balance(t);
+}
+
+/// Returns the gap in front of region, whose owner is prev or the vspace
+static inline struct vspace_gap *gap_before(struct vspace *vspace,
+                                            struct vregion *prev)
+{
+    return prev != NULL ? &prev->gap : &vspace->head_gap;
+}
+
+/**
+ * Moves gap to [start, limit) and reinserts it into the gap tree. vregions
+ * are treated as if their size was rounded up to full pages.
+ */
+static void gap_set(struct vspace *vspace, struct vspace_gap *gap,
+                    genvaddr_t start, genvaddr_t limit)
+{
+    gap->start = ROUND_UP(start, BASE_PAGE_SIZE);
+    gap->size = limit > gap->start ? limit - gap->start : 0;
+    vspace->gaps = gap_tree_insert(vspace->gaps, gap);
+}
+
+static void vspace_gaps_init(struct vspace *vspace)
+{
+    vspace->gaps = NULL;
+    gap_set(vspace, &vspace->head_gap, 0, GAP_LIMIT);
+}
+
 /**
  * \brief Add a new region into the vspace
  *
@@ -82,45 +395,33 @@ errval_t vspace_add_vregion(struct vspace *vspace, struct vregion *region)
     assert(region->size > 0);
     assert(region->base + region->size > region->base);
 
-    if (vspace->head == NULL) {
-        vspace->head = region;
-        region->next = NULL;
-        return SYS_ERR_OK;
-    }
-
-    // Insert in order
-    struct vregion *walk = vspace->head;
-    struct vregion *prev = NULL;
-    while (walk != NULL) {
-        if (region->base <= walk->base) {
-            /* check for overlaps! */
-            if (region->base + region->size > walk->base
-                || (prev != NULL && prev->base + prev->size > region->base)) {
-                return LIB_ERR_VSPACE_REGION_OVERLAP;
-            }
-
-            /* add here */
-            if (prev == NULL) {
-                region->next = vspace->head;
-                vspace->head = region;
-            } else {
-                prev->next = region;
-                region->next = walk;
-            }
-            return SYS_ERR_OK;
-        }
-
-        prev = walk;
-        walk = walk->next;
+    /* check for overlaps with the neighbours */
+    struct vregion *prev = vregion_tree_floor(vspace->root, region->base);
+    struct vregion *next = vregion_tree_higher(vspace->root, region->base);
+    if ((prev != NULL && vregion_end(prev) > region->base)
+        || (next != NULL && vregion_end(region) > next->base)) {
+        return LIB_ERR_VSPACE_REGION_OVERLAP;
     }
 
-    /* add to end of list, checking for overlap with last item */
-    assert(prev != NULL);
-    if (prev->base + prev->size > region->base) {
-        return LIB_ERR_VSPACE_REGION_OVERLAP;
+    /* add to list */
+    if (prev == NULL) {
+        region->next = vspace->head;
+        vspace->head = region;
+    } else {
+        assert(prev->next == next);
+        region->next = prev->next;
+        prev->next = region;
     }
-    prev->next = region;
-    region->next = NULL;
+
+    vspace->root = vregion_tree_insert(vspace->root, region);
+
+    /* split the gap the region was placed into */
+    struct vspace_gap *gap = gap_before(vspace, prev);
+    vspace->gaps = gap_tree_remove(vspace->gaps, gap);
+    gap_set(vspace, gap, gap->start, region->base);
+    gap_set(vspace, &region->gap, vregion_end(region),
+            next != NULL ? next->base : GAP_LIMIT);
+
     return SYS_ERR_OK;
 }
 
@@ -135,25 +436,139 @@ errval_t vspace_add_vregion(struct vspace *vspace, struct vregion *region)
 errval_t vspace_remove_vregion(struct vspace *vspace, struct vregion* region)
 {
     assert(vspace != NULL);
-    struct vregion *walk = vspace->head;
-    struct vregion *prev = NULL;
-
-    while (walk) {
-        if (walk == region) {
-            if (prev) {
-                assert(prev->next == walk);
-                prev->next = walk->next;
-            } else {
-                assert(walk == vspace->head);
-                vspace->head = walk->next;
-            }
-            return SYS_ERR_OK;
+
+    if (vregion_tree_floor(vspace->root, region->base) != region) {
+        return LIB_ERR_VREGION_NOT_FOUND;
+    }
+
+    struct vregion *prev = region->base == 0 ? NULL
+                           : vregion_tree_floor(vspace->root, region->base - 1);
+    if (prev != NULL) {
+        assert(prev->next == region);
+        prev->next = region->next;
+    } else {
+        assert(region == vspace->head);
+        vspace->head = region->next;
+    }
+
+    vspace->root = vregion_tree_remove(vspace->root, region);
+
+    /* merge the gap of the region into the gap in front of it */
+    struct vspace_gap *gap = gap_before(vspace, prev);
+    vspace->gaps = gap_tree_remove(vspace->gaps, gap);
+    vspace->gaps = gap_tree_remove(vspace->gaps, &region->gap);
+    gap_set(vspace, gap, gap->start,
+            region->next != NULL ? region->next->base : GAP_LIMIT);
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Find the vregion containing the given address
+ *
+ * \param addr  The address
+ *
+ * Library internal function
+ */
+struct vregion *vspace_find_vregion(struct vspace *vspace, genvaddr_t addr)
+{
+    struct vregion *t = vspace->root;
+    while (t != NULL) {
+        if (addr < t->base) {
+            t = t->left;
+        } else if (addr >= vregion_end(t)) {
+            t = t->right;
+        } else {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/// Arguments of a free space search
+struct find_free_args {
+    genvaddr_t minva, maxva;
+    size_t size, alignment;
+};
+
+/// Returns the aligned address of the block in gap, or 0 if it does not fit
+static genvaddr_t gap_fit(struct vspace_gap *gap, struct find_free_args *a)
+{
+    genvaddr_t start = GAP_MAX(gap->start, a->minva);
+    genvaddr_t limit = gap_limit(gap);
+    if (limit > a->maxva) {
+        limit = a->maxva;
+    }
+
+    genvaddr_t vaddr = ROUND_UP(start, a->alignment);
+    if (vaddr >= start && vaddr <= limit && a->size <= limit - vaddr) {
+        return vaddr;
+    }
+    return 0;
+}
+
+/// Searches the subtree for the smallest gap the block fits in
+static genvaddr_t gap_tree_find(struct vspace_gap *t, struct find_free_args *a)
+{
+    /* nothing in the subtree reaches far enough beyond minva */
+    if (t == NULL || t->max_limit < a->minva + a->size) {
+        return 0;
+    }
+
+    /* the left subtree only has smaller gaps */
+    if (t->size >= a->size) {
+        genvaddr_t vaddr = gap_tree_find(t->left, a);
+        if (vaddr != 0) {
+            return vaddr;
         }
-        prev = walk;
-        walk = walk->next;
+
+        vaddr = gap_fit(t, a);
+        if (vaddr != 0) {
+            return vaddr;
+        }
+    }
+
+    return gap_tree_find(t->right, a);
+}
+
+/**
+ * \brief Find free virtual address space in the vspace
+ *
+ * Returns an address in [minva, maxva) that is aligned to alignment and not
+ * covered by any vregion for size bytes. The block is placed into the
+ * smallest gap between vregions it fits in, at the lowest aligned address of
+ * that gap. vregions are treated as if their size was rounded up to full
+ * pages.
+ *
+ * \param minva     The lowest acceptable address
+ * \param maxva     The end of the acceptable address range
+ * \param size      The size of the free space
+ * \param alignment The alignment of the free space, a power of two
+ * \param retvaddr  Returns the address of the free space
+ *
+ * Library internal function
+ */
+errval_t vspace_find_free(struct vspace *vspace, genvaddr_t minva,
+                          genvaddr_t maxva, size_t size, size_t alignment,
+                          genvaddr_t *retvaddr)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    assert(minva > 0 && size > 0);
+
+    struct find_free_args args = {
+        .minva = minva,
+        .maxva = maxva,
+        .size = size,
+        .alignment = alignment,
+    };
+
+    genvaddr_t vaddr = gap_tree_find(vspace->gaps, &args);
+    if (vaddr == 0) {
+        return LIB_ERR_OUT_OF_VIRTUAL_ADDR;
     }
 
-    return LIB_ERR_VREGION_NOT_FOUND;
+    *retvaddr = vaddr;
+    return SYS_ERR_OK;
 }
 
 /**
@@ -170,6 +585,8 @@ errval_t vspace_init(struct vspace *vspace, struct pmap *pmap)
 
     vspace->pmap = pmap;
     vspace->head = NULL;
+    vspace->root = NULL;
+    vspace_gaps_init(vspace);
 
     // Setup the layout
     err = vspace_layout_init(&vspace->layout);
@@ -198,16 +615,7 @@ struct vregion* vspace_get_region(struct vspace *vspace, const void *addr)
     lvaddr_t lvaddr = (lvaddr_t)addr;
     genvaddr_t genvaddr = vspace_lvaddr_to_genvaddr(lvaddr);
 
-    struct vregion *walk = vspace->head;
-    while (walk) {
-        if (walk->base <= genvaddr &&
-            walk->base + walk->size > genvaddr) {
-            return walk;
-        }
-        walk = walk->next;
-    }
-
-    return NULL;
+    return vspace_find_vregion(vspace, genvaddr);
 }
 
 /**
@@ -227,19 +635,14 @@ errval_t vspace_pagefault_handler(struct vspace *vspace, lvaddr_t lvaddr,
     genvaddr_t genvaddr =
         vspace_layout_lvaddr_to_genvaddr(&vspace->layout, lvaddr);
 
-    struct vregion *walk = vspace->head;
-    while(walk != NULL) {
-        genvaddr_t base = vregion_get_base_addr(walk);
-        genvaddr_t size = vregion_get_size(walk);
-        if (genvaddr >= base && genvaddr < base + size) {
-            err = vregion_pagefault_handler(walk, genvaddr, type);
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_VREGION_PAGEFAULT_HANDLER);
-            }
-            return SYS_ERR_OK;
-        }
-        walk = walk->next;
+    struct vregion *region = vspace_find_vregion(vspace, genvaddr);
+    if (region == NULL) {
+        return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
     }
 
-    return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
+    err = vregion_pagefault_handler(region, genvaddr, type);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VREGION_PAGEFAULT_HANDLER);
+    }
+    return SYS_ERR_OK;
 }
@@ -26,6 +26,10 @@ enum slab_type {
 
 errval_t vspace_add_vregion(struct vspace* vspace, struct vregion* region);
 errval_t vspace_remove_vregion(struct vspace*qvspace, struct vregion* region);
+struct vregion *vspace_find_vregion(struct vspace *vspace, genvaddr_t addr);
+errval_t vspace_find_free(struct vspace *vspace, genvaddr_t minva,
+                          genvaddr_t maxva, size_t size, size_t alignment,
+                          genvaddr_t *retvaddr);
 
 errval_t vspace_pinned_init(void);
 errval_t vspace_pinned_alloc(void **retbuf, enum slab_type slab_type);
@@ -0,0 +1,903 @@
+/**
+ * \file
+ * \brief B+-tree index for the mapping database
+ *
+ * See mdb_btree.h. Every operation first locates a leaf position by its key.
+ * A position may point one past the last entry of a leaf, in which case it
+ * refers to the first entry of the next leaf.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <mdb/mdb_btree.h>
+#include <mdb/mdb_tree.h>
+#include <cap_predicates.h>
+#include <barrelfish_kpi/capabilities.h>
+#include <capabilities.h>
+#include <assert.h>
+#include <string.h>
+
+#ifdef C
+#undef C
+#endif
+#define C(cte) (&(cte)->cap)
+
+/// Search key, the fields of a cap that determine its place in the tree
+struct mdb_btree_key {
+    mdb_root_t root;
+    genpaddr_t base, end;
+    struct capability *cap;
+};
+
+/// Position of an entry in a leaf
+struct mdb_btree_pos {
+    struct mdb_btree_node *leaf;
+    int idx;
+};
+
+static void
+mdb_btree_make_key(struct capability *cap, struct mdb_btree_key *key)
+{
+    key->root = get_type_root(cap->type);
+    key->base = get_address(cap);
+    key->end = key->base + get_size(cap);
+    key->cap = cap;
+}
+
+static void
+mdb_btree_entry_key(struct mdb_btree_node *node, int i,
+                    struct mdb_btree_key *key)
+{
+    key->root = node->root[i];
+    key->base = node->base[i];
+    key->end = node->end[i];
+    key->cap = C(node->cte[i]);
+}
+
+/**
+ * \brief Compare a key with entry i of a node, same as compare_caps()
+ *
+ * Only looks at the cap if type root, base and end are equal.
+ */
+static int
+mdb_btree_compare(struct mdb_btree_key *key, struct mdb_btree_node *node,
+                  int i, bool tiebreak)
+{
+    if (key->root != node->root[i]) {
+        return key->root < node->root[i] ? -1 : 1;
+    }
+    if (key->base != node->base[i]) {
+        return key->base < node->base[i] ? -1 : 1;
+    }
+    if (key->end != node->end[i]) {
+        // larger caps come first
+        return key->end > node->end[i] ? -1 : 1;
+    }
+    return compare_caps(key->cap, C(node->cte[i]), tiebreak);
+}
+
+/// Greatest (root, end) in the subtree of entry i of a node
+static void
+mdb_btree_max(struct mdb_btree_node *node, int i, mdb_root_t *root,
+              genpaddr_t *end)
+{
+    if (node->height == 0) {
+        *root = node->root[i];
+        *end = node->end[i];
+    }
+    else {
+        *root = node->max_root[i];
+        *end = node->max_end[i];
+    }
+}
+
+/*
+ * Node helpers
+ */
+
+/// Move n entries or children from src, starting at si, to dst at di
+static void
+mdb_btree_move(struct mdb_btree_node *dst, int di, struct mdb_btree_node *src,
+               int si, int n)
+{
+    if (n <= 0) {
+        return;
+    }
+    memmove(&dst->root[di], &src->root[si], n * sizeof(dst->root[0]));
+    memmove(&dst->base[di], &src->base[si], n * sizeof(dst->base[0]));
+    memmove(&dst->end[di], &src->end[si], n * sizeof(dst->end[0]));
+    memmove(&dst->cte[di], &src->cte[si], n * sizeof(dst->cte[0]));
+    if (src->height > 0) {
+        memmove(&dst->max_root[di], &src->max_root[si],
+                n * sizeof(dst->max_root[0]));
+        memmove(&dst->max_end[di], &src->max_end[si],
+                n * sizeof(dst->max_end[0]));
+        memmove(&dst->child[di], &src->child[si], n * sizeof(dst->child[0]));
+    }
+}
+
+/// Greatest (root, end) in the subtree of a node
+static void
+mdb_btree_subtree_max(struct mdb_btree_node *node, mdb_root_t *root,
+                      genpaddr_t *end)
+{
+    *root = 0;
+    *end = 0;
+    for (int i = 0; i < node->count; i++) {
+        mdb_root_t r;
+        genpaddr_t e;
+        mdb_btree_max(node, i, &r, &e);
+        if (r > *root || (r == *root && e > *end)) {
+            *root = r;
+            *end = e;
+        }
+    }
+}
+
+/// Update the key and end of child i after its subtree changed
+static void
+mdb_btree_update(struct mdb_btree_node *node, int i)
+{
+    struct mdb_btree_node *child = node->child[i];
+    assert(child->count > 0);
+
+    node->root[i] = child->root[0];
+    node->base[i] = child->base[0];
+    node->end[i] = child->end[0];
+    node->cte[i] = child->cte[0];
+    mdb_btree_subtree_max(child, &node->max_root[i], &node->max_end[i]);
+}
+
+static struct mdb_btree_node *
+mdb_btree_take_spare(struct mdb_btree *tree, uint8_t height)
+{
+    struct mdb_btree_node *node = tree->spare;
+    assert(node);
+    tree->spare = node->next;
+    tree->spare_count--;
+
+    memset(node, 0, sizeof(*node));
+    node->height = height;
+    return node;
+}
+
+/**
+ * \brief Move the upper half of a full node to a new sibling
+ */
+static struct mdb_btree_node *
+mdb_btree_split(struct mdb_btree *tree, struct mdb_btree_node *node)
+{
+    assert(node->count == MDB_BTREE_FANOUT);
+    struct mdb_btree_node *sib = mdb_btree_take_spare(tree, node->height);
+    int half = MDB_BTREE_FANOUT / 2;
+
+    mdb_btree_move(sib, 0, node, half, MDB_BTREE_FANOUT - half);
+    sib->count = MDB_BTREE_FANOUT - half;
+    node->count = half;
+
+    if (node->height == 0) {
+        sib->prev = node;
+        sib->next = node->next;
+        if (node->next) {
+            node->next->prev = sib;
+        }
+        node->next = sib;
+    }
+    return sib;
+}
+
+/**
+ * \brief Make room for an entry at position i, splitting the node if full
+ *
+ * \param node  Node to insert in, updated to the node that got the slot
+ * \param i     Position to insert at, updated to the position in *node
+ * \returns The new sibling if the node was split, NULL otherwise
+ */
+static struct mdb_btree_node *
+mdb_btree_open_slot(struct mdb_btree *tree, struct mdb_btree_node **node,
+                    int *i)
+{
+    struct mdb_btree_node *sib = NULL;
+    if ((*node)->count == MDB_BTREE_FANOUT) {
+        sib = mdb_btree_split(tree, *node);
+        if (*i > (*node)->count) {
+            *i -= (*node)->count;
+            *node = sib;
+        }
+    }
+    mdb_btree_move(*node, *i + 1, *node, *i, (*node)->count - *i);
+    (*node)->count++;
+    return sib;
+}
+
+/// Index of the child whose subtree contains the place of key
+static int
+mdb_btree_child_index(struct mdb_btree_key *key, struct mdb_btree_node *node)
+{
+    int i = 1;
+    while (i < node->count && mdb_btree_compare(key, node, i, true) >= 0) {
+        i++;
+    }
+    return i - 1;
+}
+
+/*
+ * Searching
+ */
+
+/**
+ * \brief Find the position of the first entry that is greater than key, or
+ *        greater or equal if equal_ok is set
+ */
+static struct mdb_btree_pos
+mdb_btree_search(struct mdb_btree *tree, struct mdb_btree_key *key,
+                 bool equal_ok, bool tiebreak)
+{
+    struct mdb_btree_pos pos = { .leaf = NULL, .idx = 0 };
+    struct mdb_btree_node *node = tree->root;
+    if (!node) {
+        return pos;
+    }
+
+    // entries with a compare result of at least limit come before the
+    // position
+    int limit = equal_ok ? 1 : 0;
+    while (node->height > 0) {
+        int i = 1;
+        while (i < node->count &&
+               mdb_btree_compare(key, node, i, tiebreak) >= limit)
+        {
+            i++;
+        }
+        node = node->child[i - 1];
+    }
+
+    int i = 0;
+    while (i < node->count &&
+           mdb_btree_compare(key, node, i, tiebreak) >= limit)
+    {
+        i++;
+    }
+
+    pos.leaf = node;
+    pos.idx = i;
+    return pos;
+}
+
+/// Move a position past the end of a leaf to the next leaf. Returns false if
+/// there is no entry at the position.
+static bool
+mdb_btree_pos_valid(struct mdb_btree_pos *pos)
+{
+    while (pos->leaf && pos->idx >= pos->leaf->count) {
+        pos->leaf = pos->leaf->next;
+        pos->idx = 0;
+    }
+    return pos->leaf != NULL;
+}
+
+/// Move a position to the previous entry. Returns false if there is none.
+static bool
+mdb_btree_pos_prev(struct mdb_btree_pos *pos)
+{
+    if (!pos->leaf) {
+        return false;
+    }
+    if (pos->idx > 0) {
+        pos->idx--;
+        return true;
+    }
+    pos->leaf = pos->leaf->prev;
+    if (pos->leaf) {
+        pos->idx = pos->leaf->count - 1;
+    }
+    return pos->leaf != NULL;
+}
+
+struct cte *
+mdb_btree_find_equal(struct mdb_btree *tree, struct capability *cap)
+{
+    struct mdb_btree_key key;
+    mdb_btree_make_key(cap, &key);
+
+    struct mdb_btree_pos pos = mdb_btree_search(tree, &key, true, false);
+    if (mdb_btree_pos_valid(&pos) &&
+        mdb_btree_compare(&key, pos.leaf, pos.idx, false) == 0)
+    {
+        return pos.leaf->cte[pos.idx];
+    }
+    return NULL;
+}
+
+struct cte *
+mdb_btree_find_less(struct mdb_btree *tree, struct capability *cap,
+                    bool equal_ok)
+{
+    struct mdb_btree_key key;
+    mdb_btree_make_key(cap, &key);
+
+    struct mdb_btree_pos pos = mdb_btree_search(tree, &key, !equal_ok, false);
+    if (mdb_btree_pos_prev(&pos)) {
+        return pos.leaf->cte[pos.idx];
+    }
+    return NULL;
+}
+
+struct cte *
+mdb_btree_find_greater(struct mdb_btree *tree, struct capability *cap,
+                       bool equal_ok)
+{
+    struct mdb_btree_key key;
+    mdb_btree_make_key(cap, &key);
+
+    struct mdb_btree_pos pos = mdb_btree_search(tree, &key, equal_ok, false);
+    if (mdb_btree_pos_valid(&pos)) {
+        return pos.leaf->cte[pos.idx];
+    }
+    return NULL;
+}
+
+struct cte *
+mdb_btree_predecessor(struct mdb_btree *tree, struct cte *current)
+{
+    struct mdb_btree_key key;
+    mdb_btree_make_key(C(current), &key);
+
+    struct mdb_btree_pos pos = mdb_btree_search(tree, &key, true, true);
+    if (mdb_btree_pos_prev(&pos)) {
+        return pos.leaf->cte[pos.idx];
+    }
+    return NULL;
+}
+
+struct cte *
+mdb_btree_successor(struct mdb_btree *tree, struct cte *current)
+{
+    struct cte *ret;
+    if (mdb_btree_successors(tree, current, &ret, 1) == 1) {
+        return ret;
+    }
+    return NULL;
+}
+
+size_t
+mdb_btree_successors(struct mdb_btree *tree, struct cte *current,
+                     struct cte **ret, size_t max)
+{
+    struct mdb_btree_key key;
+    mdb_btree_make_key(C(current), &key);
+
+    struct mdb_btree_pos pos = mdb_btree_search(tree, &key, false, true);
+    size_t count = 0;
+    while (count < max && mdb_btree_pos_valid(&pos)) {
+        ret[count++] = pos.leaf->cte[pos.idx++];
+    }
+    return count;
+}
+
+/*
+ * Insertion and removal
+ */
+
+static errval_t
+mdb_btree_sub_insert(struct mdb_btree *tree, struct mdb_btree_node *node,
+                     struct mdb_btree_key *key, struct cte *cte,
+                     struct mdb_btree_node **ret_split)
+{
+    errval_t err;
+    *ret_split = NULL;
+
+    if (node->height == 0) {
+        int i = 0, compare = 1;
+        while (i < node->count &&
+               (compare = mdb_btree_compare(key, node, i, true)) > 0)
+        {
+            i++;
+        }
+        if (i < node->count && compare == 0) {
+            return CAPS_ERR_MDB_DUPLICATE_ENTRY;
+        }
+
+        *ret_split = mdb_btree_open_slot(tree, &node, &i);
+        node->root[i] = key->root;
+        node->base[i] = key->base;
+        node->end[i] = key->end;
+        node->cte[i] = cte;
+        return SYS_ERR_OK;
+    }
+
+    int i = mdb_btree_child_index(key, node);
+    struct mdb_btree_node *child_split;
+    err = mdb_btree_sub_insert(tree, node->child[i], key, cte, &child_split);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    mdb_btree_update(node, i);
+
+    if (child_split) {
+        i++;
+        *ret_split = mdb_btree_open_slot(tree, &node, &i);
+        node->child[i] = child_split;
+        mdb_btree_update(node, i);
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t
+mdb_btree_insert(struct mdb_btree *tree, struct cte *cte)
+{
+    errval_t err;
+
+    // reserve enough nodes to split every node on the path and add a root,
+    // so we never have to undo a partial insert
+    size_t needed = tree->root ? tree->root->height + 2 : 1;
+    while (tree->spare_count < needed) {
+        struct mdb_btree_node *node = tree->alloc(tree->alloc_st);
+        if (!node) {
+            return CAPS_ERR_MDB_NODE_ALLOC;
+        }
+        node->next = tree->spare;
+        tree->spare = node;
+        tree->spare_count++;
+    }
+
+    struct mdb_btree_key key;
+    mdb_btree_make_key(C(cte), &key);
+
+    if (!tree->root) {
+        struct mdb_btree_node *leaf = mdb_btree_take_spare(tree, 0);
+        leaf->count = 1;
+        leaf->root[0] = key.root;
+        leaf->base[0] = key.base;
+        leaf->end[0] = key.end;
+        leaf->cte[0] = cte;
+        tree->root = leaf;
+        return SYS_ERR_OK;
+    }
+
+    struct mdb_btree_node *split;
+    err = mdb_btree_sub_insert(tree, tree->root, &key, cte, &split);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (split) {
+        struct mdb_btree_node *old = tree->root;
+        struct mdb_btree_node *root = mdb_btree_take_spare(tree,
+                                                           old->height + 1);
+        root->count = 2;
+        root->child[0] = old;
+        root->child[1] = split;
+        mdb_btree_update(root, 0);
+        mdb_btree_update(root, 1);
+        tree->root = root;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Refill child i after it dropped below MDB_BTREE_MIN_FILL, from a
+ *        neighbour or by merging it with one
+ */
+static void
+mdb_btree_rebalance(struct mdb_btree *tree, struct mdb_btree_node *node, int i)
+{
+    struct mdb_btree_node *child = node->child[i];
+    struct mdb_btree_node *left = i > 0 ? node->child[i - 1] : NULL;
+    struct mdb_btree_node *right =
+        i + 1 < node->count ? node->child[i + 1] : NULL;
+
+    if (left && left->count > MDB_BTREE_MIN_FILL) {
+        // take the last entry of the left neighbour
+        mdb_btree_move(child, 1, child, 0, child->count);
+        mdb_btree_move(child, 0, left, left->count - 1, 1);
+        child->count++;
+        left->count--;
+        mdb_btree_update(node, i - 1);
+        mdb_btree_update(node, i);
+    }
+    else if (right && right->count > MDB_BTREE_MIN_FILL) {
+        // take the first entry of the right neighbour
+        mdb_btree_move(child, child->count, right, 0, 1);
+        mdb_btree_move(right, 0, right, 1, right->count - 1);
+        child->count++;
+        right->count--;
+        mdb_btree_update(node, i);
+        mdb_btree_update(node, i + 1);
+    }
+    else {
+        // merge the right one of child and a neighbour into the left one
+        assert(left || right);
+        if (left) {
+            right = child;
+            i--;
+        }
+        else {
+            left = child;
+        }
+        assert(left->count + right->count <= MDB_BTREE_FANOUT);
+
+        mdb_btree_move(left, left->count, right, 0, right->count);
+        left->count += right->count;
+        if (left->height == 0) {
+            left->next = right->next;
+            if (right->next) {
+                right->next->prev = left;
+            }
+        }
+        mdb_btree_move(node, i + 1, node, i + 2, node->count - i - 2);
+        node->count--;
+        tree->free(tree->alloc_st, right);
+        mdb_btree_update(node, i);
+    }
+}
+
+static errval_t
+mdb_btree_sub_remove(struct mdb_btree *tree, struct mdb_btree_node *node,
+                     struct mdb_btree_key *key)
+{
+    errval_t err;
+
+    if (node->height == 0) {
+        int i = 0, compare = 1;
+        while (i < node->count &&
+               (compare = mdb_btree_compare(key, node, i, true)) > 0)
+        {
+            i++;
+        }
+        if (i == node->count || compare != 0) {
+            return CAPS_ERR_MDB_ENTRY_NOTFOUND;
+        }
+
+        mdb_btree_move(node, i, node, i + 1, node->count - i - 1);
+        node->count--;
+        return SYS_ERR_OK;
+    }
+
+    int i = mdb_btree_child_index(key, node);
+    err = mdb_btree_sub_remove(tree, node->child[i], key);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (node->child[i]->count < MDB_BTREE_MIN_FILL) {
+        mdb_btree_rebalance(tree, node, i);
+    }
+    else {
+        mdb_btree_update(node, i);
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t
+mdb_btree_remove(struct mdb_btree *tree, struct cte *cte)
+{
+    errval_t err;
+    struct mdb_btree_node *root = tree->root;
+    if (!root) {
+        return CAPS_ERR_MDB_ENTRY_NOTFOUND;
+    }
+
+    struct mdb_btree_key key;
+    mdb_btree_make_key(C(cte), &key);
+
+    err = mdb_btree_sub_remove(tree, root, &key);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (root->height > 0 && root->count == 1) {
+        tree->root = root->child[0];
+        tree->free(tree->alloc_st, root);
+    }
+    else if (root->count == 0) {
+        tree->root = NULL;
+        tree->free(tree->alloc_st, root);
+    }
+    return SYS_ERR_OK;
+}
+
+/*
+ * The range query, see mdb_sub_find_range() in mdb_tree.c for the meaning
+ * of the results.
+ */
+
+struct mdb_btree_range {
+    mdb_root_t root;
+    genpaddr_t address, end;
+    gensize_t size;
+    int max_precision;
+    int ret;
+    struct cte *result;
+    genpaddr_t result_base;
+};
+
+static int
+mdb_btree_classify(struct mdb_btree_range *q, genpaddr_t base,
+                   genpaddr_t end)
+{
+    if ((base > q->address && base < q->end && end > q->end) ||
+        (end > q->address && end < q->end && base < q->address))
+    {
+        return MDB_RANGE_FOUND_PARTIAL;
+    }
+    if ((base >= q->address && end < q->end) ||
+        (base > q->address && end <= q->end))
+    {
+        return MDB_RANGE_FOUND_INNER;
+    }
+    if (base <= q->address && base < q->end && end >= q->end &&
+        end > q->address)
+    {
+        return MDB_RANGE_FOUND_SURROUNDING;
+    }
+    return MDB_RANGE_NOT_FOUND;
+}
+
+/**
+ * \brief Visit the entries of a subtree that may be in the range, in order
+ *
+ * Since entries are visited in ascending order, a later surrounding cap is
+ * always preferred (it is the smallest one), and an earlier inner cap is
+ * always preferred (it is the largest one). Partial matches prefer caps
+ * that start before the range, then the later one.
+ *
+ * \returns true if a result greater than max_precision was found
+ */
+static bool
+mdb_btree_sub_find_range(struct mdb_btree_range *q,
+                         struct mdb_btree_node *node)
+{
+    for (int i = 0; i < node->count; i++) {
+        // entries and subtrees that start after the range can't match, and
+        // all following ones start even later
+        if (node->root[i] > q->root ||
+            (node->root[i] == q->root &&
+             (node->base[i] > q->end ||
+              (node->base[i] == q->end && q->size != 0))))
+        {
+            break;
+        }
+
+        if (node->height > 0) {
+            // skip subtrees that end before the range
+            if (node->max_root[i] < q->root ||
+                (node->max_root[i] == q->root &&
+                 node->max_end[i] <= q->address))
+            {
+                continue;
+            }
+            if (mdb_btree_sub_find_range(q, node->child[i])) {
+                return true;
+            }
+            continue;
+        }
+
+        if (node->root[i] != q->root) {
+            continue;
+        }
+
+        int ret = mdb_btree_classify(q, node->base[i], node->end[i]);
+        if (ret > q->max_precision) {
+            q->ret = ret;
+            q->result = NULL;
+            return true;
+        }
+
+        bool take;
+        if (ret != q->ret) {
+            take = ret > q->ret;
+        }
+        else {
+            switch (ret) {
+            case MDB_RANGE_FOUND_SURROUNDING:
+                take = true;
+                break;
+            case MDB_RANGE_FOUND_PARTIAL:
+                take = node->base[i] < q->address ||
+                       q->result_base > q->address;
+                break;
+            default:
+                take = false;
+                break;
+            }
+        }
+        if (take) {
+            q->ret = ret;
+            q->result = node->cte[i];
+            q->result_base = node->base[i];
+        }
+    }
+    return false;
+}
+
+errval_t
+mdb_btree_find_range(struct mdb_btree *tree, mdb_root_t root,
+                     genpaddr_t address, gensize_t size, int max_result,
+                     struct cte **ret_node, int *result)
+{
+    if (max_result < MDB_RANGE_NOT_FOUND ||
+        max_result > MDB_RANGE_FOUND_PARTIAL)
+    {
+        return CAPS_ERR_INVALID_ARGS;
+    }
+    if (max_result > MDB_RANGE_NOT_FOUND && !ret_node) {
+        return CAPS_ERR_INVALID_ARGS;
+    }
+    if (!result) {
+        return CAPS_ERR_INVALID_ARGS;
+    }
+
+    struct mdb_btree_range q = {
+        .root = root,
+        .address = address,
+        .end = address + size,
+        .size = size,
+        .max_precision = max_result,
+        .ret = MDB_RANGE_NOT_FOUND,
+        .result = NULL,
+    };
+    if (tree->root) {
+        mdb_btree_sub_find_range(&q, tree->root);
+    }
+
+    if (ret_node) {
+        *ret_node = q.result;
+    }
+    *result = q.ret;
+    return SYS_ERR_OK;
+}
+
+errval_t
+mdb_btree_find_cap_for_address(struct mdb_btree *tree, genpaddr_t address,
+                               struct cte **ret_node)
+{
+    int result;
+    errval_t err;
+    // query for size 1 to get the smallest cap that includes the byte at the
+    // given address
+    err = mdb_btree_find_range(tree, get_type_root(ObjType_RAM), address, 1,
+                               MDB_RANGE_FOUND_SURROUNDING, ret_node,
+                               &result);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (result != MDB_RANGE_FOUND_SURROUNDING) {
+        return SYS_ERR_CAP_NOT_FOUND;
+    }
+    return SYS_ERR_OK;
+}
+
+/*
+ * Setup and invariants
+ */
+
+void
+mdb_btree_init(struct mdb_btree *tree, mdb_btree_alloc_fn alloc,
+               mdb_btree_free_fn free, void *alloc_st)
+{
+    memset(tree, 0, sizeof(*tree));
+    tree->alloc = alloc;
+    tree->free = free;
+    tree->alloc_st = alloc_st;
+}
+
+static void
+mdb_btree_free_subtree(struct mdb_btree *tree, struct mdb_btree_node *node)
+{
+    if (node->height > 0) {
+        for (int i = 0; i < node->count; i++) {
+            mdb_btree_free_subtree(tree, node->child[i]);
+        }
+    }
+    tree->free(tree->alloc_st, node);
+}
+
+void
+mdb_btree_destroy(struct mdb_btree *tree)
+{
+    if (tree->root) {
+        mdb_btree_free_subtree(tree, tree->root);
+        tree->root = NULL;
+    }
+    while (tree->spare) {
+        struct mdb_btree_node *node = tree->spare;
+        tree->spare = node->next;
+        tree->free(tree->alloc_st, node);
+    }
+    tree->spare_count = 0;
+}
+
+static enum mdb_btree_invariant
+mdb_btree_check_subtree(struct mdb_btree_node *node, bool is_root,
+                        /*inout*/ struct mdb_btree_node **prev_leaf)
+{
+    if (is_root ? node->count < (node->height > 0 ? 2 : 1)
+                : node->count < MDB_BTREE_MIN_FILL)
+    {
+        return MDB_BTREE_INVARIANT_FILL;
+    }
+    if (node->count > MDB_BTREE_FANOUT) {
+        return MDB_BTREE_INVARIANT_FILL;
+    }
+
+    if (node->height == 0) {
+        struct mdb_btree_key key;
+        for (int i = 0; i < node->count; i++) {
+            mdb_btree_make_key(C(node->cte[i]), &key);
+            if (key.root != node->root[i] || key.base != node->base[i] ||
+                key.end != node->end[i])
+            {
+                return MDB_BTREE_INVARIANT_KEY;
+            }
+            if (i > 0 && mdb_btree_compare(&key, node, i - 1, true) <= 0) {
+                return MDB_BTREE_INVARIANT_ORDER;
+            }
+        }
+
+        struct mdb_btree_node *prev = *prev_leaf;
+        if (node->prev != prev || (prev && prev->next != node)) {
+            return MDB_BTREE_INVARIANT_LEAF_LINKS;
+        }
+        if (prev) {
+            mdb_btree_entry_key(node, 0, &key);
+            if (mdb_btree_compare(&key, prev, prev->count - 1, true) <= 0) {
+                return MDB_BTREE_INVARIANT_ORDER;
+            }
+        }
+        *prev_leaf = node;
+        return MDB_BTREE_INVARIANT_OK;
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        struct mdb_btree_node *child = node->child[i];
+        if (child->height != node->height - 1) {
+            return MDB_BTREE_INVARIANT_HEIGHT;
+        }
+
+        enum mdb_btree_invariant res;
+        res = mdb_btree_check_subtree(child, false, prev_leaf);
+        if (res != MDB_BTREE_INVARIANT_OK) {
+            return res;
+        }
+
+        if (node->cte[i] != child->cte[0] ||
+            node->root[i] != child->root[0] ||
+            node->base[i] != child->base[0] ||
+            node->end[i] != child->end[0])
+        {
+            return MDB_BTREE_INVARIANT_CHILD_KEY;
+        }
+
+        mdb_root_t max_root;
+        genpaddr_t max_end;
+        mdb_btree_subtree_max(child, &max_root, &max_end);
+        if (max_root != node->max_root[i] || max_end != node->max_end[i]) {
+            return MDB_BTREE_INVARIANT_END_IS_MAX;
+        }
+    }
+    return MDB_BTREE_INVARIANT_OK;
+}
+
+enum mdb_btree_invariant
+mdb_btree_check_invariants(struct mdb_btree *tree)
+{
+    if (!tree->root) {
+        return MDB_BTREE_INVARIANT_OK;
+    }
+
+    struct mdb_btree_node *prev_leaf = NULL;
+    enum mdb_btree_invariant res;
+    res = mdb_btree_check_subtree(tree->root, true, &prev_leaf);
+    if (res == MDB_BTREE_INVARIANT_OK && prev_leaf->next != NULL) {
+        res = MDB_BTREE_INVARIANT_LEAF_LINKS;
+    }
+    return res;
+}
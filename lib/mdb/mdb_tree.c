@@ -1001,6 +1001,52 @@ mdb_successor(struct cte *current)
     return mdb_sub_find_greater(C(current), mdb_root, false, true);
 }
 
+static size_t
+mdb_sub_collect(struct cte *current, struct cte **ret, size_t count,
+                size_t max)
+{
+    if (!current || count == max) {
+        return count;
+    }
+    count = mdb_sub_collect(N(current)->left, ret, count, max);
+    if (count < max) {
+        ret[count++] = current;
+        count = mdb_sub_collect(N(current)->right, ret, count, max);
+    }
+    return count;
+}
+
+static size_t
+mdb_sub_collect_greater(struct capability *cap, struct cte *current,
+                        struct cte **ret, size_t count, size_t max)
+{
+    if (!current || count == max) {
+        return count;
+    }
+    int compare = compare_caps(cap, C(current), true);
+    if (compare < 0) {
+        // current is gt key, smaller nodes that are gt key are on the left
+        count = mdb_sub_collect_greater(cap, N(current)->left, ret, count,
+                                        max);
+        if (count < max) {
+            ret[count++] = current;
+            count = mdb_sub_collect(N(current)->right, ret, count, max);
+        }
+        return count;
+    }
+    else {
+        // current is lte key, look for greater nodes
+        return mdb_sub_collect_greater(cap, N(current)->right, ret, count,
+                                       max);
+    }
+}
+
+size_t
+mdb_successors(struct cte *current, struct cte **ret, size_t max)
+{
+    return mdb_sub_collect_greater(C(current), mdb_root, ret, 0, max);
+}
+
 /*
  * The range query.
  */
@@ -21,6 +21,11 @@
  *      split up into child nodes for smaller allocations.
  *   2. A free node, which is a regular free child node in the tree.
  *   3. An allocated node.
+ *
+ * In addition, all free nodes are kept on one free list per size. An
+ * allocation without range constraints takes the smallest free node that is
+ * big enough from these lists instead of searching the tree. Allocations
+ * within a given address range still search the tree in address order.
  */
 
 /*
@@ -66,6 +71,74 @@ static struct mmnode *new_node(struct mm *mm, enum nodetype type,
     return node;
 }
 
+/// Put a free node on the free list for its size
+static void free_list_insert(struct mm *mm, struct mmnode *node,
+                             genpaddr_t base, uint8_t sizebits)
+{
+    assert(node->type == NodeType_Free);
+    assert(sizebits < MM_NUM_FREE_LISTS);
+
+    node->base = base;
+    node->sizebits = sizebits;
+    node->free_prev = NULL;
+    node->free_next = mm->free_lists[sizebits];
+    if (node->free_next != NULL) {
+        node->free_next->free_prev = node;
+    }
+    mm->free_lists[sizebits] = node;
+    mm->free_mask |= (uint64_t)1 << sizebits;
+}
+
+/// Take a free node off its free list
+static void free_list_remove(struct mm *mm, struct mmnode *node)
+{
+    assert(node->type == NodeType_Free);
+
+    if (node->free_prev != NULL) {
+        node->free_prev->free_next = node->free_next;
+    } else {
+        assert(mm->free_lists[node->sizebits] == node);
+        mm->free_lists[node->sizebits] = node->free_next;
+        if (node->free_next == NULL) {
+            mm->free_mask &= ~((uint64_t)1 << node->sizebits);
+        }
+    }
+    if (node->free_next != NULL) {
+        node->free_next->free_prev = node->free_prev;
+    }
+    node->free_next = node->free_prev = NULL;
+}
+
+/// Returns the smallest free node of at least the given size, or NULL
+static struct mmnode *free_list_find(struct mm *mm, uint8_t sizebits)
+{
+    if (sizebits >= MM_NUM_FREE_LISTS) {
+        return NULL;
+    }
+    uint64_t mask = mm->free_mask & ~(((uint64_t)1 << sizebits) - 1);
+    if (mask == 0) {
+        return NULL;
+    }
+    return mm->free_lists[__builtin_ctzll(mask)];
+}
+
+/// Take all free nodes below a node off the free lists
+static void free_list_remove_subtree(struct mm *mm, struct mmnode *node)
+{
+    if (node->type == NodeType_Free) {
+        free_list_remove(mm, node);
+    }
+    if (node->type == NodeType_Free || node->type == NodeType_Allocated
+        || node->childbits == FLAGBITS) {
+        return;
+    }
+    for (cslot_t i = 0; i < UNBITS_CA(node->childbits); i++) {
+        if (node->children[i] != NULL) {
+            free_list_remove_subtree(mm, node->children[i]);
+        }
+    }
+}
+
 /// Reduce the number of children of a node by pushing existing children down.
 static errval_t resize_node(struct mm *mm, struct mmnode *node,
                             uint8_t newchildbits)
@@ -208,6 +281,7 @@ static errval_t add_node(struct mm *mm, genpaddr_t base, uint8_t sizebits,
     if (new == NULL) {
         return MM_ERR_NEW_NODE;
     }
+    free_list_insert(mm, new, base, sizebits);
     assert(retnode != NULL);
     *retnode = new;
     return SYS_ERR_OK;
@@ -372,7 +446,12 @@ static errval_t chunk_node(struct mm *mm, uint8_t sizebits,
         // TODO: Should deallocate the unused slots from mm->slot_alloc()
     }
 
+    if (node->type == NodeType_Free) {
+        free_list_remove(mm, node);
+    }
+
     /* construct child nodes */
+    uint8_t childsizebits = *nodesizebits - childbits;
     for (cslot_t i = 0; i < UNBITS_CA(childbits); i++) {
         struct mmnode *new = new_node(mm, node->type, FLAGBITS);
         if (new == NULL) {
@@ -381,6 +460,10 @@ static errval_t chunk_node(struct mm *mm, uint8_t sizebits,
         node->children[i] = new;
         new->cap = cap;
         cap.slot++;
+        if (new->type == NodeType_Free) {
+            free_list_insert(mm, new, *nodebase + i * UNBITS_GENPA(childsizebits),
+                             childsizebits);
+        }
     }
 
     // If configured to delete chunked capabilities, we do so now
@@ -478,6 +561,7 @@ errval_t mm_init(struct mm *mm, enum objtype objtype, genpaddr_t base,
     assert(mm != NULL);
     mm->objtype = objtype;
     assert((base & (UNBITS_GENPA(sizebits) - 1)) == 0);
+    assert(sizebits < MM_NUM_FREE_LISTS);
     mm->base = base;
     mm->sizebits = sizebits;
     assert(maxchildbits > 0 && maxchildbits != FLAGBITS);
@@ -486,6 +570,10 @@ errval_t mm_init(struct mm *mm, enum objtype objtype, genpaddr_t base,
     mm->slot_alloc = slot_alloc_func;
     mm->slot_alloc_inst = slot_alloc_inst;
     mm->delete_chunked = delete_chunked;
+    for (int i = 0; i < MM_NUM_FREE_LISTS; i++) {
+        mm->free_lists[i] = NULL;
+    }
+    mm->free_mask = 0;
 
     /* init slab allocator */
     slab_init(&mm->slabs, MM_NODE_SIZE(maxchildbits), slab_refill_func);
@@ -534,6 +622,7 @@ errval_t mm_add(struct mm *mm, struct capref cap, uint8_t sizebits, genpaddr_t b
                 return MM_ERR_NEW_NODE;
             }
             mm->root->cap = cap;
+            free_list_insert(mm, mm->root, base, sizebits);
             return SYS_ERR_OK;
         } else {
             mm->root = new_node(mm, NodeType_Dummy, FLAGBITS);
@@ -612,11 +701,25 @@ errval_t mm_alloc_range(struct mm *mm, uint8_t sizebits, genpaddr_t minbase,
     struct mmnode *node = NULL;
     errval_t err;
 
-    /* search for closest matching node in the tree */
-    err = find_node(mm, false, sizebits, minbase, maxlimit, mm->root, mm->base,
-                    mm->sizebits, &nodebase, &nodesizebits, &node);
-    if (err_is_fail(err)) {
-        return err;
+    /* is there a free node that is big enough at all? */
+    node = free_list_find(mm, sizebits);
+    if (node == NULL) {
+        return MM_ERR_NOT_FOUND;
+    }
+
+    if (minbase == mm->base && maxlimit == mm->base + UNBITS_GENPA(mm->sizebits)) {
+        /* any node will do, take the smallest one */
+        nodebase = node->base;
+        nodesizebits = node->sizebits;
+        minbase = nodebase;
+        maxlimit = nodebase + UNBITS_GENPA(nodesizebits);
+    } else {
+        /* search for closest matching node in the tree */
+        err = find_node(mm, false, sizebits, minbase, maxlimit, mm->root,
+                        mm->base, mm->sizebits, &nodebase, &nodesizebits, &node);
+        if (err_is_fail(err)) {
+            return err;
+        }
     }
 
     assert(node != NULL);
@@ -633,6 +736,7 @@ errval_t mm_alloc_range(struct mm *mm, uint8_t sizebits, genpaddr_t minbase,
     }
 
     assert(nodebase >= minbase && nodebase + UNBITS_GENPA(sizebits) <= maxlimit);
+    free_list_remove(mm, node);
     node->type = NodeType_Allocated;
 
     assert(retcap != NULL);
@@ -690,6 +794,8 @@ errval_t mm_realloc_range(struct mm *mm, uint8_t sizebits, genpaddr_t base,
     assert(node != NULL);
     if (node->type == NodeType_Chunked) {
         assert(nodesizebits == sizebits);
+        /* the children are hidden by the allocated node from now on */
+        free_list_remove_subtree(mm, node);
         node->type = NodeType_Allocated;
         /* FIXME: walk child nodes and mark them allocated? or destroy? */
         *retcap = node->cap;
@@ -709,6 +815,9 @@ errval_t mm_realloc_range(struct mm *mm, uint8_t sizebits, genpaddr_t base,
     }
 
     assert(nodebase == base && nodesizebits == sizebits);
+    if (node->type == NodeType_Free) {
+        free_list_remove(mm, node);
+    }
     node->type = NodeType_Allocated;
 
     assert(retcap != NULL);
@@ -765,6 +874,7 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base,
 
     node->type = NodeType_Free;
     node->cap = cap;
+    free_list_insert(mm, node, nodebase, nodesizebits);
 
     return SYS_ERR_OK;
 }
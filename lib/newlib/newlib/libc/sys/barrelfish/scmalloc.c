@@ -0,0 +1,641 @@
+/**
+ * \file
+ * \brief Size-class malloc with per-thread caches and per-core arenas.
+ *
+ * Requests of up to SMALL_MAX bytes are rounded up to one of
+ * MALLOC_SC_CLASSES size classes. The blocks of a class are carved from
+ * spans, SPAN_SIZE aligned chunks starting with a span header, so the header
+ * of a block is found by masking its address. Every thread keeps a short free
+ * list per class; malloc() and free() only take the arena lock to refill or
+ * drain it. Larger requests get a run of whole spans of their own.
+ *
+ * Every dispatcher has its own arena in its morecore state. Spans are taken
+ * from a sorted list of free span runs, which is fed by morecore and gives
+ * memory at its top end back to morecore. Blocks freed on a dispatcher other
+ * than the one owning their span are pushed onto a lock-free list of the
+ * owning arena, which drains it the next time it takes its lock.
+ *
+ * All metadata lives in-band, so the allocator never calls into another
+ * allocator. Under the arena lock it only calls morecore, just like the K&R
+ * malloc does, which keeps it usable in mem_serv and the monitor.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/core_state.h>
+#include <barrelfish/static_assert.h>
+
+typedef void *(*alt_malloc_t)(size_t bytes);
+alt_malloc_t alt_malloc = NULL;
+
+typedef void (*alt_free_t)(void *p);
+alt_free_t alt_free = NULL;
+
+typedef void *(*alt_realloc_t)(void *p, size_t bytes);
+alt_realloc_t alt_realloc = NULL;
+
+typedef void *(*morecore_alloc_func_t)(size_t bytes, size_t *retbytes);
+typedef void (*morecore_free_func_t)(void *base, size_t bytes);
+
+morecore_alloc_func_t sys_morecore_alloc;
+morecore_free_func_t sys_morecore_free;
+
+/// Size and alignment of a span
+#define SPAN_SIZE       (64UL * 1024)
+/// Space reserved for the span header, keeps blocks 16 byte aligned
+#define SPAN_HDR        64
+/// Largest request served from a size class
+#define SMALL_MAX       (16UL * 1024)
+/// Minimum amount of memory requested from morecore
+#define MORECORE_MIN    (16 * SPAN_SIZE)
+/// Free memory kept at the top of the heap when trimming
+#define TRIM_KEEP       (16 * SPAN_SIZE)
+
+/// Bytes a thread cache holds per size class, bounded by TCACHE_{MIN,MAX}
+#define TCACHE_BYTES    (16UL * 1024)
+#define TCACHE_MIN      2
+#define TCACHE_MAX      32
+
+#define SPAN_MAGIC      0x5c5c
+#define CLASS_LARGE     0xffff
+
+struct malloc_sc_block {
+    struct malloc_sc_block *next;
+};
+
+struct malloc_sc_span {
+    uint16_t magic;
+    uint16_t class;                     ///< Size class, or CLASS_LARGE
+    uint32_t inuse;                     ///< Blocks not on the span free list
+    size_t size;                        ///< Size of the span (run) in bytes
+    struct malloc_sc_arena *arena;      ///< Owning arena
+    struct malloc_sc_span *next, *prev; ///< Partial list of the class
+    struct malloc_sc_block *free;       ///< Free blocks
+    lvaddr_t bump;                      ///< Start of the never used part
+    bool partial;                       ///< On the partial list?
+};
+
+STATIC_ASSERT(sizeof(struct malloc_sc_span) <= SPAN_HDR, "span header size");
+
+struct malloc_sc_run {
+    struct malloc_sc_run *next;
+    size_t size;
+};
+
+struct tcache {
+    struct malloc_sc_block *head[MALLOC_SC_CLASSES];
+    uint16_t count[MALLOC_SC_CLASSES];
+};
+
+/*
+ * Size classes: 16 byte steps up to 128 bytes, then four classes per
+ * power of two (1.25, 1.5, 1.75 and 2 times the previous power) up to
+ * SMALL_MAX. This bounds internal fragmentation at 25%.
+ */
+
+static inline size_t class_index(size_t bytes)
+{
+    if (bytes <= 128) {
+        return bytes == 0 ? 0 : (bytes - 1) / 16;
+    }
+    int log = 63 - __builtin_clzl(bytes - 1);
+    size_t pow = 1UL << log;
+    size_t step = ((bytes - pow) * 4 + pow - 1) / pow;
+    return 8 + (log - 7) * 4 + step - 1;
+}
+
+static inline size_t class_size(size_t idx)
+{
+    if (idx < 8) {
+        return (idx + 1) * 16;
+    }
+    size_t pow = 128UL << ((idx - 8) / 4);
+    return pow + pow * ((idx - 8) % 4 + 1) / 4;
+}
+
+/* 8 small classes plus 4 per power of two from 2^7 to 2^14 == SMALL_MAX */
+STATIC_ASSERT(MALLOC_SC_CLASSES == 8 + 4 * (14 - 7), "size class count");
+
+static inline unsigned tcache_limit(size_t idx)
+{
+    size_t n = TCACHE_BYTES / class_size(idx);
+    return n < TCACHE_MIN ? TCACHE_MIN : (n > TCACHE_MAX ? TCACHE_MAX : n);
+}
+
+static inline struct malloc_sc_span *span_of(void *p)
+{
+    return (struct malloc_sc_span *)((lvaddr_t)p & ~(SPAN_SIZE - 1));
+}
+
+static inline struct malloc_sc_arena *arena_self(void)
+{
+    return &get_morecore_state()->sc_arena;
+}
+
+#define ARENA_LOCK   thread_mutex_lock(&get_morecore_state()->mutex)
+#define ARENA_UNLOCK thread_mutex_unlock(&get_morecore_state()->mutex)
+
+/*
+ * Free span runs. All functions below require the arena lock.
+ */
+
+static void run_insert(struct malloc_sc_arena *arena, lvaddr_t base,
+                       size_t size)
+{
+    struct malloc_sc_run **prevp = &arena->runs, *prev = NULL;
+    while (*prevp != NULL && (lvaddr_t)*prevp < base) {
+        prev = *prevp;
+        prevp = &prev->next;
+    }
+
+    struct malloc_sc_run *run = (struct malloc_sc_run *)base;
+    run->size = size;
+    run->next = *prevp;
+    *prevp = run;
+
+    if (run->next != NULL && base + run->size == (lvaddr_t)run->next) {
+        run->size += run->next->size;
+        run->next = run->next->next;
+    }
+    if (prev != NULL && (lvaddr_t)prev + prev->size == base) {
+        prev->size += run->size;
+        prev->next = run->next;
+    }
+}
+
+/// Adds memory from morecore to the free runs
+static bool arena_grow(struct malloc_sc_arena *arena, size_t size)
+{
+    size_t bytes = size > MORECORE_MIN ? size : MORECORE_MIN;
+
+    assert(sys_morecore_alloc);
+    void *buf = sys_morecore_alloc(bytes, &bytes);
+    if (buf == NULL) {
+        return false;
+    }
+
+    /* continue a previous chunk at its last span boundary */
+    lvaddr_t start = (lvaddr_t)buf == arena->mc_end ? arena->mc_used
+                     : ROUND_UP((lvaddr_t)buf, SPAN_SIZE);
+    lvaddr_t end = ROUND_DOWN((lvaddr_t)buf + bytes, SPAN_SIZE);
+
+    arena->mc_end = (lvaddr_t)buf + bytes;
+    arena->mc_used = end;
+
+    if (end > start) {
+        run_insert(arena, start, end - start);
+    }
+    return true;
+}
+
+static void *run_alloc(struct malloc_sc_arena *arena, size_t size)
+{
+    do {
+        struct malloc_sc_run **prevp = &arena->runs;
+        for (struct malloc_sc_run *run = *prevp; run != NULL;
+             prevp = &run->next, run = run->next) {
+            if (run->size < size) {
+                continue;
+            }
+            if (run->size == size) {
+                *prevp = run->next;
+            } else {
+                struct malloc_sc_run *rest =
+                    (struct malloc_sc_run *)((lvaddr_t)run + size);
+                rest->size = run->size - size;
+                rest->next = run->next;
+                *prevp = rest;
+            }
+            return run;
+        }
+    } while (arena_grow(arena, size));
+
+    return NULL;
+}
+
+/// Returns free memory at the top of the heap to morecore
+static void arena_trim(struct malloc_sc_arena *arena)
+{
+#if defined(__arm__)
+    // Not implemented, see lesscore()
+#else
+    struct malloc_sc_run *run = arena->runs;
+    if (run == NULL) {
+        return;
+    }
+    while (run->next != NULL) {
+        run = run->next;
+    }
+
+    if ((lvaddr_t)run + run->size != arena->mc_used
+        || run->size < 2 * TRIM_KEEP) {
+        return;
+    }
+
+    /* only trim if nobody else took memory from morecore since */
+    struct morecore_state *state = get_morecore_state();
+    genvaddr_t top = vregion_get_base_addr(&state->mmu_state.vregion)
+                     + state->mmu_state.offset;
+    if (vspace_genvaddr_to_lvaddr(top) != arena->mc_end) {
+        return;
+    }
+
+    lvaddr_t base = (lvaddr_t)run + TRIM_KEEP;
+    assert(sys_morecore_free);
+    sys_morecore_free((void *)base, arena->mc_end - base);
+
+    run->size = TRIM_KEEP;
+    arena->mc_end = arena->mc_used = base;
+#endif
+}
+
+/*
+ * Spans. All functions below require the arena lock.
+ */
+
+static void span_link(struct malloc_sc_arena *arena, struct malloc_sc_span *span)
+{
+    span->prev = NULL;
+    span->next = arena->partial[span->class];
+    if (span->next != NULL) {
+        span->next->prev = span;
+    }
+    arena->partial[span->class] = span;
+    span->partial = true;
+}
+
+static void span_unlink(struct malloc_sc_arena *arena,
+                        struct malloc_sc_span *span)
+{
+    if (span->prev != NULL) {
+        span->prev->next = span->next;
+    } else {
+        arena->partial[span->class] = span->next;
+    }
+    if (span->next != NULL) {
+        span->next->prev = span->prev;
+    }
+    span->partial = false;
+}
+
+static struct malloc_sc_span *span_new(struct malloc_sc_arena *arena,
+                                       uint16_t class, size_t size)
+{
+    struct malloc_sc_span *span = run_alloc(arena, size);
+    if (span == NULL) {
+        return NULL;
+    }
+
+    span->magic = SPAN_MAGIC;
+    span->class = class;
+    span->inuse = 0;
+    span->size = size;
+    span->arena = arena;
+    span->free = NULL;
+    span->bump = (lvaddr_t)span + SPAN_HDR;
+    span->partial = false;
+
+    if (class != CLASS_LARGE) {
+        span_link(arena, span);
+    }
+
+    return span;
+}
+
+/// Takes up to n blocks of a size class, returns them as a list
+static struct malloc_sc_block *arena_alloc_blocks(struct malloc_sc_arena *arena,
+                                                  size_t idx, unsigned n,
+                                                  unsigned *ret_count)
+{
+    size_t size = class_size(idx);
+    struct malloc_sc_block *list = NULL;
+    unsigned count = 0;
+
+    while (count < n) {
+        struct malloc_sc_span *span = arena->partial[idx];
+        if (span == NULL) {
+            span = span_new(arena, idx, SPAN_SIZE);
+            if (span == NULL) {
+                break;
+            }
+        }
+
+        while (count < n) {
+            struct malloc_sc_block *block = span->free;
+            if (block != NULL) {
+                span->free = block->next;
+            } else if (span->bump + size <= (lvaddr_t)span + SPAN_SIZE) {
+                block = (struct malloc_sc_block *)span->bump;
+                span->bump += size;
+            } else {
+                span_unlink(arena, span);
+                break;
+            }
+            span->inuse++;
+            block->next = list;
+            list = block;
+            count++;
+        }
+    }
+
+    *ret_count = count;
+    return list;
+}
+
+/// Frees a block or large allocation owned by this arena
+static void arena_free_block(struct malloc_sc_arena *arena,
+                             struct malloc_sc_block *block)
+{
+    struct malloc_sc_span *span = span_of(block);
+    assert(span->magic == SPAN_MAGIC && span->arena == arena);
+
+    if (span->class == CLASS_LARGE) {
+        span->magic = 0;
+        run_insert(arena, (lvaddr_t)span, span->size);
+        return;
+    }
+
+    assert(span->inuse > 0);
+    block->next = span->free;
+    span->free = block;
+    span->inuse--;
+
+    if (!span->partial) {
+        span_link(arena, span);
+    }
+
+    /* give empty spans back, but keep the last one of the class */
+    if (span->inuse == 0
+        && !(arena->partial[span->class] == span && span->next == NULL)) {
+        span_unlink(arena, span);
+        span->magic = 0;
+        run_insert(arena, (lvaddr_t)span, SPAN_SIZE);
+    }
+}
+
+/// Frees the blocks other dispatchers returned to this arena
+static void arena_drain_remote(struct malloc_sc_arena *arena)
+{
+    if (arena->remote == NULL) {
+        return;
+    }
+
+    struct malloc_sc_block *block = __sync_lock_test_and_set(&arena->remote,
+                                                              NULL);
+    while (block != NULL) {
+        struct malloc_sc_block *next = block->next;
+        arena_free_block(arena, block);
+        block = next;
+    }
+}
+
+static void remote_free(struct malloc_sc_arena *arena,
+                        struct malloc_sc_block *block)
+{
+    struct malloc_sc_block *head;
+    do {
+        head = arena->remote;
+        block->next = head;
+    } while (!__sync_bool_compare_and_swap(&arena->remote, head, block));
+}
+
+/*
+ * Slow paths, taking the arena lock.
+ */
+
+static struct malloc_sc_block *alloc_blocks(size_t idx, unsigned n,
+                                            unsigned *ret_count)
+{
+    struct malloc_sc_arena *arena = arena_self();
+
+    ARENA_LOCK;
+    arena_drain_remote(arena);
+    struct malloc_sc_block *list = arena_alloc_blocks(arena, idx, n,
+                                                      ret_count);
+    ARENA_UNLOCK;
+
+    return list;
+}
+
+static void *alloc_large(size_t bytes)
+{
+    struct malloc_sc_arena *arena = arena_self();
+
+    if (bytes > SIZE_MAX - SPAN_HDR - SPAN_SIZE) {
+        return NULL;
+    }
+    size_t size = ROUND_UP(bytes + SPAN_HDR, SPAN_SIZE);
+
+    ARENA_LOCK;
+    arena_drain_remote(arena);
+    struct malloc_sc_span *span = span_new(arena, CLASS_LARGE, size);
+    ARENA_UNLOCK;
+
+    if (span == NULL) {
+        return NULL;
+    }
+    return (void *)((lvaddr_t)span + SPAN_HDR);
+}
+
+/// Frees a list of blocks, possibly owned by different arenas
+static void free_blocks(struct malloc_sc_block *list)
+{
+    struct malloc_sc_arena *arena = arena_self();
+
+    ARENA_LOCK;
+    while (list != NULL) {
+        struct malloc_sc_block *next = list->next;
+        struct malloc_sc_span *span = span_of(list);
+        if (span->arena == arena) {
+            arena_free_block(arena, list);
+        } else {
+            remote_free(span->arena, list);
+        }
+        list = next;
+    }
+    arena_drain_remote(arena);
+    arena_trim(arena);
+    ARENA_UNLOCK;
+}
+
+/*
+ * Thread caches
+ */
+
+static void tcache_release(void *cache)
+{
+    struct tcache *tc = cache;
+
+    for (size_t idx = 0; idx < MALLOC_SC_CLASSES; idx++) {
+        if (tc->head[idx] == NULL) {
+            continue;
+        }
+        free_blocks(tc->head[idx]);
+        tc->head[idx] = NULL;
+        tc->count[idx] = 0;
+    }
+
+    struct malloc_sc_block *self = cache;
+    self->next = NULL;
+    free_blocks(self);
+}
+
+static struct tcache *tcache_get(void)
+{
+    struct tcache *tc = thread_get_malloc_cache();
+    if (tc != NULL) {
+        return tc;
+    }
+
+    unsigned count;
+    tc = (struct tcache *)alloc_blocks(class_index(sizeof(*tc)), 1, &count);
+    if (tc == NULL) {
+        return NULL;
+    }
+    memset(tc, 0, sizeof(*tc));
+    thread_set_malloc_cache(tc, tcache_release);
+
+    return tc;
+}
+
+/// Returns the first n blocks of the cache list of a class to the arenas
+static void tcache_flush(struct tcache *tc, size_t idx, unsigned n)
+{
+    struct malloc_sc_block *list = tc->head[idx], *last = list;
+    for (unsigned i = 1; i < n; i++) {
+        last = last->next;
+    }
+    tc->head[idx] = last->next;
+    tc->count[idx] -= n;
+    last->next = NULL;
+
+    free_blocks(list);
+}
+
+/*
+ * Public interface
+ */
+
+void *malloc(size_t bytes)
+{
+    if (alt_malloc != NULL) {
+        return alt_malloc(bytes);
+    }
+
+    if (bytes > SMALL_MAX) {
+        return alloc_large(bytes);
+    }
+
+    size_t idx = class_index(bytes);
+    struct tcache *tc = tcache_get();
+    if (tc == NULL) {
+        return NULL;
+    }
+
+    struct malloc_sc_block *block = tc->head[idx];
+    if (block == NULL) {
+        unsigned count;
+        block = alloc_blocks(idx, tcache_limit(idx) / 2, &count);
+        if (block == NULL) {
+            return NULL;
+        }
+        tc->count[idx] = count;
+    }
+
+    tc->head[idx] = block->next;
+    tc->count[idx]--;
+
+    return block;
+}
+
+void free(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    if (alt_free != NULL) {
+        return alt_free(p);
+    }
+
+    struct malloc_sc_span *span = span_of(p);
+    assert(span->magic == SPAN_MAGIC);
+
+    struct malloc_sc_block *block = p;
+    struct tcache *tc = thread_get_malloc_cache();
+
+    if (span->class == CLASS_LARGE || tc == NULL) {
+        block->next = NULL;
+        free_blocks(block);
+        return;
+    }
+
+    size_t idx = span->class;
+    block->next = tc->head[idx];
+    tc->head[idx] = block;
+    if (++tc->count[idx] > tcache_limit(idx)) {
+        tcache_flush(tc, idx, tc->count[idx] / 2);
+    }
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *p = malloc(nmemb * size);
+    if (p != NULL) {
+        memset(p, 0, nmemb * size);
+    }
+    return p;
+}
+
+void *realloc(void *p, size_t bytes)
+{
+    if (alt_realloc != NULL) {
+        return alt_realloc(p, bytes);
+    }
+
+    if (p == NULL) {
+        return malloc(bytes);
+    }
+
+    struct malloc_sc_span *span = span_of(p);
+    assert(span->magic == SPAN_MAGIC);
+
+    size_t usable;
+    if (span->class == CLASS_LARGE) {
+        usable = span->size - SPAN_HDR;
+        if (bytes <= usable && bytes > SMALL_MAX) {
+            return p;
+        }
+    } else {
+        usable = class_size(span->class);
+        if (bytes <= SMALL_MAX && class_index(bytes) == span->class) {
+            return p;
+        }
+    }
+
+    void *newp = malloc(bytes);
+    if (newp == NULL) {
+        return NULL;
+    }
+    memcpy(newp, p, usable < bytes ? usable : bytes);
+    free(p);
+
+    return newp;
+}
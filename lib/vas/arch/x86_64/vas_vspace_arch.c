@@ -22,3 +22,23 @@ errval_t vas_vspace_create_vroot(struct capref vroot)
 {
     return vnode_create(vroot, ObjType_VNode_x86_64_pml4);
 }
+
+/**
+ * \brief replaces the vroot in the slot with a fresh, empty page table
+ *
+ * \param vroot     slot holding the vroot to be replaced
+ *
+ * \returns SYS_ERR_OK on success
+ *          errval on failure
+ */
+errval_t vas_vspace_reset_vroot(struct capref vroot)
+{
+    errval_t err;
+
+    err = cap_delete(vroot);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return vnode_create(vroot, ObjType_VNode_x86_64_pml4);
+}
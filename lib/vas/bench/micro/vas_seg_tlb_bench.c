@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Measures the cost of random accesses to a segment right after switching
+ * into the VAS, for segments mapped with base, large and (optionally, pass
+ * "huge" as argument) huge pages. Without TLB tags every switch flushes the
+ * TLB, so the accesses are dominated by page walks of the segment mapping.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+#include <vas/vas.h>
+#include <vas/vas_segment.h>
+#include <bench/bench.h>
+
+#define EXPECT_SUCCESS(err, str) \
+    if (err_is_fail(err)) {USER_PANIC_ERR(err, str);}
+
+#define EXPECT_NONNULL(expr, str) \
+    if (!expr) {USER_PANIC(str);}
+
+#define ITERATIONS 1000
+#define DRYRUNS 50
+
+/// number of random accesses after each switch
+#define ACCESSES 1024
+
+/// segments are placed at distinct 1G aligned addresses
+#define SEG_BASE    0xC0000000000UL
+#define SEG_STRIDE  (4UL * HUGE_PAGE_SIZE)
+
+#define SEG_SIZE_SMALL  (64UL * 1024 * 1024)
+#define SEG_SIZE_HUGE   ((size_t)HUGE_PAGE_SIZE)
+
+static size_t offsets[ACCESSES];
+
+static void offsets_init(size_t size)
+{
+    uint64_t x = 0xdeadbeefcafeUL;
+    for (size_t i = 0; i < ACCESSES; i++) {
+        /* xorshift */
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        offsets[i] = (x % (size / sizeof(uint64_t))) * sizeof(uint64_t);
+    }
+}
+
+static void seg_tlb_bench(vas_handle_t vas, const char *name, size_t size,
+                          vas_flags_t flags, int idx)
+{
+    errval_t err;
+
+    lvaddr_t vaddr = SEG_BASE + idx * SEG_STRIDE;
+
+    vas_seg_handle_t seg;
+    err = vas_seg_alloc(name, VAS_SEG_TYPE_FIXED, size, vaddr,
+                        VAS_FLAGS_PERM_READ | VAS_FLAGS_PERM_WRITE | flags, &seg);
+    EXPECT_SUCCESS(err, "allocating segment");
+
+    err = vas_seg_attach(vas, seg, VAS_FLAGS_PERM_READ | VAS_FLAGS_PERM_WRITE);
+    EXPECT_SUCCESS(err, "attaching segment");
+
+    offsets_init(size);
+
+    bench_ctl_t *bench_ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, 1,
+                                            ITERATIONS + DRYRUNS);
+    EXPECT_NONNULL(bench_ctl, "bench ctl was null");
+    bench_ctl_dry_runs(bench_ctl, DRYRUNS);
+
+    cycles_t result;
+    do {
+        err = vas_switch(vas);
+        EXPECT_SUCCESS(err, "switch to vas");
+
+        volatile uint8_t *base = (volatile uint8_t *)vaddr;
+        uint64_t sum = 0;
+
+        cycles_t t_start = bench_tsc();
+        for (size_t i = 0; i < ACCESSES; i++) {
+            sum += *(volatile uint64_t *)(base + offsets[i]);
+        }
+        cycles_t t_end = bench_tsc();
+
+        __asm__ volatile("" :: "r" (sum));
+
+        err = vas_switch(VAS_HANDLE_PROCESS);
+        EXPECT_SUCCESS(err, "switch to process");
+
+        result = bench_time_diff(t_start, t_end) / ACCESSES;
+    } while(!bench_ctl_add_run(bench_ctl, &result));
+
+    bench_ctl_dump_analysis(bench_ctl, 0, name, bench_tsc_per_us());
+    bench_ctl_destroy(bench_ctl);
+
+    err = vas_seg_detach(vas, seg);
+    EXPECT_SUCCESS(err, "detaching segment");
+
+    err = vas_seg_free(seg);
+    EXPECT_SUCCESS(err, "freeing segment");
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+
+    bench_init();
+
+    err = vas_enable();
+    EXPECT_SUCCESS(err, "vas enable");
+
+    vas_handle_t vas;
+    err = vas_create("/bench/segtlb", 0, &vas);
+    EXPECT_SUCCESS(err, "creating vas");
+
+    err = vas_attach(vas, 0);
+    EXPECT_SUCCESS(err, "attaching vas");
+
+    seg_tlb_bench(vas, "seg_access_base", SEG_SIZE_SMALL, 0, 0);
+    seg_tlb_bench(vas, "seg_access_large", SEG_SIZE_SMALL, VAS_FLAGS_MAP_LARGE, 1);
+
+    if (argc > 1 && strcmp(argv[1], "huge") == 0) {
+        seg_tlb_bench(vas, "seg_access_huge_base", SEG_SIZE_HUGE, 0, 2);
+        seg_tlb_bench(vas, "seg_access_huge_large", SEG_SIZE_HUGE,
+                      VAS_FLAGS_MAP_LARGE, 3);
+        seg_tlb_bench(vas, "seg_access_huge", SEG_SIZE_HUGE, VAS_FLAGS_MAP_HUGE, 4);
+    }
+
+    printf("segment tlb benchmarks done\n");
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Breaks a vas_switch down into its stages. Every run measures the stages
+ * back to back and records one sample per stage:
+ *
+ *  - syscall:    entering and leaving the kernel (sys_nop)
+ *  - caplookup:  invocation of the vroot capability minus the syscall
+ *  - cr3:        switch into the VAS minus the vroot invocation
+ *  - touch:      first access to the working set after the switch
+ *  - warm:       second access to the working set
+ *  - tlbmiss:    (touch - warm) per page of the working set
+ *
+ * The sweep covers several working set sizes with and without TLB tags.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+#include <vas/vas.h>
+#include <bench/bench.h>
+
+#define EXPECT_SUCCESS(err, str) \
+    if (err_is_fail(err)) {USER_PANIC_ERR(err, str);}
+
+#define EXPECT_NONNULL(expr, str) \
+    if (!expr) {USER_PANIC(str);}
+
+#define ITERATIONS 1000
+#define DRYRUNS 100
+
+/// largest working set in pages
+#define WS_MAX_PAGES 2048
+
+static const size_t ws_pages[] = { 1, 8, 64, 512, WS_MAX_PAGES };
+
+enum stage {
+    STAGE_SYSCALL,
+    STAGE_CAPLOOKUP,
+    STAGE_CR3,
+    STAGE_TOUCH,
+    STAGE_WARM,
+    STAGE_TLBMISS,
+    STAGE_MAX
+};
+
+static const char *stage_names[STAGE_MAX] = {
+    [STAGE_SYSCALL]   = "syscall",
+    [STAGE_CAPLOOKUP] = "caplookup",
+    [STAGE_CR3]       = "cr3",
+    [STAGE_TOUCH]     = "touch",
+    [STAGE_WARM]      = "warm",
+    [STAGE_TLBMISS]   = "tlbmiss",
+};
+
+static inline cycles_t stage_diff(cycles_t a, cycles_t b)
+{
+    return (a > b) ? a - b : 0;
+}
+
+static cycles_t touch_pages(volatile uint8_t *ws, size_t npages)
+{
+    uint64_t sum = 0;
+    cycles_t t_start = bench_tsc();
+    for (size_t i = 0; i < npages; i++) {
+        sum += ws[i * BASE_PAGE_SIZE];
+    }
+    cycles_t t_end = bench_tsc();
+
+    /* keep the loads */
+    __asm__ volatile("" :: "r" (sum));
+
+    return bench_time_diff(t_start, t_end);
+}
+
+static void switch_bench(vas_handle_t vas, volatile uint8_t *ws, size_t npages,
+                         const char *mode)
+{
+    errval_t err;
+    cycles_t t_start, t_end;
+    cycles_t t_nop, t_invoke, t_switch;
+    cycles_t result[STAGE_MAX];
+
+    bench_ctl_t *bench_ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, STAGE_MAX,
+                                            ITERATIONS + DRYRUNS);
+    EXPECT_NONNULL(bench_ctl, "bench ctl was null");
+    bench_ctl_dry_runs(bench_ctl, DRYRUNS);
+
+    do {
+        t_start = bench_tsc();
+        err = sys_nop();
+        t_end = bench_tsc();
+        EXPECT_SUCCESS(err, "nop syscall");
+        t_nop = bench_time_diff(t_start, t_end);
+
+        t_start = bench_tsc();
+        err = vas_bench_cap_invoke_nop(vas);
+        t_end = bench_tsc();
+        EXPECT_SUCCESS(err, "cap invoke");
+        t_invoke = bench_time_diff(t_start, t_end);
+
+        t_start = bench_tsc();
+        err = vas_switch(vas);
+        t_end = bench_tsc();
+        EXPECT_SUCCESS(err, "switch to vas");
+        t_switch = bench_time_diff(t_start, t_end);
+
+        result[STAGE_TOUCH] = touch_pages(ws, npages);
+        result[STAGE_WARM] = touch_pages(ws, npages);
+
+        err = vas_switch(VAS_HANDLE_PROCESS);
+        EXPECT_SUCCESS(err, "switch to process");
+
+        result[STAGE_SYSCALL] = t_nop;
+        result[STAGE_CAPLOOKUP] = stage_diff(t_invoke, t_nop);
+        result[STAGE_CR3] = stage_diff(t_switch, t_invoke);
+        result[STAGE_TLBMISS] = stage_diff(result[STAGE_TOUCH],
+                                           result[STAGE_WARM]) / npages;
+    } while(!bench_ctl_add_run(bench_ctl, result));
+
+    for (int stage = 0; stage < STAGE_MAX; stage++) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%s/ws=%zu/%s", mode, npages,
+                 stage_names[stage]);
+        bench_ctl_dump_analysis(bench_ctl, stage, prefix, bench_tsc_per_us());
+    }
+
+    bench_ctl_destroy(bench_ctl);
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+
+    bench_init();
+
+    err = vas_enable();
+    EXPECT_SUCCESS(err, "vas enable");
+
+    vas_handle_t vas;
+    err = vas_create("/bench/switch", 0, &vas);
+    EXPECT_SUCCESS(err, "creating vas");
+
+    err = vas_attach(vas, 0);
+    EXPECT_SUCCESS(err, "attaching vas");
+
+    struct capref frame;
+    err = frame_alloc(&frame, WS_MAX_PAGES * BASE_PAGE_SIZE, NULL);
+    EXPECT_SUCCESS(err, "frame alloc");
+
+    void *ws;
+    err = vas_map(vas, &ws, frame, WS_MAX_PAGES * BASE_PAGE_SIZE,
+                  VREGION_FLAGS_READ_WRITE);
+    EXPECT_SUCCESS(err, "mapping working set");
+
+    size_t nsizes = sizeof(ws_pages) / sizeof(ws_pages[0]);
+
+    for (size_t i = 0; i < nsizes; i++) {
+        switch_bench(vas, ws, ws_pages[i], "untagged");
+    }
+
+    err = vas_tagging_enable();
+    EXPECT_SUCCESS(err, "tagging enable");
+
+    err = vas_tagging_tag(vas);
+    EXPECT_SUCCESS(err, "tagging vas");
+
+    for (size_t i = 0; i < nsizes; i++) {
+        switch_bench(vas, ws, ws_pages[i], "tagged");
+    }
+
+    err = vas_tagging_disable();
+    EXPECT_SUCCESS(err, "tagging disable");
+
+    printf("switch benchmarks done\n");
+
+    return 0;
+}
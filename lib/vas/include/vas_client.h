@@ -21,10 +21,16 @@ errval_t vas_client_vas_create(struct vas *vas);
 
 errval_t vas_client_vas_lookup(char *name, struct vas *vas);
 
+errval_t vas_client_vas_delete(vas_id_t id);
+
 errval_t vas_client_vas_attach(vas_id_t id, struct capref vroot);
 
 errval_t vas_client_vas_detach(vas_id_t id);
 
+errval_t vas_client_vas_set_life(vas_id_t id, vas_life_t life);
+
+errval_t vas_client_vas_get_life(vas_id_t id, vas_life_t *ret_life);
+
 errval_t vas_client_seg_map(vas_id_t id, struct capref frame, size_t size,
                             vas_flags_t flags, lvaddr_t *ret_vaddr);
 errval_t vas_client_seg_map_fixed(vas_id_t id, lvaddr_t vaddr, struct capref frame,
@@ -33,9 +39,17 @@ errval_t vas_client_seg_unmap(vas_id_t id, lvaddr_t vaddr);
 
 errval_t vas_client_seg_create(struct vas_seg *seg);
 errval_t vas_client_seg_lookup(struct vas_seg *seg);
+errval_t vas_client_seg_lookup_addr(vas_id_t vid, lvaddr_t vaddr,
+                                    struct vas_seg *seg);
 errval_t vas_client_seg_delete(vas_seg_id_t sid);
+errval_t vas_client_seg_set_life(vas_seg_id_t sid, vas_life_t life);
+errval_t vas_client_seg_get_life(vas_seg_id_t sid, vas_life_t *ret_life);
 errval_t vas_client_seg_attach(vas_id_t vid, vas_seg_id_t sid, vas_flags_t flags);
 errval_t vas_client_seg_detach(vas_id_t vid, vas_seg_id_t sid);
+errval_t vas_client_seg_attach_batch(vas_id_t vid, vas_seg_id_t *sids,
+                                     size_t count, vas_flags_t flags);
+errval_t vas_client_seg_detach_batch(vas_id_t vid, vas_seg_id_t *sids,
+                                     size_t count);
 
 
 #endif /* __VAS_CLIENT_H_ */
@@ -27,6 +27,12 @@ static inline vas_handle_t vas_get_handle(struct vas* vas)
 }
 
 
+///< the vas is switched to without TLB tagging
+#define VAS_TAG_NONE 0
+
+///< the kernel assigns a PCID to the vroot of the vas on each core
+#define VAS_TAG_AUTO 1
+
 #define VAS_ID_MASK 0x0000ffffffffffffUL
 #define VAS_ID_TAG_MASK 0x0fff000000000000UL
 #define VAS_ID_MASK 0x0000ffffffffffffUL
@@ -42,11 +48,32 @@ static inline vas_id_t vas_id_insert_tag(vas_id_t id, uint16_t tag)
     return ((id & ~VAS_ID_TAG_MASK) | (((vas_id_t)tag & 0xfff) << 48));
 }
 
+/**
+ * \brief returns the page size a segment with the given flags is mapped with
+ */
+static inline size_t vas_seg_page_size(vas_flags_t flags)
+{
+    if (flags & VAS_FLAGS_MAP_HUGE) {
+        return HUGE_PAGE_SIZE;
+    } else if (flags & VAS_FLAGS_MAP_LARGE) {
+        return LARGE_PAGE_SIZE;
+    }
+    return BASE_PAGE_SIZE;
+}
+
+///< the flags of a segment which are kept when it is created
+#define VAS_SEG_FLAGS_MASK (VAS_FLAGS_PERM_READ | VAS_FLAGS_PERM_WRITE | \
+                            VAS_FLAGS_PERM_EXEC | VAS_FLAGS_MAP_LARGE | \
+                            VAS_FLAGS_MAP_HUGE)
+
+///< the flags selecting the page size of a segment
+#define VAS_SEG_FLAGS_PAGESIZE (VAS_FLAGS_MAP_LARGE | VAS_FLAGS_MAP_HUGE)
+
 ///< internal representation of the VAS
 struct vas
 {
     vas_id_t id;                        ///< the vas id
-    uint16_t tag;                       ///< tag for the vas
+    uint16_t tag;                       ///< tagging mode VAS_TAG_*
     vas_state_t state;                  ///< the state of the vas
     vas_flags_t perms;                  ///< associated permissions
     char name[VAS_NAME_MAX_LEN];        ///< name of the vas
@@ -54,7 +81,9 @@ struct vas
     struct capref pagecn_cap;           ///< cap of the page cn
     struct cnoderef pagecn;             ///< pagecn cap
     struct capref   vroot;              ///< vroot
+    struct capref  *replicas;           ///< per-core vroot replicas or NULL
     struct single_slot_allocator pagecn_slot_alloc;
+    void *pagecn_slot_buf;              ///< backing memory of the slot allocator
 };
 
 struct vas_seg
@@ -31,7 +31,9 @@
  */
 
 errval_t vas_vspace_init(struct vas *vas);
+errval_t vas_vspace_destroy(struct vas *vas);
 errval_t vas_vspace_create_vroot(struct capref vroot);
+errval_t vas_vspace_reset_vroot(struct capref vroot);
 
 
 errval_t vas_vspace_map_one_frame(struct vas *vas, void **retaddr,
@@ -40,42 +42,42 @@ errval_t vas_vspace_map_one_frame(struct vas *vas, void **retaddr,
 errval_t vas_vspace_map_one_frame_fixed(struct vas *vas, lvaddr_t addr,
                                   struct capref frame, size_t size,
                                   vas_flags_t flags);
-errval_t vas_vspace_unmap(void *addr);
+errval_t vas_vspace_unmap(struct vas *vas, void *addr, struct capref *ret_frame);
 
 /**
  * \brief inherits the text and data segment regions from the domain
  *
- * \param vas   the VAS to set the segments
+ * \param vroot the vroot of the VAS or of one of its replicas
  *
  * \returns SYS_ERR_OK on success
  *          errval or error
  */
-static inline errval_t vas_vspace_inherit_segments(struct vas *vas)
+static inline errval_t vas_vspace_inherit_segments(struct capref vroot)
 {
-    struct capref vroot = {
+    struct capref proc_vroot = {
         .cnode = cnode_page,
         .slot = 0
     };
 
-    return vnode_inherit(vas->vroot, vroot, 0, 1);
+    return vnode_inherit(vroot, proc_vroot, 0, 1);
 }
 
 /**
  * \brief inherits the heap segment regions from the domain
  *
- * \param vas   the VAS to set the segments
+ * \param vroot the vroot of the VAS or of one of its replicas
  *
  * \returns SYS_ERR_OK on success
  *          errval or error
  */
-static inline errval_t vas_vspace_inherit_heap(struct vas *vas)
+static inline errval_t vas_vspace_inherit_heap(struct capref vroot)
 {
-    struct capref vroot = {
+    struct capref proc_vroot = {
         .cnode = cnode_page,
         .slot = 0
     };
 
-    return vnode_inherit(vas->vroot, vroot, 1, 32);
+    return vnode_inherit(vroot, proc_vroot, 1, 32);
 }
 
 /**
@@ -21,6 +21,7 @@
 #include <flounder/flounder_txqueue.h>
 
 extern errval_t vspace_add_vregion(struct vspace *vspace, struct vregion *region);
+extern errval_t vspace_remove_vregion(struct vspace *vspace, struct vregion* region);
 
 #ifdef NDEBUG
 #define VAS_SERVICE_DEBUG(x...)
@@ -36,26 +37,65 @@ extern errval_t vspace_add_vregion(struct vspace *vspace, struct vregion *region
 #define EXPECT_SUCCESS(expr, msg...) \
     if (!(expr)) {USER_PANIC("expr" msg);}
 
+#define X86_64_PML4_BASE(base)         (((uint64_t)(base) >> 39) & X86_64_PTABLE_MASK)
+
 union vas_name_arg {
     char namestring[32];
     uint64_t namefields[4];
 };
 
+/// number of buckets of the name and id hash indexes of the registries
+#define VAS_REGISTRY_BUCKETS 256
+
+/// number of entries in the per client cache of verified ids
+#define VAS_CLIENT_IDCACHE_SIZE 16
+
+struct list_elem
+{
+    struct list_elem *next;
+    struct list_elem *prev;
+    struct list_elem *name_next;    ///< name hash chain
+    struct list_elem *id_next;      ///< id hash chain
+    const char *name;
+    uint64_t id;
+    uint32_t name_hash;
+    bool named;                     ///< element is visible to name lookups
+};
+
+struct registry
+{
+    struct list_elem *list;         ///< all elements visible to name lookups
+    struct list_elem *names[VAS_REGISTRY_BUCKETS];
+    struct list_elem *ids[VAS_REGISTRY_BUCKETS];
+};
+
+struct idcache_entry
+{
+    uint64_t id;
+    struct registry *reg;
+    struct list_elem *elem;
+    uint32_t gen;
+};
+
 struct vas_client
 {
     struct vas_binding *b;
     struct tx_queue txq;
+    struct idcache_entry idcache[VAS_CLIENT_IDCACHE_SIZE];
 };
 
-struct list_elem
+/// segments ordered by their base address, the ranges do not overlap
+struct seg_index
 {
-    struct list_elem *next;
-    struct list_elem *prev;
+    struct seg_info **segs;
+    size_t count;
+    size_t capacity;
 };
 
 struct vas_attached
 {
     struct capref vroot;
+    struct vas_client *client;
     struct vas_attached *next;
 };
 
@@ -65,17 +105,22 @@ struct vas_info
     struct vas vas;
     struct vas_client *creator;
     struct vas_attached *attached;
-    uint64_t map[512/64];
+    uint32_t refcnt;            ///< number of clients having the vas attached
+    bool deleted;               ///< vas is deleted once the last client detaches
+    vas_life_t life;            ///< persistent vases survive their creator
+    uint64_t map[512/64];      ///< PML4 entries inherited by the attachers
+    struct seg_index segs;      ///< segments attached to this vas
     struct vas_info *next;
     struct vas_info *prev;
 };
 
-struct list_elem *vas_registered;
+static struct registry vas_registry;
 
 struct seg_attached
 {
     struct vregion vreg;
     struct capref frame;
+    struct vas_info *vi;
     struct seg_attached *next;
 };
 
@@ -88,57 +133,137 @@ struct seg_info
     struct seg_attached *attached;
     struct memobj_one_frame mobj;
     struct vas_client *creator;
+    vas_life_t life;
     char name [VAS_NAME_MAX_LEN];
 };
 
-struct list_elem *seg_registered;
+static struct registry seg_registry;
+
+/// all registered segments, used to reject overlapping segments
+static struct seg_index seg_index_all;
+
+/// incremented whenever an id is removed, invalidates the client id caches
+static uint32_t registry_gen = 1;
 
 /*
  * ------------------------------------------------------------------------------
- * VAS info management
+ * VAS and segment registries
  * ------------------------------------------------------------------------------
  */
 
-static void elem_insert(struct list_elem **list, struct list_elem *elem)
+static inline uint32_t registry_hash_name(const char *name)
 {
-    if (*list) {
-        (*list)->prev = elem;
-        elem->next = *list;
-        *list = elem;
-    } else {
-        elem->next = elem->prev = NULL;
-        *list = elem;
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < VAS_NAME_MAX_LEN && name[i]; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
+
+static inline uint32_t registry_hash_id(uint64_t id)
+{
+    /* ids are heap addresses, drop the alignment bits */
+    id = (id >> 4) * 0x9E3779B97F4A7C15UL;
+    return (uint32_t)(id >> 32);
 }
 
+static void registry_insert(struct registry *reg, struct list_elem *elem,
+                            const char *name, uint64_t id)
+{
+    elem->name = name;
+    elem->name_hash = registry_hash_name(name);
+    elem->id = id;
+    elem->named = true;
+
+    elem->prev = NULL;
+    elem->next = reg->list;
+    if (reg->list) {
+        reg->list->prev = elem;
+    }
+    reg->list = elem;
 
-typedef int (*elem_cmp_fn_t)(struct list_elem *list, void *arg);
+    struct list_elem **bucket = &reg->names[elem->name_hash % VAS_REGISTRY_BUCKETS];
+    elem->name_next = *bucket;
+    *bucket = elem;
+
+    bucket = &reg->ids[registry_hash_id(id) % VAS_REGISTRY_BUCKETS];
+    elem->id_next = *bucket;
+    *bucket = elem;
+}
 
-static int elem_cmp_seg(struct list_elem *e, void *arg)
+/**
+ * \brief hides the element from name lookups, its id remains valid
+ */
+static void registry_unpublish(struct registry *reg, struct list_elem *elem)
 {
-    struct seg_info *si = (struct seg_info *)e;
+    if (!elem->named) {
+        return;
+    }
 
-    debug_printf("elem_cmp_seg: %s %s  : %u\n", si->name, (char *)arg, strncmp(si->name, (char *)arg, VAS_NAME_MAX_LEN));
+    if (elem->prev) {
+        elem->prev->next = elem->next;
+    } else {
+        assert(reg->list == elem);
+        reg->list = elem->next;
+    }
+    if (elem->next) {
+        elem->next->prev = elem->prev;
+    }
+    elem->next = elem->prev = NULL;
 
-    return strncmp(si->name, (char *)arg, VAS_NAME_MAX_LEN);
+    struct list_elem **prev = &reg->names[elem->name_hash % VAS_REGISTRY_BUCKETS];
+    while (*prev != elem) {
+        assert(*prev);
+        prev = &(*prev)->name_next;
+    }
+    *prev = elem->name_next;
+    elem->name_next = NULL;
+
+    elem->named = false;
 }
 
-static int elem_cmp_vas(struct list_elem *e, void *arg)
+/**
+ * \brief removes the element from the registry and invalidates its id
+ */
+static void registry_remove(struct registry *reg, struct list_elem *elem)
 {
-    struct vas_info *vi = (struct vas_info *)e;
-    return strncmp(vi->vas.name, (char *)arg, VAS_NAME_MAX_LEN);
+    registry_unpublish(reg, elem);
+
+    struct list_elem **prev = &reg->ids[registry_hash_id(elem->id) % VAS_REGISTRY_BUCKETS];
+    while (*prev != elem) {
+        assert(*prev);
+        prev = &(*prev)->id_next;
+    }
+    *prev = elem->id_next;
+    elem->id_next = NULL;
+
+    registry_gen++;
 }
 
+static struct list_elem *registry_lookup_name(struct registry *reg,
+                                              const char *name)
+{
+    uint32_t hash = registry_hash_name(name);
+    struct list_elem *e = reg->names[hash % VAS_REGISTRY_BUCKETS];
+    while (e) {
+        if (e->name_hash == hash && strncmp(e->name, name, VAS_NAME_MAX_LEN) == 0) {
+            return e;
+        }
+        e = e->name_next;
+    }
+    return NULL;
+}
 
-static struct list_elem *elem_lookup(struct list_elem *list, elem_cmp_fn_t cmp,
-                                     void *arg)
+static struct list_elem *registry_lookup_id(struct registry *reg, uint64_t id)
 {
-    struct list_elem *vi = list;
-    while(vi) {
-        if (cmp(vi, arg) == 0) {
-            return vi;
+    struct list_elem *e = reg->ids[registry_hash_id(id) % VAS_REGISTRY_BUCKETS];
+    while (e) {
+        if (e->id == id) {
+            return e;
         }
-        vi = vi->next;
+        e = e->id_next;
     }
     return NULL;
 }
@@ -148,37 +273,519 @@ static struct list_elem *elem_lookup(struct list_elem *list, elem_cmp_fn_t cmp,
  * id check helpers
  * ------------------------------------------------------------------------------
  */
-static inline errval_t vas_verify_vas_id(uint64_t id, struct vas_info **ret_vi)
+
+/**
+ * \brief resolves an id using the clients cache of recently verified ids
+ */
+static struct list_elem *registry_verify_id(struct vas_client *client,
+                                            struct registry *reg, uint64_t id)
 {
     if ((id & VAS_ID_MARK) != VAS_ID_MARK) {
-        return VAS_ERR_NOT_FOUND;
+        return NULL;
+    }
+
+    id &= VAS_ID_MASK;
+
+    uint32_t hash = registry_hash_id(id);
+    struct idcache_entry *ce = &client->idcache[hash % VAS_CLIENT_IDCACHE_SIZE];
+    if (ce->id == id && ce->reg == reg && ce->gen == registry_gen) {
+        return ce->elem;
+    }
+
+    struct list_elem *e = registry_lookup_id(reg, id);
+    if (e) {
+        ce->id = id;
+        ce->reg = reg;
+        ce->elem = e;
+        ce->gen = registry_gen;
     }
 
-    struct vas_info *vi = (struct vas_info *)(VAS_ID_MASK & id);
-    if (vi->vas.id != (VAS_ID_MASK & id)) {
+    return e;
+}
+
+static inline errval_t vas_verify_vas_id(struct vas_client *client, uint64_t id,
+                                         struct vas_info **ret_vi)
+{
+    struct list_elem *e = registry_verify_id(client, &vas_registry, id);
+    if (e == NULL) {
         return VAS_ERR_NOT_FOUND;
     }
 
-    *ret_vi = vi;
+    *ret_vi = (struct vas_info *)e;
 
     return SYS_ERR_OK;
 }
 
-static inline errval_t vas_verify_seg_id(uint64_t id, struct seg_info **ret_si)
+static inline errval_t vas_verify_seg_id(struct vas_client *client, uint64_t id,
+                                         struct seg_info **ret_si)
 {
-    if ((id & VAS_ID_MARK) != VAS_ID_MARK) {
+    struct list_elem *e = registry_verify_id(client, &seg_registry, id);
+    if (e == NULL) {
         return VAS_ERR_NOT_FOUND;
     }
 
-    struct seg_info *si = (struct seg_info *)(VAS_ID_MASK & id);
-    if (si->id != (VAS_ID_MASK & id)) {
-        return VAS_ERR_NOT_FOUND;
+    *ret_si = (struct seg_info *)e;
+
+    return SYS_ERR_OK;
+}
+
+/*
+ * ------------------------------------------------------------------------------
+ * Segment address index
+ * ------------------------------------------------------------------------------
+ */
+
+#define SEG_INDEX_INITIAL_CAPACITY 8
+
+/**
+ * \brief returns the number of segments with a base address <= addr
+ */
+static size_t seg_index_pos(struct seg_index *idx, lvaddr_t addr)
+{
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->segs[mid]->vreg.base <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * \brief finds the segment containing the address
+ */
+static struct seg_info *seg_index_lookup(struct seg_index *idx, lvaddr_t addr)
+{
+    size_t pos = seg_index_pos(idx, addr);
+    if (pos == 0) {
+        return NULL;
+    }
+
+    struct seg_info *si = idx->segs[pos - 1];
+    if (addr - si->vreg.base < si->vreg.size) {
+        return si;
+    }
+    return NULL;
+}
+
+static bool seg_index_overlaps(struct seg_index *idx, lvaddr_t base, size_t size)
+{
+    size_t pos = seg_index_pos(idx, base + size - 1);
+    if (pos == 0) {
+        return false;
+    }
+
+    struct seg_info *si = idx->segs[pos - 1];
+    return (si->vreg.base + si->vreg.size > base);
+}
+
+static errval_t seg_index_insert(struct seg_index *idx, struct seg_info *si)
+{
+    if (seg_index_overlaps(idx, si->vreg.base, si->vreg.size)) {
+        return VAS_ERR_SEG_VADDR;
+    }
+
+    if (idx->count == idx->capacity) {
+        size_t capacity = idx->capacity ? 2 * idx->capacity
+                                        : SEG_INDEX_INITIAL_CAPACITY;
+        struct seg_info **segs = realloc(idx->segs, capacity * sizeof(*segs));
+        if (segs == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        idx->segs = segs;
+        idx->capacity = capacity;
+    }
+
+    size_t pos = seg_index_pos(idx, si->vreg.base);
+    memmove(&idx->segs[pos + 1], &idx->segs[pos],
+            (idx->count - pos) * sizeof(*idx->segs));
+    idx->segs[pos] = si;
+    idx->count++;
+
+    return SYS_ERR_OK;
+}
+
+static void seg_index_remove(struct seg_index *idx, struct seg_info *si)
+{
+    size_t pos = seg_index_pos(idx, si->vreg.base);
+    assert(pos > 0 && idx->segs[pos - 1] == si);
+    pos--;
+
+    idx->count--;
+    memmove(&idx->segs[pos], &idx->segs[pos + 1],
+            (idx->count - pos) * sizeof(*idx->segs));
+}
+
+/*
+ * ------------------------------------------------------------------------------
+ * VAS and segment teardown
+ * ------------------------------------------------------------------------------
+ */
+
+#define VAS_PML4_MAP_WORDS (512/64)
+
+/**
+ * \brief records the PML4 entries covering the range which the attachers of
+ *        the VAS have not yet inherited in the pending bitmap
+ */
+static void vas_info_collect(struct vas_info *vi, uint64_t *pending,
+                             lvaddr_t base, size_t size)
+{
+    uint32_t first = X86_64_PML4_BASE(base);
+    uint32_t last = X86_64_PML4_BASE(base + size - 1);
+
+    for (uint32_t entry = first; entry <= last; entry++) {
+        uint32_t slot = entry / 64;
+        uint32_t bit = entry % 64;
+
+        if (!(vi->map[slot] & (1UL << bit))) {
+            pending[slot] |= (1UL << bit);
+        }
+    }
+}
+
+/**
+ * \brief makes the pending PML4 entries visible to all attachers
+ *
+ * Each attached vroot is updated with a single inherit invocation spanning
+ * the pending entries. Entries in between which are not pending are copied
+ * as well, this is harmless as the VAS slots of the attachers mirror the
+ * VAS root page table.
+ */
+static void vas_info_inherit_pending(struct vas_info *vi, uint64_t *pending)
+{
+    errval_t err;
+
+    uint32_t first = 512, last = 0;
+    for (uint32_t slot = 0; slot < VAS_PML4_MAP_WORDS; slot++) {
+        if (pending[slot] == 0) {
+            continue;
+        }
+        if (first == 512) {
+            first = slot * 64 + __builtin_ctzl(pending[slot]);
+        }
+        last = slot * 64 + 63 - __builtin_clzl(pending[slot]);
+    }
+
+    if (first == 512) {
+        return;
+    }
+
+    struct vas_attached *at = vi->attached;
+    while(at) {
+        err = vas_vspace_inherit_regions(&vi->vas, at->vroot, first, last);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "could not inherit region");
+        }
+        at = at->next;
+    }
+
+    for (uint32_t slot = 0; slot < VAS_PML4_MAP_WORDS; slot++) {
+        vi->map[slot] |= pending[slot];
+    }
+}
+
+/**
+ * \brief makes the PML4 entries covering the range visible to all attachers
+ */
+static void vas_info_inherit(struct vas_info *vi, lvaddr_t base, size_t size)
+{
+    uint64_t pending[VAS_PML4_MAP_WORDS] = { 0 };
+    vas_info_collect(vi, pending, base, size);
+    vas_info_inherit_pending(vi, pending);
+}
+
+static errval_t seg_attached_remove(struct seg_info *si, struct seg_attached *att)
+{
+    errval_t err;
+
+    struct vregion *vreg = &att->vreg;
+    struct vspace *vs = vregion_get_vspace(vreg);
+    struct pmap *pmap = vspace_get_pmap(vs);
+
+    err = pmap->f.unmap(pmap, vregion_get_base_addr(vreg) + vregion_get_offset(vreg),
+                        vregion_get_size(vreg), NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_PMAP_UNMAP);
+    }
+
+    err = vspace_remove_vregion(vs, vreg);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VSPACE_REMOVE_REGION);
+    }
+
+    seg_index_remove(&att->vi->segs, si);
+
+    struct seg_attached **prev = &si->attached;
+    while (*prev != att) {
+        assert(*prev);
+        prev = &(*prev)->next;
+    }
+    *prev = att->next;
+
+    free(att);
+
+    return SYS_ERR_OK;
+}
+
+static struct seg_attached *seg_attached_find(struct seg_info *si,
+                                              struct vspace *vs)
+{
+    struct seg_attached *att = si->attached;
+    while (att) {
+        if (vregion_get_vspace(&att->vreg) == vs) {
+            return att;
+        }
+        att = att->next;
+    }
+    return NULL;
+}
+
+/**
+ * \brief maps the segment into the VAS
+ *
+ * The PML4 entries of the segment are not propagated to the attachers of the
+ * VAS, this is left to the caller.
+ */
+static errval_t seg_attached_add(struct vas_info *vi, struct seg_info *si,
+                                 uint32_t flags)
+{
+    errval_t err;
+
+    struct vspace *vs = &vi->vas.vspace_state.vspace;
+
+    if (seg_index_overlaps(&vi->segs, si->vreg.base, si->vreg.size)) {
+        return VAS_ERR_SEG_VADDR;
+    }
+
+    struct seg_attached *att = calloc(1, sizeof(struct seg_attached));
+    if (!att) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    att->vi = vi;
+
+    struct vregion *vreg = &att->vreg;
+    vreg->vspace = vs;
+    vreg->memobj = &si->mobj.m;
+    vreg->base   = si->vreg.base;
+    vreg->offset = si->vreg.offset;
+    vreg->size   = si->vreg.size;
+    /* the attacher may restrict the permissions, but not the page size */
+    vreg->flags  = (flags & si->vreg.flags & ~VAS_SEG_FLAGS_PAGESIZE)
+                    | (si->vreg.flags & VAS_SEG_FLAGS_PAGESIZE);
+
+    err = vspace_add_vregion(vs, vreg);
+    if (err_is_fail(err)) {
+        free(att);
+        return err_push(err, LIB_ERR_VSPACE_ADD_REGION);
+    }
+
+    /*
+     * the region is not registered with the memobj: the attachments are
+     * tracked in the segment info and removed by seg_attached_remove()
+     */
+    err = si->mobj.m.f.pagefault(&si->mobj.m, vreg, 0, 0);
+    if (err_is_fail(err)) {
+        vspace_remove_vregion(vs, vreg);
+        free(att);
+        return err_push(err, LIB_ERR_MEMOBJ_MAP_REGION);
+    }
+
+    err = seg_index_insert(&vi->segs, si);
+    if (err_is_fail(err)) {
+        struct pmap *pmap = vspace_get_pmap(vs);
+        pmap->f.unmap(pmap, vreg->base + vreg->offset, vreg->size, NULL);
+        vspace_remove_vregion(vs, vreg);
+        free(att);
+        return err;
     }
 
-    *ret_si = si;
+    att->next = si->attached;
+    si->attached = att;
 
     return SYS_ERR_OK;
 }
+
+/**
+ * \brief removes the attachments of the client from the vas
+ *
+ * A client has one attachment per vroot, i.e. one for its primary vroot and
+ * one for each per-core replica. The vas is not destroyed, even if it was
+ * the last reference.
+ */
+static errval_t vas_info_detach(struct vas_info *vi, struct vas_client *client)
+{
+    errval_t err;
+    bool found = false;
+
+    struct vas_attached **prev = &vi->attached;
+    while (*prev) {
+        struct vas_attached *ai = *prev;
+        if (ai->client != client) {
+            prev = &ai->next;
+            continue;
+        }
+
+        *prev = ai->next;
+
+        /* drop our reference to the vroot of the client */
+        err = cap_destroy(ai->vroot);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "deleting the vroot");
+        }
+        free(ai);
+
+        assert(vi->refcnt > 0);
+        vi->refcnt--;
+        found = true;
+    }
+
+    return found ? SYS_ERR_OK : VAS_ERR_NOT_ATTACHED;
+}
+
+/**
+ * \brief frees all resources of a vas once the last client has detached
+ */
+static void vas_info_destroy(struct vas_info *vi)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[service] destroying vas=0x%016lx\n", vi->vas.id);
+
+    assert(vi->refcnt == 0 && vi->attached == NULL);
+
+    struct vspace *vs = &vi->vas.vspace_state.vspace;
+
+    /* remove all segments attached to this vas */
+    while (vi->segs.count) {
+        struct seg_info *si = vi->segs.segs[vi->segs.count - 1];
+        err = seg_attached_remove(si, seg_attached_find(si, vs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "removing segment from vas");
+            seg_index_remove(&vi->segs, si);
+        }
+    }
+    free(vi->segs.segs);
+
+    /* unmap the frames the clients have mapped through the service */
+    struct vregion *vreg = vs->head;
+    while (vreg) {
+        struct vregion *next = vreg->next;
+        if (vregion_get_memobj(vreg)) {
+            struct capref frame;
+            void *addr = (void *)vspace_genvaddr_to_lvaddr(vregion_get_base_addr(vreg));
+            err = vas_vspace_unmap(&vi->vas, addr, &frame);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "unmapping frame from vas");
+            } else {
+                cap_destroy(frame);
+            }
+        }
+        vreg = next;
+    }
+
+    /* reclaim the page tables */
+    err = vas_vspace_destroy(&vi->vas);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "destroying the vspace");
+    }
+
+    registry_remove(&vas_registry, &vi->l);
+
+    vi->vas.id = 0;
+    free(vi);
+}
+
+/**
+ * \brief detaches the segment from all vases and frees its resources
+ */
+static void seg_info_destroy(struct seg_info *si)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[service] destroying seg=0x%016lx\n", si->id);
+
+    while (si->attached) {
+        err = seg_attached_remove(si, si->attached);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "removing segment from vas");
+        }
+    }
+
+    seg_index_remove(&seg_index_all, si);
+    registry_remove(&seg_registry, &si->l);
+
+    err = cap_destroy(si->mobj.frame);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "deleting the segment frame");
+    }
+
+    si->id = 0;
+    free(si);
+}
+
+/**
+ * \brief releases the resources a client holds once its binding is gone
+ *
+ * The attachments of the client are dropped. Transient vases and segments
+ * created by the client are deleted. Persistent ones remain without a
+ * creator: any client may then delete them or adopt them by making them
+ * transient again.
+ */
+static void vas_client_release(struct vas_client *client)
+{
+    for (int bucket = 0; bucket < VAS_REGISTRY_BUCKETS; bucket++) {
+        struct list_elem *e = vas_registry.ids[bucket];
+        while (e) {
+            struct list_elem *next = e->id_next;
+            struct vas_info *vi = (struct vas_info *)e;
+
+            vas_info_detach(vi, client);
+
+            if (vi->creator == client) {
+                vi->creator = NULL;
+                if (vi->life == VAS_LIFE_TRANSIENT) {
+                    registry_unpublish(&vas_registry, &vi->l);
+                    vi->deleted = true;
+                }
+            }
+
+            if (vi->deleted && vi->refcnt == 0) {
+                vas_info_destroy(vi);
+            }
+            e = next;
+        }
+    }
+
+    for (int bucket = 0; bucket < VAS_REGISTRY_BUCKETS; bucket++) {
+        struct list_elem *e = seg_registry.ids[bucket];
+        while (e) {
+            struct list_elem *next = e->id_next;
+            struct seg_info *si = (struct seg_info *)e;
+            if (si->creator == client) {
+                si->creator = NULL;
+                if (si->life == VAS_LIFE_TRANSIENT) {
+                    seg_info_destroy(si);
+                }
+            }
+            e = next;
+        }
+    }
+}
+
+/**
+ * \brief checks whether the client may delete the object or change its lifetime
+ */
+static inline bool vas_client_owns(struct vas_client *client,
+                                   struct vas_client *creator)
+{
+    /* orphaned persistent objects are owned by everyone */
+    return (creator == client || creator == NULL);
+}
+
 /*
  * ------------------------------------------------------------------------------
  * Receive handlers
@@ -202,13 +809,14 @@ static void vas_create_call__rx(struct vas_binding *_binding, uint64_t name0,
         nameptr[3] = name3;
 
         vi->vas.id = (uint64_t)vi;
+        vi->creator = _binding->st;
 
         err = vas_vspace_init(&vi->vas);
         if (err_is_fail(err)) {
             err = _binding->tx_vtbl.create_response(_binding, NOP_CONT,err, 0,0);
             free(vi);
         } else {
-            elem_insert(&vas_registered, &vi->l);
+            registry_insert(&vas_registry, &vi->l, vi->vas.name, vi->vas.id);
             err = _binding->tx_vtbl.create_response(_binding, NOP_CONT,err,
                                                     VAS_ID_MARK | vi->vas.id,
                                                     vi->vas.tag);
@@ -220,60 +828,247 @@ static void vas_create_call__rx(struct vas_binding *_binding, uint64_t name0,
     }
 }
 
-static void vas_delete_call__rx(struct vas_binding *_binding, uint64_t sid)
-{
-
-}
-
-static void vas_attach_call__rx(struct vas_binding *_binding, uint64_t id,
-                                struct capref vroot)
+static void vas_delete_call__rx(struct vas_binding *_binding, uint64_t id)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[request] delete: client=%p, vas=0x%016lx\n", _binding->st, id);
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    if (vi->deleted) {
+        err = VAS_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    if (!vas_client_owns(_binding->st, vi->creator)) {
+        err = VAS_ERR_NO_PERMISSION;
+        goto err_out;
+    }
+
+    /* the vas is no longer visible to lookups, but survives till the last detach */
+    registry_unpublish(&vas_registry, &vi->l);
+    vi->deleted = true;
+
+    if (vi->refcnt == 0) {
+        vas_info_destroy(vi);
+    }
+
+    err_out:
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] delete: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+    }
+    err = _binding->tx_vtbl.delete_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_attach_call__rx(struct vas_binding *_binding, uint64_t id,
+                                struct capref vroot)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[request] attach: client=%p, vas=0x%016lx\n", _binding->st, id);
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_ok(err) && vi->deleted) {
+        err = VAS_ERR_NOT_FOUND;
+    }
+
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] attach: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+
+        err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, err);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "send reply");
+            cap_delete(vroot);
+        }
+        return;
+    }
+
+    struct vas_attached *ai = calloc(1, sizeof(struct vas_attached));
+    if (!ai) {
+        err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, LIB_ERR_MALLOC_FAIL);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "send reply");
+            cap_delete(vroot);
+        }
+        return;
+    }
+
+    err = vas_vspace_inherit_regions(&vi->vas, vroot,
+                                     VAS_VSPACE_PML4_SLOT_MIN,
+                                     VAS_VSPACE_PML4_SLOT_MAX);
+    if (err_is_ok(err)) {
+        ai->vroot = vroot;
+        ai->client = _binding->st;
+        ai->next = vi->attached;
+        vi->attached = ai;
+        vi->refcnt++;
+    } else {
+        free(ai);
+    }
+
+    err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+        cap_delete(vroot);
+    }
+
+}
+
+static void vas_detach_call__rx(struct vas_binding *_binding, uint64_t id)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[request] detach: client=%p, vas=0x%016lx\n", _binding->st, id);
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    err = vas_info_detach(vi, _binding->st);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    if (vi->deleted && vi->refcnt == 0) {
+        vas_info_destroy(vi);
+    }
+
+    err_out:
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] detach: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+    }
+    err = _binding->tx_vtbl.detach_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_map_call__rx(struct vas_binding *_binding, uint64_t id,
+                             struct capref frame, uint64_t size, uint32_t flags)
+{
+    errval_t err;
+
+    lvaddr_t vaddr = 0;
+
+    VAS_SERVICE_DEBUG("[request] map: client=%p, vas=0x%016lx, size=0x%lx\n",
+                      _binding->st, id, size);
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    void *addr;
+    err = vas_vspace_map_one_frame(&vi->vas, &addr, frame, size, flags);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    struct vregion *vreg = vspace_get_region(&vi->vas.vspace_state.vspace, addr);
+    vas_info_inherit(vi, (lvaddr_t)addr, vregion_get_size(vreg));
+
+    vaddr = (lvaddr_t)addr;
+
+    err_out:
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] map: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+        cap_destroy(frame);
+    }
+    err = _binding->tx_vtbl.map_response(_binding, NOP_CONT, err, vaddr);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_map_fixed_call__rx(struct vas_binding *_binding, uint64_t id,
+                                   struct capref frame, uint64_t size,
+                                   uint64_t vaddr, uint32_t flags)
+{
+    errval_t err;
+
+    VAS_SERVICE_DEBUG("[request] map_fixed: client=%p, vas=0x%016lx, vaddr=0x%016lx\n",
+                      _binding->st, id, vaddr);
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    err = vas_vspace_map_one_frame_fixed(&vi->vas, vaddr, frame, size, flags);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    struct vregion *vreg = vspace_get_region(&vi->vas.vspace_state.vspace,
+                                             (void *)vaddr);
+    vas_info_inherit(vi, vaddr, vregion_get_size(vreg));
+
+    err_out:
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] map_fixed: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+        cap_destroy(frame);
+    }
+    err = _binding->tx_vtbl.map_fixed_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_unmap_call__rx(struct vas_binding *_binding, uint64_t id,
+                               uint64_t vaddr)
 {
     errval_t err;
 
-    VAS_SERVICE_DEBUG("[request] attach: client=%p, vas=0x%016lx\n", _binding->st, id);
+    VAS_SERVICE_DEBUG("[request] unmap: client=%p, vas=0x%016lx, vaddr=0x%016lx\n",
+                      _binding->st, id, vaddr);
 
     struct vas_info *vi;
-    err = vas_verify_vas_id(id, &vi);
-
+    err = vas_verify_vas_id(_binding->st, id, &vi);
     if (err_is_fail(err)) {
-        VAS_SERVICE_DEBUG("[request] attach: client=%p, vas=0x%016lx, err='%s'\n",
-                          _binding->st, id, err_getstring(err));
+        goto err_out;
+    }
 
-        err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, err);
-        if (err_is_fail(err)) {
-            USER_PANIC_ERR(err, "send reply");
-            cap_delete(vroot);
-        }
-        return;
+    /* segments are removed using seg_detach */
+    if (seg_index_lookup(&vi->segs, vaddr)) {
+        err = VAS_ERR_NO_PERMISSION;
+        goto err_out;
     }
 
-    struct vas_attached *ai = calloc(1, sizeof(struct vas_attached));
-    if (!ai) {
-        err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, LIB_ERR_MALLOC_FAIL);
-        if (err_is_fail(err)) {
-            USER_PANIC_ERR(err, "send reply");
-            cap_delete(vroot);
-        }
-        return;
+    struct capref frame;
+    err = vas_vspace_unmap(&vi->vas, (void *)vaddr, &frame);
+    if (err_is_fail(err)) {
+        goto err_out;
     }
 
-    ai->vroot = vroot;
-    ai->next = vi->attached;
-    vi->attached = ai;
+    cap_destroy(frame);
 
-    err = vas_vspace_inherit_regions(&vi->vas, vroot,
-                                     VAS_VSPACE_PML4_SLOT_MIN,
-                                     VAS_VSPACE_PML4_SLOT_MAX);
-    err = _binding->tx_vtbl.attach_response(_binding, NOP_CONT, err);
+    err_out:
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] unmap: client=%p, vas=0x%016lx, err='%s'\n",
+                          _binding->st, id, err_getstring(err));
+    }
+    err = _binding->tx_vtbl.unmap_response(_binding, NOP_CONT, err);
     if (err_is_fail(err)) {
         USER_PANIC_ERR(err, "send reply");
-        cap_delete(vroot);
     }
-
-}
-
-static void vas_detach_call__rx(struct vas_binding *_binding, uint64_t id)
-{
 }
 
 
@@ -285,10 +1080,10 @@ static void vas_lookup_call__rx(struct vas_binding *_binding, uint64_t name0,
     VAS_SERVICE_DEBUG("[request] lookup: client=%p, name='%s'\n", _binding->st,
                       narg.namestring);
 
-    struct vas_info *vi = (struct vas_info *)elem_lookup(vas_registered, elem_cmp_vas,
-                                                         narg.namestring);
+    struct vas_info *vi = (struct vas_info *)registry_lookup_name(&vas_registry,
+                                                                  narg.namestring);
     if (vi) {
-        _binding->tx_vtbl.lookup_response(_binding, NOP_CONT, VAS_ERR_NOT_FOUND,
+        _binding->tx_vtbl.lookup_response(_binding, NOP_CONT, SYS_ERR_OK,
                                           VAS_ID_MARK | vi->vas.id, vi->vas.tag);
     } else {
         _binding->tx_vtbl.lookup_response(_binding, NOP_CONT, VAS_ERR_NOT_FOUND, 0, 0);
@@ -298,25 +1093,37 @@ static void vas_lookup_call__rx(struct vas_binding *_binding, uint64_t name0,
 
 static void vas_seg_create_call__rx(struct vas_binding *_binding, uint64_t name0,
                                     uint64_t name1, uint64_t name2, uint64_t name3,
-                                    uint64_t vaddr, uint64_t size, struct capref frame)
+                                    uint64_t vaddr, uint64_t size, struct capref frame,
+                                    uint32_t flags)
 {
-    errval_t err;
+    errval_t err, err2;
 
     union vas_name_arg narg = { .namefields = {name0, name1, name2, name3}};
 
-    /// todo: proper roundup
-    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    flags &= VAS_SEG_FLAGS_MASK;
+    if (flags & VAS_FLAGS_MAP_HUGE) {
+        /* the pmap prefers large pages if both are requested */
+        flags &= ~VAS_FLAGS_MAP_LARGE;
+    }
 
-    /// todo: handling of flags
-    vregion_flags_t flags = VREGION_FLAGS_MASK;
+    size_t pagesize = vas_seg_page_size(flags);
+    size = ROUND_UP(size, pagesize);
 
-    struct seg_info *si = (struct seg_info *)elem_lookup(seg_registered, elem_cmp_seg,
-                                                         narg.namestring);
+    struct seg_info *si = (struct seg_info *)registry_lookup_name(&seg_registry,
+                                                                  narg.namestring);
     if (si) {
         err = VAS_ERR_CREATE_NAME_CONFLICT;
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                                   _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_frame;
+    }
+
+    if (size == 0 || (vaddr & (pagesize - 1))
+            || seg_index_overlaps(&seg_index_all, vaddr, size)) {
+        err = VAS_ERR_SEG_VADDR;
+        VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
+                          _binding->st, narg.namestring, err_getstring(err));
+        goto err_frame;
     }
 
     struct frame_identity id;
@@ -324,14 +1131,14 @@ static void vas_seg_create_call__rx(struct vas_binding *_binding, uint64_t name0
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                           _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_frame;
     }
 
-    if ((size > (1UL << id.bits))) {
+    if ((size > (1UL << id.bits)) || (id.base & (pagesize - 1))) {
         err = LIB_ERR_PMAP_FRAME_SIZE;
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                           _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_frame;
     }
 
     si = calloc(1, sizeof(*si));
@@ -339,7 +1146,7 @@ static void vas_seg_create_call__rx(struct vas_binding *_binding, uint64_t name0
         err = LIB_ERR_MALLOC_FAIL;
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                           _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_frame;
     }
 
     si->id = (uint64_t)si;
@@ -349,14 +1156,14 @@ static void vas_seg_create_call__rx(struct vas_binding *_binding, uint64_t name0
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                           _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_si;
     }
 
     err = si->mobj.m.f.fill(&si->mobj.m, 0, frame, size);
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', err='%s'\n",
                           _binding->st, narg.namestring, err_getstring(err));
-        goto err_out;
+        goto err_si;
     }
 
     VAS_SERVICE_DEBUG("[request] seg_create: client=%p, name='%s', id=0x%016lx\n",
@@ -368,12 +1175,26 @@ static void vas_seg_create_call__rx(struct vas_binding *_binding, uint64_t name0
     si->vreg.size = size;
     si->creator = _binding->st;
 
-    elem_insert(&seg_registered, &si->l);
+    err = seg_index_insert(&seg_index_all, si);
+    if (err_is_fail(err)) {
+        goto err_si;
+    }
 
-    err_out :
-    _binding->tx_vtbl.seg_create_response(_binding, NOP_CONT, err, VAS_ID_MARK | si->id);
+    registry_insert(&seg_registry, &si->l, si->name, si->id);
 
+    _binding->tx_vtbl.seg_create_response(_binding, NOP_CONT, SYS_ERR_OK,
+                                          VAS_ID_MARK | si->id);
     return;
+
+    err_si:
+    memobj_destroy_one_frame(&si->mobj.m);
+    free(si);
+    err_frame:
+    err2 = cap_destroy(frame);
+    if (err_is_fail(err2)) {
+        DEBUG_ERR(err2, "deleting the segment frame");
+    }
+    _binding->tx_vtbl.seg_create_response(_binding, NOP_CONT, err, 0);
 }
 
 static void vas_seg_delete_call__rx(struct vas_binding *_binding, uint64_t sid)
@@ -381,14 +1202,20 @@ static void vas_seg_delete_call__rx(struct vas_binding *_binding, uint64_t sid)
     errval_t err;
 
     struct seg_info *si;
-    err = vas_verify_seg_id(sid, &si);
+    err = vas_verify_seg_id(_binding->st, sid, &si);
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_delete: client=%p, seg=0x%016lx, err='%s'\n",
                                           _binding->st, sid, err_getstring(err));
         goto err_out;
     }
 
-    err = VAS_ERR_NOT_SUPPORTED;
+    if (!vas_client_owns(_binding->st, si->creator)) {
+        err = VAS_ERR_NO_PERMISSION;
+        goto err_out;
+    }
+
+    seg_info_destroy(si);
+
     err_out:
 
     _binding->tx_vtbl.seg_delete_response(_binding, NOP_CONT, err);
@@ -404,13 +1231,15 @@ static void vas_seg_lookup_call__rx(struct vas_binding *_binding, uint64_t name0
 
     union vas_name_arg narg = { .namefields = {name0, name1, name2, name3}};
 
-    struct seg_info *si = (struct seg_info *)elem_lookup(seg_registered,
-                                                         elem_cmp_seg, narg.namestring);
+    struct seg_info *si = (struct seg_info *)registry_lookup_name(&seg_registry,
+                                                                  narg.namestring);
     if (!si) {
-        err = VAS_ERR_CREATE_NAME_CONFLICT;
+        err = VAS_ERR_NOT_FOUND;
         goto err_out;
     }
 
+    err = SYS_ERR_OK;
+
     id = si->id | VAS_ID_MARK;
     vaddr = vregion_get_base_addr(&si->vreg);
     length = vregion_get_size(&si->vreg);
@@ -423,6 +1252,161 @@ static void vas_seg_lookup_call__rx(struct vas_binding *_binding, uint64_t name0
 
 }
 
+static void vas_seg_lookup_addr_call__rx(struct vas_binding *_binding,
+                                         uint64_t vid, uint64_t vaddr)
+{
+    errval_t err;
+
+    union vas_name_arg narg = { .namefields = { 0 } };
+    uint64_t id = 0, base = 0, length = 0;
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, vid, &vi);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    struct seg_info *si = seg_index_lookup(&vi->segs, vaddr);
+    if (si == NULL) {
+        err = VAS_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    id = si->id | VAS_ID_MARK;
+    base = vregion_get_base_addr(&si->vreg);
+    length = vregion_get_size(&si->vreg);
+    strncpy(narg.namestring, si->name, sizeof(narg.namestring));
+
+    err_out :
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] seg_lookup_addr: client=%p, vas=0x%016lx, "
+                          "vaddr=0x%016lx, err='%s'\n", _binding->st, vid, vaddr,
+                          err_getstring(err));
+    }
+    err = _binding->tx_vtbl.seg_lookup_addr_response(_binding, NOP_CONT, err, id,
+                                                     base, length,
+                                                     narg.namefields[0],
+                                                     narg.namefields[1],
+                                                     narg.namefields[2],
+                                                     narg.namefields[3]);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_set_life_call__rx(struct vas_binding *_binding, uint64_t id,
+                                  uint8_t life)
+{
+    errval_t err;
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_ok(err) && vi->deleted) {
+        err = VAS_ERR_NOT_FOUND;
+    }
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    if (!vas_client_owns(_binding->st, vi->creator)) {
+        err = VAS_ERR_NO_PERMISSION;
+        goto err_out;
+    }
+
+    switch (life) {
+    case VAS_LIFE_TRANSIENT:
+        /* adopt an orphaned vas */
+        vi->creator = _binding->st;
+        break;
+    case VAS_LIFE_PERSISTENT:
+        break;
+    default:
+        err = VAS_ERR_NOT_SUPPORTED;
+        goto err_out;
+    }
+
+    vi->life = life;
+
+    err_out:
+    err = _binding->tx_vtbl.set_life_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_get_life_call__rx(struct vas_binding *_binding, uint64_t id)
+{
+    errval_t err;
+
+    uint8_t life = VAS_LIFE_TRANSIENT;
+
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, id, &vi);
+    if (err_is_ok(err)) {
+        life = vi->life;
+    }
+
+    err = _binding->tx_vtbl.get_life_response(_binding, NOP_CONT, err, life);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_seg_set_life_call__rx(struct vas_binding *_binding, uint64_t sid,
+                                      uint8_t life)
+{
+    errval_t err;
+
+    struct seg_info *si;
+    err = vas_verify_seg_id(_binding->st, sid, &si);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    if (!vas_client_owns(_binding->st, si->creator)) {
+        err = VAS_ERR_NO_PERMISSION;
+        goto err_out;
+    }
+
+    switch (life) {
+    case VAS_LIFE_TRANSIENT:
+        /* adopt an orphaned segment */
+        si->creator = _binding->st;
+        break;
+    case VAS_LIFE_PERSISTENT:
+        break;
+    default:
+        err = VAS_ERR_NOT_SUPPORTED;
+        goto err_out;
+    }
+
+    si->life = life;
+
+    err_out:
+    err = _binding->tx_vtbl.seg_set_life_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
+static void vas_seg_get_life_call__rx(struct vas_binding *_binding, uint64_t sid)
+{
+    errval_t err;
+
+    uint8_t life = VAS_LIFE_TRANSIENT;
+
+    struct seg_info *si;
+    err = vas_verify_seg_id(_binding->st, sid, &si);
+    if (err_is_ok(err)) {
+        life = si->life;
+    }
+
+    err = _binding->tx_vtbl.seg_get_life_response(_binding, NOP_CONT, err, life);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "send reply");
+    }
+}
+
 static void vas_seg_attach_call__rx(struct vas_binding *_binding, uint64_t vid,
                                     uint64_t sid, uint32_t flags)
 {
@@ -431,120 +1415,192 @@ static void vas_seg_attach_call__rx(struct vas_binding *_binding, uint64_t vid,
 
     errval_t err;
     struct vas_info *vi;
-    err = vas_verify_vas_id(vid, &vi);
+    err = vas_verify_vas_id(_binding->st, vid, &vi);
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, no vas=0x%016lx, err='%s'\n",
                                   _binding->st, vid, err_getstring(err));
         goto err_out;
     }
 
-    struct vspace *vs = &vi->vas.vspace_state.vspace;
-
     struct seg_info *si;
-    err = vas_verify_seg_id(sid, &si);
+    err = vas_verify_seg_id(_binding->st, sid, &si);
     if (err_is_fail(err)) {
         VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, seg=0x%016lx, err='%s'\n",
                                           _binding->st, sid, err_getstring(err));
         goto err_out;
     }
 
-    flags = flags & si->vreg.flags;
-
-
-    struct seg_attached *att = calloc(1, sizeof(struct seg_attached));
-    if (!att) {
-        err = LIB_ERR_MALLOC_FAIL;
+    err = seg_attached_add(vi, si, flags);
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, seg=0x%016lx, err='%s'\n",
+                          _binding->st, sid, err_getstring(err));
         goto err_out;
     }
 
-    struct vregion *vreg = &att->vreg;
-    vreg->vspace = vs;
-    vreg->memobj = &si->mobj.m;
-    vreg->base   = si->vreg.base;
-    vreg->offset = si->vreg.offset;
-    vreg->size   = si->vreg.size;
-    vreg->flags  = flags;
+    vas_info_inherit(vi, si->vreg.base, si->vreg.size);
 
-    err = vspace_add_vregion(vs, vreg);
+    err_out:
+    err = _binding->tx_vtbl.seg_attach_response(_binding, NOP_CONT, err);
     if (err_is_fail(err)) {
-        err = err_push(err, LIB_ERR_VSPACE_ADD_REGION);
-        free(att);
-        VAS_SERVICE_DEBUG("[request] seg_attach: vspace add client=%p, seg=0x%016lx, err='%s'\n",
-                          _binding->st, sid, err_getstring(err));
+        USER_PANIC_ERR(err, "oops");
+    }
+}
+
+static void vas_seg_detach_call__rx(struct vas_binding *_binding, uint64_t vid,
+                                    uint64_t sid)
+{
+    errval_t err;
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, vid, &vi);
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, vas=0x%016lx, err='%s'\n",
+                                  _binding->st, vid, err_getstring(err));
         goto err_out;
     }
 
-    err = si->mobj.m.f.map_region(&si->mobj.m, vreg);
+    struct seg_info *si;
+    err = vas_verify_seg_id(_binding->st, sid, &si);
     if (err_is_fail(err)) {
-        err =  err_push(err, LIB_ERR_MEMOBJ_MAP_REGION);
-        free(att);
-        VAS_SERVICE_DEBUG("[request] seg_attach: map add client=%p, seg=0x%016lx, err='%s'\n",
-                          _binding->st, sid, err_getstring(err));
+        VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, seg=0x%016lx, err='%s'\n",
+                                          _binding->st, sid, err_getstring(err));
         goto err_out;
     }
 
-    err = si->mobj.m.f.pagefault(&si->mobj.m, vreg, 0, 0);
+    struct seg_attached *att = seg_attached_find(si, &vi->vas.vspace_state.vspace);
+    if (att == NULL) {
+        err = VAS_ERR_NOT_ATTACHED;
+        goto err_out;
+    }
+
+    err = seg_attached_remove(si, att);
+
+    err_out:
+    err = _binding->tx_vtbl.seg_detach_response(_binding, NOP_CONT, err);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "oops");
+    }
+}
+
+
+/*
+ * the batched variants attach or detach all segments or none of them. The
+ * attachers of the VAS are updated once for the entire batch.
+ */
+static void vas_seg_attach_batch_call__rx(struct vas_binding *_binding,
+                                          uint64_t vid, uint8_t *sids,
+                                          size_t sids_size, uint32_t flags)
+{
+    VAS_SERVICE_DEBUG("[request] seg_attach_batch: client=%p, vas=0x%016lx, nseg=%zu\n",
+                      _binding->st, vid, sids_size / sizeof(vas_seg_id_t));
+
+    errval_t err;
+    struct vas_info *vi;
+    err = vas_verify_vas_id(_binding->st, vid, &vi);
     if (err_is_fail(err)) {
-        err =  err_push(err, LIB_ERR_MEMOBJ_MAP_REGION);
-        free(att);
-        VAS_SERVICE_DEBUG("[request] seg_attach: pagefault client=%p, seg=0x%016lx, err='%s'\n",
-                                  _binding->st, sid, err_getstring(err));
         goto err_out;
     }
 
-    att->next = si->attached;
-    si->attached = att;
+    if (sids_size % sizeof(vas_seg_id_t)) {
+        err = VAS_ERR_NOT_FOUND;
+        goto err_out;
+    }
 
-#define X86_64_PML4_BASE(base)         (((uint64_t)(base) >> 39) & X86_64_PTABLE_MASK)
+    vas_seg_id_t *ids = (vas_seg_id_t *)sids;
+    size_t count = sids_size / sizeof(vas_seg_id_t);
+    uint64_t pending[VAS_PML4_MAP_WORDS] = { 0 };
 
-    uint32_t entry = X86_64_PML4_BASE(vreg->base);
-    uint32_t slot = entry / 64;
-    uint32_t bit = entry % 64;
+    size_t attached = 0;
+    for (; attached < count; attached++) {
+        struct seg_info *si;
+        err = vas_verify_seg_id(_binding->st, ids[attached], &si);
+        if (err_is_fail(err)) {
+            break;
+        }
 
+        err = seg_attached_add(vi, si, flags);
+        if (err_is_fail(err)) {
+            break;
+        }
 
-    if (!(vi->map[slot] & (1UL << bit))) {
-        struct vas_attached *at = vi->attached;
-        while(at) {
-            err = vas_vspace_inherit_regions(&vi->vas, at->vroot, entry, entry);
-            if (err_is_fail(err)) {
-                USER_PANIC_ERR(err, "could not inherit region");
+        vas_info_collect(vi, pending, si->vreg.base, si->vreg.size);
+    }
+
+    if (err_is_fail(err)) {
+        VAS_SERVICE_DEBUG("[request] seg_attach_batch: client=%p, seg=0x%016lx, err='%s'\n",
+                          _binding->st, ids[attached], err_getstring(err));
+
+        struct vspace *vs = &vi->vas.vspace_state.vspace;
+        while (attached-- > 0) {
+            struct seg_info *si = (struct seg_info *)(VAS_ID_MASK & ids[attached]);
+            errval_t err2 = seg_attached_remove(si, seg_attached_find(si, vs));
+            if (err_is_fail(err2)) {
+                USER_PANIC_ERR(err2, "could not roll back segment attach");
             }
-            at = at->next;
         }
-        vi->map[slot] |= (1UL << bit);
+        goto err_out;
     }
 
+    vas_info_inherit_pending(vi, pending);
+
     err_out:
-    err = _binding->tx_vtbl.seg_attach_response(_binding, NOP_CONT, err);
+    free(sids);
+    err = _binding->tx_vtbl.seg_attach_batch_response(_binding, NOP_CONT, err);
     if (err_is_fail(err)) {
         USER_PANIC_ERR(err, "oops");
     }
 }
 
-static void vas_seg_detach_call__rx(struct vas_binding *_binding, uint64_t vid,
-                                    uint64_t sid)
+static void vas_seg_detach_batch_call__rx(struct vas_binding *_binding,
+                                          uint64_t vid, uint8_t *sids,
+                                          size_t sids_size)
 {
     errval_t err;
     struct vas_info *vi;
-    err = vas_verify_vas_id(vid, &vi);
+    err = vas_verify_vas_id(_binding->st, vid, &vi);
     if (err_is_fail(err)) {
-        VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, vas=0x%016lx, err='%s'\n",
-                                  _binding->st, vid, err_getstring(err));
         goto err_out;
     }
 
-    struct seg_info *si;
-    err = vas_verify_seg_id(sid, &si);
-    if (err_is_fail(err)) {
-        VAS_SERVICE_DEBUG("[request] seg_attach: client=%p, seg=0x%016lx, err='%s'\n",
-                                          _binding->st, sid, err_getstring(err));
+    if (sids_size % sizeof(vas_seg_id_t)) {
+        err = VAS_ERR_NOT_FOUND;
         goto err_out;
     }
 
-    err = VAS_ERR_NOT_SUPPORTED;
+    vas_seg_id_t *ids = (vas_seg_id_t *)sids;
+    size_t count = sids_size / sizeof(vas_seg_id_t);
+    struct vspace *vs = &vi->vas.vspace_state.vspace;
+
+    /* check the entire batch before tearing anything down */
+    for (size_t i = 0; i < count; i++) {
+        struct seg_info *si;
+        err = vas_verify_seg_id(_binding->st, ids[i], &si);
+        if (err_is_fail(err)) {
+            goto err_out;
+        }
+        if (seg_attached_find(si, vs) == NULL) {
+            err = VAS_ERR_NOT_ATTACHED;
+            goto err_out;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct seg_info *si = (struct seg_info *)(VAS_ID_MASK & ids[i]);
+        struct seg_attached *att = seg_attached_find(si, vs);
+        if (att == NULL) {
+            /* segment appeared twice in the batch */
+            continue;
+        }
+        err = seg_attached_remove(si, att);
+        if (err_is_fail(err)) {
+            break;
+        }
+    }
 
     err_out:
-    err = _binding->tx_vtbl.seg_attach_response(_binding, NOP_CONT, err);
+    VAS_SERVICE_DEBUG("[request] seg_detach_batch: client=%p, vas=0x%016lx, err='%s'\n",
+                      _binding->st, vid, err_getstring(err));
+    free(sids);
+    err = _binding->tx_vtbl.seg_detach_batch_response(_binding, NOP_CONT, err);
     if (err_is_fail(err)) {
         USER_PANIC_ERR(err, "oops");
     }
@@ -557,12 +1613,22 @@ static struct vas_rx_vtbl rx_vtbl = {
     .attach_call = vas_attach_call__rx,
     .detach_call = vas_detach_call__rx,
     .lookup_call = vas_lookup_call__rx,
+    .map_call = vas_map_call__rx,
+    .map_fixed_call = vas_map_fixed_call__rx,
+    .unmap_call = vas_unmap_call__rx,
+    .set_life_call = vas_set_life_call__rx,
+    .get_life_call = vas_get_life_call__rx,
 
     .seg_create_call = vas_seg_create_call__rx,
     .seg_delete_call = vas_seg_delete_call__rx,
     .seg_attach_call = vas_seg_attach_call__rx,
     .seg_detach_call = vas_seg_detach_call__rx,
-    .seg_lookup_call = vas_seg_lookup_call__rx
+    .seg_lookup_call = vas_seg_lookup_call__rx,
+    .seg_lookup_addr_call = vas_seg_lookup_addr_call__rx,
+    .seg_set_life_call = vas_seg_set_life_call__rx,
+    .seg_get_life_call = vas_seg_get_life_call__rx,
+    .seg_attach_batch_call = vas_seg_attach_batch_call__rx,
+    .seg_detach_batch_call = vas_seg_detach_batch_call__rx
 };
 
 /*
@@ -571,6 +1637,18 @@ static struct vas_rx_vtbl rx_vtbl = {
  * ------------------------------------------------------------------------------
  */
 
+static void vas_error_handler(struct vas_binding *binding, errval_t err)
+{
+    struct vas_client *client = binding->st;
+
+    VAS_SERVICE_DEBUG("[connect] client %p gone: %s\n", client, err_getstring(err));
+
+    vas_client_release(client);
+
+    free(client);
+    binding->st = NULL;
+}
+
 static errval_t vas_connect_handler(void *st, struct vas_binding *binding)
 {
     struct vas_client *client = calloc(1, sizeof(struct vas_client));
@@ -583,6 +1661,7 @@ static errval_t vas_connect_handler(void *st, struct vas_binding *binding)
     client->b = binding;
     binding->st = client;
     binding->rx_vtbl = rx_vtbl;
+    binding->error_handler = vas_error_handler;
 
     return SYS_ERR_OK;
 }
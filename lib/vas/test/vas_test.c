@@ -175,6 +175,28 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* switches on this core use the replica, which must see the segments */
+    err = vas_replicate(vas[0], disp_get_core_id());
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to replicate vas");
+    }
+
+    vas_life_t life;
+    err = vas_seg_set_life(seg[0], VAS_LIFE_PERSISTENT);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to set segment lifetime");
+    }
+
+    err = vas_seg_get_life(seg[0], &life);
+    if (err_is_fail(err) || life != VAS_LIFE_PERSISTENT) {
+        USER_PANIC_ERR(err, "segment lifetime not persistent");
+    }
+
+    err = vas_seg_set_life(seg[0], VAS_LIFE_TRANSIENT);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to set segment lifetime");
+    }
+
     for (int i = 0; i < VAS_TEST_NUM_SEG; ++i) {
         err = vas_seg_attach(vas[0], seg[i], VAS_FLAGS_PERM_READ);
         if (err_is_fail(err)) {
@@ -191,6 +213,118 @@ int main(int argc, char *argv[])
 
     *((uint64_t*)0x80000000000) = 0x1;
 
+    vas_seg_handle_t found;
+    err = vas_seg_lookup_addr(vas[0], 0x80000000000 + 2*LARGE_PAGE_SIZE + 8, &found);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to lookup segment by address");
+    }
+    if (vas_seg_get_id(found) != vas_seg_get_id(seg[1])) {
+        USER_PANIC("lookup by address returned the wrong segment");
+    }
+
+    err = vas_seg_lookup_addr(vas[0], 0x80000000000 + LARGE_PAGE_SIZE, &found);
+    if (err_no(err) != VAS_ERR_NOT_FOUND) {
+        USER_PANIC_ERR(err, "lookup of unbacked address must fail");
+    }
+
+    /* shared heap test */
+    vas_seg_handle_t heapseg;
+    err = vas_seg_alloc("/seg/test/heap", 0, LARGE_PAGE_SIZE,
+                        0x80000000000 + 2*VAS_TEST_NUM_SEG*LARGE_PAGE_SIZE,
+                        VAS_FLAGS_PERM_READ | VAS_FLAGS_PERM_WRITE, &heapseg);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to create heap segment");
+    }
+
+    err = vas_seg_attach(vas[0], heapseg, VAS_FLAGS_PERM_READ | VAS_FLAGS_PERM_WRITE);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to attach heap segment");
+    }
+
+    err = vas_seg_heap_init(heapseg);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to initialize the segment heap");
+    }
+
+    uint64_t *elems[16];
+    for (int i = 0; i < 16; ++i) {
+        elems[i] = vas_seg_malloc(heapseg, (i + 1) * sizeof(uint64_t));
+        if (elems[i] == NULL) {
+            USER_PANIC("segment heap allocation failed");
+        }
+        *elems[i] = i;
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        if (*elems[i] != i) {
+            USER_PANIC("segment heap allocations overlap");
+        }
+        vas_seg_mfree(heapseg, elems[i]);
+    }
+
+    /* teardown test */
+    debug_printf("## VAS TEARDOWN TEST\n");
+
+    err = vas_detach(vas[0]);
+    if (err_no(err) != VAS_ERR_DETACH_SWITCH) {
+        USER_PANIC_ERR(err, "detaching active vas must fail");
+    }
+
+    err = vas_switch(VAS_HANDLE_PROCESS);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to switch to original");
+    }
+
+    err = vas_seg_detach(vas[0], heapseg);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to detach heap segment");
+    }
+
+    for (int i = 0; i < VAS_TEST_NUM_SEG; ++i) {
+        err = vas_seg_detach(vas[0], seg[i]);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "failed to detach segment");
+        }
+    }
+
+    err = vas_seg_attach_batch(vas[0], seg, VAS_TEST_NUM_SEG, VAS_FLAGS_PERM_READ);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to attach segment batch");
+    }
+
+    err = vas_seg_attach_batch(vas[0], seg, VAS_TEST_NUM_SEG, VAS_FLAGS_PERM_READ);
+    if (err_is_ok(err)) {
+        USER_PANIC("attaching attached segments must fail");
+    }
+
+    err = vas_seg_detach_batch(vas[0], seg, VAS_TEST_NUM_SEG);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to detach segment batch");
+    }
+
+    err = vas_unmap(vas[proc_id], buf2);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to unmap frame");
+    }
+
+    for (size_t i = 0; i < proc_total; ++i) {
+        err = vas_detach(vas[i]);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "failed to detach");
+        }
+    }
+
+    err = vas_switch(vas[proc_id]);
+    if (err_no(err) != VAS_ERR_SWITCH_NOT_ATTACHED) {
+        USER_PANIC_ERR(err, "switching to detached vas must fail");
+    }
+
+    /* the other processes may still be attached, deletion is deferred */
+    err = vas_delete(vas[proc_id]);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "failed to delete vas");
+    }
+
 
     debug_printf("## VAS TEST TERMINATED\n");
 
@@ -35,11 +35,7 @@ errval_t vas_enable(void)
     vas_process.id = VAS_ID_PROCESS;
     vas_process.vroot = (struct capref){.cnode = cnode_page,.slot = 0};
     vas_process.state = VAS_STATE_ACTIVE;
-    domainid_t domid = disp_get_domain_id();
-    if (domid < 0x100) {
-        debug_printf("[vas] setting tag of process vas to %u\n", domid);
-        vas_process.tag = domid;
-    }
+    vas_process.tag = VAS_TAG_AUTO;
 
     disp_set_current_vas(&vas_process);
 
@@ -131,9 +127,51 @@ errval_t vas_create(const char* name, vas_flags_t perm, vas_handle_t *ret_vas)
  */
 errval_t vas_delete(vas_handle_t vh)
 {
-    //struct vas *vas = vas_get_vas_pointer(vh);
+    errval_t err;
+
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    VAS_DEBUG_LIBVAS("deleting vas '%s'\n", vas->name);
+
+    if (vas == &vas_process) {
+        return VAS_ERR_NO_PERMISSION;
+    }
+
+    if (vas->state == VAS_STATE_ACTIVE) {
+        return VAS_ERR_DETACH_SWITCH;
+    }
+
+    if (vas->state == VAS_STATE_ATTACHED) {
+        err = vas_detach(vh);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    vas->state = VAS_STATE_DESTROYING;
+
+    if (vas->perms & VAS_FLAGS_PERM_LOCAL) {
+        err = vas_vspace_destroy(vas);
+        if (err_is_fail(err)) {
+            vas->state = VAS_STATE_DETACHED;
+            return err;
+        }
+    } else {
+        /* the service defers the deletion until all attachers have left */
+        err = vas_client_vas_delete(vas->id);
+        if (err_is_fail(err)) {
+            vas->state = VAS_STATE_DETACHED;
+            return err;
+        }
+
+        cap_destroy(vas->vroot);
+    }
+
+    vas->state = VAS_STATE_DESTROIED;
 
-    return VAS_ERR_NOT_SUPPORTED;
+    free(vas);
+
+    return SYS_ERR_OK;
 }
 
 /**
@@ -221,12 +259,12 @@ errval_t vas_attach(vas_handle_t vh, vas_flags_t perm)
         return VAS_ERR_ATTACH_STATE;
     }
 
-    err = vas_vspace_inherit_segments(vas);
+    err = vas_vspace_inherit_segments(vas->vroot);
     if (err_is_fail(err)) {
         return err;
     }
 
-    err = vas_vspace_inherit_heap(vas);
+    err = vas_vspace_inherit_heap(vas->vroot);
     if (err_is_fail(err)) {
         return err;
     }
@@ -251,9 +289,166 @@ errval_t vas_attach(vas_handle_t vh, vas_flags_t perm)
  */
 errval_t vas_detach(vas_handle_t vh)
 {
-    //struct vas *vas = vas_get_vas_pointer(vh);
+    errval_t err;
+
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    VAS_DEBUG_LIBVAS("detaching vas '%s'\n", vas->name);
+
+    if (vas == &vas_process) {
+        return VAS_ERR_NO_PERMISSION;
+    }
+
+    /* if the state is already detached don't do anything*/
+    if (vas->state == VAS_STATE_DETACHED) {
+        return SYS_ERR_OK;
+    }
+
+    /* we cannot remove the address space we are currently running on */
+    if (vas->state == VAS_STATE_ACTIVE) {
+        return VAS_ERR_DETACH_SWITCH;
+    }
+
+    if (vas->state != VAS_STATE_ATTACHED) {
+        return VAS_ERR_DETACH_STATE;
+    }
+
+    vas->state = VAS_STATE_DETACHING;
+
+    if (!(vas->perms & VAS_FLAGS_PERM_LOCAL)) {
+        err = vas_client_vas_detach(vas->id);
+        if (err_is_fail(err)) {
+            vas->state = VAS_STATE_ATTACHED;
+            return err;
+        }
 
-    return VAS_ERR_NOT_SUPPORTED;
+        /*
+         * the vroot still contains the inherited entries of the VAS, replace
+         * it with an empty one so that a later attach starts from scratch
+         */
+        err = vas_vspace_reset_vroot(vas->vroot);
+        if (err_is_fail(err)) {
+            vas->state = VAS_STATE_INVALID;
+            return err;
+        }
+
+        /* the service has dropped the replicas together with the vroot */
+        if (vas->replicas) {
+            for (coreid_t core = 0; core < MAX_COREID; core++) {
+                if (!capref_is_null(vas->replicas[core])) {
+                    cap_destroy(vas->replicas[core]);
+                }
+            }
+            free(vas->replicas);
+            vas->replicas = NULL;
+        }
+    }
+
+    vas->state = VAS_STATE_DETACHED;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief creates a replica of the VAS root page table for a core
+ *
+ * Subsequent switches to the VAS on that core load the replica, so the
+ * root page table and the TLB tag of the VAS are private to the core. The
+ * replica is attached to the VAS service, which keeps it consistent with
+ * the VAS as segments are attached and detached. The replicas are dropped
+ * when the VAS is detached.
+ *
+ * The root page table is allocated with the current RAM affinity. To home
+ * it on the NUMA node of the core, set the affinity accordingly (see
+ * ram_set_affinity()) before calling this function.
+ *
+ * Must be called on the dispatcher that attached the VAS.
+ *
+ * \param vh    handle to the VAS to replicate
+ * \param core  the core the replica is used on
+ *
+ * \returns SYS_ERR_OK on success
+ *          errval on error
+ */
+errval_t vas_replicate(vas_handle_t vh, coreid_t core)
+{
+    errval_t err;
+
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    VAS_DEBUG_LIBVAS("replicating vas '%s' for core %u\n", vas->name, core);
+
+    if (vas == &vas_process || (vas->perms & VAS_FLAGS_PERM_LOCAL)) {
+        return VAS_ERR_NOT_SUPPORTED;
+    }
+
+    if (vas->state != VAS_STATE_ATTACHED && vas->state != VAS_STATE_ACTIVE) {
+        return VAS_ERR_SWITCH_NOT_ATTACHED;
+    }
+
+    if (core >= MAX_COREID) {
+        return MON_ERR_INVALID_CORE_ID;
+    }
+
+    if (vas->replicas == NULL) {
+        vas->replicas = calloc(MAX_COREID, sizeof(struct capref));
+        if (vas->replicas == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+    }
+
+    if (!capref_is_null(vas->replicas[core])) {
+        return SYS_ERR_OK;
+    }
+
+    struct capref vroot;
+    err = slot_alloc(&vroot);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = vas_vspace_create_vroot(vroot);
+    if (err_is_fail(err)) {
+        slot_free(vroot);
+        return err;
+    }
+
+    err = vas_vspace_inherit_segments(vroot);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    err = vas_vspace_inherit_heap(vroot);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    err = vas_client_vas_attach(vas->id, vroot);
+    if (err_is_fail(err)) {
+        goto err_out;
+    }
+
+    vas->replicas[core] = vroot;
+
+    return SYS_ERR_OK;
+
+    err_out:
+    cap_destroy(vroot);
+    return err;
+}
+
+/**
+ * \brief returns the vroot to load on the current core
+ */
+static inline struct capref vas_get_vroot(struct vas *vas)
+{
+    if (vas->replicas) {
+        struct capref vroot = vas->replicas[disp_get_core_id()];
+        if (!capref_is_null(vroot)) {
+            return vroot;
+        }
+    }
+    return vas->vroot;
 }
 
 static inline errval_t vas_do_switch(struct vas *vas)
@@ -262,7 +457,7 @@ static inline errval_t vas_do_switch(struct vas *vas)
 
     errval_t err;
 
-    err = vnode_vroot_switch(vas->vroot, vas->tag);
+    err = vnode_vroot_switch(vas_get_vroot(vas), vas->tag);
     if (err_is_fail(err)) {
         return err;
     }
@@ -345,8 +540,51 @@ errval_t vas_switchm(vas_handle_t vh, vas_handle_t *ret_vas)
  */
 errval_t vas_get_perm(vas_id_t id, vas_flags_t* perm) { return VAS_ERR_NOT_SUPPORTED; }
 errval_t vas_set_perm(vas_id_t id, vas_flags_t perm) {return VAS_ERR_NOT_SUPPORTED; }
-errval_t vas_get_life(vas_id_t id, vas_life_t* life) {return VAS_ERR_NOT_SUPPORTED;}
-errval_t vas_set_life(vas_id_t id, vas_life_t lifetime) {return VAS_ERR_NOT_SUPPORTED;}
+
+/**
+ * \brief obtains the lifetime of the address space
+ *
+ * \param vh       the virtual address space
+ * \param life     returns the lifetime
+ *
+ * \returns SYS_ERR_OK on success
+ *          errval on error
+ */
+errval_t vas_get_life(vas_handle_t vh, vas_life_t* life)
+{
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    if (vas == &vas_process || (vas->perms & VAS_FLAGS_PERM_LOCAL)) {
+        *life = VAS_LIFE_TRANSIENT;
+        return SYS_ERR_OK;
+    }
+
+    return vas_client_vas_get_life(vas->id, life);
+}
+
+/**
+ * \brief sets the lifetime of the address space
+ *
+ * A persistent address space is not deleted when its creator exits. Once the
+ * creator is gone any domain may delete it, or adopt it by setting the
+ * lifetime back to VAS_LIFE_TRANSIENT.
+ *
+ * \param vh       the virtual address space
+ * \param lifetime the new lifetime
+ *
+ * \returns SYS_ERR_OK on success
+ *          errval on error
+ */
+errval_t vas_set_life(vas_handle_t vh, vas_life_t lifetime)
+{
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    if (vas == &vas_process || (vas->perms & VAS_FLAGS_PERM_LOCAL)) {
+        return VAS_ERR_NOT_SUPPORTED;
+    }
+
+    return vas_client_vas_set_life(vas->id, lifetime);
+}
 
 vas_state_t vas_get_state(vas_handle_t vh)
 {
@@ -367,9 +605,13 @@ errval_t vas_map(vas_handle_t vh, void **retaddr, struct capref frame, size_t si
 
 errval_t vas_unmap(vas_handle_t vh, void *addr)
 {
-    //struct vas *vas = vas_get_vas_pointer(vh);
+    struct vas *vas = vas_get_vas_pointer(vh);
 
-    return VAS_ERR_NOT_SUPPORTED;
+    if (!(vas->perms & VAS_FLAGS_PERM_LOCAL)) {
+        return vas_client_seg_unmap(vas->id, (lvaddr_t)addr);
+    } else {
+        return vas_vspace_unmap(vas, addr, NULL);
+    }
 }
 
 errval_t vas_tagging_enable(void)
@@ -382,11 +624,23 @@ errval_t vas_tagging_disable(void)
     return monitor_tlb_tag_toggle(0);
 }
 
+/**
+ * \brief requests TLB tagging for the address space
+ *
+ * The PCID itself is assigned by the kernel of the core the switch happens
+ * on. The request takes effect with the next switch to the address space.
+ *
+ * \param vas   the virtual address space to tag
+ *
+ * \return SYS_ERR_OK on success
+ */
 errval_t vas_tagging_tag(vas_handle_t vh)
 {
-    //struct vas *vas = vas_get_vas_pointer(vh);
+    struct vas *vas = vas_get_vas_pointer(vh);
 
-    return VAS_ERR_NOT_SUPPORTED;
+    vas->tag = VAS_TAG_AUTO;
+
+    return SYS_ERR_OK;
 }
 
 
@@ -153,8 +153,65 @@ errval_t vas_client_vas_attach(vas_id_t id, struct capref vroot)
     return msgerr;
 }
 
+errval_t vas_client_vas_delete(vas_id_t id)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+
+    errval_t err, msgerr;
+
+    err = vas_srv_rpc.vtbl.delete(&vas_srv_rpc, id, &msgerr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
+errval_t vas_client_vas_set_life(vas_id_t id, vas_life_t life)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+
+    errval_t err, msgerr;
+
+    err = vas_srv_rpc.vtbl.set_life(&vas_srv_rpc, id, life, &msgerr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
+errval_t vas_client_vas_get_life(vas_id_t id, vas_life_t *ret_life)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+
+    errval_t err, msgerr;
+    uint8_t life;
+
+    err = vas_srv_rpc.vtbl.get_life(&vas_srv_rpc, id, &msgerr, &life);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (err_is_ok(msgerr) && ret_life) {
+        *ret_life = life;
+    }
+
+    return msgerr;
+}
+
 errval_t vas_client_vas_detach(vas_id_t id)
 {
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+
     errval_t err, msgerr;
 
     err = vas_srv_rpc.vtbl.detach(&vas_srv_rpc, id, &msgerr);
@@ -224,7 +281,8 @@ errval_t vas_client_seg_create(struct vas_seg *seg)
     uint64_t *nameptr = (uint64_t*)seg->name;
     err = vas_srv_rpc.vtbl.seg_create(&vas_srv_rpc, nameptr[0], nameptr[1],
                                       nameptr[2], nameptr[3], seg->vaddr,
-                                      seg->length, seg->frame, &msgerr, &seg->id);
+                                      seg->length, seg->frame, seg->flags,
+                                      &msgerr, &seg->id);
     if (err_is_fail(err)) {
         return err;
     }
@@ -249,6 +307,26 @@ errval_t vas_client_seg_lookup(struct vas_seg *seg)
     return msgerr;
 }
 
+errval_t vas_client_seg_lookup_addr(vas_id_t vid, lvaddr_t vaddr,
+                                    struct vas_seg *seg)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+    errval_t err, msgerr;
+
+    uint64_t *nameptr = (uint64_t*)seg->name;
+    err = vas_srv_rpc.vtbl.seg_lookup_addr(&vas_srv_rpc, vid, vaddr, &msgerr,
+                                           &seg->id, &seg->vaddr, &seg->length,
+                                           &nameptr[0], &nameptr[1], &nameptr[2],
+                                           &nameptr[3]);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
 errval_t vas_client_seg_delete(vas_seg_id_t sid)
 {
     if (vas_service_client == NULL) {
@@ -264,6 +342,41 @@ errval_t vas_client_seg_delete(vas_seg_id_t sid)
     return msgerr;
 }
 
+errval_t vas_client_seg_set_life(vas_seg_id_t sid, vas_life_t life)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+    errval_t err, msgerr;
+
+    err = vas_srv_rpc.vtbl.seg_set_life(&vas_srv_rpc, sid, life, &msgerr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
+errval_t vas_client_seg_get_life(vas_seg_id_t sid, vas_life_t *ret_life)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+    errval_t err, msgerr;
+    uint8_t life;
+
+    err = vas_srv_rpc.vtbl.seg_get_life(&vas_srv_rpc, sid, &msgerr, &life);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (err_is_ok(msgerr) && ret_life) {
+        *ret_life = life;
+    }
+
+    return msgerr;
+}
+
 errval_t vas_client_seg_attach(vas_id_t vid, vas_seg_id_t sid, vas_flags_t flags)
 {
     if (vas_service_client == NULL) {
@@ -294,3 +407,39 @@ errval_t vas_client_seg_detach(vas_id_t vid, vas_seg_id_t sid)
     return msgerr;
 }
 
+errval_t vas_client_seg_attach_batch(vas_id_t vid, vas_seg_id_t *sids,
+                                     size_t count, vas_flags_t flags)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+    errval_t err, msgerr;
+
+    err = vas_srv_rpc.vtbl.seg_attach_batch(&vas_srv_rpc, vid, (uint8_t *)sids,
+                                            count * sizeof(vas_seg_id_t), flags,
+                                            &msgerr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
+errval_t vas_client_seg_detach_batch(vas_id_t vid, vas_seg_id_t *sids,
+                                     size_t count)
+{
+    if (vas_service_client == NULL) {
+        return VAS_ERR_SERVICE_NOT_ENABLED;
+    }
+    errval_t err, msgerr;
+
+    err = vas_srv_rpc.vtbl.seg_detach_batch(&vas_srv_rpc, vid, (uint8_t *)sids,
+                                            count * sizeof(vas_seg_id_t),
+                                            &msgerr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return msgerr;
+}
+
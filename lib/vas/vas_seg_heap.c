@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Segment resident heap.
+ *
+ * The allocator state lives at the beginning of the segment. Segments are
+ * mapped at the same address in every VAS, so all attachers can allocate
+ * and free concurrently without going through a server. Blocks are handed
+ * out in power-of-two size classes. Freed blocks go onto the free list of
+ * the core that frees them. The lists are lock-free stacks with an ABA
+ * counter in the head word, so frees from other processes need no locks.
+ * Fresh blocks are carved off the unused part of the segment with an
+ * atomic bump pointer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+
+#include <vas_internal.h>
+#include <vas/vas_segment.h>
+
+/*
+ * =============================================================================
+ * Type definitions
+ * =============================================================================
+ */
+
+#define SEG_HEAP_MAGIC          0x5345474845415021UL    ///< "SEGHEAP!"
+
+///< number of per-core free lists
+#define SEG_HEAP_MAX_CORES      64
+
+///< smallest block size (including the block header)
+#define SEG_HEAP_MIN_SHIFT      5
+///< largest block size (including the block header)
+#define SEG_HEAP_MAX_SHIFT      20
+#define SEG_HEAP_NUM_CLASSES    (SEG_HEAP_MAX_SHIFT - SEG_HEAP_MIN_SHIFT + 1)
+
+///< block offsets are stored in units of the block alignment
+#define SEG_HEAP_ALIGN_SHIFT    4
+#define SEG_HEAP_ALIGN          (1UL << SEG_HEAP_ALIGN_SHIFT)
+
+///< the head of a free list: 40 bit block offset, 24 bit ABA counter
+#define SEG_HEAP_OFF_BITS       40
+#define SEG_HEAP_OFF_MASK       ((1UL << SEG_HEAP_OFF_BITS) - 1)
+
+struct seg_heap_block
+{
+    uint64_t next;              ///< offset of the next free block
+    uint32_t class;             ///< size class of the block
+    uint32_t magic;             ///< detects frees of foreign pointers
+};
+
+#define SEG_HEAP_BLOCK_MAGIC    0xB10CB10C
+
+struct seg_heap
+{
+    uint64_t magic;
+    uint64_t size;                  ///< size of the segment
+    volatile uint64_t top;          ///< offset of the unused part
+    uint64_t pad[5];
+    volatile uint64_t freelist[SEG_HEAP_MAX_CORES][SEG_HEAP_NUM_CLASSES];
+};
+
+/*
+ * =============================================================================
+ * Internal functions
+ * =============================================================================
+ */
+
+static inline struct seg_heap *seg_heap_get(vas_seg_handle_t sh)
+{
+    return (struct seg_heap *)vas_seg_get_vaddr(sh);
+}
+
+static inline struct seg_heap_block *seg_heap_block(struct seg_heap *heap,
+                                                    uint64_t off)
+{
+    return (struct seg_heap_block *)((uint8_t *)heap + (off << SEG_HEAP_ALIGN_SHIFT));
+}
+
+static inline uint64_t seg_heap_offset(struct seg_heap *heap,
+                                       struct seg_heap_block *block)
+{
+    return ((uint8_t *)block - (uint8_t *)heap) >> SEG_HEAP_ALIGN_SHIFT;
+}
+
+static inline int seg_heap_class(size_t bytes)
+{
+    size_t size = bytes + sizeof(struct seg_heap_block);
+    int shift = SEG_HEAP_MIN_SHIFT;
+    while ((1UL << shift) < size) {
+        shift++;
+    }
+    if (shift > SEG_HEAP_MAX_SHIFT) {
+        return -1;
+    }
+    return shift - SEG_HEAP_MIN_SHIFT;
+}
+
+static inline size_t seg_heap_class_size(int class)
+{
+    return 1UL << (class + SEG_HEAP_MIN_SHIFT);
+}
+
+static inline coreid_t seg_heap_core(void)
+{
+    return disp_get_core_id() % SEG_HEAP_MAX_CORES;
+}
+
+static void seg_heap_push(struct seg_heap *heap, volatile uint64_t *list,
+                          struct seg_heap_block *block)
+{
+    uint64_t off = seg_heap_offset(heap, block);
+    uint64_t head, new;
+    do {
+        head = *list;
+        block->next = head & SEG_HEAP_OFF_MASK;
+        new = (((head >> SEG_HEAP_OFF_BITS) + 1) << SEG_HEAP_OFF_BITS) | off;
+    } while (!__sync_bool_compare_and_swap(list, head, new));
+}
+
+static struct seg_heap_block *seg_heap_pop(struct seg_heap *heap,
+                                           volatile uint64_t *list)
+{
+    uint64_t head, new;
+    struct seg_heap_block *block;
+    do {
+        head = *list;
+        if ((head & SEG_HEAP_OFF_MASK) == 0) {
+            return NULL;
+        }
+        block = seg_heap_block(heap, head & SEG_HEAP_OFF_MASK);
+        new = (((head >> SEG_HEAP_OFF_BITS) + 1) << SEG_HEAP_OFF_BITS) | block->next;
+    } while (!__sync_bool_compare_and_swap(list, head, new));
+
+    return block;
+}
+
+static struct seg_heap_block *seg_heap_carve(struct seg_heap *heap, int class)
+{
+    size_t size = seg_heap_class_size(class);
+    uint64_t top, new;
+    do {
+        top = heap->top;
+        new = top + size;
+        if (new > heap->size) {
+            return NULL;
+        }
+    } while (!__sync_bool_compare_and_swap(&heap->top, top, new));
+
+    return (struct seg_heap_block *)((uint8_t *)heap + top);
+}
+
+/*
+ * =============================================================================
+ * Public interface
+ * =============================================================================
+ */
+
+/**
+ * \brief formats the segment as a shared heap
+ *
+ * Must be called once, by the creator of the segment, before any other
+ * domain allocates from it. The segment must be mapped in the current
+ * address space.
+ *
+ * \param sh    the segment handle
+ *
+ * \returns SYS_ERR_OK on success
+ *          VAS_ERR_SEG_SIZE if the segment is too small
+ */
+errval_t vas_seg_heap_init(vas_seg_handle_t sh)
+{
+    struct seg_heap *heap = seg_heap_get(sh);
+    size_t size = vas_seg_get_size(sh);
+
+    size_t hdr = ROUND_UP(sizeof(struct seg_heap), BASE_PAGE_SIZE);
+    if (size <= hdr || (size >> SEG_HEAP_ALIGN_SHIFT) > SEG_HEAP_OFF_MASK) {
+        return VAS_ERR_SEG_SIZE;
+    }
+
+    memset(heap, 0, sizeof(*heap));
+    heap->size = size;
+    heap->top = hdr;
+
+    /* publish the heap only once it is fully set up */
+    __sync_synchronize();
+    heap->magic = SEG_HEAP_MAGIC;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief allocates memory from the shared heap of the segment
+ *
+ * Blocks come from the free list of the current core first, then from
+ * the unused part of the segment and finally from the free lists of the
+ * other cores.
+ *
+ * \param sh    the segment handle
+ * \param bytes the number of bytes to allocate
+ *
+ * \returns pointer to the memory, valid in all address spaces the segment
+ *          is attached to, or NULL if the heap is exhausted
+ */
+void *vas_seg_malloc(vas_seg_handle_t sh, size_t bytes)
+{
+    struct seg_heap *heap = seg_heap_get(sh);
+
+    if (heap->magic != SEG_HEAP_MAGIC) {
+        return NULL;
+    }
+
+    int class = seg_heap_class(bytes);
+    if (class < 0) {
+        return NULL;
+    }
+
+    coreid_t core = seg_heap_core();
+
+    struct seg_heap_block *block = seg_heap_pop(heap, &heap->freelist[core][class]);
+    if (block == NULL) {
+        block = seg_heap_carve(heap, class);
+    }
+
+    for (coreid_t i = 1; block == NULL && i < SEG_HEAP_MAX_CORES; i++) {
+        coreid_t victim = (core + i) % SEG_HEAP_MAX_CORES;
+        block = seg_heap_pop(heap, &heap->freelist[victim][class]);
+    }
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->class = class;
+    block->magic = SEG_HEAP_BLOCK_MAGIC;
+
+    return block + 1;
+}
+
+/**
+ * \brief returns memory to the shared heap of the segment
+ *
+ * The memory may have been allocated by any domain the segment is attached
+ * to. It is placed onto the free list of the current core.
+ *
+ * \param sh    the segment handle
+ * \param ptr   pointer returned by vas_seg_malloc()
+ */
+void vas_seg_mfree(vas_seg_handle_t sh, void *ptr)
+{
+    struct seg_heap *heap = seg_heap_get(sh);
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    struct seg_heap_block *block = (struct seg_heap_block *)ptr - 1;
+
+    assert((uint8_t *)block >= (uint8_t *)heap + sizeof(*heap));
+    assert((uint8_t *)ptr < (uint8_t *)heap + heap->size);
+    assert(block->magic == SEG_HEAP_BLOCK_MAGIC);
+    assert(block->class < SEG_HEAP_NUM_CLASSES);
+
+    block->magic = 0;
+
+    seg_heap_push(heap, &heap->freelist[seg_heap_core()][block->class], block);
+}
@@ -42,15 +42,17 @@ static inline vas_seg_handle_t vas_seg_get_handle(struct vas_seg *seg)
     return (vas_seg_handle_t)seg;
 }
 
-static errval_t vas_seg_check(lvaddr_t vaddr, size_t length)
+static errval_t vas_seg_check(lvaddr_t vaddr, size_t length, vas_flags_t flags)
 {
-    if (length > VAS_SEG_MAX_LEN) {
-
+    if (length == 0 || length > VAS_SEG_MAX_LEN) {
+        return VAS_ERR_SEG_SIZE;
     }
 
-    if (vaddr < 0x10) {
-
+    /* large and huge page segments must be aligned to the page size */
+    if (vaddr & (vas_seg_page_size(flags) - 1)) {
+        return VAS_ERR_SEG_VADDR;
     }
+
     return SYS_ERR_OK;
 }
 
@@ -67,11 +69,15 @@ errval_t vas_seg_alloc(const char *name, vas_seg_type_t type, size_t length,
     errval_t err;
     struct capref frame;
 
-    err = vas_seg_check(vaddr, length);
+    /* the segment is mapped with pages of the requested size end-to-end */
+    length = ROUND_UP(length, vas_seg_page_size(flags));
+
+    err = vas_seg_check(vaddr, length, flags);
     if (err_is_fail(err)) {
         return err;
     }
 
+    /* frames are naturally aligned to their power-of-two size */
     err = frame_alloc(&frame, length, NULL);
     if (err_is_fail(err)) {
         return err;
@@ -91,7 +97,7 @@ errval_t vas_seg_create(const char *name, vas_seg_type_t type, size_t length,
 {
     errval_t err;
 
-    err = vas_seg_check(vaddr, length);
+    err = vas_seg_check(vaddr, length, flags);
     if (err_is_fail(err)) {
         return err;
     }
@@ -103,7 +109,11 @@ errval_t vas_seg_create(const char *name, vas_seg_type_t type, size_t length,
     }
 
     if ((1UL << fi.bits) < length) {
-        return -1;
+        return LIB_ERR_PMAP_FRAME_SIZE;
+    }
+
+    if (fi.base & (vas_seg_page_size(flags) - 1)) {
+        return LIB_ERR_PMAP_FRAME_SIZE;
     }
 
     struct vas_seg *seg = calloc(1, sizeof(struct vas_seg));
@@ -168,6 +178,57 @@ errval_t vas_seg_lookup(const char *name, vas_seg_handle_t *ret_seg)
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief obtains the lifetime of the segment
+ */
+errval_t vas_seg_get_life(vas_seg_handle_t sh, vas_life_t *life)
+{
+    return vas_client_seg_get_life(vas_seg_get_pointer(sh)->id, life);
+}
+
+/**
+ * \brief sets the lifetime of the segment
+ *
+ * Persistent segments keep their contents after the creator exits and can
+ * be looked up and attached by other domains.
+ */
+errval_t vas_seg_set_life(vas_seg_handle_t sh, vas_life_t lifetime)
+{
+    return vas_client_seg_set_life(vas_seg_get_pointer(sh)->id, lifetime);
+}
+
+/**
+ * \brief finds the segment attached to the VAS which contains the address
+ *
+ * \param vh       the VAS handle
+ * \param vaddr    the virtual address to look up
+ * \param ret_seg  returns a handle to the segment
+ *
+ * \returns VAS_ERR_NOT_FOUND if no attached segment contains the address
+ */
+errval_t vas_seg_lookup_addr(vas_handle_t vh, lvaddr_t vaddr,
+                             vas_seg_handle_t *ret_seg)
+{
+    errval_t err;
+
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    struct vas_seg *seg = calloc(1, sizeof(struct vas_seg));
+    if (seg == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    err = vas_client_seg_lookup_addr(vas->id, vaddr, seg);
+    if (err_is_fail(err)) {
+        free(seg);
+        return err;
+    }
+
+    *ret_seg = vas_seg_get_handle(seg);
+
+    return SYS_ERR_OK;
+}
+
 errval_t vas_seg_attach(vas_handle_t vh, vas_seg_handle_t sh, vas_flags_t flags)
 {
     struct vas_seg *seg = vas_seg_get_pointer(sh);
@@ -184,6 +245,75 @@ errval_t vas_seg_detach(vas_handle_t vh, vas_seg_handle_t sh)
     return vas_client_seg_detach(vas->id, seg->id);
 }
 
+/**
+ * \brief attaches several segments to the VAS with a single request
+ *
+ * \param vh       the VAS handle
+ * \param sh       array of segment handles
+ * \param count    number of segments in the array
+ * \param flags    mapping flags
+ *
+ * Either all or none of the segments are attached.
+ */
+errval_t vas_seg_attach_batch(vas_handle_t vh, vas_seg_handle_t *sh,
+                              size_t count, vas_flags_t flags)
+{
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    if (count == 0) {
+        return SYS_ERR_OK;
+    }
+
+    vas_seg_id_t *sids = malloc(count * sizeof(vas_seg_id_t));
+    if (sids == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sids[i] = vas_seg_get_pointer(sh[i])->id;
+    }
+
+    errval_t err = vas_client_seg_attach_batch(vas->id, sids, count, flags);
+
+    free(sids);
+
+    return err;
+}
+
+/**
+ * \brief detaches several segments from the VAS with a single request
+ *
+ * \param vh       the VAS handle
+ * \param sh       array of segment handles
+ * \param count    number of segments in the array
+ *
+ * Either all or none of the segments are detached.
+ */
+errval_t vas_seg_detach_batch(vas_handle_t vh, vas_seg_handle_t *sh,
+                              size_t count)
+{
+    struct vas *vas = vas_get_vas_pointer(vh);
+
+    if (count == 0) {
+        return SYS_ERR_OK;
+    }
+
+    vas_seg_id_t *sids = malloc(count * sizeof(vas_seg_id_t));
+    if (sids == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sids[i] = vas_seg_get_pointer(sh[i])->id;
+    }
+
+    errval_t err = vas_client_seg_detach_batch(vas->id, sids, count);
+
+    free(sids);
+
+    return err;
+}
+
 size_t vas_seg_get_size(vas_seg_handle_t sh)
 {
     return vas_seg_get_pointer(sh)->length;
@@ -18,10 +18,6 @@
 #include <barrelfish/pmap_arch.h>
 #include <barrelfish_kpi/init.h>
 
-#define VAS_VSPACE_TAG_START 0x100
-
-static uint16_t vas_vspace_tag_alloc = VAS_VSPACE_TAG_START;
-
 /**
  * \brief initializes the VSPACE structure of the VAS
  *
@@ -55,6 +51,7 @@ errval_t vas_vspace_init(struct vas *vas)
         err =  LIB_ERR_MALLOC_FAIL;
         goto out_err;
     }
+    vas->pagecn_slot_buf = buf;
 
     err = single_slot_alloc_init_raw(&vas->pagecn_slot_alloc, vas->pagecn_cap,
                                      vas->pagecn, PAGE_CNODE_SLOTS, buf, bufsize);
@@ -107,12 +104,8 @@ errval_t vas_vspace_init(struct vas *vas)
      *  - create CNODE for the backing frames?
      */
 
-    if (vas_vspace_tag_alloc < 0x1000) {
-        vas->tag = vas_vspace_tag_alloc++;
-    } else {
-        vas->tag = 0;
-        debug_printf("warning: out of tags for this vas!\n");
-    }
+    /* the kernel hands out the PCIDs, we just ask for tagging */
+    vas->tag = VAS_TAG_AUTO;
 
 
     VAS_DEBUG_VSPACE("vspace initialized successfully\n");
@@ -121,9 +114,60 @@ errval_t vas_vspace_init(struct vas *vas)
 
     out_err :
     cap_destroy(vas->pagecn_cap);
+    free(vas->pagecn_slot_buf);
+    vas->pagecn_slot_buf = NULL;
     return err;
 }
 
+/**
+ * \brief tears down the VSPACE structure of the VAS
+ *
+ * \param vas   the VAS to destroy
+ *
+ * All regions still mapped in the VAS must have been created using
+ * vas_vspace_map_one_frame(). The page tables are reclaimed by deleting the
+ * page cn which holds all the vnode capabilities of the VAS.
+ *
+ * \returns SYS_ERR_OK on sucecss
+ *          errval on failure
+ */
+errval_t vas_vspace_destroy(struct vas *vas)
+{
+    errval_t err;
+
+    VAS_DEBUG_VSPACE("destroying vspace of vas @ %p\n", vas);
+
+    struct vspace *vspace = &vas->vspace_state.vspace;
+
+    struct vregion *walk = vspace->head;
+    while (walk) {
+        struct vregion *next = walk->next;
+        /* the meta data region of the pmap has no memory object */
+        if (vregion_get_memobj(walk) != NULL) {
+            err = vregion_destroy(walk);
+            if (err_is_fail(err)) {
+                return err_push(err, LIB_ERR_VREGION_DESTROY);
+            }
+            free(walk);
+        }
+        walk = next;
+    }
+    vspace->head = NULL;
+    vspace->root = NULL;
+    vspace->gaps = NULL;
+
+    /* deleting the page cn deletes the vroot and all page tables */
+    err = cap_destroy(vas->pagecn_cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    free(vas->pagecn_slot_buf);
+    vas->pagecn_slot_buf = NULL;
+
+    return SYS_ERR_OK;
+}
+
 
 errval_t vas_vspace_map_one_frame(struct vas *vas, void **retaddr,
                                   struct capref frame, size_t size,
@@ -149,10 +193,13 @@ errval_t vas_vspace_map_one_frame(struct vas *vas, void **retaddr,
         alignment = BASE_PAGE_SIZE;
     }
 
-    void *space = calloc(1, sizeof(struct vregion) + sizeof(struct memobj_one_frame));
-
-    vregion = space;
-    memobj = space + sizeof(struct vregion);
+    /* memobj_one_frame frees itself when its last region is unmapped */
+    vregion = calloc(1, sizeof(struct vregion));
+    memobj = calloc(1, sizeof(struct memobj_one_frame));
+    if (vregion == NULL || memobj == NULL) {
+        err = LIB_ERR_MALLOC_FAIL;
+        goto error;
+    }
 
     err = memobj_create_one_frame((struct memobj_one_frame *)memobj, size, 0);
     if (err_is_fail(err)) {
@@ -185,9 +232,8 @@ errval_t vas_vspace_map_one_frame(struct vas *vas, void **retaddr,
     return SYS_ERR_OK;
 
     error: // XXX: proper cleanup
-    if (space) {
-        free(space);
-    }
+    free(vregion);
+    free(memobj);
 
     return err;
 }
@@ -206,25 +252,28 @@ errval_t vas_vspace_map_one_frame_fixed(struct vas *vas, lvaddr_t addr,
 
     if (flags & VREGION_FLAGS_HUGE) {
         size = ROUND_UP(size, HUGE_PAGE_SIZE);
-        if (addr & ~(HUGE_PAGE_SIZE)) {
+        if (addr & (HUGE_PAGE_SIZE - 1)) {
             return LIB_ERR_VREGION_BAD_ALIGNMENT;
         }
     } else if (flags & VREGION_FLAGS_LARGE) {
         size = ROUND_UP(size, LARGE_PAGE_SIZE);
-        if (addr & ~(LARGE_PAGE_SIZE)) {
+        if (addr & (LARGE_PAGE_SIZE - 1)) {
             return LIB_ERR_VREGION_BAD_ALIGNMENT;
         }
     } else {
         size = ROUND_UP(size, BASE_PAGE_SIZE);
-        if (addr & ~(BASE_PAGE_SIZE)) {
+        if (addr & (BASE_PAGE_SIZE - 1)) {
             return LIB_ERR_VREGION_BAD_ALIGNMENT;
         }
     }
 
-    void *space = calloc(1, sizeof(struct vregion) + sizeof(struct memobj_one_frame));
-
-    vregion = space;
-    memobj = space + sizeof(struct vregion);
+    /* memobj_one_frame frees itself when its last region is unmapped */
+    vregion = calloc(1, sizeof(struct vregion));
+    memobj = calloc(1, sizeof(struct memobj_one_frame));
+    if (vregion == NULL || memobj == NULL) {
+        err = LIB_ERR_MALLOC_FAIL;
+        goto error;
+    }
 
     err = memobj_create_one_frame((struct memobj_one_frame *)memobj, size, 0);
     if (err_is_fail(err)) {
@@ -255,10 +304,56 @@ errval_t vas_vspace_map_one_frame_fixed(struct vas *vas, lvaddr_t addr,
     return SYS_ERR_OK;
 
     error: // XXX: proper cleanup
-    if (space) {
-        free(space);
-    }
+    free(vregion);
+    free(memobj);
 
     return err;
 }
 
+/**
+ * \brief unmaps a region previously mapped with vas_vspace_map_one_frame()
+ *
+ * \param vas       the VAS to unmap the region from
+ * \param addr      the base address of the region
+ * \param ret_frame returns the frame which backed the region (optional)
+ *
+ * \returns SYS_ERR_OK on sucecss
+ *          VAS_ERR_NOT_FOUND if there is no region at this address
+ */
+errval_t vas_vspace_unmap(struct vas *vas, void *addr, struct capref *ret_frame)
+{
+    errval_t err;
+
+    VAS_DEBUG_VSPACE("unmapping region in vas %s @ %p\n", vas->name, addr);
+
+    struct vregion *vregion = vspace_get_region(&vas->vspace_state.vspace, addr);
+    if (vregion == NULL) {
+        return VAS_ERR_NOT_FOUND;
+    }
+
+    if (vregion_get_base_addr(vregion) != vspace_lvaddr_to_genvaddr((lvaddr_t)addr)) {
+        return VAS_ERR_NOT_FOUND;
+    }
+
+    struct memobj_one_frame *memobj;
+    memobj = (struct memobj_one_frame *)vregion_get_memobj(vregion);
+    if (memobj == NULL || memobj->m.type != ONE_FRAME) {
+        return VAS_ERR_NOT_FOUND;
+    }
+
+    struct capref frame = memobj->frame;
+
+    /* this frees the memobj as it is mapped in exactly one region */
+    err = vregion_destroy(vregion);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_VREGION_DESTROY);
+    }
+
+    free(vregion);
+
+    if (ret_frame) {
+        *ret_frame = frame;
+    }
+
+    return SYS_ERR_OK;
+}
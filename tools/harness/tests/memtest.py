@@ -65,3 +65,43 @@ class MemTestMulti(TestCommon):
             if line.startswith("memtest passed successfully!"):
                 nseen += 1
         return PassFailResult(nspawned == nseen)
+
+@tests.add_test
+class LargePagePromoteTest(TestCommon):
+    '''transparent large pages in the heap'''
+    name = "large_page_promote"
+
+    def get_modules(self, build, machine):
+        modules = super(LargePagePromoteTest, self).get_modules(build, machine)
+        modules.add_module("test_large_promote", ["morecore=promote"])
+        return modules
+
+    def is_finished(self, line):
+        return re.search(r'test (PASSED|FAILED)', line) is not None
+
+    def process_data(self, testdir, rawiter):
+        passed = False
+        for line in rawiter:
+            if re.search(r'test PASSED', line):
+                passed = True
+        return PassFailResult(passed)
+
+@tests.add_test
+class SizeClassMallocTest(TestCommon):
+    '''size-class malloc with many threads and two dispatchers'''
+    name = "sizeclass_malloc"
+
+    def get_modules(self, build, machine):
+        modules = super(SizeClassMallocTest, self).get_modules(build, machine)
+        modules.add_module("sizeclass_malloc")
+        return modules
+
+    def get_finish_string(self):
+        return "sizeclass_malloc passed"
+
+    def process_data(self, testdir, rawiter):
+        passed = False
+        for line in rawiter:
+            if line.startswith(self.get_finish_string()):
+                passed = True
+        return PassFailResult(passed)
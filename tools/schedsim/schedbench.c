@@ -0,0 +1,415 @@
+/**
+ * \file
+ * \brief Scheduler benchmark
+ *
+ * Drives the RBED scheduler of the CPU driver with synthetic workloads of
+ * many dispatchers and reports the cost of every scheduling decision
+ * together with the quality of the resulting schedule.
+ *
+ * The workload consists of periodic hard real-time tasks, which together
+ * use a given share of the CPU, and best-effort tasks, which block and
+ * unblock at random. As in the simulator, every tick of simulated time
+ * runs the dispatcher picked by the scheduler for one tick. The cost of
+ * schedule(), make_runnable() and scheduler_remove() is measured in host
+ * nanoseconds. The schedule is measured in ticks: a hard real-time job
+ * misses its deadline if it has not run for its WCET by then, the latency
+ * of a job is the time from its release until it first runs and the
+ * latency of a best-effort task is the time from unblocking until it runs.
+ * Soft real-time tasks are not supported by the scheduler yet.
+ *
+ * Without -n, a sweep over several numbers of dispatchers is run.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "schedsim.h"
+
+#define PERIOD_MIN      100     ///< Minimal period of HRT tasks in ticks
+#define PERIOD_SPREAD   8       ///< Longest period is PERIOD_SPREAD x shortest
+
+static const int sweep_ndisp[] = { 16, 128, 1024, 4096 };
+
+struct bench_params {
+    int ndisp;                  ///< Number of dispatchers
+    int hrt_percent;            ///< Share of dispatchers that are HRT
+    int hrt_util;               ///< CPU utilization of all HRT tasks, percent
+    int churn;                  ///< Block/unblock events per 1000 ticks
+    size_t runtime;             ///< Simulated ticks
+    uint64_t seed;
+};
+
+/// Per-task bookkeeping of the benchmark
+struct task_stats {
+    unsigned long job_release;  ///< Release time of the current job
+    unsigned long job_exec;     ///< Ticks the current job ran so far
+    bool job_started, job_done;
+    bool blocked;               ///< Best-effort task is blocked
+    size_t wakeup_time;         ///< Last unblock, if waiting to be run
+    bool waiting;
+};
+
+/// Cost of one kind of scheduler operation
+struct op_stats {
+    const char *name;
+    uint64_t *samples;
+    size_t count, max;
+};
+
+/// Schedule quality of one kind of task
+struct lat_stats {
+    unsigned long events, misses;
+    unsigned long lat_sum, lat_max;
+};
+
+static struct dcb *dcbs;
+static struct task_stats *stats;
+static struct op_stats op_schedule, op_runnable, op_remove;
+static struct lat_stats hrt_stats, be_stats;
+static unsigned long idle_ticks, be_ticks;
+
+static uint64_t rand_state;
+
+static inline uint64_t rand_next(void)
+{
+    /* xorshift */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void op_init(struct op_stats *op, const char *name, size_t max)
+{
+    op->name = name;
+    op->samples = malloc(max * sizeof(uint64_t));
+    assert(op->samples != NULL);
+    op->count = 0;
+    op->max = max;
+}
+
+static inline void op_add(struct op_stats *op, uint64_t ns)
+{
+    if(op->count < op->max) {
+        op->samples[op->count++] = ns;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void op_print(struct op_stats *op)
+{
+    if(op->count == 0) {
+        printf("  %-17s calls 0\n", op->name);
+        return;
+    }
+
+    uint64_t sum = 0;
+    for(size_t i = 0; i < op->count; i++) {
+        sum += op->samples[i];
+    }
+    qsort(op->samples, op->count, sizeof(uint64_t), cmp_u64);
+
+    printf("  %-17s calls %8zu  mean %6" PRIu64 " ns  p50 %6" PRIu64
+           " ns  p99 %6" PRIu64 " ns  max %8" PRIu64 " ns\n", op->name,
+           op->count, sum / op->count, op->samples[op->count / 2],
+           op->samples[op->count * 99 / 100], op->samples[op->count - 1]);
+}
+
+static void op_free(struct op_stats *op)
+{
+    free(op->samples);
+}
+
+static inline void lat_add(struct lat_stats *l, unsigned long lat)
+{
+    l->events++;
+    l->lat_sum += lat;
+    l->lat_max = MAX(l->lat_max, lat);
+}
+
+static struct dcb *timed_schedule(void)
+{
+    uint64_t t0 = now_ns();
+    struct dcb *d = schedule();
+    op_add(&op_schedule, now_ns() - t0);
+    return d;
+}
+
+static void timed_make_runnable(struct dcb *dcb)
+{
+    uint64_t t0 = now_ns();
+    make_runnable(dcb);
+    op_add(&op_runnable, now_ns() - t0);
+}
+
+static void timed_remove(struct dcb *dcb)
+{
+    uint64_t t0 = now_ns();
+    scheduler_remove(dcb);
+    op_add(&op_remove, now_ns() - t0);
+}
+
+/// Finish the current job of a HRT task, counting a miss if it is incomplete
+static void hrt_job_finish(struct task_stats *ts)
+{
+    if(ts->job_started && !ts->job_done) {
+        hrt_stats.misses++;
+    }
+    ts->job_started = ts->job_done = false;
+}
+
+/// Account one tick of execution of the dispatched task
+static void account_tick(struct dcb *dcb)
+{
+    if(dcb == NULL) {
+        idle_ticks++;
+        return;
+    }
+
+    struct task_stats *ts = &stats[dcb->id];
+
+    if(dcb->type == TASK_TYPE_BEST_EFFORT) {
+        be_ticks++;
+        if(ts->waiting) {
+            lat_add(&be_stats, kernel_now - ts->wakeup_time);
+            ts->waiting = false;
+        }
+        return;
+    }
+
+    // New job of a periodic task
+    if(!ts->job_started || dcb->release_time != ts->job_release) {
+        hrt_job_finish(ts);
+        ts->job_release = dcb->release_time;
+        ts->job_exec = 0;
+        ts->job_started = true;
+        lat_add(&hrt_stats, kernel_now - dcb->release_time);
+    }
+
+    if(++ts->job_exec == dcb->wcet) {
+        // Completed at the end of this tick
+        ts->job_done = true;
+        if(kernel_now + 1 > ts->job_release + dcb->deadline) {
+            hrt_stats.misses++;
+        }
+    }
+}
+
+static void create_tasks(struct bench_params *p, int *nhrt)
+{
+    *nhrt = p->ndisp * p->hrt_percent / 100;
+
+    // Spread the HRT utilization evenly, periods have to be long enough
+    // for every task to get at least one tick of WCET
+    unsigned long share = (unsigned long)p->hrt_util * (SPECTRUM / 100);
+    unsigned long pmin = PERIOD_MIN;
+    if(*nhrt > 0) {
+        share /= *nhrt;
+        pmin = MAX(pmin, (SPECTRUM + share - 1) / share);
+    }
+
+    for(int i = 0; i < p->ndisp; i++) {
+        struct dcb *dcb = &dcbs[i];
+        init_dcb(dcb, i);
+
+        if(i < *nhrt) {
+            dcb->type = TASK_TYPE_HARD_REALTIME;
+            dcb->period = pmin + rand_next() % (pmin * (PERIOD_SPREAD - 1));
+            dcb->deadline = dcb->period;
+            dcb->wcet = dcb->period * share / SPECTRUM;
+            assert(dcb->wcet > 0);
+            // Don't release everything at once
+            dcb->release_time = kernel_now + rand_next() % dcb->period;
+            snprintf(dcb->dsg.name, DISP_NAME_LEN, "h %d", i);
+        } else {
+            dcb->type = TASK_TYPE_BEST_EFFORT;
+            dcb->weight = 1;
+            snprintf(dcb->dsg.name, DISP_NAME_LEN, "b %d", i);
+            stats[i].wakeup_time = kernel_now;
+            stats[i].waiting = true;
+        }
+        timed_make_runnable(dcb);
+    }
+}
+
+/// Block or unblock a random best-effort task
+static void churn_event(struct bench_params *p, int nhrt)
+{
+    int nbe = p->ndisp - nhrt;
+    if(nbe == 0) {
+        return;
+    }
+
+    int i = nhrt + rand_next() % nbe;
+    struct task_stats *ts = &stats[i];
+
+    if(ts->blocked) {
+        ts->blocked = false;
+        ts->wakeup_time = kernel_now;
+        ts->waiting = true;
+        timed_make_runnable(&dcbs[i]);
+    } else {
+        ts->blocked = true;
+        ts->waiting = false;
+        timed_remove(&dcbs[i]);
+    }
+    dcb_current = timed_schedule();
+}
+
+static void reset_state(void)
+{
+    memset(kcb_current, 0, sizeof(*kcb_current));
+    queue_tail = NULL;
+    lastdisp = NULL;
+    dcb_current = NULL;
+    kernel_now = 0;
+    idle_ticks = be_ticks = 0;
+    memset(&hrt_stats, 0, sizeof(hrt_stats));
+    memset(&be_stats, 0, sizeof(be_stats));
+}
+
+static void run_bench(struct bench_params *p)
+{
+    int nhrt;
+
+    reset_state();
+    rand_state = p->seed;
+
+    dcbs = calloc(p->ndisp, sizeof(struct dcb));
+    stats = calloc(p->ndisp, sizeof(struct task_stats));
+    assert(dcbs != NULL && stats != NULL);
+
+    size_t nchurn = p->runtime * p->churn / 1000 + 1;
+    op_init(&op_schedule, "schedule", p->runtime + nchurn);
+    op_init(&op_runnable, "make_runnable", p->ndisp + nchurn);
+    op_init(&op_remove, "scheduler_remove", nchurn);
+
+    create_tasks(p, &nhrt);
+
+    unsigned long churn_acc = 0;
+    for(kernel_now = 0; kernel_now < p->runtime; kernel_now++) {
+        for(churn_acc += p->churn; churn_acc >= 1000; churn_acc -= 1000) {
+            churn_event(p, nhrt);
+        }
+
+        dcb_current = timed_schedule();
+        account_tick(dcb_current);
+    }
+
+    // Jobs that are past their deadline and still incomplete
+    for(int i = 0; i < nhrt; i++) {
+        struct task_stats *ts = &stats[i];
+        if(ts->job_started && !ts->job_done
+           && ts->job_release + dcbs[i].deadline < kernel_now) {
+            hrt_stats.misses++;
+        }
+    }
+
+    printf("dispatchers %d (hrt %d, be %d), hrt utilization %d%%, "
+           "churn %d/1000 ticks, %zu ticks\n", p->ndisp, nhrt,
+           p->ndisp - nhrt, p->hrt_util, p->churn, p->runtime);
+    op_print(&op_schedule);
+    op_print(&op_runnable);
+    op_print(&op_remove);
+    printf("  hrt jobs %lu  missed %lu (%.2f%%)  release latency mean %.1f max %lu ticks\n",
+           hrt_stats.events, hrt_stats.misses,
+           hrt_stats.events ? 100.0 * hrt_stats.misses / hrt_stats.events : 0.0,
+           hrt_stats.events ? (double)hrt_stats.lat_sum / hrt_stats.events : 0.0,
+           hrt_stats.lat_max);
+    printf("  be wakeups %lu  wakeup latency mean %.1f max %lu ticks  cpu %.1f%%  idle %.1f%%\n",
+           be_stats.events,
+           be_stats.events ? (double)be_stats.lat_sum / be_stats.events : 0.0,
+           be_stats.lat_max, 100.0 * be_ticks / p->runtime,
+           100.0 * idle_ticks / p->runtime);
+
+    op_free(&op_schedule);
+    op_free(&op_runnable);
+    op_free(&op_remove);
+    free(stats);
+    free(dcbs);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-n dispatchers] [-h hrt percent] [-u hrt utilization]\n"
+           "          [-c churn per 1000 ticks] [-t ticks] [-s seed]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_params p = {
+        .ndisp = 0,
+        .hrt_percent = 50,
+        .hrt_util = 50,
+        .churn = 100,
+        .runtime = 100000,
+        .seed = 0x2545f4914f6cdd1dULL,
+    };
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:h:u:c:t:s:")) != -1) {
+        switch(opt) {
+        case 'n':
+            p.ndisp = atoi(optarg);
+            break;
+        case 'h':
+            p.hrt_percent = atoi(optarg);
+            break;
+        case 'u':
+            p.hrt_util = atoi(optarg);
+            break;
+        case 'c':
+            p.churn = atoi(optarg);
+            break;
+        case 't':
+            p.runtime = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            p.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if(p.hrt_percent < 0 || p.hrt_percent > 100 || p.hrt_util < 0
+       || p.hrt_util * (SPECTRUM / 100) + BETA > SPECTRUM
+       || (p.hrt_percent > 0 && p.hrt_util == 0) || p.seed == 0) {
+        usage(argv[0]);
+    }
+
+    if(p.ndisp > 0) {
+        run_bench(&p);
+    } else {
+        for(size_t i = 0; i < sizeof(sweep_ndisp) / sizeof(sweep_ndisp[0]); i++) {
+            p.ndisp = sweep_ndisp[i];
+            run_bench(&p);
+        }
+    }
+
+    return 0;
+}
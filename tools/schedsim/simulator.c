@@ -12,96 +12,7 @@
  * ETH Zurich D-INFK, Haldeneggsteig 4, CH-8092 Zurich. Attn: Systems Group.
  */
 
-#include <stdlib.h>
-#include <stdbool.h>
-#include <assert.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <stdint.h>
-
-/***** Prerequisite definitions copied from Barrelfish headers *****/
-
-#define trace_event(x,y,z)
-
-#define DISP_NAME_LEN   16
-
-enum task_type {
-    TASK_TYPE_BEST_EFFORT,
-    TASK_TYPE_SOFT_REALTIME,
-    TASK_TYPE_HARD_REALTIME
-};
-
-enum objtype {
-    ObjType_CNode,
-    ObjType_EndPoint
-};
-
-struct capability {
-    enum objtype        type;
-};
-
-struct cte {
-    struct capability cap;
-};
-
-typedef uintptr_t dispatcher_handle_t;
-
-struct dispatcher_shared_generic {
-    char        name[DISP_NAME_LEN];///< Name of domain, for debugging purposes
-};
-
-struct dcb {
-    dispatcher_handle_t disp;
-    struct cte          cspace;
-    struct cte          ep;
-    size_t              vspace;
-    struct dcb          *next;          ///< Next DCB in schedule
-    unsigned long       release_time, etime, last_dispatch;
-    unsigned long       wcet, period, deadline;
-    unsigned short      weight;
-    enum task_type      type;
-
-    // Simulator state
-    int                 id;
-    bool                dispatched;
-    unsigned long       blocktime;
-    struct dispatcher_shared_generic dsg;
-};
-
-struct kcb {
-    struct kcb *prev, *next;
-    struct dcb *queue_head, *queue_tail;
-    unsigned int u_hrt, u_srt, w_be, n_be;
-} curr = { 0, 0, 0, 0, 0, 0, 0, 0 };
-struct kcb *kcb_current = &curr;
-
-
-static void panic(const char *msg, ...)
-{
-    va_list ap;
-
-    fprintf(stderr, "Scheduler panic: ");
-    va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
-    va_end(ap);
-    fprintf(stderr, "\n");
-
-    exit(EXIT_FAILURE);
-}
-
-static __attribute__ ((unused)) struct dispatcher_shared_generic *
-get_dispatcher_shared_generic(dispatcher_handle_t handle)
-{
-    return (struct dispatcher_shared_generic *)handle;
-}
-
-static size_t kernel_now = 0;
-static int kernel_timeslice = 80;
-static struct dcb *dcb_current = NULL;
-
-/***** Including scheduler C file *****/
-
-#include "../../kernel/schedule_rbed.c"
+#include "schedsim.h"
 
 /***** Simulator internal definitions *****/
 
@@ -109,23 +20,6 @@ static struct dcb *dcb_current = NULL;
 
 static struct dcb *sched, **allptrs;
 
-static void init_dcb(struct dcb *dcb, int id)
-{
-    dcb->disp = (uintptr_t)&dcb->dsg;
-    dcb->cspace.cap.type = ObjType_CNode;
-    dcb->ep.cap.type = ObjType_EndPoint;
-    dcb->vspace = 1;
-    dcb->next = NULL;
-    dcb->release_time = 0;
-    dcb->wcet = 0;
-    dcb->period = 0;
-    dcb->weight = 0;
-    dcb->etime = 0;
-
-    dcb->id = id;
-    snprintf(dcb->dsg.name, DISP_NAME_LEN, "%d", id);
-}
-
 static inline char typechar(enum task_type type)
 {
     switch(type) {
@@ -14,6 +14,7 @@
 #else
 #include <mdb/mdb.h>
 #include <mdb/mdb_tree.h>
+#include <mdb/mdb_btree.h>
 #define RESET_ROOT() do { mdb_init(&(struct kcb){ .mdb_root = 0 }); } while(0)
 #define PRED(c) mdb_predecessor(c)
 #define NEXT(c) mdb_successor(c)
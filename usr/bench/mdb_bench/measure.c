@@ -163,7 +163,94 @@ static cycles_t measure_has_descendants(struct cte *ctes, size_t count)
     return end - begin;
 }
 
+static cycles_t measure_revoke_descendants(struct cte *ctes, size_t count)
+{
+    for (int i = 0; i < count; i++) {
+        INS(&ctes[i]);
+    }
+
+    // remove the descendants of the first cap, the way the revoke mark
+    // phase used to find them
+    struct cte *cte = &ctes[0], *next;
+    if (!HASDESC(cte)) {
+        return 0;
+    }
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    while ((next = NEXT(cte)) && is_ancestor(&next->cap, &cte->cap)) {
+        REM(next);
+    }
+    cycles_t end = bench_tsc();
+
+    return end - begin;
+}
+
 #ifndef OLD_MDB
+#define BATCH_SIZE 64
+
+static cycles_t measure_iterate_batch_1000(struct cte *ctes, size_t count)
+{
+    for (int i = 0; i < count; i++) {
+        INS(&ctes[i]);
+    }
+
+    // randomly select start cap
+    size_t startpos, mod = 1;
+    while (mod < count) { mod <<= 1; }
+    do {
+        // assuming count is power-of-two
+        startpos = rand() % mod;
+    } while (startpos >= count);
+    struct cte *cte = &ctes[startpos];
+    struct cte *batch[BATCH_SIZE];
+
+    __asm volatile ("" : : : "memory");
+
+    // same as iterate_1000, but fetching successors in batches
+    cycles_t begin = bench_tsc();
+    for (size_t i = 0; i < 1000; i += BATCH_SIZE) {
+        size_t want = 1000 - i < BATCH_SIZE ? 1000 - i : BATCH_SIZE;
+        if (mdb_successors(cte, batch, want) < want) {
+            return 0;
+        }
+        cte = batch[want-1];
+    }
+    cycles_t end = bench_tsc();
+
+    return end - begin;
+}
+
+static cycles_t measure_revoke_descendants_batch(struct cte *ctes, size_t count)
+{
+    for (int i = 0; i < count; i++) {
+        INS(&ctes[i]);
+    }
+
+    // remove the descendants of the first cap like revoke_descendants, but
+    // fetch them in batches the way the revoke mark phase does now
+    struct cte *cte = &ctes[0];
+    struct cte *batch[BATCH_SIZE];
+    size_t i, n;
+    if (!HASDESC(cte)) {
+        return 0;
+    }
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    do {
+        n = mdb_successors(cte, batch, BATCH_SIZE);
+        for (i = 0; i < n && is_ancestor(&batch[i]->cap, &cte->cap); i++) {
+            REM(batch[i]);
+        }
+    } while (i == n && n == BATCH_SIZE);
+    cycles_t end = bench_tsc();
+
+    return end - begin;
+}
+
 static cycles_t measure_query_address(struct cte *ctes, size_t count)
 {
     for (int i = 0; i < count; i++) {
@@ -188,6 +275,113 @@ static cycles_t measure_query_address(struct cte *ctes, size_t count)
 
     return end - begin;
 }
+
+/*
+ * The same measurements on the B+-tree index. The tree is built from scratch
+ * for every run and freed again afterwards.
+ */
+
+static struct mdb_btree_node *btree_node_alloc(void *st)
+{
+    return malloc(sizeof(struct mdb_btree_node));
+}
+
+static void btree_node_free(void *st, struct mdb_btree_node *node)
+{
+    free(node);
+}
+
+static void btree_fill(struct mdb_btree *tree, struct cte *ctes, size_t from,
+                       size_t count)
+{
+    mdb_btree_init(tree, btree_node_alloc, btree_node_free, NULL);
+    for (size_t i = from; i < count; i++) {
+        errval_t err = mdb_btree_insert(tree, &ctes[i]);
+        assert_err(err, "mdb_btree_insert");
+    }
+}
+
+static cycles_t measure_btree_insert_one(struct cte *ctes, size_t count)
+{
+    struct mdb_btree tree;
+    // insert all except first
+    btree_fill(&tree, ctes, 1, count);
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    mdb_btree_insert(&tree, &ctes[0]);
+    cycles_t end = bench_tsc();
+
+    mdb_btree_destroy(&tree);
+    return end - begin;
+}
+
+static cycles_t measure_btree_remove_one(struct cte *ctes, size_t count)
+{
+    struct mdb_btree tree;
+    btree_fill(&tree, ctes, 0, count);
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    mdb_btree_remove(&tree, &ctes[0]);
+    cycles_t end = bench_tsc();
+
+    mdb_btree_destroy(&tree);
+    return end - begin;
+}
+
+static cycles_t measure_btree_iterate_1000(struct cte *ctes, size_t count)
+{
+    struct mdb_btree tree;
+    btree_fill(&tree, ctes, 0, count);
+
+    // randomly select start cap
+    size_t startpos, mod = 1;
+    while (mod < count) { mod <<= 1; }
+    do {
+        // assuming count is power-of-two
+        startpos = rand() % mod;
+    } while (startpos >= count);
+    struct cte *cte = &ctes[startpos];
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    for (int i = 0; i < 1000 && cte; i++) {
+        cte = mdb_btree_successor(&tree, cte);
+    }
+    cycles_t end = bench_tsc();
+
+    mdb_btree_destroy(&tree);
+    return cte ? end - begin : 0;
+}
+
+static cycles_t measure_btree_query_address(struct cte *ctes, size_t count)
+{
+    struct mdb_btree tree;
+    btree_fill(&tree, ctes, 0, count);
+
+    // randomly select a cap from which to take the address
+    size_t pos, mod = 1;
+    while (mod < count) { mod <<= 1; }
+    do {
+        // assuming count is power-of-two
+        pos = rand() % mod;
+    } while (pos >= count);
+    genpaddr_t base = ctes[pos].cap.u.ram.base;
+    struct cte *result;
+
+    __asm volatile ("" : : : "memory");
+
+    cycles_t begin = bench_tsc();
+    mdb_btree_find_cap_for_address(&tree, base, &result);
+    cycles_t end = bench_tsc();
+
+    mdb_btree_destroy(&tree);
+    return end - begin;
+}
 #endif
 
 struct measure_opt measure_opts[] = {
@@ -200,8 +394,15 @@ struct measure_opt measure_opts[] = {
     { "has_copies", measure_has_copies, },
     { "has_ancestors", measure_has_ancestors, },
     { "has_descendants", measure_has_descendants, },
+    { "revoke_descendants", measure_revoke_descendants, },
 #ifndef OLD_MDB
+    { "iterate_batch_1000", measure_iterate_batch_1000, },
+    { "revoke_descendants_batch", measure_revoke_descendants_batch, },
     { "query_address", measure_query_address, },
+    { "btree_insert_one", measure_btree_insert_one, },
+    { "btree_remove_one", measure_btree_remove_one, },
+    { "btree_iterate_1000", measure_btree_iterate_1000, },
+    { "btree_query_address", measure_btree_query_address, },
 #endif
     { NULL, NULL, },
 };
@@ -136,10 +136,40 @@ static void reset_mdb_szprob_cp_nat_ram(char *base, size_t size)
     }
 }
 
+static void reset_mdb_ram_1b_frames(char *base, size_t size)
+{
+    clear_mdb(base, size);
+
+    // generate one RAM cap with a 1-byte frame descendant for every byte,
+    // like a memory pool that gets torn down with a revoke
+    struct cte *ctes = (struct cte*)base;
+    size_t num_caps = size / sizeof(struct cte);
+
+    uint8_t ram_bits = 0;
+    while ((1UL<<ram_bits) < num_caps) { ram_bits++; }
+
+    struct capability ram = {
+        .type = ObjType_RAM,
+        .rights = CAPRIGHTS_ALLRIGHTS,
+        .u.ram = { .base = 0, .bits = ram_bits },
+    };
+    ctes[0].cap = ram;
+
+    for (int i = 1; i < num_caps; i++) {
+        struct capability cap = {
+            .type = ObjType_Frame,
+            .rights = CAPRIGHTS_ALLRIGHTS,
+            .u.frame = { .base = i-1, .bits = 0 },
+        };
+        ctes[i].cap = cap;
+    }
+}
+
 struct reset_opt reset_opts[] = {
     { "random_nat_ram", reset_mdb_random_nat_ram, },
     { "propszrand_nat_ram", reset_mdb_propszrand_nat_ram, },
     { "seq_1b_ram", reset_mdb_seq_1b_ram, },
     { "szprob_cp_nat_ram", reset_mdb_szprob_cp_nat_ram, },
+    { "ram_1b_frames", reset_mdb_ram_1b_frames, },
     { NULL, NULL, },
 };
@@ -0,0 +1,212 @@
+/**
+ * \file
+ * \brief Slab allocator benchmark
+ *
+ * Fills a slab allocator with many slabs to FILL_PERCENT of its capacity and
+ * then measures alloc and free in a random steady state: every run allocates
+ * one block and frees a random live block. Built as slab_bench for the slab
+ * allocator of libbarrelfish and as slab_bench_old for the previous
+ * implementation with linear slab lists. slab_bench additionally measures
+ * the same workload through a magazine.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/slab.h>
+#include <bench/bench.h>
+
+#ifdef OLD_SLAB
+#include "old_slab.h"
+#define BENCH_NAME      "old"
+#define allocator_t     struct old_slab_allocator
+#define bench_slab_init(s, bs)  old_slab_init(s, bs)
+#define bench_slab_grow         old_slab_grow
+#define bench_slab_alloc        old_slab_alloc
+#define bench_slab_free         old_slab_free
+#define bench_slab_freecount    old_slab_freecount
+#else
+#define BENCH_NAME      "new"
+#define allocator_t     struct slab_allocator
+#define bench_slab_init(s, bs)  slab_init(s, bs, NULL)
+#define bench_slab_grow         slab_grow
+#define bench_slab_alloc        slab_alloc
+#define bench_slab_free         slab_free
+#define bench_slab_freecount    slab_freecount
+#endif
+
+#define BENCH_RUN_COUNT 10000
+#define BENCH_DRY_RUNS  100
+
+#define BLOCKSIZE       64
+#define SLABSIZE        BASE_PAGE_SIZE
+#define FILL_PERCENT    90
+
+static const size_t nslabs_sweep[] = { 16, 64, 256, 1024 };
+
+static uint64_t rand_state = 0x2545f4914f6cdd1dUL;
+
+static inline uint64_t rand_next(void)
+{
+    /* xorshift */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+struct bench_state {
+    allocator_t slabs;
+    void *pool;
+    void **live;
+    size_t nlive;
+};
+
+static void bench_setup(struct bench_state *st, size_t nslabs)
+{
+    bench_slab_init(&st->slabs, BLOCKSIZE);
+
+    st->pool = malloc(nslabs * SLABSIZE);
+    assert(st->pool != NULL);
+    for (size_t i = 0; i < nslabs; i++) {
+        bench_slab_grow(&st->slabs, (char *)st->pool + i * SLABSIZE, SLABSIZE);
+    }
+
+    size_t total = bench_slab_freecount(&st->slabs);
+    st->live = malloc(total * sizeof(void *));
+    assert(st->live != NULL);
+
+    /* allocate everything, then free a random subset */
+    for (st->nlive = 0; st->nlive < total; st->nlive++) {
+        st->live[st->nlive] = bench_slab_alloc(&st->slabs);
+        assert(st->live[st->nlive] != NULL);
+    }
+    while (st->nlive > total * FILL_PERCENT / 100) {
+        size_t k = rand_next() % st->nlive;
+        bench_slab_free(&st->slabs, st->live[k]);
+        st->live[k] = st->live[--st->nlive];
+    }
+}
+
+static void bench_teardown(struct bench_state *st)
+{
+    free(st->live);
+    free(st->pool);
+}
+
+static void slab_bench(size_t nslabs)
+{
+    struct bench_state st;
+    cycles_t result[2];
+    char name[64];
+
+    bench_setup(&st, nslabs);
+
+    bench_ctl_t *ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, 2,
+                                      BENCH_RUN_COUNT + BENCH_DRY_RUNS);
+    bench_ctl_dry_runs(ctl, BENCH_DRY_RUNS);
+
+    do {
+        size_t k = rand_next() % st.nlive;
+
+        cycles_t t0 = bench_tsc();
+        void *block = bench_slab_alloc(&st.slabs);
+        cycles_t t1 = bench_tsc();
+        assert(block != NULL);
+
+        void *victim = st.live[k];
+        st.live[k] = block;
+
+        cycles_t t2 = bench_tsc();
+        bench_slab_free(&st.slabs, victim);
+        cycles_t t3 = bench_tsc();
+
+        result[0] = bench_time_diff(t0, t1);
+        result[1] = bench_time_diff(t2, t3);
+    } while (!bench_ctl_add_run(ctl, result));
+
+    snprintf(name, sizeof(name), "%s/slabs=%zu/alloc", BENCH_NAME, nslabs);
+    bench_ctl_dump_analysis(ctl, 0, name, bench_tsc_per_us());
+    snprintf(name, sizeof(name), "%s/slabs=%zu/free", BENCH_NAME, nslabs);
+    bench_ctl_dump_analysis(ctl, 1, name, bench_tsc_per_us());
+
+    bench_ctl_destroy(ctl);
+    bench_teardown(&st);
+}
+
+#ifndef OLD_SLAB
+static void magazine_bench(size_t nslabs)
+{
+    struct bench_state st;
+    struct slab_magazine mag;
+    cycles_t result[2];
+    char name[64];
+
+    bench_setup(&st, nslabs);
+    slab_magazine_init(&mag, &st.slabs, NULL);
+
+    bench_ctl_t *ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, 2,
+                                      BENCH_RUN_COUNT + BENCH_DRY_RUNS);
+    bench_ctl_dry_runs(ctl, BENCH_DRY_RUNS);
+
+    do {
+        size_t k = rand_next() % st.nlive;
+
+        cycles_t t0 = bench_tsc();
+        void *block = slab_magazine_alloc(&mag);
+        cycles_t t1 = bench_tsc();
+        assert(block != NULL);
+
+        void *victim = st.live[k];
+        st.live[k] = block;
+
+        cycles_t t2 = bench_tsc();
+        slab_magazine_free(&mag, victim);
+        cycles_t t3 = bench_tsc();
+
+        result[0] = bench_time_diff(t0, t1);
+        result[1] = bench_time_diff(t2, t3);
+    } while (!bench_ctl_add_run(ctl, result));
+
+    snprintf(name, sizeof(name), "magazine/slabs=%zu/alloc", nslabs);
+    bench_ctl_dump_analysis(ctl, 0, name, bench_tsc_per_us());
+    snprintf(name, sizeof(name), "magazine/slabs=%zu/free", nslabs);
+    bench_ctl_dump_analysis(ctl, 1, name, bench_tsc_per_us());
+
+    bench_ctl_destroy(ctl);
+    slab_magazine_flush(&mag);
+    bench_teardown(&st);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    bench_init();
+
+    size_t nsizes = sizeof(nslabs_sweep) / sizeof(nslabs_sweep[0]);
+
+    for (size_t i = 0; i < nsizes; i++) {
+        slab_bench(nslabs_sweep[i]);
+    }
+
+#ifndef OLD_SLAB
+    for (size_t i = 0; i < nsizes; i++) {
+        magazine_bench(nslabs_sweep[i]);
+    }
+#endif
+
+    printf("slab benchmarks done\n");
+
+    return 0;
+}
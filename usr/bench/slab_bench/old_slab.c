@@ -0,0 +1,117 @@
+/**
+ * \file
+ * \brief Slab allocator with linear slab lists, for comparison
+ *
+ * This is the slab allocator of libbarrelfish before slabs were kept on
+ * full/partial/empty lists and in an address tree. Allocation and free scan
+ * the list of slabs.
+ */
+
+/*
+ * Copyright (c) 2008, 2009, 2010, 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/slab.h>
+#include "old_slab.h"
+
+struct old_block_head {
+    struct old_block_head *next;///< Pointer to next block in free list
+};
+
+void old_slab_init(struct old_slab_allocator *slabs, size_t blocksize)
+{
+    slabs->slabs = NULL;
+    slabs->blocksize = SLAB_REAL_BLOCKSIZE(blocksize);
+}
+
+void old_slab_grow(struct old_slab_allocator *slabs, void *buf, size_t buflen)
+{
+    /* setup slab_head structure at top of buffer */
+    assert(buflen > sizeof(struct old_slab_head));
+    struct old_slab_head *head = buf;
+    buflen -= sizeof(struct old_slab_head);
+    buf = (char *)buf + sizeof(struct old_slab_head);
+
+    /* calculate number of blocks in buffer */
+    size_t blocksize = slabs->blocksize;
+    assert(buflen / blocksize <= UINT32_MAX);
+    head->free = head->total = buflen / blocksize;
+    assert(head->total > 0);
+
+    /* enqueue blocks in freelist */
+    struct old_block_head *bh = head->blocks = buf;
+    for (uint32_t i = head->total; i > 1; i--) {
+        buf = (char *)buf + blocksize;
+        bh->next = buf;
+        bh = buf;
+    }
+    bh->next = NULL;
+
+    /* enqueue slab in list of slabs */
+    head->next = slabs->slabs;
+    slabs->slabs = head;
+}
+
+void *old_slab_alloc(struct old_slab_allocator *slabs)
+{
+    /* find a slab with free blocks */
+    struct old_slab_head *sh;
+    for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+
+    if (sh == NULL) {
+        return NULL;
+    }
+
+    /* dequeue top block from freelist */
+    struct old_block_head *bh = sh->blocks;
+    assert(bh != NULL);
+    sh->blocks = bh->next;
+    sh->free--;
+
+    return bh;
+}
+
+void old_slab_free(struct old_slab_allocator *slabs, void *block)
+{
+    if (block == NULL) {
+        return;
+    }
+
+    struct old_block_head *bh = (struct old_block_head *)block;
+
+    /* find matching slab */
+    struct old_slab_head *sh;
+    size_t blocksize = slabs->blocksize;
+    for (sh = slabs->slabs; sh != NULL; sh = sh->next) {
+        /* check if block falls inside this slab */
+        uintptr_t slab_limit = (uintptr_t)sh + sizeof(struct old_slab_head)
+                               + blocksize * sh->total;
+        if ((uintptr_t)bh > (uintptr_t)sh && (uintptr_t)bh < slab_limit) {
+            break;
+        }
+    }
+    assert(sh != NULL);
+
+    /* re-enqueue in slab's free list */
+    bh->next = sh->blocks;
+    sh->blocks = bh;
+    sh->free++;
+    assert(sh->free <= sh->total);
+}
+
+size_t old_slab_freecount(struct old_slab_allocator *slabs)
+{
+    size_t ret = 0;
+
+    for (struct old_slab_head *sh = slabs->slabs; sh != NULL; sh = sh->next) {
+        ret += sh->free;
+    }
+
+    return ret;
+}
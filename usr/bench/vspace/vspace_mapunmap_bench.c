@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2015 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Measures pmap map and unmap throughput for regions made of many individual
+ * base page mappings. Every page is a separate child in the metadata of its
+ * page table, so this exercises the lookups of the pmap when page tables
+ * fill up. Each run maps all pages of the region one by one and then unmaps
+ * them again; the reported numbers are cycles per page. The batched runs
+ * do the same through pmap map_batch and unmap_batch, if the pmap has them.
+ */
+#include <stdio.h>
+#include <barrelfish/barrelfish.h>
+
+#include <bench/bench.h>
+
+#define BENCH_RUN_COUNT 50
+#define BENCH_DRY_RUNS  5
+
+/// largest region in pages
+#define MAX_PAGES 4096
+
+static const size_t region_pages[] = { 16, 64, 256, 512, 1024, MAX_PAGES };
+
+/// a frame cap can only be mapped once, so every page gets its own copy
+static struct capref pages[MAX_PAGES];
+
+static struct pmap_map_op map_ops[MAX_PAGES];
+static struct pmap_unmap_op unmap_ops[MAX_PAGES];
+
+#define EXPECT_SUCCESS(err, msg) \
+    if (err_is_fail(err)) {USER_PANIC_ERR(err, msg);}
+
+static void mapunmap_bench(struct pmap *pmap, genvaddr_t base, size_t npages)
+{
+    errval_t err;
+    cycles_t tsc_start, tsc_end;
+    cycles_t result[2];
+    char buf[32];
+
+    bench_ctl_t *b_ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, 2,
+                                        BENCH_RUN_COUNT + BENCH_DRY_RUNS);
+    bench_ctl_dry_runs(b_ctl, BENCH_DRY_RUNS);
+
+    do {
+        tsc_start = bench_tsc();
+        for (size_t i = 0; i < npages; i++) {
+            err = pmap->f.map(pmap, base + i * BASE_PAGE_SIZE, pages[i], 0,
+                              BASE_PAGE_SIZE, VREGION_FLAGS_READ_WRITE,
+                              NULL, NULL);
+            EXPECT_SUCCESS(err, "pmap map");
+        }
+        tsc_end = bench_tsc();
+        result[0] = bench_time_diff(tsc_start, tsc_end) / npages;
+
+        tsc_start = bench_tsc();
+        for (size_t i = 0; i < npages; i++) {
+            err = pmap->f.unmap(pmap, base + i * BASE_PAGE_SIZE,
+                                BASE_PAGE_SIZE, NULL);
+            EXPECT_SUCCESS(err, "pmap unmap");
+        }
+        tsc_end = bench_tsc();
+        result[1] = bench_time_diff(tsc_start, tsc_end) / npages;
+    } while (!bench_ctl_add_run(b_ctl, result));
+
+    snprintf(buf, sizeof(buf), "%zu/map", npages);
+    bench_ctl_dump_analysis(b_ctl, 0, buf, bench_tsc_per_us());
+    snprintf(buf, sizeof(buf), "%zu/unmap", npages);
+    bench_ctl_dump_analysis(b_ctl, 1, buf, bench_tsc_per_us());
+
+    bench_ctl_destroy(b_ctl);
+}
+
+static void mapunmap_batch_bench(struct pmap *pmap, genvaddr_t base,
+                                 size_t npages)
+{
+    errval_t err;
+    cycles_t tsc_start, tsc_end;
+    cycles_t result[2];
+    char buf[32];
+
+    for (size_t i = 0; i < npages; i++) {
+        map_ops[i] = (struct pmap_map_op) {
+            .vaddr = base + i * BASE_PAGE_SIZE,
+            .frame = pages[i],
+            .offset = 0,
+            .size = BASE_PAGE_SIZE,
+            .flags = VREGION_FLAGS_READ_WRITE,
+        };
+        unmap_ops[i] = (struct pmap_unmap_op) {
+            .vaddr = base + i * BASE_PAGE_SIZE,
+            .size = BASE_PAGE_SIZE,
+        };
+    }
+
+    bench_ctl_t *b_ctl = bench_ctl_init(BENCH_MODE_FIXEDRUNS, 2,
+                                        BENCH_RUN_COUNT + BENCH_DRY_RUNS);
+    bench_ctl_dry_runs(b_ctl, BENCH_DRY_RUNS);
+
+    do {
+        tsc_start = bench_tsc();
+        err = pmap->f.map_batch(pmap, map_ops, npages);
+        EXPECT_SUCCESS(err, "pmap map_batch");
+        tsc_end = bench_tsc();
+        result[0] = bench_time_diff(tsc_start, tsc_end) / npages;
+
+        tsc_start = bench_tsc();
+        err = pmap->f.unmap_batch(pmap, unmap_ops, npages);
+        EXPECT_SUCCESS(err, "pmap unmap_batch");
+        tsc_end = bench_tsc();
+        result[1] = bench_time_diff(tsc_start, tsc_end) / npages;
+    } while (!bench_ctl_add_run(b_ctl, result));
+
+    snprintf(buf, sizeof(buf), "%zu/map_batch", npages);
+    bench_ctl_dump_analysis(b_ctl, 0, buf, bench_tsc_per_us());
+    snprintf(buf, sizeof(buf), "%zu/unmap_batch", npages);
+    bench_ctl_dump_analysis(b_ctl, 1, buf, bench_tsc_per_us());
+
+    bench_ctl_destroy(b_ctl);
+}
+
+int main(int argc,
+         char *argv[])
+{
+    errval_t err;
+
+    bench_init();
+
+    debug_printf("=======================================\n");
+    debug_printf("VSPACE Map/Unmap benchmark started\n");
+    debug_printf("=======================================\n");
+
+    struct capref frame;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+    EXPECT_SUCCESS(err, "frame alloc");
+
+    for (size_t i = 0; i < MAX_PAGES; i++) {
+        err = slot_alloc(&pages[i]);
+        EXPECT_SUCCESS(err, "slot alloc");
+        err = cap_copy(pages[i], frame);
+        EXPECT_SUCCESS(err, "cap copy");
+    }
+
+    struct pmap *pmap = get_current_pmap();
+
+    // reserve the address range with an empty vregion, so that nothing else
+    // gets mapped there. We map the pages directly through the pmap.
+    static struct memobj_anon memobj;
+    static struct vregion vregion;
+    err = memobj_create_anon(&memobj, MAX_PAGES * BASE_PAGE_SIZE, 0);
+    EXPECT_SUCCESS(err, "memobj create anon");
+    err = vregion_map_aligned(&vregion, get_current_vspace(), &memobj.m, 0,
+                              MAX_PAGES * BASE_PAGE_SIZE,
+                              VREGION_FLAGS_READ_WRITE, LARGE_PAGE_SIZE);
+    EXPECT_SUCCESS(err, "vregion map");
+    genvaddr_t base = vregion_get_base_addr(&vregion);
+
+    size_t nsizes = sizeof(region_pages) / sizeof(region_pages[0]);
+    for (size_t i = 0; i < nsizes; i++) {
+        mapunmap_bench(pmap, base, region_pages[i]);
+    }
+
+    if (pmap->f.map_batch && pmap->f.unmap_batch) {
+        for (size_t i = 0; i < nsizes; i++) {
+            mapunmap_batch_bench(pmap, base, region_pages[i]);
+        }
+    }
+
+    debug_printf("=======================================\n");
+    debug_printf("benchmark done\n");
+    debug_printf("=======================================\n");
+
+    return 0;
+}
@@ -287,6 +287,19 @@ invoke_monitor_get_arch_id(uintptr_t *arch_id)
     return sysret.error;
 }
 
+static inline errval_t
+invoke_monitor_get_sched_load(uint32_t *load)
+{
+    DEBUG_INVOCATION("%s: called from %p\n", __FUNCTION__, __builtin_return_address(0));
+    assert(load != NULL);
+
+    struct sysret sysret = cap_invoke1(cap_kernel, KernelCmd_Get_sched_load);
+    if (err_is_ok(sysret.error)) {
+        *load = sysret.value;
+    }
+    return sysret.error;
+}
+
 static inline errval_t
 invoke_monitor_ipi_register(struct capref ep, int chanid)
 {
@@ -174,6 +174,18 @@ invoke_monitor_get_arch_id(uintptr_t *arch_id)
     return sysret.error;
 }
 
+static inline errval_t
+invoke_monitor_get_sched_load(uint32_t *load)
+{
+    assert(load != NULL);
+
+    struct sysret sysret = cap_invoke1(cap_kernel, KernelCmd_Get_sched_load);
+    if (sysret.error == SYS_ERR_OK) {
+        *load = sysret.value;
+    }
+    return sysret.error;
+}
+
 static inline errval_t invoke_monitor_sync_timer(uint64_t synctime)
 {
     uint8_t invoke_bits = get_cap_valid_bits(cap_kernel);
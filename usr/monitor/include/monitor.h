@@ -176,6 +176,14 @@ struct monitor_blocking_binding *rsrc_get_binding(rsrcid_t id);
 errval_t rsrc_set_phase_data(rsrcid_t id, uintptr_t active, void *data,
                              size_t len);
 
+// Load balancing
+errval_t rsrc_balance_set_policy(uint32_t period, uint32_t threshold,
+                                 uint32_t hold);
+errval_t rsrc_balance_set_policy_inter(uint32_t period, uint32_t threshold,
+                                       uint32_t hold);
+void rsrc_balance_set_load(coreid_t coreid, uint32_t load);
+errval_t rsrc_balance_join(struct monitor_binding *b);
+
 // Time coordination
 errval_t timing_sync_timer(void);
 void timing_sync_timer_reply(errval_t err);
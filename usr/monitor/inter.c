@@ -612,6 +612,22 @@ static void inter_rsrc_join_complete(struct intermon_binding *b, rsrcid_t id)
     assert(err_is_ok(err));
 }
 
+static void inter_rsrc_load(struct intermon_binding *b, coreid_t coreid,
+                            uint32_t load)
+{
+    rsrc_balance_set_load(coreid, load);
+}
+
+static void inter_rsrc_balance_policy(struct intermon_binding *b,
+                                      uint32_t period, uint32_t threshold,
+                                      uint32_t hold)
+{
+    errval_t err = rsrc_balance_set_policy_inter(period, threshold, hold);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rsrc_balance_set_policy_inter failed");
+    }
+}
+
 static void spawnd_image_request(struct intermon_binding *b)
 {
     assert(bsp_monitor);
@@ -733,6 +749,8 @@ static struct intermon_rx_vtbl the_intermon_vtable = {
     .rsrc_timer_sync_reply     = inter_rsrc_timer_sync_reply,
     .rsrc_phase                = inter_rsrc_phase,
     .rsrc_phase_data           = inter_rsrc_phase_data,
+    .rsrc_load                 = inter_rsrc_load,
+    .rsrc_balance_policy       = inter_rsrc_balance_policy,
 
     .give_kcb_request = give_kcb_request,
     .give_kcb_response = give_kcb_response,
@@ -117,6 +117,17 @@ static void rpc_rsrc_join(struct monitor_blocking_binding *b,
     }
 }
 
+static void rsrc_balance(struct monitor_blocking_binding *b, uint32_t period,
+                         uint32_t threshold, uint32_t hold)
+{
+    errval_t err, err2;
+
+    err = rsrc_balance_set_policy(period, threshold, hold);
+
+    err2 = b->tx_vtbl.rsrc_balance_response(b, NOP_CONT, err);
+    assert(err_is_ok(err2));
+}
+
 static void alloc_monitor_ep(struct monitor_blocking_binding *b)
 {
     struct capref retcap = NULL_CAP;
@@ -497,6 +508,7 @@ static struct monitor_blocking_rx_vtbl rx_vtbl = {
     .rsrc_manifest_call      = rsrc_manifest,
     .rsrc_join_call          = rpc_rsrc_join,
     .rsrc_phase_call         = rsrc_phase,
+    .rsrc_balance_call       = rsrc_balance,
 
     .alloc_monitor_ep_call   = alloc_monitor_ep,
     .cap_identify_call       = cap_identify,
@@ -805,6 +805,14 @@ static void migrate_dispatcher_request(struct monitor_binding *b,
    printf("%s:%d\n", __FUNCTION__, __LINE__);
 }
 
+static void rsrc_balance_join_request(struct monitor_binding *b)
+{
+    errval_t err = rsrc_balance_join(b);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rsrc_balance_join failed");
+    }
+}
+
 struct monitor_rx_vtbl the_table = {
     .alloc_iref_request = alloc_iref_request,
 
@@ -830,6 +838,8 @@ struct monitor_rx_vtbl the_table = {
     .span_domain_request    = span_domain_request,
 
     .migrate_dispatcher_request = migrate_dispatcher_request,
+
+    .rsrc_balance_join = rsrc_balance_join_request,
 };
 
 errval_t monitor_client_setup(struct spawninfo *si)
@@ -0,0 +1,290 @@
+/**
+ * \file
+ * \brief Cross-core load balancing
+ *
+ * While balancing is enabled, every monitor periodically reads the scheduler
+ * load of its core and sends it to all other monitors. Dispatchers can't
+ * move between cores, so a monitor whose core stays more loaded than the
+ * least loaded core for a number of rounds asks one of the local
+ * dispatchers that joined balancing to move a thread there. The domain
+ * decides whether it can follow the hint, e.g. if it is spanned to that
+ * core.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <monitor.h>
+#include <barrelfish/deferred.h>
+
+/// Rounds after which the load reported by another core is ignored
+#define LOAD_MAX_AGE    4
+
+struct balance_client {
+    struct monitor_binding *b;
+    struct balance_client *next;
+};
+
+/// Balancing policy, see rsrc_balance_set_policy()
+static struct {
+    uint32_t period;        ///< Balancing period in ms, 0 if disabled
+    uint32_t threshold;     ///< Load difference that counts as imbalance
+    uint32_t hold;          ///< Rounds of imbalance before we move a thread
+} policy;
+
+static struct periodic_event balance_event;
+
+/// Last load reported by every core
+static uint32_t core_load[MAX_COREID + 1];
+/// Rounds since the load of a core was reported, 0 if never
+static uint8_t core_age[MAX_COREID + 1];
+
+/// Consecutive rounds this core was overloaded
+static uint32_t imbalance;
+
+/// Local dispatchers that joined balancing, hinted in round-robin order
+static struct balance_client *clients, *next_client;
+
+static void send_load(uint32_t load)
+{
+    for (int i = 0; i <= MAX_COREID; i++) {
+        struct intermon_binding *b = NULL;
+        if (i == my_core_id || err_is_fail(intermon_binding_get(i, &b))) {
+            continue;
+        }
+
+        // If the channel is busy, the load of the next round will do
+        errval_t err = b->tx_vtbl.rsrc_load(b, NOP_CONT, my_core_id, load);
+        if (err_is_fail(err) && err_no(err) != FLOUNDER_ERR_TX_BUSY) {
+            DEBUG_ERR(err, "sending load to core %d", i);
+        }
+    }
+}
+
+static void remove_client(struct balance_client *c)
+{
+    struct balance_client **p;
+    for (p = &clients; *p != c; p = &(*p)->next) {
+        assert(*p != NULL);
+    }
+    *p = c->next;
+    if (next_client == c) {
+        next_client = c->next;
+    }
+    free(c);
+}
+
+/**
+ * \brief Hints the next local client to move a thread to the given core
+ *
+ * \return true if a hint was sent
+ */
+static bool send_hint(coreid_t dest)
+{
+    while (clients != NULL) {
+        struct balance_client *c = next_client ? next_client : clients;
+        next_client = c->next;
+
+        errval_t err = c->b->tx_vtbl.rsrc_balance_hint(c->b, NOP_CONT, dest);
+        if (err_is_ok(err)) {
+            return true;
+        } else if (err_no(err) == FLOUNDER_ERR_TX_BUSY) {
+            // Client is busy, try again next round
+            return false;
+        }
+
+        // The domain is gone
+        remove_client(c);
+    }
+    return false;
+}
+
+static void balance_round(void *arg)
+{
+    uint32_t load;
+    errval_t err = invoke_monitor_get_sched_load(&load);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "reading scheduler load, disabling load balancing");
+        rsrc_balance_set_policy_inter(0, 0, 0);
+        return;
+    }
+    send_load(load);
+
+    // Find the least loaded core we heard from recently
+    coreid_t dest = my_core_id;
+    uint32_t min_load = load;
+    for (int i = 0; i <= MAX_COREID; i++) {
+        if (i == my_core_id || core_age[i] == 0) {
+            continue;
+        }
+        if (core_age[i] > LOAD_MAX_AGE) {
+            core_age[i] = 0;
+            continue;
+        }
+        if (core_load[i] < min_load) {
+            dest = i;
+            min_load = core_load[i];
+        }
+        core_age[i]++;
+    }
+
+    if (dest == my_core_id || load <= min_load + policy.threshold) {
+        imbalance = 0;
+        return;
+    }
+
+    if (++imbalance >= policy.hold && send_hint(dest)) {
+        imbalance = 0;
+        // Account for the thread until the next load report of dest
+        core_load[dest]++;
+    }
+}
+
+/**
+ * \brief Records the load reported by another core
+ */
+void rsrc_balance_set_load(coreid_t coreid, uint32_t load)
+{
+    core_load[coreid] = load;
+    core_age[coreid] = 1;
+}
+
+/**
+ * \brief Adds a local dispatcher to the set of balancing clients
+ */
+errval_t rsrc_balance_join(struct monitor_binding *b)
+{
+    struct balance_client *c = malloc(sizeof(struct balance_client));
+    if (c == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    c->b = b;
+    c->next = clients;
+    clients = c;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Sets the balancing policy of this core
+ *
+ * \param period    Balancing period in ms, 0 disables balancing
+ * \param threshold Load difference to the least loaded core that counts
+ *                  as imbalance
+ * \param hold      Number of consecutive imbalanced periods before a thread
+ *                  is moved
+ */
+errval_t rsrc_balance_set_policy_inter(uint32_t period, uint32_t threshold,
+                                       uint32_t hold)
+{
+    errval_t err;
+
+    if (period != 0 && (threshold == 0 || hold == 0)) {
+        return MON_ERR_RSRC_BALANCE_POLICY;
+    }
+
+    if (policy.period != 0) {
+        err = periodic_event_cancel(&balance_event);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    policy.period = 0;
+    imbalance = 0;
+    if (period == 0) {
+        return SYS_ERR_OK;
+    }
+
+    uint32_t load;
+    err = invoke_monitor_get_sched_load(&load);
+    if (err_is_fail(err)) {
+        return MON_ERR_RSRC_BALANCE_UNSUPPORTED;
+    }
+
+    err = periodic_event_create(&balance_event, get_default_waitset(),
+                                (delayus_t)period * 1000,
+                                MKCLOSURE(balance_round, NULL));
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    policy.period = period;
+    policy.threshold = threshold;
+    policy.hold = hold;
+    return SYS_ERR_OK;
+}
+
+struct balance_policy_state {
+    struct intermon_msg_queue_elem elem;
+    struct intermon_rsrc_balance_policy__args args;
+};
+
+static void balance_policy_handler(struct intermon_binding *b,
+                                   struct intermon_msg_queue_elem *e);
+
+static void balance_policy_cont(struct intermon_binding *b, uint32_t period,
+                                uint32_t threshold, uint32_t hold)
+{
+    errval_t err = b->tx_vtbl.rsrc_balance_policy(b, NOP_CONT, period,
+                                                  threshold, hold);
+    if (err_is_fail(err)) {
+        if (err_no(err) == FLOUNDER_ERR_TX_BUSY) {
+            struct intermon_state *st = b->st;
+            assert(st != NULL);
+            struct balance_policy_state *me =
+                malloc(sizeof(struct balance_policy_state));
+            assert(me != NULL);
+            me->args.period = period;
+            me->args.threshold = threshold;
+            me->args.hold = hold;
+            me->elem.cont = balance_policy_handler;
+
+            err = intermon_enqueue_send(b, &st->queue,
+                                        get_default_waitset(),
+                                        &me->elem.queue);
+            if (err_is_fail(err)) {
+                USER_PANIC_ERR(err, "intermon_enqueue_send failed");
+            }
+            return;
+        }
+        USER_PANIC_ERR(err, "sending balancing policy");
+    }
+}
+
+static void balance_policy_handler(struct intermon_binding *b,
+                                   struct intermon_msg_queue_elem *e)
+{
+    struct balance_policy_state *st = (struct balance_policy_state *)e;
+    balance_policy_cont(b, st->args.period, st->args.threshold,
+                        st->args.hold);
+    free(e);
+}
+
+/**
+ * \brief Sets the balancing policy on all cores
+ *
+ * \return Result of setting the policy on this core
+ */
+errval_t rsrc_balance_set_policy(uint32_t period, uint32_t threshold,
+                                 uint32_t hold)
+{
+    if (period != 0 && (threshold == 0 || hold == 0)) {
+        return MON_ERR_RSRC_BALANCE_POLICY;
+    }
+
+    for (int i = 0; i <= MAX_COREID; i++) {
+        struct intermon_binding *b = NULL;
+        if (i != my_core_id && err_is_ok(intermon_binding_get(i, &b))) {
+            balance_policy_cont(b, period, threshold, hold);
+        }
+    }
+
+    return rsrc_balance_set_policy_inter(period, threshold, hold);
+}
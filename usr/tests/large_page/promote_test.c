@@ -0,0 +1,99 @@
+/**
+ * \file
+ * \brief Test for transparent large pages in the heap
+ *
+ * Must be started with the argument "morecore=promote".
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/core_state.h>
+#include <barrelfish/morecore.h>
+
+// 16MB of heap in chunks of 64k
+#define CHUNK_SIZE  (64UL*1024)
+#define CHUNKS      256
+
+/**
+ * \brief Counts the large pages that are completely part of the heap, and
+ * how many of them are mapped as large pages.
+ */
+static void count_large_pages(size_t *ret_total, size_t *ret_large)
+{
+    struct vspace_mmu_aware *mmu = &get_morecore_state()->mmu_state;
+    struct pmap *pmap = get_current_pmap();
+    genvaddr_t base = vregion_get_base_addr(&mmu->vregion);
+    size_t total = 0, large = 0;
+
+    for (genvaddr_t off = 0; off + LARGE_PAGE_SIZE <= mmu->mapoffset;
+         off += LARGE_PAGE_SIZE) {
+        size_t pagesize;
+        errval_t err = pmap->f.lookup(pmap, base + off, NULL, &pagesize,
+                                      NULL, NULL, NULL);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "heap page at offset 0x%"PRIxGENVADDR
+                           " is not mapped", off);
+        }
+        total++;
+        if (pagesize == LARGE_PAGE_SIZE) {
+            large++;
+        }
+    }
+
+    *ret_total = total;
+    *ret_large = large;
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+    size_t total, large, promoted;
+
+    struct vspace_mmu_aware *mmu = &get_morecore_state()->mmu_state;
+    if (!(mmu->memobj.m.flags & MEMOBJ_ANON_LARGE_PAGES)) {
+        debug_printf("usage: %s morecore=promote\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < CHUNKS; i++) {
+        uint8_t *buf = malloc(CHUNK_SIZE);
+        if (!buf) {
+            USER_PANIC("malloc %d failed\n", i);
+        }
+        memset(buf, i % 256, CHUNK_SIZE);
+    }
+
+    // Only the large page which was filled during initialization, while
+    // RAM came in base pages, may be mapped with base pages
+    count_large_pages(&total, &large);
+    debug_printf("%zu of %zu large pages of the heap are mapped large\n",
+                 large, total);
+    if (total < (CHUNKS * CHUNK_SIZE) / LARGE_PAGE_SIZE || large + 1 < total) {
+        debug_printf("test FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    err = morecore_promote(&promoted);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "morecore_promote");
+    }
+
+    count_large_pages(&total, &large);
+    debug_printf("promoted %zu, now %zu of %zu large pages are mapped large\n",
+                 promoted, large, total);
+    if (large != total) {
+        debug_printf("test FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    debug_printf("test PASSED\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/types.h>
+#include <barrelfish/cap_predicates.h>
+#include <mdb/mdb.h>
+#include <mdb/mdb_tree.h>
+#include <mdb/mdb_btree.h>
+
+/*
+ * Randomized tests for the B+-tree index: every operation must give the same
+ * result as the AA-tree, which holds the same caps.
+ */
+
+#define RUNS 100
+#define CAP_COUNT 1000
+#define MAX_ADDR_BITS 16
+#define QUERY_COUNT 200
+
+static struct cte caps[CAP_COUNT];
+static bool present[CAP_COUNT];
+static struct mdb_btree tree;
+
+static struct mdb_btree_node *node_alloc(void *st)
+{
+    return malloc(sizeof(struct mdb_btree_node));
+}
+
+static void node_free(void *st, struct mdb_btree_node *node)
+{
+    free(node);
+}
+
+static inline size_t randrange(size_t begin, size_t end)
+{
+    return begin + rand() / (RAND_MAX / (end - begin + 1) + 1);
+}
+
+static void random_cap(struct capability *cap)
+{
+    // naturally aligned RAM and Frame caps, some of them copies
+    uint8_t bits = randrange(0, MAX_ADDR_BITS - 4);
+    cap->type = rand() % 2 ? ObjType_RAM : ObjType_Frame;
+    cap->rights = CAPRIGHTS_ALLRIGHTS;
+    cap->u.ram.bits = bits;
+    cap->u.ram.base = randrange(0, (1 << (MAX_ADDR_BITS - bits)) - 1) << bits;
+}
+
+static void check_invariants(void)
+{
+    enum mdb_btree_invariant res = mdb_btree_check_invariants(&tree);
+    if (res != MDB_BTREE_INVARIANT_OK) {
+        USER_PANIC("mdb_btree_check_invariants failed: %d\n", res);
+    }
+}
+
+static void check_order(void)
+{
+    // walk both trees from the first cap in the ordering
+    struct capability first = { .type = ObjType_Null };
+    struct cte *aa = mdb_find_greater(&first, true);
+    struct cte *bt = mdb_btree_find_greater(&tree, &first, true);
+    size_t count = 0;
+
+    while (aa || bt) {
+        if (aa != bt) {
+            USER_PANIC("cap %zu in order differs: %p (mdb) != %p (btree)\n",
+                       count, aa, bt);
+        }
+        struct cte *next[8];
+        size_t n = mdb_btree_successors(&tree, bt, next, 8);
+        struct cte *succ = aa;
+        for (size_t i = 0; i < n; i++) {
+            succ = mdb_successor(succ);
+            if (next[i] != succ) {
+                USER_PANIC("mdb_btree_successors differs at %zu\n", i);
+            }
+        }
+        if (n < 8 && mdb_successor(succ) != NULL) {
+            USER_PANIC("mdb_btree_successors returned too few caps\n");
+        }
+
+        aa = mdb_successor(aa);
+        bt = mdb_btree_successor(&tree, bt);
+        if (bt && mdb_btree_predecessor(&tree, bt) != mdb_predecessor(bt)) {
+            USER_PANIC("mdb_btree_predecessor differs\n");
+        }
+        count++;
+    }
+}
+
+static void check_queries(void)
+{
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        genpaddr_t address = randrange(0, 1 << MAX_ADDR_BITS);
+        gensize_t size = randrange(0, 1 << (MAX_ADDR_BITS - 2));
+        int max_result = randrange(MDB_RANGE_NOT_FOUND,
+                                   MDB_RANGE_FOUND_PARTIAL);
+        struct cte *aa_cte = NULL, *bt_cte = NULL;
+        int aa_result, bt_result;
+        errval_t err;
+
+        err = mdb_find_range(get_type_root(ObjType_RAM), address, size,
+                             max_result, &aa_cte, &aa_result);
+        assert(err_is_ok(err));
+        err = mdb_btree_find_range(&tree, get_type_root(ObjType_RAM), address,
+                                   size, max_result, &bt_cte, &bt_result);
+        assert(err_is_ok(err));
+
+        // results above max_result are not unique
+        if (aa_result > max_result ? bt_result <= max_result
+            : aa_result != bt_result || aa_cte != bt_cte)
+        {
+            USER_PANIC("find_range(0x%"PRIxGENPADDR", %"PRIuGENSIZE", %d): "
+                       "%d %p (mdb) != %d %p (btree)\n", address, size,
+                       max_result, aa_result, aa_cte, bt_result, bt_cte);
+        }
+
+        errval_t aa_err = mdb_find_cap_for_address(address, &aa_cte);
+        errval_t bt_err = mdb_btree_find_cap_for_address(&tree, address,
+                                                         &bt_cte);
+        if (aa_err != bt_err || (err_is_ok(aa_err) && aa_cte != bt_cte)) {
+            USER_PANIC("find_cap_for_address(0x%"PRIxGENPADDR") differs\n",
+                       address);
+        }
+
+        struct capability cap;
+        random_cap(&cap);
+        aa_cte = mdb_find_greater(&cap, false);
+        bt_cte = mdb_btree_find_greater(&tree, &cap, false);
+        if (aa_cte != bt_cte) {
+            USER_PANIC("find_greater differs\n");
+        }
+        aa_cte = mdb_find_less(&cap, false);
+        bt_cte = mdb_btree_find_less(&tree, &cap, false);
+        if (aa_cte != bt_cte) {
+            USER_PANIC("find_less differs\n");
+        }
+        aa_cte = mdb_find_equal(&cap);
+        bt_cte = mdb_btree_find_equal(&tree, &cap);
+        if ((aa_cte == NULL) != (bt_cte == NULL) ||
+            (aa_cte && !is_copy(&aa_cte->cap, &bt_cte->cap)))
+        {
+            USER_PANIC("find_equal differs\n");
+        }
+    }
+}
+
+static void check_all(void)
+{
+    check_invariants();
+    check_order();
+    check_queries();
+}
+
+struct kcb clear = {
+    .mdb_root = 0
+};
+int main(int argc, char *argv[])
+{
+    errval_t err;
+
+    for (int run = 0; run < RUNS; run++) {
+        putchar('-'); fflush(stdout);
+
+        memset(caps, 0, sizeof(caps));
+        memset(present, 0, sizeof(present));
+        mdb_init(&clear);
+        mdb_btree_init(&tree, node_alloc, node_free, NULL);
+
+        for (int i = 0; i < CAP_COUNT; i++) {
+            if (i > 0 && rand() % 10 == 0) {
+                caps[i].cap = caps[randrange(0, i - 1)].cap;
+            }
+            else {
+                random_cap(&caps[i].cap);
+            }
+        }
+
+        // insert everything, then remove and reinsert random caps
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < CAP_COUNT; i++) {
+                if (present[i] || (round > 0 && rand() % 2)) {
+                    continue;
+                }
+                err = mdb_insert(&caps[i]);
+                assert(err_is_ok(err));
+                err = mdb_btree_insert(&tree, &caps[i]);
+                if (err_is_fail(err)) {
+                    USER_PANIC_ERR(err, "mdb_btree_insert");
+                }
+                err = mdb_btree_insert(&tree, &caps[i]);
+                if (err_no(err) != CAPS_ERR_MDB_DUPLICATE_ENTRY) {
+                    USER_PANIC("inserting a cap twice did not fail\n");
+                }
+                present[i] = true;
+            }
+            check_all();
+
+            for (int i = 0; i < CAP_COUNT; i++) {
+                if (!present[i] || rand() % 2) {
+                    continue;
+                }
+                err = mdb_remove(&caps[i]);
+                assert(err_is_ok(err));
+                err = mdb_btree_remove(&tree, &caps[i]);
+                if (err_is_fail(err)) {
+                    USER_PANIC_ERR(err, "mdb_btree_remove");
+                }
+                err = mdb_btree_remove(&tree, &caps[i]);
+                if (err_no(err) != CAPS_ERR_MDB_ENTRY_NOTFOUND) {
+                    USER_PANIC("removing a cap twice did not fail\n");
+                }
+                present[i] = false;
+            }
+            check_all();
+        }
+
+        mdb_btree_destroy(&tree);
+    }
+    printf("\nmdbtest_btree passed\n");
+    return 0;
+}
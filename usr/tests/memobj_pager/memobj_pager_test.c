@@ -0,0 +1,192 @@
+/**
+ * \file
+ * \brief Test eviction of anonymous memobj frames to a backing store
+ *
+ * Fills an anonymous memobj with frames holding known patterns, pins one of
+ * them and evicts the rest with pager_free into a backing store in memory.
+ * The evicted frames are faulted back in and their contents checked.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <barrelfish/barrelfish.h>
+
+#define NFRAMES     8
+#define PINNED      3
+
+#define EXPECT_SUCCESS(err, msg) \
+    if (err_is_fail(err)) {USER_PANIC_ERR(err, msg);}
+
+/// in-memory backing store, one slot per frame
+struct mem_pager {
+    struct memobj_anon_pager p;
+    void *slots[NFRAMES];
+    size_t nout, nin, ndiscard;
+};
+
+static errval_t mem_page_out(struct memobj_anon_pager *pager, genvaddr_t offset,
+                             void *buf, size_t size)
+{
+    struct mem_pager *mp = (struct mem_pager *)pager;
+    size_t slot = offset / BASE_PAGE_SIZE;
+
+    assert(slot < NFRAMES && mp->slots[slot] == NULL);
+    mp->slots[slot] = malloc(size);
+    if (mp->slots[slot] == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    memcpy(mp->slots[slot], buf, size);
+    mp->nout++;
+    return SYS_ERR_OK;
+}
+
+static errval_t mem_page_in(struct memobj_anon_pager *pager, genvaddr_t offset,
+                            void *buf, size_t size)
+{
+    struct mem_pager *mp = (struct mem_pager *)pager;
+    size_t slot = offset / BASE_PAGE_SIZE;
+
+    assert(slot < NFRAMES && mp->slots[slot] != NULL);
+    memcpy(buf, mp->slots[slot], size);
+    free(mp->slots[slot]);
+    mp->slots[slot] = NULL;
+    mp->nin++;
+    return SYS_ERR_OK;
+}
+
+static void mem_discard(struct memobj_anon_pager *pager, genvaddr_t offset,
+                        size_t size)
+{
+    struct mem_pager *mp = (struct mem_pager *)pager;
+    size_t slot = offset / BASE_PAGE_SIZE;
+
+    free(mp->slots[slot]);
+    mp->slots[slot] = NULL;
+    mp->ndiscard++;
+}
+
+static struct mem_pager pager = {
+    .p = {
+        .page_out = mem_page_out,
+        .page_in  = mem_page_in,
+        .discard  = mem_discard,
+    },
+};
+
+static uint8_t pattern(size_t frame, size_t i)
+{
+    return (frame * 31 + i) & 0xff;
+}
+
+static void check_frame(uint8_t *buf, size_t frame)
+{
+    for (size_t i = 0; i < BASE_PAGE_SIZE; i++) {
+        if (buf[i] != pattern(frame, i)) {
+            USER_PANIC("frame %zu: wrong contents at %zu\n", frame, i);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+    struct memobj_anon anon;
+    struct vregion vregion;
+    struct memobj *memobj = &anon.m;
+    size_t size = NFRAMES * BASE_PAGE_SIZE;
+
+    err = memobj_create_anon(&anon, size, 0);
+    EXPECT_SUCCESS(err, "memobj_create_anon");
+    err = vregion_map(&vregion, get_current_vspace(), memobj, 0, size,
+                      VREGION_FLAGS_READ_WRITE);
+    EXPECT_SUCCESS(err, "vregion_map");
+
+    uint8_t *base = (uint8_t *)vspace_genvaddr_to_lvaddr(
+                        vregion_get_base_addr(&vregion));
+
+    // without a backing store nothing can be evicted
+    err = memobj->f.pager_free(memobj, size, NULL, 0);
+    assert(err_no(err) == LIB_ERR_MEMOBJ_NO_PAGER);
+    memobj_anon_set_pager(&anon, &pager.p);
+
+    for (size_t f = 0; f < NFRAMES; f++) {
+        struct capref frame;
+        err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+        EXPECT_SUCCESS(err, "frame_alloc");
+        err = memobj->f.fill(memobj, f * BASE_PAGE_SIZE, frame, BASE_PAGE_SIZE);
+        EXPECT_SUCCESS(err, "fill");
+        err = memobj->f.pagefault(memobj, &vregion, f * BASE_PAGE_SIZE, 0);
+        EXPECT_SUCCESS(err, "pagefault");
+
+        for (size_t i = 0; i < BASE_PAGE_SIZE; i++) {
+            base[f * BASE_PAGE_SIZE + i] = pattern(f, i);
+        }
+    }
+
+    err = memobj->f.unpin(memobj, &vregion, PINNED * BASE_PAGE_SIZE,
+                          BASE_PAGE_SIZE);
+    assert(err_no(err) == LIB_ERR_MEMOBJ_NOT_PINNED);
+    err = memobj->f.pin(memobj, &vregion, PINNED * BASE_PAGE_SIZE,
+                        BASE_PAGE_SIZE);
+    EXPECT_SUCCESS(err, "pin");
+
+    // ask for everything, only the unpinned frames can go
+    struct capref freed[NFRAMES];
+    err = memobj->f.pager_free(memobj, size, freed, NFRAMES);
+    EXPECT_SUCCESS(err, "pager_free");
+
+    size_t nfreed = 0;
+    for (size_t i = 0; i < NFRAMES; i++) {
+        if (!capref_is_null(freed[i])) {
+            nfreed++;
+            err = cap_destroy(freed[i]);
+            EXPECT_SUCCESS(err, "cap_destroy");
+        }
+    }
+    assert(nfreed == NFRAMES - 1);
+    assert(pager.nout == NFRAMES - 1);
+    assert(pager.slots[PINNED] == NULL);
+
+    // the pinned frame is still mapped and intact
+    check_frame(base + PINNED * BASE_PAGE_SIZE, PINNED);
+
+    for (size_t f = 0; f < NFRAMES; f++) {
+        if (f == PINNED) {
+            continue;
+        }
+        err = memobj->f.pagefault(memobj, &vregion, f * BASE_PAGE_SIZE, 0);
+        EXPECT_SUCCESS(err, "pagefault");
+        check_frame(base + f * BASE_PAGE_SIZE, f);
+    }
+    assert(pager.nin == NFRAMES - 1);
+
+    err = memobj->f.unpin(memobj, &vregion, PINNED * BASE_PAGE_SIZE,
+                          BASE_PAGE_SIZE);
+    EXPECT_SUCCESS(err, "unpin");
+
+    // frames that are still in the backing store are dropped on destroy
+    err = memobj->f.pager_free(memobj, 2 * BASE_PAGE_SIZE, NULL, 0);
+    EXPECT_SUCCESS(err, "pager_free");
+    assert(pager.nout == NFRAMES + 1);
+
+    err = vregion_destroy(&vregion);
+    EXPECT_SUCCESS(err, "vregion_destroy");
+    err = memobj_destroy_anon(memobj);
+    EXPECT_SUCCESS(err, "memobj_destroy_anon");
+    assert(pager.ndiscard == 2);
+
+    printf("memobj_pager_test completed successfully!\n");
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+/**
+ * \file
+ * \brief Tests for the size-class malloc (newlib_malloc = "sizeclass")
+ *
+ * Exercises the paths of scmalloc.c that a single threaded program does not
+ * reach: thread caches of many threads and their release when the threads
+ * are freed, blocks freed on another dispatcher than the one owning them,
+ * and realloc() across size classes and into and out of large allocations.
+ *
+ * The domain spans to the next core for the cross-dispatcher test.
+ */
+
+/*
+ * Copyright (c) 2015, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <barrelfish/barrelfish.h>
+#include <barrelfish/dispatch.h>
+#include <barrelfish/core_state.h>
+
+/// Largest request served from a size class, see scmalloc.c
+#define SMALL_MAX       (16 * 1024)
+
+#define THREADS         8
+#define THREAD_ROUNDS   4
+#define THREAD_OPS      20000
+#define THREAD_SLOTS    256
+
+#define XFER_ROUNDS     32
+#define XFER_BLOCKS     2048
+
+static inline uint32_t next_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static inline uint8_t pattern(size_t i, uint8_t tag)
+{
+    return (uint8_t)(i * 7 + tag);
+}
+
+static void fill(void *p, size_t from, size_t to, uint8_t tag)
+{
+    uint8_t *b = p;
+    for (size_t i = from; i < to; i++) {
+        b[i] = pattern(i, tag);
+    }
+}
+
+static bool check(void *p, size_t bytes, uint8_t tag)
+{
+    uint8_t *b = p;
+    for (size_t i = 0; i < bytes; i++) {
+        if (b[i] != pattern(i, tag)) {
+            printf("%p[%zu] = 0x%x, expected 0x%x\n", p, i, b[i],
+                   pattern(i, tag));
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Sizes around the boundaries of the size classes and of large requests
+static size_t boundary_sizes(size_t *sizes, size_t max)
+{
+    size_t n = 0;
+    for (size_t s = 16; s <= 128 && n + 2 <= max; s += 16) {
+        sizes[n++] = s;
+        sizes[n++] = s + 1;
+    }
+    for (size_t pow = 128; pow < SMALL_MAX; pow *= 2) {
+        for (size_t q = 1; q <= 4 && n + 2 <= max; q++) {
+            sizes[n++] = pow + pow * q / 4;
+            sizes[n++] = pow + pow * q / 4 + 1;
+        }
+    }
+    static const size_t large[] = { 64 * 1024 - 64, 64 * 1024,
+                                    200 * 1024, 1024 * 1024 };
+    for (size_t i = 0; i < sizeof(large) / sizeof(large[0]) && n < max; i++) {
+        sizes[n++] = large[i];
+    }
+    return n;
+}
+
+static size_t random_size(uint32_t *seed)
+{
+    uint32_t r = next_rand(seed);
+    switch (r % 8) {
+    case 0:
+        return r % 64;
+    case 7:
+        return SMALL_MAX + r % (3 * SMALL_MAX);
+    default:
+        return r % SMALL_MAX;
+    }
+}
+
+/*
+ * realloc() across size classes
+ */
+
+static void realloc_test(void)
+{
+    size_t sizes[128];
+    size_t n = boundary_sizes(sizes, 128);
+
+    for (int pass = 0; pass < 2; pass++) {
+        size_t old = 0;
+        void *p = NULL;
+        // up through all classes and back down
+        for (size_t k = 0; k < 2 * n; k++) {
+            size_t bytes = k < n ? sizes[k] : sizes[2 * n - 1 - k];
+            p = realloc(p, bytes);
+            if (p == NULL) {
+                USER_PANIC("realloc to %zu failed\n", bytes);
+            }
+            if (!check(p, old < bytes ? old : bytes, pass)) {
+                USER_PANIC("realloc %zu -> %zu lost data\n", old, bytes);
+            }
+            fill(p, 0, bytes, pass);
+            old = bytes;
+        }
+        free(p);
+    }
+
+    // realloc(NULL, n) and shrinking within a class
+    void *p = realloc(NULL, 100);
+    assert(p != NULL);
+    fill(p, 0, 100, 3);
+    void *q = realloc(p, 97);
+    if (q != p || !check(q, 97, 3)) {
+        USER_PANIC("realloc within a class moved or lost data\n");
+    }
+    free(q);
+
+    printf("realloc test passed\n");
+}
+
+/*
+ * Many threads on one dispatcher
+ */
+
+static int churn_thread(void *arg)
+{
+    uint32_t seed = (uintptr_t)arg;
+    void *ptr[THREAD_SLOTS] = { NULL };
+    size_t size[THREAD_SLOTS];
+    uint8_t tag[THREAD_SLOTS];
+
+    for (int i = 0; i < THREAD_OPS; i++) {
+        size_t s = next_rand(&seed) % THREAD_SLOTS;
+        if (ptr[s] != NULL && !check(ptr[s], size[s], tag[s])) {
+            USER_PANIC("block of thread %p corrupted\n", thread_self());
+        }
+
+        size_t bytes = random_size(&seed);
+        switch (next_rand(&seed) % 3) {
+        case 0:
+            free(ptr[s]);
+            ptr[s] = NULL;
+            break;
+        case 1:
+            free(ptr[s]);
+            ptr[s] = malloc(bytes);
+            if (ptr[s] == NULL) {
+                USER_PANIC("malloc(%zu) failed\n", bytes);
+            }
+            tag[s] = seed;
+            fill(ptr[s], 0, bytes, tag[s]);
+            size[s] = bytes;
+            break;
+        case 2:
+            if (ptr[s] == NULL) {
+                break;
+            }
+            ptr[s] = realloc(ptr[s], bytes);
+            if (ptr[s] == NULL) {
+                USER_PANIC("realloc(%zu) failed\n", bytes);
+            }
+            if (!check(ptr[s], size[s] < bytes ? size[s] : bytes, tag[s])) {
+                USER_PANIC("realloc lost data\n");
+            }
+            fill(ptr[s], 0, bytes, tag[s]);
+            size[s] = bytes;
+            break;
+        }
+
+        if (i % 64 == 0) {
+            thread_yield();
+        }
+    }
+
+    // leave some blocks to the thread cache, the rest is freed on exit
+    for (int s = 0; s < THREAD_SLOTS; s += 2) {
+        free(ptr[s]);
+    }
+    for (int s = 1; s < THREAD_SLOTS; s += 2) {
+        if (ptr[s] != NULL && !check(ptr[s], size[s], tag[s])) {
+            USER_PANIC("block of thread %p corrupted\n", thread_self());
+        }
+        free(ptr[s]);
+    }
+    return 0;
+}
+
+static void thread_test(void)
+{
+    errval_t err;
+
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        struct thread *threads[THREADS];
+        for (int i = 0; i < THREADS; i++) {
+            threads[i] = thread_create(churn_thread,
+                                       (void *)(uintptr_t)(round * THREADS + i + 1));
+            if (threads[i] == NULL) {
+                USER_PANIC("thread_create failed\n");
+            }
+        }
+        // joining frees the threads and releases their thread caches
+        for (int i = 0; i < THREADS; i++) {
+            int retval;
+            err = thread_join(threads[i], &retval);
+            if (err_is_fail(err) || retval != 0) {
+                USER_PANIC_ERR(err, "thread_join");
+            }
+        }
+    }
+
+    printf("thread test passed\n");
+}
+
+/*
+ * Blocks freed on another dispatcher
+ */
+
+struct xfer {
+    void *ptr[XFER_BLOCKS];
+    size_t size[XFER_BLOCKS];
+    uint8_t tag;
+};
+
+static struct xfer to_remote, from_remote;
+
+static void xfer_alloc(struct xfer *x, uint32_t *seed)
+{
+    for (int i = 0; i < XFER_BLOCKS; i++) {
+        x->size[i] = random_size(seed);
+        x->ptr[i] = malloc(x->size[i]);
+        if (x->ptr[i] == NULL) {
+            USER_PANIC("malloc(%zu) failed\n", x->size[i]);
+        }
+        fill(x->ptr[i], 0, x->size[i], x->tag);
+    }
+}
+
+static void xfer_free(struct xfer *x)
+{
+    for (int i = 0; i < XFER_BLOCKS; i++) {
+        if (!check(x->ptr[i], x->size[i], x->tag)) {
+            USER_PANIC("block passed between dispatchers corrupted\n");
+        }
+        free(x->ptr[i]);
+        x->ptr[i] = NULL;
+    }
+}
+
+/// Runs on the other dispatcher: frees our blocks and allocates some of its own
+static int remote_thread(void *arg)
+{
+    uint32_t seed = (uintptr_t)arg;
+
+    xfer_free(&to_remote);
+    from_remote.tag = seed;
+    xfer_alloc(&from_remote, &seed);
+
+    return 0;
+}
+
+static size_t heap_used(void)
+{
+    return get_morecore_state()->mmu_state.offset;
+}
+
+static volatile int ndispatchers = 1;
+
+static void domain_spanned_callback(void *arg, errval_t err)
+{
+    ndispatchers++;
+}
+
+static void remote_free_test(void)
+{
+    errval_t err;
+    coreid_t other = disp_get_core_id() + 1;
+
+    err = domain_new_dispatcher(other, domain_spanned_callback, NULL);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "domain_new_dispatcher");
+    }
+    while (ndispatchers < 2) {
+        thread_yield();
+    }
+
+    uint32_t seed = 42;
+    size_t used = 0;
+    for (int round = 0; round < XFER_ROUNDS; round++) {
+        to_remote.tag = round;
+        xfer_alloc(&to_remote, &seed);
+
+        struct thread *t;
+        err = domain_thread_create_on(other, remote_thread,
+                                      (void *)(uintptr_t)(round + 1), &t);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "domain_thread_create_on");
+        }
+        int retval;
+        err = domain_thread_join(t, &retval);
+        if (err_is_fail(err) || retval != 0) {
+            USER_PANIC_ERR(err, "domain_thread_join");
+        }
+
+        // these belong to the other dispatcher
+        xfer_free(&from_remote);
+
+        // blocks freed by the other dispatcher must be reused, a leak grows
+        // the heap by the size of a whole round every round
+        if (round == 0) {
+            used = heap_used();
+        } else if (heap_used() > 2 * used) {
+            USER_PANIC("heap grew from %zu to %zu bytes, remote frees leak\n",
+                       used, heap_used());
+        }
+    }
+
+    printf("remote free test passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+    realloc_test();
+    thread_test();
+    remote_free_test();
+
+    printf("sizeclass_malloc passed\n");
+    return EXIT_SUCCESS;
+}